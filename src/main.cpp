@@ -66,6 +66,15 @@ const char* getShaderSystemText(const byte v) {
 	}
 }
 
+const char* getBVHQualityText(BVHBuildQuality quality) {
+	switch (quality) {
+		case BVHBuildQuality::Fast: return "fast";
+		case BVHBuildQuality::Balanced: return "balanced";
+		case BVHBuildQuality::High: return "high";
+		default: return "unknown";
+	}
+}
+
 static Stopwatch sw;
 
 void dumpObjects(const Scene& scene, const std::vector<SceneObject*>& objs, string& str);
@@ -176,6 +185,8 @@ int main(int argc, const char * argv[]) {
 	string cmd;
 	bool enableDumpScene = false;
 	bool enableDumpBloom = false;
+	bool enableStreaming = false;
+	int envmapImportanceWidth = 1024;
 	
 	for (int i = 1; i < argc; i++) {
 		const char* arg = argv[i];
@@ -202,6 +213,8 @@ int main(int argc, const char * argv[]) {
 				enableDumpScene = true;
 			} else if (IF_ARG("--dump-bloom")) {
 				enableDumpBloom = true;
+			} else if (IF_ARG("--stream")) {
+				enableStreaming = true;
 			} else if (IF_ARG("-ver") || IF_ARG("--ver") || IF_ARG("--version")) {
 				printVerInfo();
 				return 0;
@@ -214,14 +227,29 @@ int main(int argc, const char * argv[]) {
                              "       ./raygen render -enaa false myScene.json   # disable antialias\n"
                              "       ./raygen render scene.json -o out.hdr      # linear-radiance HDR (RGBE)\n\n");
 				printf("  -r | --resolution                    specify resolution of result image\n"
+							 "  --stream                             render out of core straight to a .ppm or .pfm (HDR) file, for huge resolutions\n"
 							 "  -s | --samples                       number of ray tracing samples\n"
-							 "  -c | --cores | --threads             number of threads/cores to render parallelly\n"
+							 "  -c | --cores | --threads             number of threads/cores to render parallelly (default: all)\n"
 							 "  -ds | --dof-samples                  number of samples on depth of field calculation\n"
 							 "  -enaa | --enable-antialias           enable antialias (default: on)\n"
 							 "  -encs | --enable-color-sampling      enable read colors from texture (default: on)\n"
 							 "  -enpp | --enable-postprocess         eanble post-processes such as grow and blur\n"
 							 "  -endn | --enable-denoise             enable À-Trous wavelet denoiser (default: off)\n"
 							 "  -dni  | --denoise-intensity          blend 0..1 between noisy and denoised (default: 1.0)\n"
+							 "  -dnf  | --denoise-fused-levels       denoise levels to run together per cache tile (default: 0)\n"
+							 "  -enha | --enable-half-aovs           keep denoise guides as half floats (default: on)\n"
+							 "  -eninst | --enable-instancing        share meshes placed more than once via instance BVH (default: on)\n"
+							 "  -bw | --bvh-width                    BVH node width: 2, 4 (SSE) or 8 (AVX) (default: 2)\n"
+							 "  -bq | --bvh-quality                  BVH build preset: fast, balanced or high (default: balanced)\n"
+							 "  -enpk | --enable-packets             trace primary rays as 4x4 packets when DOF and -bw 2 allow (default: on)\n"
+							 "  -enwf | --enable-wavefront           breadth-first wavefront integrator instead of recursion (default: off)\n"
+							 "  -enit | --enable-iterative           loop-based path integrator instead of recursion, needs -enls (default: off)\n"
+							 "  -enls | --enable-lobe-selection      trace one lobe of mixed materials per hit, not all (default: off)\n"
+							 "  -enlb | --enable-light-bvh           pick area lights by distance and facing, not power alone (default: on)\n"
+							 "  -sq | --sequence                     low-discrepancy sequence: halton, sobol or zsobol (default: halton)\n"
+							 "  -eis | --envmap-importance-size      width of the envmap importance map, 0 = full resolution (default: 1024)\n"
+							 "  -enpg | --enable-path-guiding        learn indirect light during the first adaptive passes (default: off)\n"
+							 "  --guiding-passes                     adaptive passes the path guide trains over (default: 4)\n"
 							 "  -blth | --bloom-threshold            linear-radiance luma at which bloom starts (default: 1.0)\n"
 							 "  -blst | --bloom-strength             additive gain on the blurred HDR halo (default: 1.0)\n"
 							 "  -blcv | --bloom-curve                knee sharpness; 1=linear, >1=sharper cutoff (default: 1.0)\n"
@@ -248,10 +276,53 @@ int main(int argc, const char * argv[]) {
 				else READ_ARG_BOL("--enable-denoise", rs.enableDenoise)
 				else READ_ARG_FLT("-dni", rs.denoiseIntensity)
 				else READ_ARG_FLT("--denoise-intensity", rs.denoiseIntensity)
+				else READ_ARG_INT("-dnf", rs.denoiseFusedLevels)
+				else READ_ARG_INT("--denoise-fused-levels", rs.denoiseFusedLevels)
+				else READ_ARG_BOL("-enha", rs.enableHalfFloatAOVs)
+				else READ_ARG_BOL("--enable-half-aovs", rs.enableHalfFloatAOVs)
+				else READ_ARG_BOL("-eninst", rs.enableInstancing)
+				else READ_ARG_BOL("--enable-instancing", rs.enableInstancing)
+				else READ_ARG_INT("-bw", rs.bvhWidth)
+				else READ_ARG_INT("--bvh-width", rs.bvhWidth)
+				else if (IF_ARG("-bq") || IF_ARG("--bvh-quality")) {
+					NEXT_ARG;
+					if (IS_ARG_CASE_INSEN("fast")) rs.bvhQuality = BVHBuildQuality::Fast;
+					else if (IS_ARG_CASE_INSEN("balanced")) rs.bvhQuality = BVHBuildQuality::Balanced;
+					else if (IS_ARG_CASE_INSEN("high")) rs.bvhQuality = BVHBuildQuality::High;
+					else {
+						printf("unknown bvh quality: %s\n", arg);
+						return 1;
+					}
+				}
+				else READ_ARG_BOL("-enpk", rs.enablePacketTracing)
+				else READ_ARG_BOL("--enable-packets", rs.enablePacketTracing)
+				else READ_ARG_BOL("-enwf", rs.enableWavefront)
+				else READ_ARG_BOL("--enable-wavefront", rs.enableWavefront)
+				else READ_ARG_BOL("-enit", rs.enableIterativeIntegrator)
+				else READ_ARG_BOL("--enable-iterative", rs.enableIterativeIntegrator)
+				else READ_ARG_BOL("-enls", rs.enableLobeSelection)
+				else READ_ARG_BOL("--enable-lobe-selection", rs.enableLobeSelection)
+				else READ_ARG_BOL("-enlb", rs.enableLightBVH)
+				else READ_ARG_BOL("--enable-light-bvh", rs.enableLightBVH)
+				else READ_ARG_INT("-eis", envmapImportanceWidth)
+				else READ_ARG_INT("--envmap-importance-size", envmapImportanceWidth)
+				else if (IF_ARG("-sq") || IF_ARG("--sequence")) {
+					NEXT_ARG;
+					if (IS_ARG_CASE_INSEN("halton")) rs.sampleSequence = LowDiscrepancySequence::Halton;
+					else if (IS_ARG_CASE_INSEN("sobol")) rs.sampleSequence = LowDiscrepancySequence::Sobol;
+					else if (IS_ARG_CASE_INSEN("zsobol")) rs.sampleSequence = LowDiscrepancySequence::ZSobol;
+					else {
+						printf("unknown sample sequence: %s\n", arg);
+						return 1;
+					}
+				}
 				else READ_ARG_BOL("-enad", rs.enableAdaptiveSampling)
 				else READ_ARG_BOL("--enable-adaptive", rs.enableAdaptiveSampling)
 				else READ_ARG_INT("--adaptive-base", rs.adaptiveBaseSamples)
 				else READ_ARG_FLT("--adaptive-threshold", rs.adaptiveThreshold)
+				else READ_ARG_BOL("-enpg", rs.enablePathGuiding)
+				else READ_ARG_BOL("--enable-path-guiding", rs.enablePathGuiding)
+				else READ_ARG_INT("--guiding-passes", rs.guidingTrainingPasses)
 				else READ_ARG_FLT("-blth", rs.bloomThreshold)
 				else READ_ARG_FLT("--bloom-threshold", rs.bloomThreshold)
 				else READ_ARG_FLT("-blst", rs.bloomStrength)
@@ -401,14 +472,33 @@ int main(int argc, const char * argv[]) {
 	File file(scenefile);
 
 	if (outputImageFile.isEmpty()) {
+		// Streaming writes its raster itself, and only as PPM or PFM.
+		const char* ext = enableStreaming ? "ppm" : "jpg";
 		const string& inpath = file.getPath();
 		if (inpath.isEmpty()) {
-			outputImageFile.appendFormat("%s.jpg", file.getBaseName().c_str());
+			outputImageFile.appendFormat("%s.%s", file.getBaseName().c_str(), ext);
 		} else {
-			outputImageFile.appendFormat("%s%s%s.jpg", file.getPath().c_str(), PATH_SPLITTER_STR, file.getBaseName().c_str());
+			outputImageFile.appendFormat("%s%s%s.%s", file.getPath().c_str(), PATH_SPLITTER_STR, file.getBaseName().c_str(), ext);
 		}
 	}
 
+	if (enableStreaming) {
+		if (!outputImageFile.endsWith(".ppm", StringComparingFlags::SCF_CASE_INSENSITIVE)
+			&& !outputImageFile.endsWith(".pfm", StringComparingFlags::SCF_CASE_INSENSITIVE)) {
+			errorExit("--stream writes .ppm or .pfm output only\n");
+		}
+		rs.streamOutputPath = outputImageFile;
+		if (rs.enableAdaptiveSampling) {
+			std::cout << "warning: --stream samples every tile uniformly, rendering without adaptive sampling\n";
+			rs.enableAdaptiveSampling = false;
+		}
+	}
+
+	if (rs.enablePathGuiding && !rs.enableAdaptiveSampling) {
+		std::cout << "warning: path guiding needs adaptive sampling (-enad), rendering without it\n";
+		rs.enablePathGuiding = false;
+	}
+
 	if (enableDumpBloom) {
 		File outFile(outputImageFile);
 		const string& outPath = outFile.getPath();
@@ -422,6 +512,7 @@ int main(int argc, const char * argv[]) {
 	RayRenderer renderer(&rs);
 	RendererSceneLoader loader;
 	Scene scene;
+	scene.envmapImportanceWidth = envmapImportanceWidth;
 	
 	loader.load(renderer, &scene, scenefile);
 	
@@ -473,15 +564,29 @@ int main(int argc, const char * argv[]) {
 	}
 
 	sw.stop();
+
+	const BVHBuildStats& bvhStats = renderer.getBVHBuildStats();
+	printf(ANSI_RESET_LINE "bvh: %zu triangles, %zu nodes (%zu leaves), SAH %.2f, %s build in %.3fs on %d thread(s)\n",
+		bvhStats.primCount, bvhStats.nodeCount, bvhStats.leafCount,
+		bvhStats.sahCost, getBVHQualityText(bvhStats.quality), bvhStats.seconds, bvhStats.threads);
+	if (bvhStats.references > bvhStats.primCount) {
+		printf("bvh: spatial splits added %zu triangle references\n", bvhStats.references - bvhStats.primCount);
+	}
+	if (bvhStats.width > 2) {
+		printf("bvh: collapsed to %zu %d-wide nodes\n", bvhStats.wideNodeCount, bvhStats.width);
+	}
 	
 	// .hdr extension → save the linear-radiance HDR buffer (float, no
 	// tonemap, no clamp). Anything else falls through to the LDR preview.
+	// A streaming render has written its file block by block already.
 	ImageCodecFormat outFormat = ImageCodecFormat::ICF_AUTO;
 	getImageFormatByExtension(outputImageFile, &outFormat);
-	if (outFormat == ImageCodecFormat::ICF_HDR) {
-		saveImage(renderer.getHdrResult(), outputImageFile);
-	} else {
-		saveImage(renderer.getRenderResult(), outputImageFile);
+	if (!enableStreaming) {
+		if (outFormat == ImageCodecFormat::ICF_HDR) {
+			saveImage(renderer.getHdrResult(), outputImageFile);
+		} else {
+			saveImage(renderer.getRenderResult(), outputImageFile);
+		}
 	}
 	
 	static string _time_str_done;
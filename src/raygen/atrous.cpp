@@ -0,0 +1,511 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "atrous.h"
+#include <algorithm>
+#include <cmath>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RAYGEN_ATROUS_AVX2
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define RAYGEN_ATROUS_SSE2
+#endif
+
+namespace raygen {
+
+namespace {
+
+// Core edge of a fused tile: with the color, luminance and guide planes
+// of its halo'd neighbourhood that's a few hundred KB, about an L2.
+const int ATROUS_FUSE_TILE = 64;
+
+// B3 spline 5-tap: 1/16, 1/4, 3/8, 1/4, 1/16
+const float ATROUS_KERNEL[5] = { 1.0f/16.0f, 1.0f/4.0f, 3.0f/8.0f, 1.0f/4.0f, 1.0f/16.0f };
+
+const float LOG2_E = 1.44269504f;
+
+// Weights below 2^-100 are flushed to zero. Left as they are, the kernel
+// and color products push them into denormals, which cost the multiply
+// units some hundred cycles each; taps that are masked off entirely (a
+// normal facing away, a miss) would hit that on every pixel.
+const float ATROUS_EXP2_FLOOR = -100.0f;
+
+inline float luminance(float r, float g, float b) {
+    return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+// Lane operations for the level pass. The scalar lanes take the borders
+// and leftovers of a row (and all of it without SSE2); exp2/log2 there are
+// the libm ones, the SIMD lanes use polynomials good to ~1e-7 relative,
+// far below anything an edge-stopping weight can show.
+struct AtrousLanes1 {
+    typedef float F;
+    enum { width = 1 };
+    static inline F set1(float f) { return f; }
+    static inline F load(const float* p) { return *p; }
+    static inline void store(float* p, F a) { *p = a; }
+    static inline F add(F a, F b) { return a + b; }
+    static inline F sub(F a, F b) { return a - b; }
+    static inline F mul(F a, F b) { return a * b; }
+    static inline F div(F a, F b) { return a / b; }
+    static inline F max(F a, F b) { return a > b ? a : b; }
+    static inline F abs(F a) { return fabsf(a); }
+    // Picks a where ws > eps, b elsewhere.
+    static inline F selectAbove(F ws, float eps, F a, F b) { return ws > eps ? a : b; }
+    static inline F exp2(F x) { return x < ATROUS_EXP2_FLOOR ? 0.0f : exp2f(x); }
+    static inline F log2(F x) { return log2f(x); }
+};
+
+// 2^f for f in [-0.5, 0.5]: Taylor to the 6th power.
+template<class L>
+inline typename L::F exp2Poly(typename L::F f) {
+    typename L::F p = L::set1(0.000154035304f);
+    p = L::add(L::mul(p, f), L::set1(0.00133335581f));
+    p = L::add(L::mul(p, f), L::set1(0.00961812911f));
+    p = L::add(L::mul(p, f), L::set1(0.0555041087f));
+    p = L::add(L::mul(p, f), L::set1(0.240226507f));
+    p = L::add(L::mul(p, f), L::set1(0.693147181f));
+    return L::add(L::mul(p, f), L::set1(1.0f));
+}
+
+// log2(m) for m in [√½, √2) as 2/ln2 · atanh(t), t = (m - 1) / (m + 1).
+template<class L>
+inline typename L::F log2Poly(typename L::F t) {
+    const typename L::F t2 = L::mul(t, t);
+    typename L::F p = L::set1(0.412198583f);
+    p = L::add(L::mul(p, t2), L::set1(0.577078016f));
+    p = L::add(L::mul(p, t2), L::set1(0.961796694f));
+    p = L::add(L::mul(p, t2), L::set1(2.88539008f));
+    return L::mul(p, t);
+}
+
+#if defined(RAYGEN_ATROUS_SSE2)
+struct AtrousLanes4 {
+    typedef __m128 F;
+    enum { width = 4 };
+    static inline F set1(float f) { return _mm_set1_ps(f); }
+    static inline F load(const float* p) { return _mm_loadu_ps(p); }
+    static inline void store(float* p, F a) { _mm_storeu_ps(p, a); }
+    static inline F add(F a, F b) { return _mm_add_ps(a, b); }
+    static inline F sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static inline F mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static inline F div(F a, F b) { return _mm_div_ps(a, b); }
+    static inline F max(F a, F b) { return _mm_max_ps(a, b); }
+    static inline F abs(F a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static inline F selectAbove(F ws, float eps, F a, F b) {
+        const F m = _mm_cmpgt_ps(ws, _mm_set1_ps(eps));
+        return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+    }
+    static inline F exp2(F x) {
+        const F live = _mm_cmpge_ps(x, _mm_set1_ps(ATROUS_EXP2_FLOOR));
+        x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(ATROUS_EXP2_FLOOR)), _mm_set1_ps(127.0f));
+        const __m128i i = _mm_cvtps_epi32(x);
+        const F f = _mm_sub_ps(x, _mm_cvtepi32_ps(i));
+        const F scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23));
+        return _mm_and_ps(live, _mm_mul_ps(exp2Poly<AtrousLanes4>(f), scale));
+    }
+    // x > 0 and normal.
+    static inline F log2(F x) {
+        const __m128i bits = _mm_castps_si128(x);
+        const __m128i e = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+        F m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+                                            _mm_set1_epi32(0x3f800000)));
+        const F big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+        m = _mm_or_ps(_mm_and_ps(big, _mm_mul_ps(m, _mm_set1_ps(0.5f))), _mm_andnot_ps(big, m));
+        const F ef = _mm_add_ps(_mm_cvtepi32_ps(e), _mm_and_ps(big, _mm_set1_ps(1.0f)));
+        const F t = _mm_div_ps(_mm_sub_ps(m, _mm_set1_ps(1.0f)), _mm_add_ps(m, _mm_set1_ps(1.0f)));
+        return _mm_add_ps(ef, log2Poly<AtrousLanes4>(t));
+    }
+};
+typedef AtrousLanes4 AtrousSimdLanes;
+#elif defined(RAYGEN_ATROUS_AVX2)
+struct AtrousLanes8 {
+    typedef __m256 F;
+    enum { width = 8 };
+    static inline F set1(float f) { return _mm256_set1_ps(f); }
+    static inline F load(const float* p) { return _mm256_loadu_ps(p); }
+    static inline void store(float* p, F a) { _mm256_storeu_ps(p, a); }
+    static inline F add(F a, F b) { return _mm256_add_ps(a, b); }
+    static inline F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static inline F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static inline F div(F a, F b) { return _mm256_div_ps(a, b); }
+    static inline F max(F a, F b) { return _mm256_max_ps(a, b); }
+    static inline F abs(F a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static inline F selectAbove(F ws, float eps, F a, F b) {
+        return _mm256_blendv_ps(b, a, _mm256_cmp_ps(ws, _mm256_set1_ps(eps), _CMP_GT_OQ));
+    }
+    static inline F exp2(F x) {
+        const F live = _mm256_cmp_ps(x, _mm256_set1_ps(ATROUS_EXP2_FLOOR), _CMP_GE_OQ);
+        x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(ATROUS_EXP2_FLOOR)), _mm256_set1_ps(127.0f));
+        const __m256i i = _mm256_cvtps_epi32(x);
+        const F f = _mm256_sub_ps(x, _mm256_cvtepi32_ps(i));
+        const F scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(i, _mm256_set1_epi32(127)), 23));
+        return _mm256_and_ps(live, _mm256_mul_ps(exp2Poly<AtrousLanes8>(f), scale));
+    }
+    // x > 0 and normal.
+    static inline F log2(F x) {
+        const __m256i bits = _mm256_castps_si256(x);
+        const __m256i e = _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127));
+        F m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+                                                  _mm256_set1_epi32(0x3f800000)));
+        const F big = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+        m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+        const F ef = _mm256_add_ps(_mm256_cvtepi32_ps(e), _mm256_and_ps(big, _mm256_set1_ps(1.0f)));
+        const F t = _mm256_div_ps(_mm256_sub_ps(m, _mm256_set1_ps(1.0f)), _mm256_add_ps(m, _mm256_set1_ps(1.0f)));
+        return _mm256_add_ps(ef, log2Poly<AtrousLanes8>(t));
+    }
+};
+typedef AtrousLanes8 AtrousSimdLanes;
+#endif
+
+// Color and luminance planes of a window of the frame, addressed in frame
+// coordinates: the full-frame working planes, or a fused tile's scratch.
+struct AtrousView {
+    float* r;
+    float* g;
+    float* b;
+    float* l;
+    int x0, y0, stride;
+
+    inline size_t at(int x, int y) const {
+        return (size_t)(y - this->y0) * this->stride + (x - this->x0);
+    }
+};
+
+// Everything one level's pass reads besides its source colors.
+struct AtrousLevel {
+    const float* nx;
+    const float* ny;
+    const float* nz;
+    const float* depth;
+    int width, height;
+    int step;
+    float sigmaNormal;
+    // Luminance and depth edge-stopping scales, premultiplied by log2(e)
+    // so each tap's three weights come out of one exp2.
+    float colorK, depthK;
+};
+
+// Pixels [x0, x1) of row y; x1 - x0 is a multiple of the lane width. Wider
+// lanes must only get pixels whose taps all lie inside the frame.
+template<class L>
+void atrousSpan(const AtrousLevel& lv, const AtrousView& src, const AtrousView& dst,
+                const int y, const int x0, const int x1) {
+    typedef typename L::F F;
+    const int s = lv.step;
+    const F zero = L::set1(0.0f);
+    const F colorK = L::set1(lv.colorK);
+    const F depthK = L::set1(lv.depthK);
+    const F sigmaN = L::set1(lv.sigmaNormal);
+    // Keeps log2 finite where the normals face away (or are the zero
+    // normal of a miss): the weight then underflows to ~0 as pow() gives.
+    const F minDot = L::set1(1e-30f);
+
+    for (int x = x0; x < x1; x += L::width) {
+        const size_t gc = (size_t)y * lv.width + x;
+        const size_t sc = src.at(x, y);
+        const F cl = L::load(src.l + sc);
+        const F cnx = L::load(lv.nx + gc);
+        const F cny = L::load(lv.ny + gc);
+        const F cnz = L::load(lv.nz + gc);
+        const F cd = L::load(lv.depth + gc);
+
+        F sr = zero, sg = zero, sb = zero, ws = zero;
+
+        for (int ky = 0; ky < 5; ++ky) {
+            const int ny = y + (ky - 2) * s;
+            if (ny < 0 || ny >= lv.height) continue;
+            const size_t growBase = (size_t)ny * lv.width;
+            for (int kx = 0; kx < 5; ++kx) {
+                const int nx = x + (kx - 2) * s;
+                if (L::width == 1 && (nx < 0 || nx >= lv.width)) continue;
+
+                const size_t gn = growBase + nx;
+                const size_t sn = src.at(nx, ny);
+
+                const F dl = L::sub(L::load(src.l + sn), cl);
+                const F dd = L::abs(L::sub(L::load(lv.depth + gn), cd));
+                const F dot = L::add(L::add(L::mul(L::load(lv.nx + gn), cnx),
+                                            L::mul(L::load(lv.ny + gn), cny)),
+                                     L::mul(L::load(lv.nz + gn), cnz));
+
+                // kernel · exp(-dl²/2σc²) · dot^σn · exp(-|dd|/σd·step)
+                const F e = L::sub(L::mul(sigmaN, L::log2(L::max(dot, minDot))),
+                                   L::add(L::mul(L::mul(dl, dl), colorK), L::mul(dd, depthK)));
+                const F weight = L::mul(L::set1(ATROUS_KERNEL[kx] * ATROUS_KERNEL[ky]), L::exp2(e));
+
+                sr = L::add(sr, L::mul(L::load(src.r + sn), weight));
+                sg = L::add(sg, L::mul(L::load(src.g + sn), weight));
+                sb = L::add(sb, L::mul(L::load(src.b + sn), weight));
+                ws = L::add(ws, weight);
+            }
+        }
+
+        const size_t dc = dst.at(x, y);
+        const F inv = L::div(L::set1(1.0f), L::max(ws, L::set1(1e-8f)));
+        const F outR = L::selectAbove(ws, 1e-8f, L::mul(sr, inv), L::load(src.r + sc));
+        const F outG = L::selectAbove(ws, 1e-8f, L::mul(sg, inv), L::load(src.g + sc));
+        const F outB = L::selectAbove(ws, 1e-8f, L::mul(sb, inv), L::load(src.b + sc));
+        L::store(dst.r + dc, outR);
+        L::store(dst.g + dc, outG);
+        L::store(dst.b + dc, outB);
+        L::store(dst.l + dc, L::add(L::add(L::mul(outR, L::set1(0.2126f)),
+                                           L::mul(outG, L::set1(0.7152f))),
+                                    L::mul(outB, L::set1(0.0722f))));
+    }
+}
+
+// One level over the rectangle [x0, x1) × [y0, y1): SIMD across the
+// columns whose taps stay inside the frame, scalar at the borders.
+void atrousRect(const AtrousLevel& lv, const AtrousView& src, const AtrousView& dst,
+                const int x0, const int y0, const int x1, const int y1) {
+    const int reach = 2 * lv.step;
+    const int a = std::min(std::max(reach, x0), x1);
+    const int b = std::max(std::min(lv.width - reach, x1), a);
+
+    for (int y = y0; y < y1; ++y) {
+        atrousSpan<AtrousLanes1>(lv, src, dst, y, x0, a);
+#if defined(RAYGEN_ATROUS_SSE2) || defined(RAYGEN_ATROUS_AVX2)
+        const int simdEnd = a + (b - a) / AtrousSimdLanes::width * AtrousSimdLanes::width;
+        atrousSpan<AtrousSimdLanes>(lv, src, dst, y, a, simdEnd);
+        atrousSpan<AtrousLanes1>(lv, src, dst, y, simdEnd, x1);
+#else
+        atrousSpan<AtrousLanes1>(lv, src, dst, y, a, x1);
+#endif
+    }
+}
+
+// fn(y0, y1) over row bands, a few per worker so a band of expensive
+// (edge-heavy) rows doesn't hold the whole stage up.
+template<class Fn>
+void forRowBands(ThreadPool& pool, const int h, const Fn& fn) {
+    const int bands = std::max(1, std::min(h, pool.size() * 4));
+    const int rowsPerBand = (h + bands - 1) / bands;
+    pool.parallelFor(bands, [&fn, rowsPerBand, h](int band) {
+        const int y0 = band * rowsPerBand;
+        const int y1 = std::min(h, y0 + rowsPerBand);
+        if (y0 < y1) fn(y0, y1);
+    });
+}
+
+}
+
+void AtrousDenoiser::resize(int width, int height) {
+    this->w = std::max(0, width);
+    this->h = std::max(0, height);
+    const size_t n = (size_t)this->w * this->h;
+
+    for (auto* v : { &r, &g, &b, &normalX, &normalY, &normalZ, &depth, &albedoR, &albedoG, &albedoB }) {
+        v->resize(n);
+    }
+    this->hit.resize(n);
+    for (int i = 0; i < 2; i++) {
+        for (auto* v : { &workR[i], &workG[i], &workB[i], &workL[i] }) {
+            v->resize(n);
+        }
+    }
+}
+
+void AtrousDenoiser::release() {
+    this->w = 0;
+    this->h = 0;
+    for (auto* v : { &r, &g, &b, &normalX, &normalY, &normalZ, &depth, &albedoR, &albedoG, &albedoB }) {
+        std::vector<float>().swap(*v);
+    }
+    std::vector<uint8_t>().swap(this->hit);
+    for (int i = 0; i < 2; i++) {
+        for (auto* v : { &workR[i], &workG[i], &workB[i], &workL[i] }) {
+            std::vector<float>().swap(*v);
+        }
+    }
+}
+
+void AtrousDenoiser::denoise(ThreadPool& pool, const AtrousParams& params) {
+    const int W = this->w;
+    const int H = this->h;
+    if (W <= 0 || H <= 0) return;
+
+    const int levels = std::max(1, params.levels);
+
+    AtrousView work[2];
+    for (int i = 0; i < 2; i++) {
+        work[i] = { workR[i].data(), workG[i].data(), workB[i].data(), workL[i].data(), 0, 0, W };
+    }
+
+    // Pre-pass: firefly suppression + albedo demodulation.
+    //
+    // Fireflies — isolated bright pixels from rare high-contribution paths
+    // (e.g. a lucky NEE hit on a dark material) — are preserved by the
+    // edge-stopping kernel because their color differs so much from
+    // neighbors that the weight collapses to zero. At samples=1 this shows
+    // up as persistent bright dots. A soft clamp against the 3×3 local max
+    // luminance pulls them into a reasonable range before filtering without
+    // touching legitimate bright regions (where the max is already close).
+    //
+    // Demodulation then divides the suppressed noisy signal by albedo so
+    // the filter operates on "incoming lighting" — smooth across material
+    // boundaries — and we re-multiply by albedo after the final pass to
+    // restore color detail. The albedo floor prevents division-blowup on
+    // dark channels; the demod cap bounds any residual amplification.
+    // Sky pixels (no hit) pass through unchanged.
+    const float albedoFloor = 0.3f;
+    const float demodCap = 3.0f;
+    const float fireflyRatio = 1.5f;
+    const float fireflyEps = 0.01f;
+
+    // The noisy luminance goes to the second working set's plane first, so
+    // the 3×3 max reads one plane instead of recomputing it nine times.
+    float* noisyL = workL[1].data();
+    forRowBands(pool, H, [&](int y0, int y1) {
+        for (size_t i = (size_t)y0 * W; i < (size_t)y1 * W; ++i) {
+            noisyL[i] = luminance(this->r[i], this->g[i], this->b[i]);
+        }
+    });
+
+    forRowBands(pool, H, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            for (int x = 0; x < W; ++x) {
+                const size_t i = (size_t)y * W + x;
+
+                float maxNeighLum = 0.0f;
+                for (int dy = -1; dy <= 1; ++dy) {
+                    const int ny = y + dy;
+                    if (ny < 0 || ny >= H) continue;
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        if (dx == 0 && dy == 0) continue;
+                        const int nx = x + dx;
+                        if (nx < 0 || nx >= W) continue;
+                        maxNeighLum = fmaxf(maxNeighLum, noisyL[(size_t)ny * W + nx]);
+                    }
+                }
+
+                float cr = this->r[i], cg = this->g[i], cb = this->b[i];
+                const float cap = fireflyRatio * maxNeighLum + fireflyEps;
+                if (noisyL[i] > cap) {
+                    const float scale = cap / noisyL[i];
+                    cr *= scale; cg *= scale; cb *= scale;
+                }
+
+                if (this->hit[i]) {
+                    cr = fminf(cr / fmaxf(this->albedoR[i], albedoFloor), demodCap);
+                    cg = fminf(cg / fmaxf(this->albedoG[i], albedoFloor), demodCap);
+                    cb = fminf(cb / fmaxf(this->albedoB[i], albedoFloor), demodCap);
+                }
+                work[0].r[i] = cr;
+                work[0].g[i] = cg;
+                work[0].b[i] = cb;
+                work[0].l[i] = luminance(cr, cg, cb);
+            }
+        }
+    });
+
+    const float sigmaC = params.sigmaColor;
+    const float invSigmaC2 = 1.0f / (2.0f * sigmaC * sigmaC + 1e-8f);
+    auto levelInfo = [&](int level) {
+        const int step = 1 << level;
+        AtrousLevel lv;
+        lv.nx = this->normalX.data();
+        lv.ny = this->normalY.data();
+        lv.nz = this->normalZ.data();
+        lv.depth = this->depth.data();
+        lv.width = W;
+        lv.height = H;
+        lv.step = step;
+        lv.sigmaNormal = params.sigmaNormal;
+        lv.colorK = invSigmaC2 * LOG2_E;
+        // Depth tolerance grows with step size so far-apart taps at high
+        // levels don't erroneously reject over micro depth gradients.
+        lv.depthK = LOG2_E / (params.sigmaDepth * (float)step + 1e-8f);
+        return lv;
+    };
+
+    int cur = 0;
+    int level = 0;
+
+    const int fused = std::min(params.fusedLevels, levels);
+    if (fused > 1) {
+        // reach[k]: how far beyond the tile core level k's output has to
+        // extend for the fused levels after it.
+        std::vector<int> reach((size_t)fused, 0);
+        for (int k = fused - 2; k >= 0; --k) {
+            reach[k] = reach[k + 1] + 2 * (1 << (k + 1));
+        }
+
+        const int tilesX = (W + ATROUS_FUSE_TILE - 1) / ATROUS_FUSE_TILE;
+        const int tilesY = (H + ATROUS_FUSE_TILE - 1) / ATROUS_FUSE_TILE;
+        const AtrousView& src = work[0];
+        const AtrousView& dst = work[1];
+
+        pool.parallelFor(tilesX * tilesY, [&](int t) {
+            // Two scratch windows per worker, reused across tiles.
+            thread_local std::vector<float> scratch[2];
+
+            const int cx0 = (t % tilesX) * ATROUS_FUSE_TILE;
+            const int cy0 = (t / tilesX) * ATROUS_FUSE_TILE;
+            const int cx1 = std::min(W, cx0 + ATROUS_FUSE_TILE);
+            const int cy1 = std::min(H, cy0 + ATROUS_FUSE_TILE);
+
+            AtrousView views[2];
+            const AtrousView* in = &src;
+            for (int k = 0; k < fused; ++k) {
+                const AtrousLevel lv = levelInfo(k);
+                if (k == fused - 1) {
+                    atrousRect(lv, *in, dst, cx0, cy0, cx1, cy1);
+                    break;
+                }
+
+                const int x0 = std::max(0, cx0 - reach[k]), y0 = std::max(0, cy0 - reach[k]);
+                const int x1 = std::min(W, cx1 + reach[k]), y1 = std::min(H, cy1 + reach[k]);
+                const size_t n = (size_t)(x1 - x0) * (y1 - y0);
+                std::vector<float>& buf = scratch[k & 1];
+                if (buf.size() < n * 4) buf.resize(n * 4);
+                views[k & 1] = { buf.data(), buf.data() + n, buf.data() + n * 2, buf.data() + n * 3,
+                                 x0, y0, x1 - x0 };
+                atrousRect(lv, *in, views[k & 1], x0, y0, x1, y1);
+                in = &views[k & 1];
+            }
+        });
+
+        cur = 1;
+        level = fused;
+    }
+
+    for (; level < levels; ++level) {
+        const AtrousLevel lv = levelInfo(level);
+        const AtrousView& src = work[cur];
+        const AtrousView& dst = work[cur ^ 1];
+        forRowBands(pool, H, [&](int y0, int y1) {
+            atrousRect(lv, src, dst, 0, y0, W, y1);
+        });
+        cur ^= 1;
+    }
+
+    // Remodulate and blend with the original noisy input by `intensity`.
+    // intensity = 1 → pure filtered output (full denoise)
+    // intensity = 0 → original noisy (pass-through, effectively disabled)
+    // Blending happens in linear-HDR space, before the post-denoise tonemap.
+    const AtrousView& filtered = work[cur];
+    const float t = std::min(std::max(params.intensity, 0.0f), 1.0f);
+    const float s = 1.0f - t;
+    forRowBands(pool, H, [&](int y0, int y1) {
+        for (size_t i = (size_t)y0 * W; i < (size_t)y1 * W; ++i) {
+            float fr = filtered.r[i], fg = filtered.g[i], fb = filtered.b[i];
+            if (this->hit[i]) {
+                fr *= this->albedoR[i];
+                fg *= this->albedoG[i];
+                fb *= this->albedoB[i];
+            }
+            this->r[i] = this->r[i] * s + fr * t;
+            this->g[i] = this->g[i] * s + fg * t;
+            this->b[i] = this->b[i] * s + fb * t;
+        }
+    });
+}
+
+}
@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __raygen_atrous_h__
+#define __raygen_atrous_h__
+
+#include <vector>
+#include <cstdint>
+#include "threadpool.h"
+
+namespace raygen {
+
+struct AtrousParams {
+    int levels = 5;
+    float sigmaColor = 0.4f;
+    float sigmaNormal = 128.0f;
+    float sigmaDepth = 0.1f;
+    // 0 = pass-through, 1 = full filter.
+    float intensity = 1.0f;
+    // Leading levels run together per cache tile, see AtrousDenoiser.
+    // 0 or 1 = every level is its own full-frame pass.
+    int fusedLevels = 0;
+};
+
+// Edge-avoiding À-Trous wavelet denoiser (Dammertz et al. 2010) over planar
+// float buffers: one plane per channel, row-major, so a row of any channel
+// is contiguous and the 5×5 stencil's edge-stopping weights run SSE/AVX
+// lanes wide. Every stage runs on the thread pool.
+//
+// Each level is normally one pass over the whole frame. With fusedLevels
+// set, the first levels instead run back to back on one 64 px tile at a
+// time (plus the halo later levels read), so their intermediate results
+// stay in cache. The result matches the separate passes up to float
+// rounding, but the halos are filtered again for every tile, so fusing
+// only pays off where memory bandwidth rather than arithmetic bounds the
+// passes, e.g. many cores sharing one memory bus.
+//
+// The planes are members and keep their allocation across calls at the
+// same size, so denoising frame after frame or block after block doesn't
+// reallocate; release() gives them back (about 72 bytes per pixel).
+class AtrousDenoiser {
+public:
+    // Sizes the planes for a w × h frame.
+    void resize(int width, int height);
+    // Frees every plane; the next resize() allocates them again.
+    void release();
+    inline int width() const { return this->w; }
+    inline int height() const { return this->h; }
+
+    // Noisy linear radiance, filled by the caller; denoise() replaces it
+    // with the result.
+    std::vector<float> r, g, b;
+    // Primary-hit guides. `hit` is 0 where the eye ray left the scene;
+    // those pixels pass through the albedo (de)modulation untouched.
+    std::vector<float> normalX, normalY, normalZ, depth;
+    std::vector<float> albedoR, albedoG, albedoB;
+    std::vector<uint8_t> hit;
+
+    void denoise(ThreadPool& pool, const AtrousParams& params);
+
+private:
+    int w = 0, h = 0;
+    // Ping-pong working planes: color and its luminance.
+    std::vector<float> workR[2], workG[2], workB[2], workL[2];
+};
+
+}
+
+#endif /* __raygen_atrous_h__ */
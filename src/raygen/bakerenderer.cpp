@@ -8,7 +8,6 @@
 
 #include "bakerenderer.h"
 
-#include <thread>
 #include "ucm/ansi.h"
 #include "ugm/imgfilter.h"
 
@@ -26,8 +25,15 @@ BakeRenderer::~BakeRenderer() {
 void BakeRenderer::prepareBake() {
 	if (this->scene == NULL) return;
 	
+	// Lightmaps are written per placement, so every baked triangle has to be
+	// in view space with its own object.
+	this->settings.enableInstancing = false;
+	ldsSetSequence(this->settings.sampleSequence, this->settings.samples);
+
 	this->clearTransformedScene();
 	this->transformScene();
+	this->prepareMedia();
+	this->sceneDirty = false;
 	
 	if (this->imgbits != NULL) {
 		delete[] this->imgbits;
@@ -61,15 +67,8 @@ void BakeRenderer::bakeMesh(const Mesh& mesh) {
 //	this->renderingImage.clear();
 	this->progressRate = 0;
 
-	std::vector<std::thread> threads;
-
-	for (int i = 0; i < this->settings.threads; i++) {
-		threads.push_back(std::thread([this, &mesh, i] { this->bakeMeshThread2(mesh, i); }));
-	}
-
-	for (std::thread &th : threads) {
-		th.join();
-	}
+	// bakeMeshThread2 strides by settings.threads, so one task per stride.
+	this->workerPool().parallelFor(this->settings.threads, [this, &mesh](int i) { this->bakeMeshThread2(mesh, i); });
 
 //	if (this->enableBakingPostProcess) {
 //		img::blur(this->renderingImage);
@@ -102,15 +101,7 @@ void BakeRenderer::bakeMesh3(const Mesh& mesh) {
 	
 	///////////////////////////////////////////////////////////////////////
 	
-	std::vector<std::thread> threads;
-	
-	for (int i = 0; i < this->settings.threads; i++) {
-		threads.push_back(std::thread([this, &mesh, i] { this->bakeMeshThread3(mesh, i); }));
-	}
-	
-	for (std::thread &th : threads) {
-		th.join();
-	}
+	this->workerPool().parallelFor(this->settings.threads, [this, &mesh](int i) { this->bakeMeshThread3(mesh, i); });
 	
 	///////////////////////////////////////////////////////////////////////
 	
@@ -388,6 +379,11 @@ void BakeRenderer::fillVertex(const RenderMeshTriangle& rt, const vec2& v) {
 color3 BakeRenderer::bakeMeshFragment(const RenderMeshTriangle& rt, const vec2& uv) {
 	color3 c;
 	
+	// Every texel is a pixel-sample of its own, so its random draws don't
+	// depend on which bake thread got the triangle.
+	ldsBeginPixelSample((int)(uv.x * this->renderingImage.width()),
+											(int)(uv.y * this->renderingImage.height()), 0);
+	
 	if (this->settings.enableAntialias) {
 		constexpr float offset = 0.001;
 		
@@ -24,11 +24,25 @@ namespace raygen {
 // disagreement and BSDF paths get trapped bouncing between adjacent crests
 // until MAX_TRACE_DEPTH / Russian roulette terminates them at throughput 0
 // (the "black triangles at grazing" symptom).
-inline vec3 geomNormal(const RenderMeshTriangle& tri, const vec3& shadingN) {
-    const vec3& gn = tri.ti.normalizedpd;
+inline vec3 geomNormal(const RayTriangleIntersectionInfo& interInfo, const vec3& shadingN) {
+    const vec3 gn = interInfo.geometricNormal();
     return (dot(gn, shadingN) >= 0.0f) ? gn : -gn;
 }
 
+// Medium on the far side of `obj`'s surface: its interior on the way in
+// (or `current` when it has none), the scene's global medium on the way
+// out. Phase 1 does no nesting: exiting an object always returns to the
+// global medium, so two adjacent water cubes can't currently share their
+// interior — revisited when the medium-stack lands.
+inline const HomogeneousMedium* mediumAcross(const RayRenderer& renderer, const SceneObject& obj,
+                                             bool entering, const HomogeneousMedium* current) {
+    if (entering) {
+        return obj.interiorMedium != NULL ? obj.interiorMedium : current;
+    }
+    const Scene* sc = renderer.getScene();
+    return (sc != NULL) ? sc->globalMedium : NULL;
+}
+
 inline float fresnelSchlick(float cosTheta, float refractiveIndex) {
     float r0 = (1.0f - refractiveIndex) / (1.0f + refractiveIndex);
     r0 = r0 * r0;
@@ -51,20 +65,118 @@ inline vec3 refract(const vec3& d, const vec3& normal, float r = 1.45f) {
     return normalize(d * r - normal * ((into ? 1 : -1) * (c * r + sqrtf(t))));
 }
 
+namespace {
+
+inline float guideLuminance(const color3& c) {
+    return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
+// Volume NEE term of a Lambertian surface, excluding albedo; see
+// DiffuseShader::shade.
+inline color3 diffuseVolumeLight(const RayRenderer& renderer, const vec3& hit, const vec3& normal) {
+    vec3 vDir; float vDist; float vPdf = 0.0f; color3 vLe;
+    if (renderer.sampleVolumeLightForNEE(hit, normal, vDir, vDist, vPdf, vLe) && vPdf > 0.0f) {
+        const float cosL = fmaxf(0.0f, dot(vDir, normal));
+        return vLe * (cosL * (float)(1.0 / M_PI) / vPdf);
+    }
+    return color3::zero;
+}
+
+// DiffuseShader::shade with path guiding on. Where the guide is trained the
+// bounce comes from the guide or the cosine lobe with equal odds, and every
+// strategy is weighted against that mixture: the bounce by cos/π over the
+// mixture pdf, the light samples by the power heuristic against it, and the
+// emission hit / envmap miss down the path through bsdfSampledPdf. Half the
+// bounces staying on the cosine lobe keeps a poorly learned region no worse
+// than half as good as plain sampling. While the guide trains, the bounce
+// and light estimates are recorded at their directions as well.
+color3 shadeGuidedDiffuse(BSDFParam& param, PathGuide& guide, const color3& albedo) {
+    const RayRenderer& renderer = param.renderer;
+    const auto& interInfo = param.interInfo;
+    const vec3& hit = interInfo.hit;
+    const vec3& normal = param.vi.normal;
+
+    const GuideDirectionTree* tree = guide.lookup(hit);
+    const bool recording = guide.recording();
+
+    auto mixturePdf = [&](const vec3& d) {
+        const float bsdfPdf = fmaxf(0.0f, dot(d, normal)) * (float)(1.0 / M_PI);
+        return tree != NULL ? 0.5f * (bsdfPdf + tree->pdf(d)) : bsdfPdf;
+    };
+
+    vec3 dir;
+    bool guided = false;
+    if (tree != NULL && randomValue() < 0.5f) {
+        const float u0 = randomValue();
+        const float u1 = randomValue();
+        float guidePdf;
+        guided = tree->sample(u0, u1, dir, guidePdf);
+    }
+    if (!guided) dir = cosineWeightedDirection(normal);
+
+    const color3 savedT = param.throughput;
+    const float savedBsdfPdf = param.bsdfSampledPdf;
+    color3 color = color3::zero;
+
+    // A guided direction below the surface carries no light.
+    const float cosSampled = dot(dir, normal);
+    const float pdf = mixturePdf(dir);
+    if (cosSampled > 0.0f && pdf > 0.0f) {
+        const float weight = cosSampled * (float)(1.0 / M_PI) / pdf;
+        param.throughput *= albedo * weight;
+        param.bsdfSampledPdf = pdf;
+
+        const Ray ray = SurfaceRay(hit, dir, geomNormal(interInfo, normal));
+        const color3 Li = renderer.tracePath(ray, (void*)&param);
+        color += Li * weight;
+        if (recording) guide.record(hit, dir, guideLuminance(Li) / pdf);
+    }
+
+    vec3 lDir;
+    float lightPdf;
+    color3 Le;
+    if (renderer.sampleAreaLightForNEE(hit, normal, lDir, lightPdf, Le)) {
+        const float cosL = dot(lDir, normal);
+        const float pb = mixturePdf(lDir);
+        const float pl2 = lightPdf * lightPdf;
+        const float wLight = pl2 / (pl2 + pb * pb);
+        color += Le * (cosL * wLight / ((float)M_PI * lightPdf));
+        if (recording) guide.record(hit, lDir, guideLuminance(Le) * wLight / lightPdf);
+    }
+
+    Ray shadowRay;
+    float maxT;
+    if (renderer.samplePointLights(hit, normal, Le, shadowRay, maxT)
+        && !renderer.isShadowed(shadowRay, maxT, ShadowOccluders::OpaqueOrRefractive)) {
+        color += Le;
+    }
+
+    if (renderer.sampleEnvmapForNEE(hit, normal, lDir, lightPdf, Le)) {
+        const float cosL = dot(lDir, normal);
+        const float pb = mixturePdf(lDir);
+        const float pe2 = lightPdf * lightPdf;
+        const float wEnv = pe2 / (pe2 + pb * pb);
+        color += Le * (cosL * wEnv / ((float)M_PI * lightPdf));
+        if (recording) guide.record(hit, lDir, guideLuminance(Le) * wEnv / lightPdf);
+    }
+
+    color += diffuseVolumeLight(renderer, hit, normal);
+
+    param.throughput = savedT;
+    param.bsdfSampledPdf = savedBsdfPdf;
+
+    return color * albedo;
+}
+
+}
+
 color3 DiffuseShader::shade(BSDFParam& param) {
     const RayRenderer& renderer = param.renderer;
     const auto& interInfo = param.interInfo;
 
-    const SceneObject& obj = interInfo.triangle->object;
+    const SceneObject& obj = *interInfo.object;
     const Material& m = obj.material;
 
-    // Cosine-weighted hemisphere sampling: p(ω) = cos(θ)/π. For a Lambertian
-    // BRDF albedo/π the MC estimator simplifies to albedo * L(ω), i.e. just
-    // multiply the incoming radiance by surface color — no extra cos/π factors
-    // needed in the shader (the 1/π is already in traceLight's direct term).
-    const vec3 dir = cosineWeightedDirection(param.vi.normal);
-    const Ray ray = SurfaceRay(interInfo.hit, dir, geomNormal(*interInfo.triangle, param.vi.normal));
-
     color3 albedo(1.0f, 1.0f, 1.0f);
     if (renderer.settings.enableColorSampling) {
         albedo = m.color;
@@ -73,6 +185,18 @@ color3 DiffuseShader::shade(BSDFParam& param) {
         }
     }
 
+    PathGuide* guide = renderer.getPathGuide();
+    if (guide != NULL) {
+        return shadeGuidedDiffuse(param, *guide, albedo);
+    }
+
+    // Cosine-weighted hemisphere sampling: p(ω) = cos(θ)/π. For a Lambertian
+    // BRDF albedo/π the MC estimator simplifies to albedo * L(ω), i.e. just
+    // multiply the incoming radiance by surface color — no extra cos/π factors
+    // needed in the shader (the 1/π is already in traceLight's direct term).
+    const vec3 dir = cosineWeightedDirection(param.vi.normal);
+    const Ray ray = SurfaceRay(interInfo.hit, dir, geomNormal(interInfo, param.vi.normal));
+
     const color3 savedT = param.throughput;
     const float savedBsdfPdf = param.bsdfSampledPdf;
     param.throughput *= albedo;
@@ -92,14 +216,7 @@ color3 DiffuseShader::shade(BSDFParam& param) {
     // σe at the sample point (already medium-self-attenuated) and add the
     // Lambertian direct term L = (albedo/π) · Le · cosθ / pdfω. albedo is
     // applied at return so we just multiply by cosθ/(π·pdf) here.
-    {
-        vec3 vDir; float vDist; float vPdf = 0.0f; color3 vLe;
-        if (renderer.sampleVolumeLightForNEE(interInfo.hit, param.vi.normal,
-                                              vDir, vDist, vPdf, vLe) && vPdf > 0.0f) {
-            const float cosL = fmaxf(0.0f, dot(vDir, param.vi.normal));
-            color += vLe * (cosL * (float)(1.0 / M_PI) / vPdf);
-        }
-    }
+    color += diffuseVolumeLight(renderer, interInfo.hit, param.vi.normal);
 
     param.throughput = savedT;
     param.bsdfSampledPdf = savedBsdfPdf;
@@ -107,10 +224,67 @@ color3 DiffuseShader::shade(BSDFParam& param) {
     return color * albedo;
 }
 
+void DiffuseShader::sample(BSDFParam& param, BSDFSample& s) {
+    const RayRenderer& renderer = param.renderer;
+    const auto& interInfo = param.interInfo;
+
+    const SceneObject& obj = *interInfo.object;
+    const Material& m = obj.material;
+    const vec3& normal = param.vi.normal;
+
+    // Same draws, in the same order, as shade(): bounce direction first,
+    // then traceLight's area + point light, then the envmap.
+    const vec3 dir = cosineWeightedDirection(normal);
+
+    color3 albedo(1.0f, 1.0f, 1.0f);
+    if (renderer.settings.enableColorSampling) {
+        albedo = m.color;
+        if (m.texture != NULL) {
+            albedo *= m.texture->sample(param.vi.uv * m.texTiling).rgb;
+        }
+    }
+
+    const float bsdfPdf = fmaxf(0.0f, dot(dir, normal)) * (float)(1.0 / M_PI);
+
+    Ray shadowRay;
+    float maxT;
+    vec3 lDir;
+    float lightPdf;
+    color3 Le;
+
+    // traceAreaLight's estimate, MIS-weighted against the cosine lobe.
+    if (renderer.sampleAreaLight(interInfo.hit, normal, lDir, lightPdf, Le, shadowRay, maxT)) {
+        const float cosObj = dot(lDir, normal);
+        const float pl2 = lightPdf * lightPdf;
+        const float pb = cosObj * (float)(1.0 / M_PI);
+        const float wLight = pl2 / (pl2 + pb * pb);
+        s.addShadow(shadowRay, maxT, ShadowOccluders::Opaque,
+                    Le * albedo * (cosObj * wLight / ((float)M_PI * lightPdf)));
+    }
+
+    if (renderer.samplePointLights(interInfo.hit, normal, Le, shadowRay, maxT)) {
+        s.addShadow(shadowRay, maxT, ShadowOccluders::OpaqueOrRefractive, Le * albedo);
+    }
+
+    // traceEnvmapLight's estimate; shade() hands it the bounce's pdf.
+    if (renderer.sampleEnvmapLight(interInfo.hit, normal, lDir, lightPdf, Le, shadowRay, maxT)) {
+        const float cosObj = dot(lDir, normal);
+        const float e2 = lightPdf * lightPdf;
+        const float w = (bsdfPdf > 0.0f) ? e2 / (e2 + bsdfPdf * bsdfPdf) : 1.0f;
+        s.addShadow(shadowRay, maxT, ShadowOccluders::OpaqueOrRefractive,
+                    Le * albedo * (cosObj * w / ((float)M_PI * lightPdf)));
+    }
+
+    s.scattered = true;
+    s.ray = SurfaceRay(interInfo.hit, dir, geomNormal(interInfo, normal));
+    s.weight = albedo;
+    s.pdf = bsdfPdf;
+}
+
 color3 EmissionShader::shade(BSDFParam& param) {
     const RayTriangleIntersectionInfo& interInfo = param.interInfo;
 
-    const SceneObject& obj = interInfo.triangle->object;
+    const SceneObject& obj = *interInfo.object;
     const Material& m = obj.material;
 
     const vec3 lightray = interInfo.hit - param.inray.origin;
@@ -170,30 +344,144 @@ inline float smithG1(const vec3& w, float ax, float ay) {
 }
 }
 
+namespace {
+// Albedo (colour × texture) drives both the diffuse lobe (when not
+// metallic) and, for metals, the Fresnel F0.
+inline color3 glossyF0(const RayRenderer& renderer, const Material& m, const VertexInterpolation& vi) {
+    color3 albedo = m.color;
+    if (renderer.settings.enableColorSampling && m.texture != NULL) {
+        albedo *= m.texture->sample(vi.uv * m.texTiling).rgb;
+    }
+    return (m.metallic >= 1.0f) ? albedo
+         : (albedo * m.metallic + color3(0.04f, 0.04f, 0.04f) * (1.0f - m.metallic));
+}
+
+inline color3 schlickF(const color3& F0, float VdotH) {
+    const float a1 = fmaxf(0.0f, 1.0f - VdotH);
+    const float a5 = a1 * a1 * a1 * a1 * a1;
+    return F0 + (color3(1.0f, 1.0f, 1.0f) - F0) * a5;
+}
+
+// Reflect off the shading normal; if the result dives below the geometric
+// plane (smooth-shading vs flat-geometry disagreement — common on
+// Gerstner-displaced ocean meshes where vertex-normal interpolation tilts
+// the shading normal almost parallel to the grazing camera ray), fall back
+// to reflecting off the geometric face normal so the bounce stays in the
+// upper hemisphere instead of plunging down through the surface and
+// sampling the dark hemisphere of the envmap (the "black wave triangles"
+// symptom).
+inline vec3 mirrorDirection(const vec3& inDir, const vec3& normal, const vec3& gN) {
+    vec3 r = reflect(inDir, normal);
+    if (dot(r, gN) <= 0.0f) {
+        r = reflect(inDir, gN);
+    }
+    return r;
+}
+
+// Rough anisotropic GGX lobe at one shading point, shared by the recursive
+// and the wavefront glossy shader.
+struct GGXLobe {
+    vec3 normal, t, b;
+    float ax, ay;
+    vec3 Vlocal;
+    float G1v;
+    color3 F0;
+
+    GGXLobe(const Material& m, const vec3& normal, const vec3& inDir, const color3& F0)
+    : normal(normal), F0(F0) {
+        // Build a tangent frame for anisotropy. `t` rotates in the tangent
+        // plane by anisoRotation so the user can orient the brush direction.
+        buildTangentFrame(normal, t, b);
+        if (fabsf(m.anisoRotation) > 0.0f) {
+            const float a = m.anisoRotation * (float)(M_PI / 180.0);
+            const float cosA = cosf(a), sinA = sinf(a);
+            const vec3 t2 = t * cosA + b * sinA;
+            const vec3 b2 = b * cosA - t * sinA;
+            t = t2; b = b2;
+        }
+
+        // Anisotropic αx / αy split. clamp anisotropy to (-0.99, 0.99) so
+        // neither axis collapses to zero width. Sign convention: aniso > 0
+        // elongates the highlight along the tangent direction, < 0 along
+        // bitangent — that means a tighter distribution along tangent, so
+        // αx shrinks as aniso grows.
+        const float aniso = fmaxf(-0.99f, fminf(0.99f, m.anisotropy));
+        const float r2 = m.roughness * m.roughness;
+        ax = fmaxf(1e-3f, r2 * (1.0f - aniso));
+        ay = fmaxf(1e-3f, r2 * (1.0f + aniso));
+
+        // View direction in the local frame (z = normal).
+        const vec3 V = -inDir;
+        Vlocal = vec3(dot(V, t), dot(V, b), dot(V, normal));
+        G1v = (Vlocal.z > 0.0f) ? smithG1(Vlocal, ax, ay) : 0.0f;
+    }
+
+    // Seen from below the shading plane: the lobe is black.
+    inline bool backFacing() const { return Vlocal.z <= 0.0f; }
+
+    inline float D(const vec3& Hlocal) const {
+        const float hx_ax = Hlocal.x / ax;
+        const float hy_ay = Hlocal.y / ay;
+        const float denom = hx_ax * hx_ax + hy_ay * hy_ay + Hlocal.z * Hlocal.z;
+        return 1.0f / ((float)M_PI * ax * ay * denom * denom);
+    }
+
+    // Evaluate (f·cos_L, pdf_bsdf) at an arbitrary world-space outgoing dir.
+    // Returns false when the geometry is invalid (below-surface / degenerate
+    // half-vector). Shared between area-light and envmap NEE.
+    bool eval(const vec3& dirWorld, color3& fCos, float& pdfBsdf) const {
+        const vec3 Llocal(dot(dirWorld, t), dot(dirWorld, b), dot(dirWorld, normal));
+        if (Llocal.z <= 0.0f) return false;
+        vec3 Hlocal = Vlocal + Llocal;
+        const float hlen2 = Hlocal.x*Hlocal.x + Hlocal.y*Hlocal.y + Hlocal.z*Hlocal.z;
+        if (hlen2 <= 0.0f) return false;
+        Hlocal = Hlocal * (1.0f / sqrtf(hlen2));
+        if (Hlocal.z <= 0.0f) return false;
+        const float VdotH = fmaxf(0.0f, dot(Vlocal, Hlocal));
+        if (VdotH <= 0.0f) return false;
+        const float d = D(Hlocal);
+        const float G1l = smithG1(Llocal, ax, ay);
+        const color3 F = schlickF(F0, VdotH);
+        // f·cos_L = F·D·G2 / (4·V.z) — the L.z cancels the 1/L.z in the BRDF.
+        fCos = F * (d * G1v * G1l / (4.0f * Vlocal.z));
+        pdfBsdf = G1v * d / (4.0f * Vlocal.z);
+        return true;
+    }
+
+    // BSDF sampling: visible-normal sample → half vector, then reflect.
+    // Returns false when the reflected direction lands below the surface.
+    bool sample(float u1, float u2, vec3& L, color3& weight, float& pdf) const {
+        const vec3 H_local = sampleGGXVNDF(Vlocal, ax, ay, u1, u2);
+        const vec3 L_local = H_local * (2.0f * dot(Vlocal, H_local)) - Vlocal;
+        if (L_local.z <= 0.0f) return false;
+
+        L = t * L_local.x + b * L_local.y + normal * L_local.z;
+
+        // VNDF sampling estimator: weight = F · G1(outgoing). The V-side G1
+        // is cancelled by the VNDF pdf.
+        const float VdotH = fmaxf(0.0f, dot(Vlocal, H_local));
+        weight = schlickF(F0, VdotH) * smithG1(L_local, ax, ay);
+
+        // pdf of the sampled direction, handed to the next hit so emission
+        // MIS and envmap-miss MIS can apply the complementary BSDF-side
+        // weight.
+        pdf = G1v * D(H_local) / (4.0f * Vlocal.z);
+        return true;
+    }
+};
+}
+
 color3 GlossyShader::shade(BSDFParam& param) {
     const RayRenderer& renderer = param.renderer;
     const auto& interInfo = param.interInfo;
 
-    const SceneObject& obj = interInfo.triangle->object;
+    const SceneObject& obj = *interInfo.object;
     const Material& m = obj.material;
 
     const vec3& normal = param.vi.normal;
     const vec3& inDir = param.inray.dir;
 
-    // Albedo (colour × texture) drives both the diffuse lobe (when not
-    // metallic) and, for metals, the Fresnel F0.
-    color3 albedo = m.color;
-    if (renderer.settings.enableColorSampling && m.texture != NULL) {
-        albedo *= m.texture->sample(param.vi.uv * m.texTiling).rgb;
-    }
-
-    const color3 F0 = (m.metallic >= 1.0f) ? albedo
-                    : (albedo * m.metallic + color3(0.04f, 0.04f, 0.04f) * (1.0f - m.metallic));
-    auto schlickF = [&](float VdotH) {
-        const float a1 = fmaxf(0.0f, 1.0f - VdotH);
-        const float a5 = a1 * a1 * a1 * a1 * a1;
-        return F0 + (color3(1.0f, 1.0f, 1.0f) - F0) * a5;
-    };
+    const color3 F0 = glossyF0(renderer, m, param.vi);
 
     // Smooth material fast path: treat ~0 roughness as a delta mirror. The
     // BSDF pdf is a Dirac delta so NEE can't hit this lobe, and the emission
@@ -201,21 +489,10 @@ color3 GlossyShader::shade(BSDFParam& param) {
     // advertise bsdfSampledPdf = 0 so the next hit skips the BSDF-side MIS
     // weight.
     if (m.roughness < 1e-3f) {
-        const vec3 gN = geomNormal(*interInfo.triangle, normal);
-        // Reflect off the shading normal; if the result dives below the
-        // geometric plane (smooth-shading vs flat-geometry disagreement —
-        // common on Gerstner-displaced ocean meshes where vertex-normal
-        // interpolation tilts the shading normal almost parallel to the
-        // grazing camera ray), fall back to reflecting off the geometric
-        // face normal so the bounce stays in the upper hemisphere instead
-        // of plunging down through the surface and sampling the dark
-        // hemisphere of the envmap (the "black wave triangles" symptom).
-        vec3 r = reflect(inDir, normal);
-        if (dot(r, gN) <= 0.0f) {
-            r = reflect(inDir, gN);
-        }
+        const vec3 gN = geomNormal(interInfo, normal);
+        const vec3 r = mirrorDirection(inDir, normal, gN);
         const float cosI = fmaxf(0.0f, -dot(inDir, normal));
-        const color3 F = schlickF(cosI);
+        const color3 F = schlickF(F0, cosI);
 
         const color3 savedT = param.throughput;
         const float savedPdf = param.bsdfSampledPdf;
@@ -227,58 +504,8 @@ color3 GlossyShader::shade(BSDFParam& param) {
         return incoming * F;
     }
 
-    // Build a tangent frame for anisotropy. `t` rotates in the tangent plane
-    // by anisoRotation so the user can orient the brush direction.
-    vec3 t, b;
-    buildTangentFrame(normal, t, b);
-    if (fabsf(m.anisoRotation) > 0.0f) {
-        const float a = m.anisoRotation * (float)(M_PI / 180.0);
-        const float cosA = cosf(a), sinA = sinf(a);
-        const vec3 t2 = t * cosA + b * sinA;
-        const vec3 b2 = b * cosA - t * sinA;
-        t = t2; b = b2;
-    }
-
-    // Anisotropic αx / αy split. clamp anisotropy to (-0.99, 0.99) so neither
-    // axis collapses to zero width. Sign convention: aniso > 0 elongates the
-    // highlight along the tangent direction, < 0 along bitangent — that means
-    // a tighter distribution along tangent, so αx shrinks as aniso grows.
-    const float aniso = fmaxf(-0.99f, fminf(0.99f, m.anisotropy));
-    const float r2 = m.roughness * m.roughness;
-    const float ax = fmaxf(1e-3f, r2 * (1.0f - aniso));
-    const float ay = fmaxf(1e-3f, r2 * (1.0f + aniso));
-
-    // View direction in the local frame (z = normal).
-    const vec3 V = -inDir;
-    const vec3 Vlocal(dot(V, t), dot(V, b), dot(V, normal));
-    if (Vlocal.z <= 0.0f) return color3::zero;  // back-face
-
-    const float G1v = smithG1(Vlocal, ax, ay);
-
-    // Evaluate (f·cos_L, pdf_bsdf) at an arbitrary world-space outgoing dir.
-    // Returns false when the geometry is invalid (below-surface / degenerate
-    // half-vector). Shared between area-light and envmap NEE.
-    auto evalGlossy = [&](const vec3& dirWorld, color3& fCos, float& pdfBsdf) -> bool {
-        const vec3 Llocal(dot(dirWorld, t), dot(dirWorld, b), dot(dirWorld, normal));
-        if (Llocal.z <= 0.0f) return false;
-        vec3 Hlocal = Vlocal + Llocal;
-        const float hlen2 = Hlocal.x*Hlocal.x + Hlocal.y*Hlocal.y + Hlocal.z*Hlocal.z;
-        if (hlen2 <= 0.0f) return false;
-        Hlocal = Hlocal * (1.0f / sqrtf(hlen2));
-        if (Hlocal.z <= 0.0f) return false;
-        const float VdotH = fmaxf(0.0f, dot(Vlocal, Hlocal));
-        if (VdotH <= 0.0f) return false;
-        const float hx_ax = Hlocal.x / ax;
-        const float hy_ay = Hlocal.y / ay;
-        const float denom = hx_ax * hx_ax + hy_ay * hy_ay + Hlocal.z * Hlocal.z;
-        const float D = 1.0f / ((float)M_PI * ax * ay * denom * denom);
-        const float G1l = smithG1(Llocal, ax, ay);
-        const color3 F = schlickF(VdotH);
-        // f·cos_L = F·D·G2 / (4·V.z) — the L.z cancels the 1/L.z in the BRDF.
-        fCos = F * (D * G1v * G1l / (4.0f * Vlocal.z));
-        pdfBsdf = G1v * D / (4.0f * Vlocal.z);
-        return true;
-    };
+    const GGXLobe lobe(m, normal, inDir, F0);
+    if (lobe.backFacing()) return color3::zero;
 
     color3 direct = color3::zero;
 
@@ -290,7 +517,7 @@ color3 GlossyShader::shade(BSDFParam& param) {
         vec3 lDir; float pdfLight = 0.0f; color3 Le;
         if (renderer.sampleAreaLightForNEE(interInfo.hit, normal, lDir, pdfLight, Le)) {
             color3 fCos; float pdfBsdf = 0.0f;
-            if (evalGlossy(lDir, fCos, pdfBsdf)) {
+            if (lobe.eval(lDir, fCos, pdfBsdf)) {
                 const float pl2 = pdfLight * pdfLight;
                 const float pb2 = pdfBsdf * pdfBsdf;
                 const float wLight = pl2 / (pl2 + pb2);
@@ -304,7 +531,7 @@ color3 GlossyShader::shade(BSDFParam& param) {
         vec3 eDir; float pdfEnv = 0.0f; color3 Li;
         if (renderer.sampleEnvmapForNEE(interInfo.hit, normal, eDir, pdfEnv, Li)) {
             color3 fCos; float pdfBsdf = 0.0f;
-            if (evalGlossy(eDir, fCos, pdfBsdf)) {
+            if (lobe.eval(eDir, fCos, pdfBsdf)) {
                 const float pe2 = pdfEnv * pdfEnv;
                 const float pb2 = pdfBsdf * pdfBsdf;
                 const float wEnv = pe2 / (pe2 + pb2);
@@ -322,18 +549,16 @@ color3 GlossyShader::shade(BSDFParam& param) {
         if (renderer.sampleVolumeLightForNEE(interInfo.hit, normal,
                                               vDir, vDist, vPdf, vLe) && vPdf > 0.0f) {
             color3 fCos; float pdfBsdf = 0.0f;
-            if (evalGlossy(vDir, fCos, pdfBsdf)) {
+            if (lobe.eval(vDir, fCos, pdfBsdf)) {
                 direct += vLe * fCos * (1.0f / vPdf);
             }
         }
     }
 
-    // BSDF sampling: visible-normal sample → half vector, then reflect.
-    const vec3 H_local = sampleGGXVNDF(Vlocal, ax, ay, randomValue(), randomValue());
-    vec3 L_local = H_local * (2.0f * dot(Vlocal, H_local)) - Vlocal;
-    if (L_local.z <= 0.0f) return direct;  // below surface — direct-only
-
-    const vec3 L = t * L_local.x + b * L_local.y + normal * L_local.z;
+    vec3 L;
+    color3 weight;
+    float pdfBsdfSampled;
+    if (!lobe.sample(randomValue(), randomValue(), L, weight, pdfBsdfSampled)) return direct;  // below surface — direct-only
 
     // Geometric-plane sanity: the VNDF-sampled L can be above the shading
     // plane yet below the geometric face plane when the smooth shading
@@ -343,25 +568,9 @@ color3 GlossyShader::shade(BSDFParam& param) {
     // the dark hemisphere of the envmap. Drop the BSDF contribution and
     // keep just the direct-lighting term — NEE has already been added
     // above for the area / envmap / volume lobes.
-    const vec3 gN = geomNormal(*interInfo.triangle, normal);
+    const vec3 gN = geomNormal(interInfo, normal);
     if (dot(L, gN) <= 0.0f) return direct;
 
-    const float VdotH = fmaxf(0.0f, dot(Vlocal, H_local));
-    const color3 F = schlickF(VdotH);
-
-    // VNDF sampling estimator: weight = F · G1(outgoing). The V-side G1 is
-    // cancelled by the VNDF pdf.
-    const float G1o = smithG1(L_local, ax, ay);
-    const color3 weight = F * G1o;
-
-    // pdf of the sampled direction, handed to the next hit so emission MIS
-    // and envmap-miss MIS can apply the complementary BSDF-side weight.
-    const float hx_ax = H_local.x / ax;
-    const float hy_ay = H_local.y / ay;
-    const float denomBS = hx_ax * hx_ax + hy_ay * hy_ay + H_local.z * H_local.z;
-    const float D_bs = 1.0f / ((float)M_PI * ax * ay * denomBS * denomBS);
-    const float pdfBsdfSampled = G1v * D_bs / (4.0f * Vlocal.z);
-
     const color3 savedT = param.throughput;
     const float savedPdf = param.bsdfSampledPdf;
     param.throughput *= weight;
@@ -373,12 +582,70 @@ color3 GlossyShader::shade(BSDFParam& param) {
     return direct + incoming * weight;
 }
 
-color3 RefractionShader::shade(BSDFParam& param) {
+void GlossyShader::sample(BSDFParam& param, BSDFSample& s) {
     const RayRenderer& renderer = param.renderer;
     const auto& interInfo = param.interInfo;
 
-    const SceneObject& obj = interInfo.triangle->object;
-    const Material& m = obj.material;
+    const Material& m = interInfo.object->material;
+    const vec3& normal = param.vi.normal;
+    const vec3& inDir = param.inray.dir;
+
+    const color3 F0 = glossyF0(renderer, m, param.vi);
+    const vec3 gN = geomNormal(interInfo, normal);
+
+    if (m.roughness < 1e-3f) {
+        s.scattered = true;
+        s.ray = SurfaceRay(interInfo.hit, mirrorDirection(inDir, normal, gN), gN);
+        s.weight = schlickF(F0, fmaxf(0.0f, -dot(inDir, normal)));
+        s.pdf = 0.0f;
+        return;
+    }
+
+    const GGXLobe lobe(m, normal, inDir, F0);
+    if (lobe.backFacing()) return;
+
+    Ray shadowRay;
+    float maxT;
+    vec3 lDir;
+    float lightPdf;
+    color3 Le;
+    color3 fCos;
+    float pdfBsdf;
+
+    if (renderer.sampleAreaLight(interInfo.hit, normal, lDir, lightPdf, Le, shadowRay, maxT)
+        && lobe.eval(lDir, fCos, pdfBsdf)) {
+        const float pl2 = lightPdf * lightPdf;
+        const float wLight = pl2 / (pl2 + pdfBsdf * pdfBsdf);
+        s.addShadow(shadowRay, maxT, ShadowOccluders::Opaque, Le * fCos * (wLight / lightPdf));
+    }
+
+    if (renderer.sampleEnvmapLight(interInfo.hit, normal, lDir, lightPdf, Le, shadowRay, maxT)
+        && lobe.eval(lDir, fCos, pdfBsdf)) {
+        const float pe2 = lightPdf * lightPdf;
+        const float wEnv = pe2 / (pe2 + pdfBsdf * pdfBsdf);
+        s.addShadow(shadowRay, maxT, ShadowOccluders::OpaqueOrRefractive, Le * fCos * (wEnv / lightPdf));
+    }
+
+    vec3 L;
+    color3 weight;
+    float pdf;
+    if (!lobe.sample(randomValue(), randomValue(), L, weight, pdf)) return;
+    if (dot(L, gN) <= 0.0f) return;
+
+    s.scattered = true;
+    s.ray = SurfaceRay(interInfo.hit, L, gN);
+    s.weight = weight;
+    s.pdf = pdf;
+}
+
+namespace {
+// One refraction bounce: picks reflection or refraction and, for dispersive
+// materials, the path's wavelength band. Returns the outgoing direction;
+// `chanMask` receives the band mask the bounce's radiance is scaled by.
+// Shared by the recursive and the wavefront refraction shader.
+vec3 sampleRefraction(BSDFParam& param, const vec3& gN, color3& chanMask) {
+    const auto& interInfo = param.interInfo;
+    const Material& m = interInfo.object->material;
 
     const vec3& normal = param.vi.normal;
     const vec3& inDir = param.inray.dir;
@@ -400,7 +667,7 @@ color3 RefractionShader::shade(BSDFParam& param) {
     // estimator integrates over the three bands. Deeper CA hits just use
     // the stored channel's IOR and return full RGB (the outer mask clips).
     float ior = m.refractionRatio;
-    color3 chanMask(1.0f, 1.0f, 1.0f);
+    chanMask = color3(1.0f, 1.0f, 1.0f);
     bool firstCAHit = false;
     if (m.chromaDispersion > 0.0f) {
         if (param.chromaChannel < 0) {
@@ -427,7 +694,7 @@ color3 RefractionShader::shade(BSDFParam& param) {
         : refract(inDir, normal, ior);
 
     if (m.roughness > 0.0f) {
-        dir = (dir + randomRayInHemisphere(normal) * m.roughness).normalize();
+        dir = (dir + randomDirectionInHemisphere(normal) * m.roughness).normalize();
     }
 
     // Geometric-plane sanity for the reflect branch — the smooth shading
@@ -437,11 +704,28 @@ color3 RefractionShader::shade(BSDFParam& param) {
     // turns the triangle black). Re-reflect off the geometric face normal
     // in that case so the bounce stays in the upper hemisphere. Refract
     // is left alone — refraction is supposed to cross the interface.
-    const vec3 gN = geomNormal(*interInfo.triangle, normal);
     if (pickReflect && dot(dir, gN) <= 0.0f) {
         dir = reflect(inDir, gN);
     }
 
+    return dir;
+}
+}
+
+color3 RefractionShader::shade(BSDFParam& param) {
+    const RayRenderer& renderer = param.renderer;
+    const auto& interInfo = param.interInfo;
+
+    const SceneObject& obj = *interInfo.object;
+    const Material& m = obj.material;
+
+    const vec3& normal = param.vi.normal;
+    const vec3& inDir = param.inray.dir;
+
+    const vec3 gN = geomNormal(interInfo, normal);
+    color3 chanMask;
+    const vec3 dir = sampleRefraction(param, gN, chanMask);
+
     const color3 savedT = param.throughput;
     const float savedPdf = param.bsdfSampledPdf;
     const HomogeneousMedium* savedMedium = param.currentMedium;
@@ -455,22 +739,11 @@ color3 RefractionShader::shade(BSDFParam& param) {
     // interface (the refract branch — reflection bounces back on the same
     // side). Reflection flips dot(dir, normal); refraction preserves its
     // sign, so the product with dot(inDir, normal) stays positive only on
-    // the refract branch. Phase 1 does no nesting: exiting an object
-    // always returns to the scene's global medium, so two adjacent water
-    // cubes can't currently share their interior — revisited when the
-    // medium-stack lands.
+    // the refract branch.
     const float dotIn = dot(inDir, normal);
     const float dotOut = dot(dir, normal);
-    const bool refracted = dotIn * dotOut > 0.0f;
-    if (refracted) {
-        const bool entering = dotIn < 0.0f;
-        if (entering) {
-            const HomogeneousMedium* interior = obj.interiorMedium;
-            if (interior != NULL) param.currentMedium = interior;
-        } else {
-            const Scene* sc = renderer.getScene();
-            param.currentMedium = (sc != NULL) ? sc->globalMedium : NULL;
-        }
+    if (dotIn * dotOut > 0.0f) {
+        param.currentMedium = mediumAcross(renderer, obj, dotIn < 0.0f, param.currentMedium);
     }
 
     const color3f color = renderer.tracePath(SurfaceRay(interInfo.hit, dir, gN), (void*)&param);
@@ -482,11 +755,32 @@ color3 RefractionShader::shade(BSDFParam& param) {
     return color * m.color * chanMask;
 }
 
+void RefractionShader::sample(BSDFParam& param, BSDFSample& s) {
+    const auto& interInfo = param.interInfo;
+    const Material& m = interInfo.object->material;
+
+    const vec3 gN = geomNormal(interInfo, param.vi.normal);
+    color3 chanMask;
+    const vec3 dir = sampleRefraction(param, gN, chanMask);
+
+    // Both Fresnel branches are delta lobes: no MIS pair downstream.
+    s.scattered = true;
+    s.ray = SurfaceRay(interInfo.hit, dir, gN);
+    s.weight = m.color * chanMask;
+    s.pdf = 0.0f;
+
+    // Medium swap as in shade().
+    const float dotIn = dot(param.inray.dir, param.vi.normal);
+    if (dotIn * dot(dir, param.vi.normal) > 0.0f) {
+        s.medium = mediumAcross(param.renderer, *interInfo.object, dotIn < 0.0f, param.currentMedium);
+    }
+}
+
 color3 GlassShader::shade(BSDFParam& param) {
     const RayRenderer& renderer = param.renderer;
     const auto& interInfo = param.interInfo;
 
-    const SceneObject& obj = interInfo.triangle->object;
+    const SceneObject& obj = *interInfo.object;
     const Material& m = obj.material;
 
     vec3 normal = param.vi.normal;
@@ -494,7 +788,7 @@ color3 GlassShader::shade(BSDFParam& param) {
     vec3 r = refract(param.inray.dir, normal, m.refractionRatio);
 
     if (m.roughness > 0.0f) {
-        r = (r + randomRayInHemisphere(normal) * m.roughness).normalize();
+        r = (r + randomDirectionInHemisphere(normal) * m.roughness).normalize();
     }
 
     const color3 savedT = param.throughput;
@@ -502,7 +796,7 @@ color3 GlassShader::shade(BSDFParam& param) {
     param.throughput *= m.color;
     param.bsdfSampledPdf = 0.0f;  // delta refraction lobe
 
-    const color3f color = renderer.tracePath(SurfaceRay(interInfo.hit, r, geomNormal(*interInfo.triangle, normal)), (void*)&param);
+    const color3f color = renderer.tracePath(SurfaceRay(interInfo.hit, r, geomNormal(interInfo, normal)), (void*)&param);
 
     param.throughput = savedT;
     param.bsdfSampledPdf = savedPdf;
@@ -514,7 +808,7 @@ color3 TransparencyShader::shade(BSDFParam& param) {
     const RayRenderer& renderer = param.renderer;
     const auto& interInfo = param.interInfo;
 
-    const SceneObject& obj = interInfo.triangle->object;
+    const SceneObject& obj = *interInfo.object;
     const Material& m = obj.material;
 
     const color3 savedT = param.throughput;
@@ -528,16 +822,9 @@ color3 TransparencyShader::shade(BSDFParam& param) {
     // swapped on refraction). Reflection isn't possible on this branch since
     // the ray direction is preserved; we always take the "through" side.
     const float dotIn = dot(param.inray.dir, param.vi.normal);
-    const bool entering = dotIn < 0.0f;
-    if (entering) {
-        const HomogeneousMedium* interior = obj.interiorMedium;
-        if (interior != NULL) param.currentMedium = interior;
-    } else {
-        const Scene* sc = renderer.getScene();
-        param.currentMedium = (sc != NULL) ? sc->globalMedium : NULL;
-    }
+    param.currentMedium = mediumAcross(renderer, obj, dotIn < 0.0f, param.currentMedium);
 
-    const color3 color = renderer.tracePath(SurfaceRay(interInfo.hit, param.inray.dir, geomNormal(*interInfo.triangle, param.vi.normal)), (void*)&param);
+    const color3 color = renderer.tracePath(SurfaceRay(interInfo.hit, param.inray.dir, geomNormal(interInfo, param.vi.normal)), (void*)&param);
 
     param.throughput = savedT;
     param.currentMedium = savedMedium;
@@ -545,17 +832,31 @@ color3 TransparencyShader::shade(BSDFParam& param) {
     return color * m.transparency;
 }
 
+void TransparencyShader::sample(BSDFParam& param, BSDFSample& s) {
+    const auto& interInfo = param.interInfo;
+    const Material& m = interInfo.object->material;
+
+    // Straight through; the caller's BSDF pdf still describes the ray.
+    s.scattered = true;
+    s.ray = SurfaceRay(interInfo.hit, param.inray.dir, geomNormal(interInfo, param.vi.normal));
+    s.weight = color3(m.transparency, m.transparency, m.transparency);
+    s.pdf = param.bsdfSampledPdf;
+    // Medium swap as in shade().
+    s.medium = mediumAcross(param.renderer, *interInfo.object,
+                            dot(param.inray.dir, param.vi.normal) < 0.0f, param.currentMedium);
+}
+
 color3 AnisotropicShader::shade(BSDFParam& param) {
     const RayRenderer& renderer = param.renderer;
     const auto& interInfo = param.interInfo;
 
-    const SceneObject& obj = interInfo.triangle->object;
+    const SceneObject& obj = *interInfo.object;
     const Material& m = obj.material;
 
     const vec3& normal = param.vi.normal;
 
-    const vec3 dir = randomRayInHemisphere(normal);
-    const Ray ray = SurfaceRay(interInfo.hit, dir, geomNormal(*interInfo.triangle, normal));
+    const vec3 dir = randomDirectionInHemisphere(normal);
+    const Ray ray = SurfaceRay(interInfo.hit, dir, geomNormal(interInfo, normal));
 
     color3 albedo(1.0f, 1.0f, 1.0f);
     if (renderer.settings.enableColorSampling) {
@@ -576,17 +877,64 @@ color3 AnisotropicShader::shade(BSDFParam& param) {
     return color * albedo;
 }
 
+namespace {
+
+enum MixLobe { MixLobeNone, MixLobeDiffuse, MixLobeGlossy, MixLobeRefraction };
+
+// Picks one of a mixed material's lobes with probability proportional to
+// its weight; `outScale` = weight / probability = the sum of the weights,
+// so the picked lobe scaled by it has the expectation of the weighted sum.
+inline MixLobe pickMixLobe(const Material& m, float u, float& outScale) {
+    const float diffuse = 1.0f - m.glossy - m.refraction;
+    const float wDiffuse = (diffuse > 0.00001f) ? diffuse : 0.0f;
+    const float wGlossy = (m.glossy > 0.00001f) ? m.glossy : 0.0f;
+    const float wRefraction = (m.refraction > 0.00001f) ? m.refraction : 0.0f;
+    const float total = wDiffuse + wGlossy + wRefraction;
+    outScale = total;
+    if (total <= 0.0f) return MixLobeNone;
+
+    u *= total;
+    if (u < wDiffuse || (wGlossy <= 0.0f && wRefraction <= 0.0f)) return MixLobeDiffuse;
+    if (u < wDiffuse + wGlossy || wRefraction <= 0.0f) return MixLobeGlossy;
+    return MixLobeRefraction;
+}
+
+}
+
 color3 MixShader::shade(BSDFParam& param) {
     const auto& interInfo = param.interInfo;
 
-    const SceneObject& obj = interInfo.triangle->object;
+    const SceneObject& obj = *interInfo.object;
     const Material& m = obj.material;
 
     color3 color;
 
-    const float diffuse = 1.0f - m.glossy - m.refraction;
     const color3 savedT = param.throughput;
 
+    // One lobe per hit: the path stays a path instead of splitting two or
+    // three ways per bounce. The lobe's throughput carries the 1/p scale,
+    // so Russian Roulette sees the same expected contribution, and the lobe
+    // sets bsdfSampledPdf for its own sample as it would alone — each lobe
+    // pairs its NEE with its own bounce, so the MIS stays consistent.
+    if (param.renderer.settings.enableLobeSelection) {
+        float scale;
+        const MixLobe lobe = pickMixLobe(m, randomValue(), scale);
+        if (lobe == MixLobeNone) return color;
+
+        param.throughput = savedT * scale;
+        if (lobe == MixLobeDiffuse) {
+            color = diffuseShader.shade(param) * scale;
+        } else if (lobe == MixLobeGlossy) {
+            color = glossyShader.shade(param) * scale;
+        } else {
+            color = refractionShader.shade(param) * scale;
+        }
+        param.throughput = savedT;
+        return color;
+    }
+
+    const float diffuse = 1.0f - m.glossy - m.refraction;
+
     // Each child branch's recursive tracePath needs the MixShader-level weight
     // baked into the throughput so Russian Roulette sees the true contribution.
     // Restore between siblings so branches don't interfere.
@@ -609,4 +957,21 @@ color3 MixShader::shade(BSDFParam& param) {
     return color;
 }
 
+void MixShader::sample(BSDFParam& param, BSDFSample& s) {
+    const Material& m = param.interInfo.object->material;
+
+    float scale;
+    const MixLobe lobe = pickMixLobe(m, randomValue(), scale);
+    if (lobe == MixLobeNone) return;
+
+    if (lobe == MixLobeDiffuse) {
+        diffuseShader.sample(param, s);
+    } else if (lobe == MixLobeGlossy) {
+        glossyShader.sample(param, s);
+    } else {
+        refractionShader.sample(param, s);
+    }
+    s.scale(scale);
+}
+
 }
@@ -60,6 +60,65 @@ public:
 	{ }
 };
 
+// Occluders that block a shadow ray queued in a BSDFSample; mirrors the
+// predicates the recursive light tracers pass to RayRenderer::isOccluded.
+enum class ShadowOccluders {
+	// Opaque non-emissive geometry. Area-light samples use this so the
+	// other triangles of the same light never self-shadow.
+	Opaque,
+	// Opaque or refractive non-emissive geometry (point lights, envmap).
+	OpaqueOrRefractive,
+};
+
+#define BSDF_MAX_SHADOW_RAYS 3
+
+struct BSDFShadowRay {
+	Ray ray;
+	float maxT;
+	ShadowOccluders occluders;
+	// Radiance this light sample adds when the ray is unblocked.
+	color3 radiance;
+};
+
+// One path vertex as the wavefront integrator consumes it: instead of
+// recursing through tracePath, a shader's sample() hands back what the
+// vertex emits, the next-event shadow rays to test, and at most one
+// continuation ray. Radiance and weight are relative to the incoming path
+// throughput.
+struct BSDFSample {
+	color3 emitted = color3::zero;
+	int shadowCount = 0;
+	BSDFShadowRay shadows[BSDF_MAX_SHADOW_RAYS];
+
+	bool scattered = false;
+	Ray ray;
+	color3 weight = color3::zero;
+	// Solid-angle pdf of `ray.dir`, 0 for delta lobes (see bsdfSampledPdf).
+	float pdf = 0.0f;
+	// The path's dispersion channel after this vertex (see chromaChannel).
+	int chromaChannel = -1;
+	// Medium `ray` travels through: the one the vertex was hit in, or the
+	// one on the far side when the lobe crossed the surface.
+	const HomogeneousMedium* medium = NULL;
+
+	inline void addShadow(const Ray& ray, float maxT, ShadowOccluders occluders, const color3& radiance) {
+		if (this->shadowCount >= BSDF_MAX_SHADOW_RAYS) return;
+		BSDFShadowRay& s = this->shadows[this->shadowCount++];
+		s.ray = ray;
+		s.maxT = maxT;
+		s.occluders = occluders;
+		s.radiance = radiance;
+	}
+
+	// Scales everything but `emitted`, i.e. what the lobe contributes.
+	inline void scale(float f) {
+		for (int i = 0; i < this->shadowCount; i++) {
+			this->shadows[i].radiance = this->shadows[i].radiance * f;
+		}
+		this->weight = this->weight * f;
+	}
+};
+
 class BSDFShader
 {
 public:
@@ -70,6 +129,7 @@ class DiffuseShader : public BSDFShader
 {
 public:
 	color3 shade(BSDFParam& param);
+	void sample(BSDFParam& param, BSDFSample& s);
 };
 
 class EmissionShader : public BSDFShader
@@ -82,12 +142,14 @@ class GlossyShader : public BSDFShader
 {
 public:
   color3 shade(BSDFParam& param);
+  void sample(BSDFParam& param, BSDFSample& s);
 };
 
 class RefractionShader : public BSDFShader
 {
 public:
 	color3 shade(BSDFParam& param);
+	void sample(BSDFParam& param, BSDFSample& s);
 };
 
 class GlassShader : public BSDFShader
@@ -100,6 +162,7 @@ class TransparencyShader : public BSDFShader
 {
 public:
   color3 shade(BSDFParam& param);
+  void sample(BSDFParam& param, BSDFSample& s);
 };
 
 class AnisotropicShader : public BSDFShader
@@ -117,6 +180,11 @@ private:
 	
 public:
 	color3 shade(BSDFParam& param);
+	// shade() traces every lobe with a non-zero weight and sums them, or
+	// with RendererSettings::enableLobeSelection picks one the way sample()
+	// does. A wavefront path can't branch, so sample() always picks one
+	// lobe with probability proportional to its weight.
+	void sample(BSDFParam& param, BSDFSample& s);
 };
 
 }
@@ -10,6 +10,9 @@
 #include <algorithm>
 #include <cmath>
 #include <cfloat>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 namespace raygen {
 
@@ -19,20 +22,57 @@ using ugm::BoundingBox;
 
 namespace {
 
-constexpr int BVH_BINS = 16;
-constexpr uint16_t BVH_LEAF_SIZE = 4;  // stop splitting at this many prims
+// Upper bound of the presets' bin counts (8 / 16 / 32).
+constexpr int BVH_MAX_BINS = 32;
+// Leaves are tested BVH_LEAF_BLOCK triangles per SIMD pass, so the SAH
+// charges intersection per started block rather than per triangle: a leaf
+// of 3 costs the same as a full one, and splitting stops at one block.
+constexpr uint16_t BVH_LEAF_SIZE = BVH_LEAF_BLOCK;
 constexpr float BVH_TRAVERSAL_COST = 1.0f;
-constexpr float BVH_INTERSECT_COST = 1.5f;
+constexpr float BVH_INTERSECT_COST = 1.5f;  // per block
+// BVHNode::count is 16 bits. A range SAH can't (or won't) split that is
+// bigger than this is halved by index instead of becoming one leaf.
+constexpr uint32_t BVH_MAX_LEAF_COUNT = 0xFFFFu;
+// High preset: a spatial split is only tried where the best object split's
+// children overlap by more than this fraction of the root's surface area
+// (the paper's alpha), and duplication may grow the reference count by at
+// most this fraction of the triangle count.
+constexpr float BVH_SPATIAL_ALPHA = 1e-5f;
+constexpr float BVH_SPATIAL_MAX_DUPLICATION = 0.5f;
+constexpr int BVH_SPATIAL_BINS = 16;
+// A spatial split may keep every reference on one side, shrinking only its
+// box; past this depth only object splits are taken, so the tree stays
+// well inside the traversal stacks.
+constexpr int BVH_SPATIAL_MAX_DEPTH = 40;
+// Parallel build: ranges at least this big get their bbox / bin reductions
+// split across threads; subtrees at most this big become one worker task.
+constexpr uint32_t BVH_PARALLEL_REDUCE_MIN = 1u << 16;
+constexpr uint32_t BVH_TASK_MIN_PRIMS = 1u << 12;
+// Instances are few and each leaf entry costs a ray transform plus a whole
+// BLAS descent, so keep top-level leaves tiny.
+constexpr uint16_t TLAS_LEAF_SIZE = 2;
 
 struct Bin {
     BoundingBox bbox;
-    int count = 0;
+    int count = 0;  // references starting in this bin
+    int exits = 0;  // references ending in it; == count for object bins
     Bin() {
         bbox.min = vec3( FLT_MAX,  FLT_MAX,  FLT_MAX);
         bbox.max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
     }
 };
 
+// Best split found so far for one node. `bin` is the last bin of the left
+// side; spatial splits also record the plane they cut at.
+struct SplitCandidate {
+    float cost = FLT_MAX;
+    int axis = -1;
+    int bin = -1;
+    bool spatial = false;
+    float pos = 0.0f;
+    BoundingBox leftBox, rightBox;
+};
+
 inline void expandBBox(BoundingBox& dst, const BoundingBox& src) {
     dst.min.x = fminf(dst.min.x, src.min.x);
     dst.min.y = fminf(dst.min.y, src.min.y);
@@ -58,6 +98,17 @@ inline float surfaceArea(const BoundingBox& b) {
     return 2.0f * (dx * dy + dy * dz + dz * dx);
 }
 
+inline float surfaceArea(const BVHNode& n) {
+    const float dx = n.bmax.x - n.bmin.x;
+    const float dy = n.bmax.y - n.bmin.y;
+    const float dz = n.bmax.z - n.bmin.z;
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+inline float leafBlocks(uint32_t count) {
+    return (float)((count + BVH_LEAF_BLOCK - 1) / BVH_LEAF_BLOCK);
+}
+
 inline BoundingBox emptyBBox() {
     BoundingBox b;
     b.min = vec3( FLT_MAX,  FLT_MAX,  FLT_MAX);
@@ -65,159 +116,1134 @@ inline BoundingBox emptyBBox() {
     return b;
 }
 
+inline bool validBBox(const BoundingBox& b) {
+    return b.min.x <= b.max.x && b.min.y <= b.max.y && b.min.z <= b.max.z;
+}
+
+inline BoundingBox clipBBox(BoundingBox a, const BoundingBox& b) {
+    a.min = vec3(fmaxf(a.min.x, b.min.x), fmaxf(a.min.y, b.min.y), fmaxf(a.min.z, b.min.z));
+    a.max = vec3(fminf(a.max.x, b.max.x), fminf(a.max.y, b.max.y), fminf(a.max.z, b.max.z));
+    return a;
+}
+
+inline int binIndex(float c, float cmin, float scale, int binCount) {
+    const int b = (int)((c - cmin) * scale);
+    return b < 0 ? 0 : (b >= binCount ? binCount - 1 : b);
+}
+
+// Evaluates the split after each of the first binCount-1 bins on `axis` and
+// takes it into `best` if it is cheaper. The left side counts references
+// starting in its bins and the right side those ending in its bins: the
+// same thing for object bins, and what counts a reference straddling a
+// spatial plane on both sides. Splits leaving a side empty, or both sides
+// with all `count` references, are skipped.
+inline void sweepBins(const Bin* bins, int binCount, uint32_t count, float invParentArea,
+                      int axis, SplitCandidate& best) {
+    BoundingBox leftBox[BVH_MAX_BINS - 1], rightBox[BVH_MAX_BINS - 1];
+    int leftCnt[BVH_MAX_BINS - 1], rightCnt[BVH_MAX_BINS - 1];
+    {
+        BoundingBox lb = emptyBBox();
+        int lc = 0;
+        for (int i = 0; i < binCount - 1; i++) {
+            expandBBox(lb, bins[i].bbox);
+            lc += bins[i].count;
+            leftBox[i] = lb;
+            leftCnt[i] = lc;
+        }
+        BoundingBox rb = emptyBBox();
+        int rc = 0;
+        for (int i = binCount - 1; i > 0; i--) {
+            expandBBox(rb, bins[i].bbox);
+            rc += bins[i].exits;
+            rightBox[i - 1] = rb;
+            rightCnt[i - 1] = rc;
+        }
+    }
+
+    for (int i = 0; i < binCount - 1; i++) {
+        if (leftCnt[i] == 0 || rightCnt[i] == 0) continue;
+        if ((uint32_t)leftCnt[i] >= count && (uint32_t)rightCnt[i] >= count) continue;
+        const float cost = BVH_TRAVERSAL_COST
+            + BVH_INTERSECT_COST * invParentArea
+              * (surfaceArea(leftBox[i]) * leafBlocks(leftCnt[i])
+                 + surfaceArea(rightBox[i]) * leafBlocks(rightCnt[i]));
+        if (cost < best.cost) {
+            best.cost = cost;
+            best.axis = axis;
+            best.bin = i;
+            best.spatial = false;
+            best.leftBox = leftBox[i];
+            best.rightBox = rightBox[i];
+        }
+    }
+}
+
+// Bounds of the parts of `rt` either side of the plane at `pos` on `axis`,
+// each clipped to `box` (a reference may already cover only part of its
+// triangle). A side the triangle doesn't reach comes back empty.
+inline void splitTriangleBox(const RenderMeshTriangle& rt, const BoundingBox& box, int axis, float pos,
+                             BoundingBox& left, BoundingBox& right) {
+    left = emptyBBox();
+    right = emptyBBox();
+    const vec3* v[3] = { &rt.v1, &rt.v2, &rt.v3 };
+    for (int i = 0; i < 3; i++) {
+        const vec3& a = *v[i];
+        const vec3& b = *v[(i + 1) % 3];
+        const float pa = a[axis], pb = b[axis];
+        if (pa <= pos) expandBBox(left, a);
+        if (pa >= pos) expandBBox(right, a);
+        if ((pa < pos && pos < pb) || (pb < pos && pos < pa)) {
+            vec3 p = a + (b - a) * ((pos - pa) / (pb - pa));
+            p[axis] = pos;
+            expandBBox(left, p);
+            expandBBox(right, p);
+        }
+    }
+    left = clipBBox(left, box);
+    right = clipBBox(right, box);
+    left.max[axis] = fminf(left.max[axis], pos);
+    right.min[axis] = fmaxf(right.min[axis], pos);
+}
+
+// Runs fn(threadIndex, begin, end) over `threads` contiguous slices of
+// [first, first+count). threads == 1 runs inline on the caller.
+template<typename Fn>
+void parallelFor(int threads, uint32_t first, uint32_t count, Fn&& fn) {
+    if (threads <= 1 || count < (uint32_t)threads) {
+        fn(0, first, first + count);
+        return;
+    }
+    std::vector<std::thread> pool;
+    const uint32_t chunk = (count + threads - 1) / threads;
+    for (int t = 1; t < threads; t++) {
+        const uint32_t begin = std::min(first + count, first + chunk * t);
+        const uint32_t end = std::min(first + count, begin + chunk);
+        pool.push_back(std::thread([&fn, t, begin, end] { fn(t, begin, end); }));
+    }
+    fn(0, first, std::min(first + count, first + chunk));
+    for (std::thread& th : pool) th.join();
+}
+
 }  // namespace
 
+void TriangleSoA::resize(size_t n) {
+    if (n > 0) n += BVH_LEAF_BLOCK;  // zeroed tail for block loads
+    v0x.resize(n); v0y.resize(n); v0z.resize(n);
+    e1x.resize(n); e1y.resize(n); e1z.resize(n);
+    e2x.resize(n); e2y.resize(n); e2z.resize(n);
+}
+
+void TriangleSoA::clear() {
+    resize(0);
+    v0x.shrink_to_fit(); v0y.shrink_to_fit(); v0z.shrink_to_fit();
+    e1x.shrink_to_fit(); e1y.shrink_to_fit(); e1z.shrink_to_fit();
+    e2x.shrink_to_fit(); e2y.shrink_to_fit(); e2z.shrink_to_fit();
+}
+
+void TriangleSoA::set(size_t i, const RenderMeshTriangle& rt) {
+    // Same edge construction as RenderMeshTriangle::intersectsRay so the
+    // two paths agree bit for bit.
+    const vec3 e1 = rt.v2 - rt.v1;
+    const vec3 e2 = rt.v3 - rt.v1;
+    v0x[i] = rt.v1.x; v0y[i] = rt.v1.y; v0z[i] = rt.v1.z;
+    e1x[i] = e1.x;    e1y[i] = e1.y;    e1z[i] = e1.z;
+    e2x[i] = e2.x;    e2y[i] = e2.y;    e2z[i] = e2.z;
+}
+
 void TriangleBVH::reset() {
     nodes.clear();
+    nodes4.clear();
+    nodes8.clear();
     prims.clear();
+    tris.clear();
     centroids.clear();
 }
 
-void TriangleBVH::build(std::vector<const RenderMeshTriangle*>& inprims) {
+void TriangleBVH::build(const std::vector<const RenderMeshTriangle*>& inprims, int threads, int width,
+                        BVHBuildQuality quality) {
+    const auto t0 = std::chrono::steady_clock::now();
+
     reset();
+    stats = BVHBuildStats();
+    stats.quality = quality;
     if (inprims.empty()) return;
 
+    threads = std::max(1, threads);
+    binCount = (quality == BVHBuildQuality::Fast) ? 8 : (quality == BVHBuildQuality::High) ? 32 : 16;
+    binAllAxes = (quality == BVHBuildQuality::High);
+
     prims = inprims;
-    centroids.resize(prims.size());
-    for (size_t i = 0; i < prims.size(); i++) {
-        const auto& b = prims[i]->bbox;
-        centroids[i] = (b.min + b.max) * 0.5f;
+    nodes.reserve(prims.size() * 2);
+    nodes.emplace_back();
+
+    if (quality == BVHBuildQuality::High) {
+        if (prims.size() <= BVH_TASK_MIN_PRIMS) threads = 1;
+        buildSpatial(threads);
+    } else {
+        centroids.resize(prims.size());
+        parallelFor(threads, 0, (uint32_t)prims.size(), [&](int, uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; i++) {
+                const auto& b = prims[i]->bbox;
+                centroids[i] = (b.min + b.max) * 0.5f;
+            }
+        });
+
+        if (threads == 1 || prims.size() <= BVH_TASK_MIN_PRIMS) {
+            buildRecursive(nodes, 0, 0, (uint32_t)prims.size());
+            threads = 1;
+        } else {
+            buildParallel(threads);
+        }
+
+        // Centroids only needed during build.
+        centroids.clear();
+        centroids.shrink_to_fit();
     }
 
-    nodes.reserve(prims.size() * 2);
+    // Snapshot intersection data in final leaf order.
+    tris.resize(prims.size());
+    parallelFor(threads, 0, (uint32_t)prims.size(), [&](int, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) tris.set(i, *prims[i]);
+    });
+
+    stats.primCount = inprims.size();
+    stats.references = prims.size();
+    stats.nodeCount = nodes.size();
+    stats.threads = threads;
+
+    computeSahCost();
+    stats.buildSahCost = stats.sahCost;
+
+    // The binary nodes stay around (stats, and the source for collapsing);
+    // traversal uses the wide array when there is one.
+    if (width == 4) {
+        collapse(nodes4);
+        stats.wideNodeCount = nodes4.size();
+    } else if (width == 8) {
+        collapse(nodes8);
+        stats.wideNodeCount = nodes8.size();
+    } else {
+        width = 2;
+    }
+    stats.width = width;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+bool TriangleBVH::refit(int threads, float maxSahGrowth) {
+    if (nodes.empty()) return true;
+
+    const auto t0 = std::chrono::steady_clock::now();
+    const int buildThreads = std::max(1, threads);
+    threads = prims.size() > BVH_TASK_MIN_PRIMS ? buildThreads : 1;
+
+    // Leaves and the SoA snapshot straight from the moved primitives.
+    parallelFor(threads, 0, (uint32_t)prims.size(), [&](int, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) tris.set(i, *prims[i]);
+    });
+    parallelFor(threads, 0, (uint32_t)nodes.size(), [&](int, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            BVHNode& n = nodes[i];
+            if (!n.isLeaf()) continue;
+            BoundingBox b = emptyBBox();
+            for (uint32_t k = 0; k < n.count; k++) expandBBox(b, prims[n.firstOrLeft + k]->bbox);
+            n.bmin = b.min;
+            n.bmax = b.max;
+        }
+    });
+
+    // Both the serial build and the parallel splice append children after
+    // their parent, so one reverse sweep meets every child before its parent.
+    for (size_t i = nodes.size(); i-- > 0; ) {
+        BVHNode& n = nodes[i];
+        if (n.isLeaf()) continue;
+        const BVHNode& l = nodes[n.firstOrLeft];
+        const BVHNode& r = nodes[n.firstOrLeft + 1];
+        n.bmin = vec3(fminf(l.bmin.x, r.bmin.x), fminf(l.bmin.y, r.bmin.y), fminf(l.bmin.z, r.bmin.z));
+        n.bmax = vec3(fmaxf(l.bmax.x, r.bmax.x), fmaxf(l.bmax.y, r.bmax.y), fmaxf(l.bmax.z, r.bmax.z));
+    }
+
+    computeSahCost();
+    if (stats.sahCost > stats.buildSahCost * maxSahGrowth) {
+        // build() resets `prims` before copying its input; hand it a copy.
+        std::vector<const RenderMeshTriangle*> moved = prims;
+        build(moved, buildThreads, stats.width, stats.quality);
+        return false;
+    }
+
+    // Collapsing is linear too, and picks its slots by area, so redo it
+    // rather than patching the old wide nodes' bounds.
+    if (stats.width == 4) {
+        collapse(nodes4);
+        stats.wideNodeCount = nodes4.size();
+    } else if (stats.width == 8) {
+        collapse(nodes8);
+        stats.wideNodeCount = nodes8.size();
+    }
+
+    stats.refits++;
+    stats.threads = threads;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return true;
+}
+
+void TriangleBVH::computeSahCost() {
+    // Root-normalised SAH cost, for comparing builds (serial vs parallel,
+    // before/after a tuning change, a refit against its build) rather than
+    // as an absolute number.
+    const float rootArea = surfaceArea(nodes[0]);
+    const float invRootArea = (rootArea > 0.0f) ? 1.0f / rootArea : 0.0f;
+    double cost = 0.0;
+    stats.leafCount = 0;
+    for (const BVHNode& n : nodes) {
+        const float area = surfaceArea(n) * invRootArea;
+        if (n.isLeaf()) {
+            stats.leafCount++;
+            cost += area * leafBlocks(n.count) * BVH_INTERSECT_COST;
+        } else {
+            cost += area * BVH_TRAVERSAL_COST;
+        }
+    }
+    stats.sahCost = (float)cost;
+}
+
+template<int W>
+void TriangleBVH::collapse(std::vector<WideBVHNode<W>>& out) {
+    out.clear();
+    out.reserve(nodes.size() / (W / 2) + 1);
+    if (nodes[0].isLeaf()) {
+        // Single-leaf tree: wrap it so traversal always starts at a wide node.
+        WideBVHNode<W> root;
+        for (int i = 0; i < W; i++) {
+            root.bminx[i] = root.bminy[i] = root.bminz[i] =  FLT_MAX;
+            root.bmaxx[i] = root.bmaxy[i] = root.bmaxz[i] = -FLT_MAX;
+            root.child[i] = 0;
+            root.count[i] = 0;
+        }
+        const BVHNode& n = nodes[0];
+        root.bminx[0] = n.bmin.x; root.bminy[0] = n.bmin.y; root.bminz[0] = n.bmin.z;
+        root.bmaxx[0] = n.bmax.x; root.bmaxy[0] = n.bmax.y; root.bmaxz[0] = n.bmax.z;
+        root.child[0] = n.firstOrLeft;
+        root.count[0] = n.count;
+        out.push_back(root);
+        return;
+    }
+    collapseNode(out, 0);
+}
+
+template<int W>
+uint32_t TriangleBVH::collapseNode(std::vector<WideBVHNode<W>>& out, uint32_t binIdx) {
+    // Gather up to W binary descendants by repeatedly opening the inner
+    // child with the largest surface area — the one most likely to be
+    // entered, so flattening it saves the most node visits.
+    uint32_t slots[W];
+    int used = 2;
+    slots[0] = nodes[binIdx].firstOrLeft;
+    slots[1] = nodes[binIdx].firstOrLeft + 1;
+    while (used < W) {
+        int best = -1;
+        float bestArea = -1.0f;
+        for (int i = 0; i < used; i++) {
+            const BVHNode& c = nodes[slots[i]];
+            if (c.isLeaf()) continue;
+            const float area = surfaceArea(c);
+            if (area > bestArea) {
+                bestArea = area;
+                best = i;
+            }
+        }
+        if (best < 0) break;
+        const uint32_t opened = slots[best];
+        slots[best] = nodes[opened].firstOrLeft;
+        slots[used++] = nodes[opened].firstOrLeft + 1;
+    }
+
+    const uint32_t outIdx = (uint32_t)out.size();
+    out.emplace_back();
+    for (int i = 0; i < W; i++) {
+        // Written through out[outIdx] each time: the recursion below may
+        // reallocate `out`.
+        float bminx = FLT_MAX, bminy = FLT_MAX, bminz = FLT_MAX;
+        float bmaxx = -FLT_MAX, bmaxy = -FLT_MAX, bmaxz = -FLT_MAX;
+        uint32_t child = 0;
+        uint16_t count = 0;
+        if (i < used) {
+            const BVHNode& c = nodes[slots[i]];
+            bminx = c.bmin.x; bminy = c.bmin.y; bminz = c.bmin.z;
+            bmaxx = c.bmax.x; bmaxy = c.bmax.y; bmaxz = c.bmax.z;
+            if (c.isLeaf()) {
+                child = c.firstOrLeft;
+                count = c.count;
+            } else {
+                child = collapseNode(out, slots[i]);
+            }
+        }
+        WideBVHNode<W>& w = out[outIdx];
+        w.bminx[i] = bminx; w.bminy[i] = bminy; w.bminz[i] = bminz;
+        w.bmaxx[i] = bmaxx; w.bmaxy[i] = bmaxy; w.bmaxz[i] = bmaxz;
+        w.child[i] = child;
+        w.count[i] = count;
+    }
+    return outIdx;
+}
+
+// Top levels are split on the calling thread (with the per-node reductions
+// fanned out across `threads`), until there are enough independent subtrees
+// to keep every worker busy. Those subtrees are then built into private node
+// arrays by a worker pool pulling from a shared cursor, and spliced back in.
+// Every split decision is the same function of the same primitive range as
+// in the serial build, so the resulting tree is identical up to node order.
+void TriangleBVH::buildParallel(int threads) {
+    int taskDepth = 2;  // ~4 subtrees per worker for load balance
+    for (int t = threads - 1; t > 0; t >>= 1) taskDepth++;
+
+    std::vector<BuildTask> tasks;
+    buildTop(0, 0, (uint32_t)prims.size(), 0, taskDepth, threads, tasks);
+    stats.subtreeTasks = (int)tasks.size();
+
+    // Largest first, so the tail of the run isn't one big straggler.
+    std::sort(tasks.begin(), tasks.end(), [](const BuildTask& a, const BuildTask& b) {
+        return a.count > b.count;
+    });
+
+    std::vector<std::vector<BVHNode>> subtrees(tasks.size());
+    std::atomic<size_t> nextTask{0};
+    auto worker = [&]() {
+        while (true) {
+            const size_t i = nextTask.fetch_add(1, std::memory_order_relaxed);
+            if (i >= tasks.size()) return;
+            std::vector<BVHNode>& local = subtrees[i];
+            local.reserve(tasks[i].count * 2);
+            local.emplace_back();
+            buildRecursive(local, 0, tasks[i].first, tasks[i].count);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++) pool.push_back(std::thread(worker));
+    worker();
+    for (std::thread& th : pool) th.join();
+
+    // Splice: local root replaces the placeholder at task.nodeIdx, local
+    // nodes 1.. are appended at `base`. Leaves already hold global prim
+    // indices (ranges are disjoint slices of the shared prims array).
+    for (size_t i = 0; i < tasks.size(); i++) {
+        const std::vector<BVHNode>& local = subtrees[i];
+        const uint32_t base = (uint32_t)nodes.size();
+        auto remap = [base](BVHNode n) {
+            if (!n.isLeaf()) n.firstOrLeft = base + n.firstOrLeft - 1;
+            return n;
+        };
+        nodes[tasks[i].nodeIdx] = remap(local[0]);
+        for (size_t k = 1; k < local.size(); k++) {
+            nodes.push_back(remap(local[k]));
+        }
+        std::vector<BVHNode>().swap(subtrees[i]);
+    }
+}
+
+void TriangleBVH::buildTop(uint32_t nodeIdx, uint32_t first, uint32_t count,
+                           int depth, int taskDepth, int threads,
+                           std::vector<BuildTask>& tasks) {
+    if (depth >= taskDepth || count <= BVH_TASK_MIN_PRIMS) {
+        tasks.push_back(BuildTask{ nodeIdx, first, count });
+        return;
+    }
+
+    uint32_t mid;
+    if (!findSplit(nodes[nodeIdx], first, count, mid, threads)) return;
+
+    const uint32_t leftIdx = (uint32_t)nodes.size();
     nodes.emplace_back();
-    buildRecursive(0, 0, (uint32_t)prims.size());
+    nodes.emplace_back();
+    nodes[nodeIdx].firstOrLeft = leftIdx;
+
+    buildTop(leftIdx,     first, mid - first,         depth + 1, taskDepth, threads, tasks);
+    buildTop(leftIdx + 1, mid,   first + count - mid, depth + 1, taskDepth, threads, tasks);
+}
 
-    // Copy the reordered permutation back so the caller sees the same order
-    // the BVH uses (matches existing KDTree behaviour which took ownership).
-    inprims = prims;
+void TriangleBVH::buildRecursive(std::vector<BVHNode>& out, uint32_t nodeIdx, uint32_t first, uint32_t count) {
+    uint32_t mid;
+    if (!findSplit(out[nodeIdx], first, count, mid, 1)) return;
 
-    // Centroids only needed during build.
-    centroids.clear();
-    centroids.shrink_to_fit();
+    // Allocate children contiguously (left at leftIdx, right at leftIdx+1) so
+    // we only need one index stored in the parent.
+    const uint32_t leftIdx = (uint32_t)out.size();
+    out.emplace_back();
+    out.emplace_back();
+    out[nodeIdx].firstOrLeft = leftIdx;
+
+    buildRecursive(out, leftIdx,     first, mid - first);
+    buildRecursive(out, leftIdx + 1, mid,   first + count - mid);
 }
 
-void TriangleBVH::buildRecursive(uint32_t nodeIdx, uint32_t first, uint32_t count) {
+bool TriangleBVH::findSplit(BVHNode& node, uint32_t first, uint32_t count, uint32_t& mid, int threads) {
+    // Only worth fanning out on ranges big enough to amortise thread spawn.
+    if (count < BVH_PARALLEL_REDUCE_MIN) threads = 1;
+
     // Primitive bbox + centroid bbox over [first, first+count).
-    BoundingBox pbox = emptyBBox();
-    BoundingBox cbox = emptyBBox();
-    for (uint32_t i = first; i < first + count; i++) {
-        expandBBox(pbox, prims[i]->bbox);
-        expandBBox(cbox, centroids[i]);
+    std::vector<BoundingBox> pboxes(threads, emptyBBox());
+    std::vector<BoundingBox> cboxes(threads, emptyBBox());
+    parallelFor(threads, first, count, [&](int t, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            expandBBox(pboxes[t], prims[i]->bbox);
+            expandBBox(cboxes[t], centroids[i]);
+        }
+    });
+    BoundingBox pbox = pboxes[0];
+    BoundingBox cbox = cboxes[0];
+    for (int t = 1; t < threads; t++) {
+        expandBBox(pbox, pboxes[t]);
+        expandBBox(cbox, cboxes[t]);
     }
-    nodes[nodeIdx].bmin = pbox.min;
-    nodes[nodeIdx].bmax = pbox.max;
+    node.bmin = pbox.min;
+    node.bmax = pbox.max;
 
-    if (count <= BVH_LEAF_SIZE) {
-        nodes[nodeIdx].firstOrLeft = first;
-        nodes[nodeIdx].count = (uint16_t)count;
-        nodes[nodeIdx].axis = 0;
+    // Leaf by default; overwritten below if a split is taken. Forced leaves
+    // may exceed BVH_LEAF_SIZE, but never BVH_MAX_LEAF_COUNT.
+    node.firstOrLeft = first;
+    node.count = (uint16_t)std::min<uint32_t>(count, BVH_MAX_LEAF_COUNT);
+    node.axis = 0;
+
+    if (count <= BVH_LEAF_SIZE) return false;
+
+    // Fast and Balanced bin only the axis with the widest centroid extent —
+    // where binning can make the finest distinction between primitives.
+    // High bins all three. Axes whose centroids coincide can't be split.
+    const vec3 cext = cbox.max - cbox.min;
+    int widest = 0;
+    if (cext.y > cext.x) widest = 1;
+    if (cext.z > ((widest == 0) ? cext.x : cext.y)) widest = 2;
+
+    float scale[3] = { 0.0f, 0.0f, 0.0f };
+    for (int a = 0; a < 3; a++) {
+        if ((binAllAxes || a == widest) && cext[a] >= 1e-12f) scale[a] = (float)binCount / cext[a];
+    }
+
+    const float parentArea = surfaceArea(pbox);
+    const float invParentArea = (parentArea > 0.0f) ? 1.0f / parentArea : 0.0f;
+
+    SplitCandidate best;
+    best.cost = (count <= BVH_MAX_LEAF_COUNT) ? leafBlocks(count) * BVH_INTERSECT_COST : FLT_MAX;
+
+    if (scale[0] > 0.0f || scale[1] > 0.0f || scale[2] > 0.0f) {
+        std::vector<Bin> threadBins((size_t)threads * 3 * BVH_MAX_BINS);
+        parallelFor(threads, first, count, [&](int t, uint32_t begin, uint32_t end) {
+            Bin* bins = &threadBins[(size_t)t * 3 * BVH_MAX_BINS];
+            for (uint32_t i = begin; i < end; i++) {
+                for (int a = 0; a < 3; a++) {
+                    if (scale[a] == 0.0f) continue;
+                    Bin& bin = bins[a * BVH_MAX_BINS + binIndex(centroids[i][a], cbox.min[a], scale[a], binCount)];
+                    expandBBox(bin.bbox, prims[i]->bbox);
+                    bin.count++;
+                }
+            }
+        });
+        for (int a = 0; a < 3; a++) {
+            if (scale[a] == 0.0f) continue;
+            Bin bins[BVH_MAX_BINS];
+            for (int t = 0; t < threads; t++) {
+                for (int b = 0; b < binCount; b++) {
+                    const Bin& tb = threadBins[((size_t)t * 3 + a) * BVH_MAX_BINS + b];
+                    if (tb.count == 0) continue;
+                    expandBBox(bins[b].bbox, tb.bbox);
+                    bins[b].count += tb.count;
+                }
+            }
+            for (int b = 0; b < binCount; b++) bins[b].exits = bins[b].count;
+            sweepBins(bins, binCount, count, invParentArea, a, best);
+        }
+    }
+
+    mid = first;
+    if (best.axis >= 0) {
+        // Partition in place by bin index.
+        const int a = best.axis;
+        for (uint32_t i = first; i < first + count; i++) {
+            if (binIndex(centroids[i][a], cbox.min[a], scale[a], binCount) <= best.bin) {
+                std::swap(prims[i], prims[mid]);
+                std::swap(centroids[i], centroids[mid]);
+                mid++;
+            }
+        }
+    }
+
+    if (mid == first || mid == first + count) {
+        // Splitting won't help, or can't (all centroids coincide).
+        if (count <= BVH_MAX_LEAF_COUNT) return false;
+        mid = first + count / 2;
+        best.axis = 0;
+    }
+
+    node.count = 0;
+    node.axis = (uint16_t)best.axis;
+    return true;
+}
+
+// Spatial-split build (High preset). Top levels are split on the calling
+// thread, then subtrees go to a worker pool as in buildParallel, each
+// writing private nodes and a private leaf-order reference list that are
+// spliced back in task order. Unlike buildParallel the result depends on
+// the thread count: the duplication budget is shared out per subtree.
+void TriangleBVH::buildSpatial(int threads) {
+    std::vector<BuildRef> refs(prims.size());
+    BoundingBox root = emptyBBox();
+    for (size_t i = 0; i < prims.size(); i++) {
+        refs[i].prim = prims[i];
+        refs[i].box = prims[i]->bbox;
+        expandBBox(root, refs[i].box);
+    }
+    spatialMinOverlap = BVH_SPATIAL_ALPHA * surfaceArea(root);
+    size_t budget = (size_t)(prims.size() * BVH_SPATIAL_MAX_DUPLICATION);
+
+    std::vector<const RenderMeshTriangle*> ordered;
+    ordered.reserve(prims.size() + budget);
+
+    if (threads == 1) {
+        buildSpatialRecursive(nodes, ordered, 0, refs, budget, 0);
+        prims.swap(ordered);
         return;
     }
 
-    // Pick the axis with the widest centroid extent — this is where binning
-    // can make the finest distinction between primitives.
-    const vec3 cext = cbox.max - cbox.min;
-    int axis = 0;
-    if (cext.y > cext.x) axis = 1;
-    if (cext.z > ((axis == 0) ? cext.x : cext.y)) axis = 2;
+    int taskDepth = 2;  // ~4 subtrees per worker for load balance
+    for (int t = threads - 1; t > 0; t >>= 1) taskDepth++;
 
-    const float cmin = cbox.min[axis];
-    const float cextAxis = cext[axis];
-    if (cextAxis < 1e-12f) {
-        // All centroids coincide; can't split meaningfully.
-        nodes[nodeIdx].firstOrLeft = first;
-        nodes[nodeIdx].count = (uint16_t)std::min<uint32_t>(count, 0xFFFFu);
-        nodes[nodeIdx].axis = 0;
+    std::vector<SpatialBuildTask> tasks;
+    buildSpatialTop(0, refs, budget, 0, taskDepth, ordered, tasks);
+    stats.subtreeTasks = (int)tasks.size();
+
+    // Largest first, so the tail of the run isn't one big straggler.
+    std::sort(tasks.begin(), tasks.end(), [](const SpatialBuildTask& a, const SpatialBuildTask& b) {
+        return a.refs.size() > b.refs.size();
+    });
+
+    std::vector<std::vector<BVHNode>> subtrees(tasks.size());
+    std::vector<std::vector<const RenderMeshTriangle*>> subtreePrims(tasks.size());
+    std::atomic<size_t> nextTask{0};
+    auto worker = [&]() {
+        while (true) {
+            const size_t i = nextTask.fetch_add(1, std::memory_order_relaxed);
+            if (i >= tasks.size()) return;
+            std::vector<BVHNode>& local = subtrees[i];
+            local.reserve(tasks[i].refs.size() * 2);
+            local.emplace_back();
+            buildSpatialRecursive(local, subtreePrims[i], 0, tasks[i].refs, tasks[i].budget, tasks[i].depth);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++) pool.push_back(std::thread(worker));
+    worker();
+    for (std::thread& th : pool) th.join();
+
+    // Splice as buildParallel does; leaves additionally move to where the
+    // subtree's references land in the shared list.
+    for (size_t i = 0; i < tasks.size(); i++) {
+        const std::vector<BVHNode>& local = subtrees[i];
+        const uint32_t base = (uint32_t)nodes.size();
+        const uint32_t primBase = (uint32_t)ordered.size();
+        auto remap = [base, primBase](BVHNode n) {
+            n.firstOrLeft = n.isLeaf() ? primBase + n.firstOrLeft : base + n.firstOrLeft - 1;
+            return n;
+        };
+        nodes[tasks[i].nodeIdx] = remap(local[0]);
+        for (size_t k = 1; k < local.size(); k++) {
+            nodes.push_back(remap(local[k]));
+        }
+        ordered.insert(ordered.end(), subtreePrims[i].begin(), subtreePrims[i].end());
+        std::vector<BVHNode>().swap(subtrees[i]);
+        std::vector<const RenderMeshTriangle*>().swap(subtreePrims[i]);
+    }
+
+    prims.swap(ordered);
+}
+
+void TriangleBVH::buildSpatialTop(uint32_t nodeIdx, std::vector<BuildRef>& refs, size_t budget,
+                                  int depth, int taskDepth, std::vector<const RenderMeshTriangle*>& outPrims,
+                                  std::vector<SpatialBuildTask>& tasks) {
+    if (depth >= taskDepth || refs.size() <= BVH_TASK_MIN_PRIMS) {
+        tasks.push_back(SpatialBuildTask{ nodeIdx, std::move(refs), budget, depth });
         return;
     }
 
-    const float scale = (float)BVH_BINS / cextAxis;
+    std::vector<BuildRef> left, right;
+    if (!splitRefs(nodes[nodeIdx], refs, left, right, budget, depth)) {
+        nodes[nodeIdx].firstOrLeft = (uint32_t)outPrims.size();
+        for (const BuildRef& r : refs) outPrims.push_back(r.prim);
+        return;
+    }
+    std::vector<BuildRef>().swap(refs);
 
-    Bin bins[BVH_BINS];
-    for (uint32_t i = first; i < first + count; i++) {
-        int b = (int)((centroids[i][axis] - cmin) * scale);
-        if (b < 0) b = 0;
-        if (b >= BVH_BINS) b = BVH_BINS - 1;
-        expandBBox(bins[b].bbox, prims[i]->bbox);
-        bins[b].count++;
+    // What's left of the budget is shared in proportion to subtree size.
+    const size_t leftBudget = (size_t)((double)budget * left.size() / (left.size() + right.size()));
+
+    const uint32_t leftIdx = (uint32_t)nodes.size();
+    nodes.emplace_back();
+    nodes.emplace_back();
+    nodes[nodeIdx].firstOrLeft = leftIdx;
+
+    buildSpatialTop(leftIdx,     left,  leftBudget,          depth + 1, taskDepth, outPrims, tasks);
+    buildSpatialTop(leftIdx + 1, right, budget - leftBudget, depth + 1, taskDepth, outPrims, tasks);
+}
+
+void TriangleBVH::buildSpatialRecursive(std::vector<BVHNode>& out, std::vector<const RenderMeshTriangle*>& outPrims,
+                                        uint32_t nodeIdx, std::vector<BuildRef>& refs, size_t& budget,
+                                        int depth) const {
+    std::vector<BuildRef> left, right;
+    if (!splitRefs(out[nodeIdx], refs, left, right, budget, depth)) {
+        out[nodeIdx].firstOrLeft = (uint32_t)outPrims.size();
+        for (const BuildRef& r : refs) outPrims.push_back(r.prim);
+        return;
+    }
+    // Done with this level's list before going deeper.
+    std::vector<BuildRef>().swap(refs);
+
+    const uint32_t leftIdx = (uint32_t)out.size();
+    out.emplace_back();
+    out.emplace_back();
+    out[nodeIdx].firstOrLeft = leftIdx;
+
+    buildSpatialRecursive(out, outPrims, leftIdx,     left,  budget, depth + 1);
+    buildSpatialRecursive(out, outPrims, leftIdx + 1, right, budget, depth + 1);
+}
+
+bool TriangleBVH::splitRefs(BVHNode& node, const std::vector<BuildRef>& refs,
+                            std::vector<BuildRef>& left, std::vector<BuildRef>& right, size_t& budget,
+                            int depth) const {
+    const uint32_t count = (uint32_t)refs.size();
+
+    BoundingBox nbox = emptyBBox();
+    BoundingBox cbox = emptyBBox();
+    for (const BuildRef& r : refs) {
+        expandBBox(nbox, r.box);
+        expandBBox(cbox, (r.box.min + r.box.max) * 0.5f);
     }
+    node.bmin = nbox.min;
+    node.bmax = nbox.max;
+    node.firstOrLeft = 0;
+    node.count = (uint16_t)std::min<uint32_t>(count, BVH_MAX_LEAF_COUNT);
+    node.axis = 0;
 
-    // Sweep bins left→right and right→left to compute per-split SAH.
-    float leftArea[BVH_BINS - 1], rightArea[BVH_BINS - 1];
-    int   leftCnt[BVH_BINS - 1],  rightCnt[BVH_BINS - 1];
+    if (count <= BVH_LEAF_SIZE) return false;
+
+    const float parentArea = surfaceArea(nbox);
+    const float invParentArea = (parentArea > 0.0f) ? 1.0f / parentArea : 0.0f;
+
+    SplitCandidate best;
+    best.cost = (count <= BVH_MAX_LEAF_COUNT) ? leafBlocks(count) * BVH_INTERSECT_COST : FLT_MAX;
+
+    // Object splits on all three axes, binned by reference centroid.
+    const vec3 cext = cbox.max - cbox.min;
+    float scale[3];
     {
-        BoundingBox lb = emptyBBox();
-        int lc = 0;
-        for (int i = 0; i < BVH_BINS - 1; i++) {
-            if (bins[i].count > 0) expandBBox(lb, bins[i].bbox);
-            lc += bins[i].count;
-            leftArea[i] = (lc > 0) ? surfaceArea(lb) : 0.0f;
-            leftCnt[i]  = lc;
+        Bin bins[3][BVH_MAX_BINS];
+        for (int a = 0; a < 3; a++) scale[a] = (cext[a] >= 1e-12f) ? (float)binCount / cext[a] : 0.0f;
+        for (const BuildRef& r : refs) {
+            const vec3 c = (r.box.min + r.box.max) * 0.5f;
+            for (int a = 0; a < 3; a++) {
+                if (scale[a] == 0.0f) continue;
+                Bin& bin = bins[a][binIndex(c[a], cbox.min[a], scale[a], binCount)];
+                expandBBox(bin.bbox, r.box);
+                bin.count++;
+                bin.exits++;
+            }
         }
-        BoundingBox rb = emptyBBox();
-        int rc = 0;
-        for (int i = BVH_BINS - 1; i > 0; i--) {
-            if (bins[i].count > 0) expandBBox(rb, bins[i].bbox);
-            rc += bins[i].count;
-            rightArea[i - 1] = (rc > 0) ? surfaceArea(rb) : 0.0f;
-            rightCnt[i - 1]  = rc;
+        for (int a = 0; a < 3; a++) {
+            if (scale[a] > 0.0f) sweepBins(bins[a], binCount, count, invParentArea, a, best);
         }
     }
+    const SplitCandidate object = best;
 
-    const float parentArea = surfaceArea(pbox);
-    const float invParentArea = (parentArea > 0.0f) ? 1.0f / parentArea : 0.0f;
+    // Spatial splits, where the object split's children overlap enough for
+    // cutting the straddling triangles to pay — or where no object split was
+    // found at all, as with long thin triangles sharing a centroid.
+    bool trySpatial = budget > 0 && depth < BVH_SPATIAL_MAX_DEPTH;
+    if (trySpatial && object.axis >= 0) {
+        const BoundingBox overlap = clipBBox(object.leftBox, object.rightBox);
+        trySpatial = validBBox(overlap) && surfaceArea(overlap) > spatialMinOverlap;
+    }
+    for (int a = 0; trySpatial && a < 3; a++) {
+        const float lo = nbox.min[a];
+        const float ext = nbox.max[a] - lo;
+        if (ext < 1e-12f) continue;
+        const float binWidth = ext / (float)BVH_SPATIAL_BINS;
+        const float invBinWidth = (float)BVH_SPATIAL_BINS / ext;
 
-    const float leafCost = (float)count * BVH_INTERSECT_COST;
-    float bestCost = leafCost;
-    int bestBin = -1;
-    for (int i = 0; i < BVH_BINS - 1; i++) {
-        if (leftCnt[i] == 0 || rightCnt[i] == 0) continue;
-        const float cost = BVH_TRAVERSAL_COST
-            + BVH_INTERSECT_COST * invParentArea
-              * (leftArea[i] * leftCnt[i] + rightArea[i] * rightCnt[i]);
-        if (cost < bestCost) {
-            bestCost = cost;
-            bestBin = i;
+        // A reference adds its box, cut to the slab, to every bin it
+        // crosses. That overestimates the pieces of a diagonal triangle
+        // somewhat, but clipping the triangle itself at every bin plane
+        // costs more than the rest of the build; the exact clip is only
+        // done for the split that is taken.
+        Bin bins[BVH_SPATIAL_BINS];
+        for (const BuildRef& r : refs) {
+            const int b0 = binIndex(r.box.min[a], lo, invBinWidth, BVH_SPATIAL_BINS);
+            const int b1 = binIndex(r.box.max[a], lo, invBinWidth, BVH_SPATIAL_BINS);
+            bins[b0].count++;
+            bins[b1].exits++;
+            for (int b = b0; b <= b1; b++) {
+                BoundingBox piece = r.box;
+                if (b > b0) piece.min[a] = lo + binWidth * b;
+                if (b < b1) piece.max[a] = lo + binWidth * (b + 1);
+                expandBBox(bins[b].bbox, piece);
+            }
+        }
+
+        SplitCandidate c;
+        c.cost = best.cost;
+        sweepBins(bins, BVH_SPATIAL_BINS, count, invParentArea, a, c);
+        if (c.axis >= 0) {
+            best = c;
+            best.spatial = true;
+            best.pos = lo + binWidth * (c.bin + 1);
         }
     }
 
-    if (bestBin < 0) {
-        // Splitting won't help. Force a leaf even if > BVH_LEAF_SIZE; clamp
-        // to uint16 so count fits (scenes with >65k prims in one spot are
-        // rare, but be defensive).
-        const uint32_t leafCount = std::min<uint32_t>(count, 0xFFFFu);
-        nodes[nodeIdx].firstOrLeft = first;
-        nodes[nodeIdx].count = (uint16_t)leafCount;
-        nodes[nodeIdx].axis = 0;
-        return;
+    auto partition = [&](const SplitCandidate& c) {
+        left.clear();
+        right.clear();
+        const int a = c.axis;
+        for (const BuildRef& r : refs) {
+            if (!c.spatial) {
+                const vec3 centroid = (r.box.min + r.box.max) * 0.5f;
+                (binIndex(centroid[a], cbox.min[a], scale[a], binCount) <= c.bin ? left : right).push_back(r);
+            } else if (r.box.max[a] <= c.pos) {
+                left.push_back(r);
+            } else if (r.box.min[a] >= c.pos) {
+                right.push_back(r);
+            } else {
+                BuildRef l = r, rr = r;
+                splitTriangleBox(*r.prim, r.box, a, c.pos, l.box, rr.box);
+                if (validBBox(l.box)) left.push_back(l);
+                if (validBBox(rr.box)) right.push_back(rr);
+            }
+        }
+        return !left.empty() && !right.empty();
+    };
+
+    bool split = best.axis >= 0 && partition(best);
+    if (!split && best.spatial && object.axis >= 0) {
+        best = object;
+        split = partition(best);
+    }
+    if (!split) {
+        if (count <= BVH_MAX_LEAF_COUNT) return false;
+        left.assign(refs.begin(), refs.begin() + count / 2);
+        right.assign(refs.begin() + count / 2, refs.end());
+        best.axis = 0;
     }
 
-    // Partition in place by bin index.
-    uint32_t mid = first;
-    for (uint32_t i = first; i < first + count; i++) {
-        int b = (int)((centroids[i][axis] - cmin) * scale);
-        if (b < 0) b = 0;
-        if (b >= BVH_BINS) b = BVH_BINS - 1;
-        if (b <= bestBin) {
-            std::swap(prims[i], prims[mid]);
-            std::swap(centroids[i], centroids[mid]);
-            mid++;
+    const size_t added = left.size() + right.size() - count;
+    budget -= std::min(budget, added);
+
+    node.count = 0;
+    node.axis = (uint16_t)best.axis;
+    return true;
+}
+
+bool TriangleBVH::intersectClosest(const Ray& ray, RayTriangleIntersectionInfo& info) const {
+    if (nodes.empty()) return false;
+    if (!nodes4.empty()) return intersectClosestWide(nodes4, ray, info);
+    if (!nodes8.empty()) return intersectClosestWide(nodes8, ray, info);
+
+    const float invDx = (fabsf(ray.dir.x) > 1e-20f) ? 1.0f / ray.dir.x : 1e30f;
+    const float invDy = (fabsf(ray.dir.y) > 1e-20f) ? 1.0f / ray.dir.y : 1e30f;
+    const float invDz = (fabsf(ray.dir.z) > 1e-20f) ? 1.0f / ray.dir.z : 1e30f;
+    const int signX = invDx < 0.0f;
+    const int signY = invDy < 0.0f;
+    const int signZ = invDz < 0.0f;
+    const int dirSign[3] = { signX, signY, signZ };
+
+    uint32_t stack[64];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    // Only the winning index is tracked during traversal; the triangle
+    // pointer and hit record are filled once at the end.
+    uint32_t bestPrim = UINT32_MAX;
+    float bestU = 0.0f, bestV = 0.0f;
+
+    while (sp > 0) {
+        const BVHNode& n = nodes[stack[--sp]];
+
+        // Slab test; reject if behind origin or farther than current closest.
+        const float t1x = (n.bmin.x - ray.origin.x) * invDx;
+        const float t2x = (n.bmax.x - ray.origin.x) * invDx;
+        const float t1y = (n.bmin.y - ray.origin.y) * invDy;
+        const float t2y = (n.bmax.y - ray.origin.y) * invDy;
+        const float t1z = (n.bmin.z - ray.origin.z) * invDz;
+        const float t2z = (n.bmax.z - ray.origin.z) * invDz;
+        const float tmin = fmaxf(fmaxf(fminf(t1x, t2x), fminf(t1y, t2y)), fminf(t1z, t2z));
+        const float tmax = fminf(fminf(fmaxf(t1x, t2x), fmaxf(t1y, t2y)), fmaxf(t1z, t2z));
+        if (tmax < 0.0f || tmin > tmax || tmin > info.t) continue;
+
+        if (n.count > 0) {
+            intersectLeaf(n.firstOrLeft, n.count, ray, info.t, bestPrim, bestU, bestV);
+        } else {
+            // Push far child first so the near child is popped first — gives
+            // early-out on the closer half and tightens info.t faster.
+            const uint32_t l = n.firstOrLeft;
+            const uint32_t r = l + 1;
+            if (dirSign[n.axis]) {
+                stack[sp++] = l;
+                stack[sp++] = r;
+            } else {
+                stack[sp++] = r;
+                stack[sp++] = l;
+            }
+        }
+    }
+
+    if (bestPrim == UINT32_MAX) return false;
+
+    const RenderMeshTriangle* rt = prims[bestPrim];
+    info.triangle = rt;
+    info.hit = ray.origin + ray.dir * info.t;
+    info.u = bestU;
+    info.v = bestV;
+    info.w = 1.0f - bestU - bestV;
+    info.object = &rt->object;
+    info.normalMatrix = NULL;
+    return true;
+}
+
+// Packet traversal in the style of Wald et al.'s coherent ray tracing with
+// Reshetov's "first active ray": the packet enters a node as a whole and the
+// stack entry remembers the first ray that hit it, since rays before it
+// already missed an ancestor. When every ray agrees on the direction sign
+// per axis, an interval slab test over the packet's origin and inverse-
+// direction ranges rejects whole subtrees before any per-ray work; packets
+// that diverge just skip that early-out.
+bool TriangleBVH::intersectClosestPacket(const Ray* rays, int count, RayTriangleIntersectionInfo* infos) const {
+    if (nodes.empty() || count <= 0) return false;
+    count = std::min(count, BVH_PACKET_SIZE);
+
+    float ox[BVH_PACKET_SIZE], oy[BVH_PACKET_SIZE], oz[BVH_PACKET_SIZE];
+    float ix[BVH_PACKET_SIZE], iy[BVH_PACKET_SIZE], iz[BVH_PACKET_SIZE];
+    uint32_t bestPrim[BVH_PACKET_SIZE];
+    float bestU[BVH_PACKET_SIZE], bestV[BVH_PACKET_SIZE];
+
+    BoundingBox orange = emptyBBox();
+    BoundingBox irange = emptyBBox();
+    for (int r = 0; r < count; r++) {
+        ox[r] = rays[r].origin.x; oy[r] = rays[r].origin.y; oz[r] = rays[r].origin.z;
+        ix[r] = (fabsf(rays[r].dir.x) > 1e-20f) ? 1.0f / rays[r].dir.x : 1e30f;
+        iy[r] = (fabsf(rays[r].dir.y) > 1e-20f) ? 1.0f / rays[r].dir.y : 1e30f;
+        iz[r] = (fabsf(rays[r].dir.z) > 1e-20f) ? 1.0f / rays[r].dir.z : 1e30f;
+        bestPrim[r] = UINT32_MAX;
+        expandBBox(orange, rays[r].origin);
+        expandBBox(irange, vec3(ix[r], iy[r], iz[r]));
+    }
+    const bool coherent = (irange.min.x > 0.0f || irange.max.x < 0.0f)
+                       && (irange.min.y > 0.0f || irange.max.y < 0.0f)
+                       && (irange.min.z > 0.0f || irange.max.z < 0.0f);
+    const int dirSign[3] = { ix[0] < 0.0f, iy[0] < 0.0f, iz[0] < 0.0f };
+
+    // Bounds on (plane - o) * invD over the whole packet: the product of two
+    // intervals is bracketed by its corner products.
+    auto lowerBound = [](float plane, float o0, float o1, float i0, float i1) {
+        const float d0 = plane - o1, d1 = plane - o0;
+        return fminf(fminf(d0 * i0, d0 * i1), fminf(d1 * i0, d1 * i1));
+    };
+    auto upperBound = [](float plane, float o0, float o1, float i0, float i1) {
+        const float d0 = plane - o1, d1 = plane - o0;
+        return fmaxf(fmaxf(d0 * i0, d0 * i1), fmaxf(d1 * i0, d1 * i1));
+    };
+
+    // Farthest current hit over the packet; only ever shrinks, so it is
+    // refreshed after leaves rather than kept exact.
+    float packetMaxT = 0.0f;
+    for (int r = 0; r < count; r++) packetMaxT = fmaxf(packetMaxT, infos[r].t);
+
+    struct Entry {
+        uint32_t node;
+        int first;
+    };
+    Entry stack[64];
+    int sp = 0;
+    stack[sp++] = Entry{ 0, 0 };
+
+    while (sp > 0) {
+        const Entry e = stack[--sp];
+        const BVHNode& n = nodes[e.node];
+
+        if (coherent) {
+            const float nx = dirSign[0] ? n.bmax.x : n.bmin.x, fx = dirSign[0] ? n.bmin.x : n.bmax.x;
+            const float ny = dirSign[1] ? n.bmax.y : n.bmin.y, fy = dirSign[1] ? n.bmin.y : n.bmax.y;
+            const float nz = dirSign[2] ? n.bmax.z : n.bmin.z, fz = dirSign[2] ? n.bmin.z : n.bmax.z;
+            const float tmin = fmaxf(fmaxf(lowerBound(nx, orange.min.x, orange.max.x, irange.min.x, irange.max.x),
+                                           lowerBound(ny, orange.min.y, orange.max.y, irange.min.y, irange.max.y)),
+                                     lowerBound(nz, orange.min.z, orange.max.z, irange.min.z, irange.max.z));
+            const float tmax = fminf(fminf(upperBound(fx, orange.min.x, orange.max.x, irange.min.x, irange.max.x),
+                                           upperBound(fy, orange.min.y, orange.max.y, irange.min.y, irange.max.y)),
+                                     upperBound(fz, orange.min.z, orange.max.z, irange.min.z, irange.max.z));
+            if (tmax < 0.0f || tmin > tmax || tmin > packetMaxT) continue;
+        }
+
+        // Per-ray slab test, same as intersectClosest, from the first ray
+        // that may still hit.
+        auto hitsNode = [&](int r) {
+            const float t1x = (n.bmin.x - ox[r]) * ix[r], t2x = (n.bmax.x - ox[r]) * ix[r];
+            const float t1y = (n.bmin.y - oy[r]) * iy[r], t2y = (n.bmax.y - oy[r]) * iy[r];
+            const float t1z = (n.bmin.z - oz[r]) * iz[r], t2z = (n.bmax.z - oz[r]) * iz[r];
+            const float tmin = fmaxf(fmaxf(fminf(t1x, t2x), fminf(t1y, t2y)), fminf(t1z, t2z));
+            const float tmax = fminf(fminf(fmaxf(t1x, t2x), fmaxf(t1y, t2y)), fmaxf(t1z, t2z));
+            return !(tmax < 0.0f || tmin > tmax || tmin > infos[r].t);
+        };
+        int first = e.first;
+        while (first < count && !hitsNode(first)) first++;
+        if (first == count) continue;
+
+        if (n.count > 0) {
+            packetMaxT = 0.0f;
+            for (int r = 0; r < count; r++) {
+                if (r == first || (r > first && hitsNode(r))) {
+                    intersectLeaf(n.firstOrLeft, n.count, rays[r], infos[r].t, bestPrim[r], bestU[r], bestV[r]);
+                }
+                packetMaxT = fmaxf(packetMaxT, infos[r].t);
+            }
+        } else {
+            // Near child first for the first active ray; coherent packets
+            // mostly agree with it.
+            const uint32_t l = n.firstOrLeft;
+            const uint32_t r = l + 1;
+            const int sign = (n.axis == 0) ? (ix[first] < 0.0f)
+                           : (n.axis == 1) ? (iy[first] < 0.0f) : (iz[first] < 0.0f);
+            if (sign) {
+                stack[sp++] = Entry{ l, first };
+                stack[sp++] = Entry{ r, first };
+            } else {
+                stack[sp++] = Entry{ r, first };
+                stack[sp++] = Entry{ l, first };
+            }
         }
     }
 
-    const uint32_t leftCount = mid - first;
-    const uint32_t rightCount = count - leftCount;
-    if (leftCount == 0 || rightCount == 0) {
-        const uint32_t leafCount = std::min<uint32_t>(count, 0xFFFFu);
+    bool anyHit = false;
+    for (int r = 0; r < count; r++) {
+        if (bestPrim[r] == UINT32_MAX) continue;
+        const RenderMeshTriangle* rt = prims[bestPrim[r]];
+        RayTriangleIntersectionInfo& info = infos[r];
+        info.triangle = rt;
+        info.hit = rays[r].origin + rays[r].dir * info.t;
+        info.u = bestU[r];
+        info.v = bestV[r];
+        info.w = 1.0f - bestU[r] - bestV[r];
+        info.object = &rt->object;
+        info.normalMatrix = NULL;
+        anyHit = true;
+    }
+    return anyHit;
+}
+
+template<int W>
+bool TriangleBVH::intersectClosestWide(const std::vector<WideBVHNode<W>>& wnodes, const Ray& ray,
+                                       RayTriangleIntersectionInfo& info) const {
+    const WideBVHRay wr(ray);
+
+    // Entries carry the entry distance computed when they were pushed, so a
+    // child that was in range then but is beyond a closer hit found since
+    // is dropped on pop without touching its memory.
+    struct Entry {
+        uint32_t idx;
+        uint16_t count;  // prims for a leaf child; 0 = wide node index
+        float tnear;
+    };
+    Entry stack[64 * W];
+    int sp = 0;
+    stack[sp++] = Entry{ 0, 0, 0.0f };
+
+    uint32_t bestPrim = UINT32_MAX;
+    float bestU = 0.0f, bestV = 0.0f;
+
+    float tnear[W];
+    while (sp > 0) {
+        const Entry e = stack[--sp];
+        if (e.tnear > info.t) continue;
+
+        if (e.count > 0) {
+            intersectLeaf(e.idx, e.count, ray, info.t, bestPrim, bestU, bestV);
+            continue;
+        }
+
+        const WideBVHNode<W>& n = wnodes[e.idx];
+        const int mask = intersectWideChildren(n, wr, info.t, tnear);
+        if (!mask) continue;
+
+        // Insertion-sort the hit children far → near onto the stack so the
+        // nearest is popped first.
+        const int base = sp;
+        for (int c = 0; c < W; c++) {
+            if (!(mask & (1 << c))) continue;
+            const Entry ce{ n.child[c], n.count[c], tnear[c] };
+            int k = sp++;
+            while (k > base && stack[k - 1].tnear < ce.tnear) {
+                stack[k] = stack[k - 1];
+                k--;
+            }
+            stack[k] = ce;
+        }
+    }
+
+    if (bestPrim == UINT32_MAX) return false;
+
+    const RenderMeshTriangle* rt = prims[bestPrim];
+    info.triangle = rt;
+    info.hit = ray.origin + ray.dir * info.t;
+    info.u = bestU;
+    info.v = bestV;
+    info.w = 1.0f - bestU - bestV;
+    info.object = &rt->object;
+    info.normalMatrix = NULL;
+    return true;
+}
+
+void InstanceBVH::reset() {
+    nodes.clear();
+    instances.clear();
+}
+
+void InstanceBVH::build(const std::vector<BVHInstance>& ininstances) {
+    reset();
+    if (ininstances.empty()) return;
+
+    instances = ininstances;
+    nodes.reserve(instances.size() * 2);
+    nodes.emplace_back();
+    buildRecursive(0, 0, (uint32_t)instances.size());
+}
+
+void InstanceBVH::buildRecursive(uint32_t nodeIdx, uint32_t first, uint32_t count) {
+    BoundingBox pbox = emptyBBox();
+    BoundingBox cbox = emptyBBox();
+    for (uint32_t i = first; i < first + count; i++) {
+        expandBBox(pbox, instances[i].bbox);
+        expandBBox(cbox, (instances[i].bbox.min + instances[i].bbox.max) * 0.5f);
+    }
+    nodes[nodeIdx].bmin = pbox.min;
+    nodes[nodeIdx].bmax = pbox.max;
+
+    const vec3 cext = cbox.max - cbox.min;
+    int axis = 0;
+    if (cext.y > cext.x) axis = 1;
+    if (cext.z > ((axis == 0) ? cext.x : cext.y)) axis = 2;
+
+    if (count <= TLAS_LEAF_SIZE || cext[axis] < 1e-12f) {
         nodes[nodeIdx].firstOrLeft = first;
-        nodes[nodeIdx].count = (uint16_t)leafCount;
+        nodes[nodeIdx].count = (uint16_t)std::min<uint32_t>(count, 0xFFFFu);
         nodes[nodeIdx].axis = 0;
         return;
     }
 
-    // Allocate children contiguously (left at leftIdx, right at leftIdx+1) so
-    // we only need one index stored in the parent.
+    // Object-median split. Instance counts are small next to triangle
+    // counts, and instance boxes overlap heavily (same mesh, nearby
+    // placements), so binned SAH buys little over a balanced tree here.
+    const uint32_t half = count / 2;
+    std::nth_element(instances.begin() + first,
+                     instances.begin() + first + half,
+                     instances.begin() + first + count,
+                     [axis](const BVHInstance& a, const BVHInstance& b) {
+        return a.bbox.min[axis] + a.bbox.max[axis] < b.bbox.min[axis] + b.bbox.max[axis];
+    });
+
     const uint32_t leftIdx = (uint32_t)nodes.size();
     nodes.emplace_back();
     nodes.emplace_back();
@@ -226,20 +1252,17 @@ void TriangleBVH::buildRecursive(uint32_t nodeIdx, uint32_t first, uint32_t coun
     nodes[nodeIdx].count = 0;
     nodes[nodeIdx].axis = (uint16_t)axis;
 
-    buildRecursive(leftIdx,     first, leftCount);
-    buildRecursive(leftIdx + 1, mid,   rightCount);
+    buildRecursive(leftIdx,     first,        half);
+    buildRecursive(leftIdx + 1, first + half, count - half);
 }
 
-bool TriangleBVH::intersectClosest(const Ray& ray, RayTriangleIntersectionInfo& info) const {
+bool InstanceBVH::intersectClosest(const Ray& ray, RayTriangleIntersectionInfo& info) const {
     if (nodes.empty()) return false;
 
     const float invDx = (fabsf(ray.dir.x) > 1e-20f) ? 1.0f / ray.dir.x : 1e30f;
     const float invDy = (fabsf(ray.dir.y) > 1e-20f) ? 1.0f / ray.dir.y : 1e30f;
     const float invDz = (fabsf(ray.dir.z) > 1e-20f) ? 1.0f / ray.dir.z : 1e30f;
-    const int signX = invDx < 0.0f;
-    const int signY = invDy < 0.0f;
-    const int signZ = invDz < 0.0f;
-    const int dirSign[3] = { signX, signY, signZ };
+    const int dirSign[3] = { invDx < 0.0f, invDy < 0.0f, invDz < 0.0f };
 
     uint32_t stack[64];
     int sp = 0;
@@ -250,7 +1273,6 @@ bool TriangleBVH::intersectClosest(const Ray& ray, RayTriangleIntersectionInfo&
     while (sp > 0) {
         const BVHNode& n = nodes[stack[--sp]];
 
-        // Slab test; reject if behind origin or farther than current closest.
         const float t1x = (n.bmin.x - ray.origin.x) * invDx;
         const float t2x = (n.bmax.x - ray.origin.x) * invDx;
         const float t1y = (n.bmin.y - ray.origin.y) * invDy;
@@ -263,13 +1285,16 @@ bool TriangleBVH::intersectClosest(const Ray& ray, RayTriangleIntersectionInfo&
 
         if (n.count > 0) {
             for (uint16_t i = 0; i < n.count; i++) {
-                if (prims[n.firstOrLeft + i]->intersectsRay(ray, info)) {
+                const BVHInstance& inst = instances[n.firstOrLeft + i];
+                // The BLAS writes a mesh-local hit; only the placement is
+                // recorded here and the point is rebuilt once at the end.
+                if (inst.blas->intersectClosest(inst.localRay(ray), info)) {
+                    info.object = inst.object;
+                    info.normalMatrix = &inst.normalMatrix;
                     anyHit = true;
                 }
             }
         } else {
-            // Push far child first so the near child is popped first — gives
-            // early-out on the closer half and tightens info.t faster.
             const uint32_t l = n.firstOrLeft;
             const uint32_t r = l + 1;
             if (dirSign[n.axis]) {
@@ -281,6 +1306,10 @@ bool TriangleBVH::intersectClosest(const Ray& ray, RayTriangleIntersectionInfo&
             }
         }
     }
+
+    if (anyHit) {
+        info.hit = ray.origin + ray.dir * info.t;
+    }
     return anyHit;
 }
 
@@ -11,6 +11,14 @@
 
 #include <vector>
 #include <cstdint>
+#include <algorithm>
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#define RAYGEN_BVH_SSE
+#if defined(__AVX__)
+#define RAYGEN_BVH_AVX
+#endif
+#endif
 #include "ugm/types3d.h"
 #include "raycommon.h"
 
@@ -29,17 +37,171 @@ struct BVHNode {
     inline bool isLeaf() const { return count > 0; }
 };
 
+// W-wide node produced by collapsing the binary tree (W = 4 or 8). Child
+// bounds are stored per component so one SSE/AVX pass slab-tests every
+// child. A child slot is a leaf when `count[i] > 0` (then `child[i]` is its
+// first primitive), an inner node when `count[i] == 0` (`child[i]` indexes
+// the wide node array). Unused slots have inverted bounds and never hit.
+template<int W>
+struct WideBVHNode {
+    float bminx[W], bminy[W], bminz[W];
+    float bmaxx[W], bmaxy[W], bmaxz[W];
+    uint32_t child[W];
+    uint16_t count[W];
+};
+
+// Per-ray constants for the wide slab test. Near/far planes are chosen by
+// the direction sign up front instead of min/max-ing both, which is also
+// what makes the inverted bounds of empty slots fail the test.
+struct WideBVHRay {
+    float ox, oy, oz;
+    float idx, idy, idz;
+    int signX, signY, signZ;
+
+    explicit WideBVHRay(const ugm::Ray& ray);
+};
+
+// Lane operations for the leaf block test. One Möller–Trumbore evaluation
+// runs over BVH_LEAF_BLOCK consecutive leaf triangles: 8 with AVX, 4 with
+// SSE, and a plain per-triangle loop where neither is available.
+#ifdef RAYGEN_BVH_SSE
+struct BVHLanes4 {
+    typedef __m128 F;
+    enum { width = 4 };
+    static inline F set1(float f) { return _mm_set1_ps(f); }
+    static inline F load(const float* p) { return _mm_loadu_ps(p); }
+    static inline void store(float* p, F a) { _mm_storeu_ps(p, a); }
+    static inline F add(F a, F b) { return _mm_add_ps(a, b); }
+    static inline F sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static inline F mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static inline F div(F a, F b) { return _mm_div_ps(a, b); }
+    static inline F abs(F a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static inline F ge(F a, F b) { return _mm_cmpge_ps(a, b); }
+    static inline F gt(F a, F b) { return _mm_cmpgt_ps(a, b); }
+    static inline F le(F a, F b) { return _mm_cmple_ps(a, b); }
+    static inline F lt(F a, F b) { return _mm_cmplt_ps(a, b); }
+    static inline F both(F a, F b) { return _mm_and_ps(a, b); }
+    static inline int mask(F a) { return _mm_movemask_ps(a); }
+};
+#endif
+#ifdef RAYGEN_BVH_AVX
+struct BVHLanes8 {
+    typedef __m256 F;
+    enum { width = 8 };
+    static inline F set1(float f) { return _mm256_set1_ps(f); }
+    static inline F load(const float* p) { return _mm256_loadu_ps(p); }
+    static inline void store(float* p, F a) { _mm256_storeu_ps(p, a); }
+    static inline F add(F a, F b) { return _mm256_add_ps(a, b); }
+    static inline F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static inline F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static inline F div(F a, F b) { return _mm256_div_ps(a, b); }
+    static inline F abs(F a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static inline F ge(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static inline F gt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static inline F le(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static inline F lt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static inline F both(F a, F b) { return _mm256_and_ps(a, b); }
+    static inline int mask(F a) { return _mm256_movemask_ps(a); }
+};
+typedef BVHLanes8 BVHLeafLanes;
+constexpr int BVH_LEAF_BLOCK = 8;
+#elif defined(RAYGEN_BVH_SSE)
+typedef BVHLanes4 BVHLeafLanes;
+constexpr int BVH_LEAF_BLOCK = 4;
+#else
+constexpr int BVH_LEAF_BLOCK = 4;
+#endif
+
+// Largest ray packet TriangleBVH::intersectClosestPacket takes in one call.
+constexpr int BVH_PACKET_SIZE = 16;
+
+// Build presets for TriangleBVH, trading build time for trace speed.
+//   Fast      8 centroid bins on the widest axis; for interactive previews.
+//   Balanced  16 bins on the widest axis.
+//   High      32 bins on all three axes, plus SBVH-style spatial splits
+//             (Stich et al. 2009) where object-split children overlap: a
+//             triangle straddling the split plane is referenced from both
+//             sides, each reference bounding only its own side's part.
+//             Pays off on long thin triangles and grazing-angle terrain.
+enum class BVHBuildQuality {
+    Fast,
+    Balanced,
+    High,
+};
+
+// TriangleBVH::refit keeps the old topology only while its SAH cost stays
+// within this factor of the cost the last full build produced.
+constexpr float BVH_REFIT_MAX_SAH_GROWTH = 1.5f;
+
+// Leaf-ordered intersection data: entry i belongs to prims[i] of the owning
+// TriangleBVH. Holds only what Möller–Trumbore reads — v1 and the edges
+// v2-v1 / v3-v1 — split per component, so a leaf's triangles sit in a few
+// contiguous cache lines and the fat RenderMeshTriangle is only touched
+// once the closest hit is known. Each array carries BVH_LEAF_BLOCK zeroed
+// entries past the end so a block load at the last leaf stays in bounds.
+struct TriangleSoA {
+    std::vector<float> v0x, v0y, v0z;
+    std::vector<float> e1x, e1y, e1z;
+    std::vector<float> e2x, e2y, e2z;
+
+    void resize(size_t n);
+    void clear();
+    void set(size_t i, const RenderMeshTriangle& rt);
+};
+
+// Filled by TriangleBVH::build (and updated by refit) for the build-time
+// report.
+struct BVHBuildStats {
+    double seconds = 0.0;   // wall time of the last build() or refit()
+    size_t primCount = 0;
+    size_t nodeCount = 0;
+    size_t leafCount = 0;
+    int threads = 1;        // workers actually used (1 for small inputs)
+    int subtreeTasks = 0;   // subtrees handed to the worker pool
+    float sahCost = 0.0f;   // SAH cost normalised by the root surface area
+    int width = 2;          // node width traversed (2 = binary)
+    size_t wideNodeCount = 0;
+    float buildSahCost = 0.0f;  // sahCost as the last full build left it
+    int refits = 0;             // refit() calls since the last full build
+    BVHBuildQuality quality = BVHBuildQuality::Balanced;
+    size_t references = 0;  // leaf entries; > primCount after spatial splits
+};
+
 class TriangleBVH {
 public:
     void reset();
 
-    // Reorders `prims` in place (permutation); stored pointers are retained.
-    void build(std::vector<const RenderMeshTriangle*>& prims);
+    // Keeps its own leaf-ordered copy of `prims`; the caller's list is left
+    // in its order, which the renderer's refit relies on. With threads > 1
+    // the top of the tree is split cooperatively and the subtrees below are
+    // built as parallel tasks; the tree is the same as the single-threaded
+    // build up to node order.
+    // `width` 4 or 8 additionally collapses the binary tree into wide nodes
+    // and switches traversal to them; anything else keeps the binary tree.
+    // With BVHBuildQuality::High a triangle may sit in several leaves.
+    void build(const std::vector<const RenderMeshTriangle*>& prims, int threads = 1, int width = 2,
+               BVHBuildQuality quality = BVHBuildQuality::Balanced);
+
+    // For primitives that moved in place since build() (same pointers, same
+    // count, bboxes updated): recomputes node bounds bottom-up and refreshes
+    // the leaf-ordered triangle data, keeping the tree topology — a linear
+    // pass instead of a full SAH build. Moving geometry far enough makes the
+    // old splits poor, so when the refitted SAH cost exceeds `maxSahGrowth`
+    // times that of the last build the tree is rebuilt from the same
+    // primitives instead, and false is returned. After a High build the
+    // refitted leaves bound whole triangles rather than their clipped parts.
+    bool refit(int threads = 1, float maxSahGrowth = BVH_REFIT_MAX_SAH_GROWTH);
 
     // Closest-hit traversal. `info.t` is used as the current closest distance
     // for node/prim pruning and is updated as closer hits are found.
     bool intersectClosest(const ugm::Ray& ray, RayTriangleIntersectionInfo& info) const;
 
+    // Closest-hit for a coherent packet of up to BVH_PACKET_SIZE rays (e.g.
+    // neighbouring primary rays), walking the binary tree once for all of
+    // them. Each `infos[i]` behaves as in intersectClosest for `rays[i]`.
+    // Returns true if any ray hit.
+    bool intersectClosestPacket(const ugm::Ray* rays, int count, RayTriangleIntersectionInfo* infos) const;
+
     // Any-hit traversal for shadow/occlusion rays. Returns true as soon as a
     // primitive in (0, maxT) passes `pred`. `pred` is called with a
     // `const RenderMeshTriangle*` after a ray-triangle intersection is
@@ -47,22 +209,498 @@ public:
     template<typename Pred>
     bool intersectAny(const ugm::Ray& ray, float maxT, Pred&& pred) const;
 
+    inline int width() const { return stats.width; }
     inline size_t nodeCount() const { return nodes.size(); }
-    inline size_t primCount() const { return prims.size(); }
+    inline size_t primCount() const { return stats.primCount; }
+    inline const BVHBuildStats& buildStats() const { return stats; }
 
 private:
     std::vector<BVHNode> nodes;
-    std::vector<const RenderMeshTriangle*> prims;
+    std::vector<WideBVHNode<4>> nodes4;  // filled only for width 4
+    std::vector<WideBVHNode<8>> nodes8;  // filled only for width 8
+    std::vector<const RenderMeshTriangle*> prims;  // leaf order; may repeat
+    TriangleSoA tris;                  // parallel to prims after build
     std::vector<ugm::vec3> centroids;  // parallel to prims during build
+    BVHBuildStats stats;
+
+    // Preset state for the running build().
+    int binCount = 16;
+    bool binAllAxes = false;
+    float spatialMinOverlap = 0.0f;  // High: overlap area that tries a spatial split
+
+    // Same tests (and epsilons) as RenderMeshTriangle::intersectsRay — the
+    // closest-hit and the any-hit flavour respectively — run on `tris[i]`.
+    inline bool intersectTriangle(uint32_t i, const ugm::Ray& ray, float maxT,
+                                  float& t, float& u, float& v) const;
+    inline bool occludesTriangle(uint32_t i, const ugm::Ray& ray, float maxT) const;
+
+    // The same two tests over triangles [first, first+n), n <= L::width, in
+    // one SIMD pass. intersectBlock returns the lane of the nearest hit in
+    // [0, maxT) or -1; occludesBlock returns the bitmask of occluding lanes.
+    template<typename L>
+    inline int intersectBlock(uint32_t first, int n, const ugm::Ray& ray, float maxT,
+                              float& t, float& u, float& v) const;
+    template<typename L>
+    inline int occludesBlock(uint32_t first, int n, const ugm::Ray& ray, float maxT) const;
+
+    // Leaf loops over whole blocks. intersectLeaf shrinks `maxT` and records
+    // the winner when a closer hit is found; occludesLeaf stops at the first
+    // intersected triangle that passes `pred`.
+    inline bool intersectLeaf(uint32_t first, uint32_t count, const ugm::Ray& ray, float& maxT,
+                              uint32_t& bestPrim, float& bestU, float& bestV) const;
+    template<typename Pred>
+    inline bool occludesLeaf(uint32_t first, uint32_t count, const ugm::Ray& ray, float maxT,
+                             Pred& pred) const;
+
+    // Subtree deferred to a worker: build [first, first+count) under nodeIdx.
+    struct BuildTask {
+        uint32_t nodeIdx, first, count;
+    };
+
+    // Binned-SAH split of [first, first+count). Fills `node` bounds, and
+    // either makes it a leaf (returns false) or partitions the range around
+    // `mid` and marks it internal (returns true; caller sets firstOrLeft).
+    bool findSplit(BVHNode& node, uint32_t first, uint32_t count, uint32_t& mid, int threads);
+
+    // High preset. Spatial splits change how many references a subtree
+    // holds, so instead of partitioning `prims` in place each node owns its
+    // reference list and leaves append theirs to the output in tree order.
+    struct BuildRef {
+        const RenderMeshTriangle* prim;
+        ugm::BoundingBox box;  // the part of `prim` this reference covers
+    };
+    struct SpatialBuildTask {
+        uint32_t nodeIdx;
+        std::vector<BuildRef> refs;
+        size_t budget;
+        int depth;
+    };
+    // As findSplit, over `refs`, splitting them into `left` / `right`.
+    // `budget` caps how many more references spatial splits may add; past
+    // BVH_SPATIAL_MAX_DEPTH only object splits are considered.
+    bool splitRefs(BVHNode& node, const std::vector<BuildRef>& refs,
+                   std::vector<BuildRef>& left, std::vector<BuildRef>& right, size_t& budget,
+                   int depth) const;
+    void buildSpatial(int threads);
+    void buildSpatialRecursive(std::vector<BVHNode>& out, std::vector<const RenderMeshTriangle*>& outPrims,
+                               uint32_t nodeIdx, std::vector<BuildRef>& refs, size_t& budget,
+                               int depth) const;
+    void buildSpatialTop(uint32_t nodeIdx, std::vector<BuildRef>& refs, size_t budget,
+                         int depth, int taskDepth, std::vector<const RenderMeshTriangle*>& outPrims,
+                         std::vector<SpatialBuildTask>& tasks);
+    // Fills stats.leafCount and stats.sahCost from the current node bounds.
+    void computeSahCost();
+    void buildRecursive(std::vector<BVHNode>& out, uint32_t nodeIdx, uint32_t first, uint32_t count);
+    void buildParallel(int threads);
+    void buildTop(uint32_t nodeIdx, uint32_t first, uint32_t count,
+                  int depth, int taskDepth, int threads, std::vector<BuildTask>& tasks);
+
+    // Binary → W-wide. Each wide node takes the children of one binary node
+    // and keeps opening its largest-area inner child until W slots are used.
+    template<int W>
+    void collapse(std::vector<WideBVHNode<W>>& out);
+    template<int W>
+    uint32_t collapseNode(std::vector<WideBVHNode<W>>& out, uint32_t binIdx);
+
+    template<int W>
+    bool intersectClosestWide(const std::vector<WideBVHNode<W>>& wnodes, const ugm::Ray& ray,
+                              RayTriangleIntersectionInfo& info) const;
+    template<int W, typename Pred>
+    bool intersectAnyWide(const std::vector<WideBVHNode<W>>& wnodes, const ugm::Ray& ray,
+                          float maxT, Pred&& pred) const;
+};
+
+// One placement of a shared mesh in the top-level BVH. The bottom-level
+// `blas` and its triangles are built once in mesh-local space and shared by
+// every placement; rays are carried into that space at the instance boundary
+// with `toLocal` (direction left unnormalized so `t` stays comparable across
+// levels).
+struct BVHInstance {
+    const TriangleBVH* blas = NULL;
+    const SceneObject* object = NULL;
+    ugm::Matrix4 toLocal;       // view → mesh-local
+    ugm::Matrix4 normalMatrix;  // mesh-local normal → view
+    ugm::BoundingBox bbox;      // view-space bounds of the placed mesh
+
+    inline ugm::Ray localRay(const ugm::Ray& ray) const {
+        return ugm::Ray((ugm::vec4(ray.origin, 1.0f) * toLocal).xyz,
+                        (ugm::vec4(ray.dir, 0.0f) * toLocal).xyz);
+    }
+};
+
+// Top-level BVH over mesh instances. Same node layout as TriangleBVH, with
+// leaves indexing into the instance array instead of triangles.
+class InstanceBVH {
+public:
+    void reset();
+
+    // Takes a copy of `instances`; the BLAS pointers must outlive this tree.
+    void build(const std::vector<BVHInstance>& instances);
+
+    // Closest-hit traversal; on a hit that beats `info.t` fills `info.object`
+    // and `info.normalMatrix` from the instance and moves `info.hit` back into
+    // view space.
+    bool intersectClosest(const ugm::Ray& ray, RayTriangleIntersectionInfo& info) const;
+
+    // Any-hit traversal. `pred` is called as pred(triangle, placement) since
+    // the triangle alone can't tell which SceneObject it was hit through.
+    template<typename Pred>
+    bool intersectAny(const ugm::Ray& ray, float maxT, Pred&& pred) const;
+
+    inline bool empty() const { return instances.empty(); }
+    inline size_t instanceCount() const { return instances.size(); }
+
+private:
+    std::vector<BVHNode> nodes;
+    std::vector<BVHInstance> instances;  // reordered so leaves are contiguous
 
     void buildRecursive(uint32_t nodeIdx, uint32_t first, uint32_t count);
 };
 
+inline WideBVHRay::WideBVHRay(const ugm::Ray& ray)
+    : ox(ray.origin.x), oy(ray.origin.y), oz(ray.origin.z) {
+    idx = (fabsf(ray.dir.x) > 1e-20f) ? 1.0f / ray.dir.x : 1e30f;
+    idy = (fabsf(ray.dir.y) > 1e-20f) ? 1.0f / ray.dir.y : 1e30f;
+    idz = (fabsf(ray.dir.z) > 1e-20f) ? 1.0f / ray.dir.z : 1e30f;
+    signX = idx < 0.0f;
+    signY = idy < 0.0f;
+    signZ = idz < 0.0f;
+}
+
+// Slab-tests children [lane, lane+4) of `n` against (0, tmax). Returns the
+// hit lanes as a bitmask (bit 0 = `lane`) and writes their entry distances.
+template<int W>
+inline int intersectWideChildren4(const WideBVHNode<W>& n, int lane, const WideBVHRay& r,
+                                  float tmax, float* tnear) {
+    const float* nx = (r.signX ? n.bmaxx : n.bminx) + lane;
+    const float* ny = (r.signY ? n.bmaxy : n.bminy) + lane;
+    const float* nz = (r.signZ ? n.bmaxz : n.bminz) + lane;
+    const float* fx = (r.signX ? n.bminx : n.bmaxx) + lane;
+    const float* fy = (r.signY ? n.bminy : n.bmaxy) + lane;
+    const float* fz = (r.signZ ? n.bminz : n.bmaxz) + lane;
+#ifdef RAYGEN_BVH_SSE
+    const __m128 ox = _mm_set1_ps(r.ox), oy = _mm_set1_ps(r.oy), oz = _mm_set1_ps(r.oz);
+    const __m128 ix = _mm_set1_ps(r.idx), iy = _mm_set1_ps(r.idy), iz = _mm_set1_ps(r.idz);
+    const __m128 tn = _mm_max_ps(
+        _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nx), ox), ix),
+                   _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(ny), oy), iy)),
+        _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nz), oz), iz), _mm_setzero_ps()));
+    const __m128 tf = _mm_min_ps(
+        _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(fx), ox), ix),
+                   _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(fy), oy), iy)),
+        _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(fz), oz), iz), _mm_set1_ps(tmax)));
+    _mm_storeu_ps(tnear, tn);
+    return _mm_movemask_ps(_mm_cmple_ps(tn, tf));
+#else
+    int mask = 0;
+    for (int i = 0; i < 4; i++) {
+        const float tn = fmaxf(fmaxf((nx[i] - r.ox) * r.idx, (ny[i] - r.oy) * r.idy),
+                               fmaxf((nz[i] - r.oz) * r.idz, 0.0f));
+        const float tf = fminf(fminf((fx[i] - r.ox) * r.idx, (fy[i] - r.oy) * r.idy),
+                               fminf((fz[i] - r.oz) * r.idz, tmax));
+        tnear[i] = tn;
+        if (tn <= tf) mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+inline int intersectWideChildren(const WideBVHNode<4>& n, const WideBVHRay& r, float tmax, float* tnear) {
+    return intersectWideChildren4(n, 0, r, tmax, tnear);
+}
+
+inline int intersectWideChildren(const WideBVHNode<8>& n, const WideBVHRay& r, float tmax, float* tnear) {
+#if defined(__AVX__)
+    const float* nx = r.signX ? n.bmaxx : n.bminx;
+    const float* ny = r.signY ? n.bmaxy : n.bminy;
+    const float* nz = r.signZ ? n.bmaxz : n.bminz;
+    const float* fx = r.signX ? n.bminx : n.bmaxx;
+    const float* fy = r.signY ? n.bminy : n.bmaxy;
+    const float* fz = r.signZ ? n.bminz : n.bmaxz;
+    const __m256 ox = _mm256_set1_ps(r.ox), oy = _mm256_set1_ps(r.oy), oz = _mm256_set1_ps(r.oz);
+    const __m256 ix = _mm256_set1_ps(r.idx), iy = _mm256_set1_ps(r.idy), iz = _mm256_set1_ps(r.idz);
+    const __m256 tn = _mm256_max_ps(
+        _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nx), ox), ix),
+                      _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(ny), oy), iy)),
+        _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nz), oz), iz), _mm256_setzero_ps()));
+    const __m256 tf = _mm256_min_ps(
+        _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(fx), ox), ix),
+                      _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(fy), oy), iy)),
+        _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(fz), oz), iz), _mm256_set1_ps(tmax)));
+    _mm256_storeu_ps(tnear, tn);
+    return _mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ));
+#else
+    // No AVX: two 4-wide halves.
+    return intersectWideChildren4(n, 0, r, tmax, tnear)
+         | (intersectWideChildren4(n, 4, r, tmax, tnear + 4) << 4);
+#endif
+}
+
+inline bool TriangleBVH::intersectTriangle(uint32_t i, const ugm::Ray& ray, float maxT,
+                                           float& t, float& u, float& v) const {
+    const float e1x = tris.e1x[i], e1y = tris.e1y[i], e1z = tris.e1z[i];
+    const float e2x = tris.e2x[i], e2y = tris.e2y[i], e2z = tris.e2z[i];
+
+    // pvec = cross(dir, edge2)
+    const float px = ray.dir.y * e2z - ray.dir.z * e2y;
+    const float py = ray.dir.z * e2x - ray.dir.x * e2z;
+    const float pz = ray.dir.x * e2y - ray.dir.y * e2x;
+    const float det = e1x * px + e1y * py + e1z * pz;
+    if (fabsf(det) < 1e-8f) return false;
+
+    const float invDet = 1.0f / det;
+    const float tx = ray.origin.x - tris.v0x[i];
+    const float ty = ray.origin.y - tris.v0y[i];
+    const float tz = ray.origin.z - tris.v0z[i];
+    u = (tx * px + ty * py + tz * pz) * invDet;
+    if (u < 0.0f || u > 1.0f) return false;
+
+    // qvec = cross(tvec, edge1)
+    const float qx = ty * e1z - tz * e1y;
+    const float qy = tz * e1x - tx * e1z;
+    const float qz = tx * e1y - ty * e1x;
+    v = (ray.dir.x * qx + ray.dir.y * qy + ray.dir.z * qz) * invDet;
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+    return t >= 0.0f && t < maxT;
+}
+
+inline bool TriangleBVH::occludesTriangle(uint32_t i, const ugm::Ray& ray, float maxT) const {
+    const float e1x = tris.e1x[i], e1y = tris.e1y[i], e1z = tris.e1z[i];
+    const float e2x = tris.e2x[i], e2y = tris.e2y[i], e2z = tris.e2z[i];
+
+    const float hx = ray.dir.y * e2z - ray.dir.z * e2y;
+    const float hy = ray.dir.z * e2x - ray.dir.x * e2z;
+    const float hz = ray.dir.x * e2y - ray.dir.y * e2x;
+    const float a = e1x * hx + e1y * hy + e1z * hz;
+    if (fabsf(a) < 1e-6f) return false;  // parallel to the triangle
+
+    const float f = 1.0f / a;
+    const float sx = ray.origin.x - tris.v0x[i];
+    const float sy = ray.origin.y - tris.v0y[i];
+    const float sz = ray.origin.z - tris.v0z[i];
+    const float u = f * (sx * hx + sy * hy + sz * hz);
+    if (u < 0.0f || u > 1.0f) return false;
+
+    const float qx = sy * e1z - sz * e1y;
+    const float qy = sz * e1x - sx * e1z;
+    const float qz = sx * e1y - sy * e1x;
+    const float v = f * (ray.dir.x * qx + ray.dir.y * qy + ray.dir.z * qz);
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    const float t = f * (e2x * qx + e2y * qy + e2z * qz);
+    return t > 1e-6f && t < maxT;
+}
+
+template<typename L>
+inline int TriangleBVH::intersectBlock(uint32_t first, int n, const ugm::Ray& ray, float maxT,
+                                       float& t, float& u, float& v) const {
+    typedef typename L::F F;
+    const F e1x = L::load(&tris.e1x[first]), e1y = L::load(&tris.e1y[first]), e1z = L::load(&tris.e1z[first]);
+    const F e2x = L::load(&tris.e2x[first]), e2y = L::load(&tris.e2y[first]), e2z = L::load(&tris.e2z[first]);
+    const F dx = L::set1(ray.dir.x), dy = L::set1(ray.dir.y), dz = L::set1(ray.dir.z);
+
+    const F px = L::sub(L::mul(dy, e2z), L::mul(dz, e2y));
+    const F py = L::sub(L::mul(dz, e2x), L::mul(dx, e2z));
+    const F pz = L::sub(L::mul(dx, e2y), L::mul(dy, e2x));
+    const F det = L::add(L::add(L::mul(e1x, px), L::mul(e1y, py)), L::mul(e1z, pz));
+    F ok = L::ge(L::abs(det), L::set1(1e-8f));
+
+    const F invDet = L::div(L::set1(1.0f), det);
+    const F tx = L::sub(L::set1(ray.origin.x), L::load(&tris.v0x[first]));
+    const F ty = L::sub(L::set1(ray.origin.y), L::load(&tris.v0y[first]));
+    const F tz = L::sub(L::set1(ray.origin.z), L::load(&tris.v0z[first]));
+    const F bu = L::mul(L::add(L::add(L::mul(tx, px), L::mul(ty, py)), L::mul(tz, pz)), invDet);
+    ok = L::both(ok, L::both(L::ge(bu, L::set1(0.0f)), L::le(bu, L::set1(1.0f))));
+
+    const F qx = L::sub(L::mul(ty, e1z), L::mul(tz, e1y));
+    const F qy = L::sub(L::mul(tz, e1x), L::mul(tx, e1z));
+    const F qz = L::sub(L::mul(tx, e1y), L::mul(ty, e1x));
+    const F bv = L::mul(L::add(L::add(L::mul(dx, qx), L::mul(dy, qy)), L::mul(dz, qz)), invDet);
+    ok = L::both(ok, L::both(L::ge(bv, L::set1(0.0f)), L::le(L::add(bu, bv), L::set1(1.0f))));
+
+    const F bt = L::mul(L::add(L::add(L::mul(e2x, qx), L::mul(e2y, qy)), L::mul(e2z, qz)), invDet);
+    ok = L::both(ok, L::both(L::ge(bt, L::set1(0.0f)), L::lt(bt, L::set1(maxT))));
+
+    int mask = L::mask(ok) & ((1 << n) - 1);
+    if (!mask) return -1;
+
+    float ts[L::width], us[L::width], vs[L::width];
+    L::store(ts, bt);
+    L::store(us, bu);
+    L::store(vs, bv);
+    int best = -1;
+    for (int i = 0; i < n; i++) {
+        if ((mask & (1 << i)) && (best < 0 || ts[i] < ts[best])) best = i;
+    }
+    t = ts[best];
+    u = us[best];
+    v = vs[best];
+    return best;
+}
+
+template<typename L>
+inline int TriangleBVH::occludesBlock(uint32_t first, int n, const ugm::Ray& ray, float maxT) const {
+    typedef typename L::F F;
+    const F e1x = L::load(&tris.e1x[first]), e1y = L::load(&tris.e1y[first]), e1z = L::load(&tris.e1z[first]);
+    const F e2x = L::load(&tris.e2x[first]), e2y = L::load(&tris.e2y[first]), e2z = L::load(&tris.e2z[first]);
+    const F dx = L::set1(ray.dir.x), dy = L::set1(ray.dir.y), dz = L::set1(ray.dir.z);
+
+    const F hx = L::sub(L::mul(dy, e2z), L::mul(dz, e2y));
+    const F hy = L::sub(L::mul(dz, e2x), L::mul(dx, e2z));
+    const F hz = L::sub(L::mul(dx, e2y), L::mul(dy, e2x));
+    const F a = L::add(L::add(L::mul(e1x, hx), L::mul(e1y, hy)), L::mul(e1z, hz));
+    F ok = L::ge(L::abs(a), L::set1(1e-6f));
+
+    const F f = L::div(L::set1(1.0f), a);
+    const F sx = L::sub(L::set1(ray.origin.x), L::load(&tris.v0x[first]));
+    const F sy = L::sub(L::set1(ray.origin.y), L::load(&tris.v0y[first]));
+    const F sz = L::sub(L::set1(ray.origin.z), L::load(&tris.v0z[first]));
+    const F bu = L::mul(f, L::add(L::add(L::mul(sx, hx), L::mul(sy, hy)), L::mul(sz, hz)));
+    ok = L::both(ok, L::both(L::ge(bu, L::set1(0.0f)), L::le(bu, L::set1(1.0f))));
+
+    const F qx = L::sub(L::mul(sy, e1z), L::mul(sz, e1y));
+    const F qy = L::sub(L::mul(sz, e1x), L::mul(sx, e1z));
+    const F qz = L::sub(L::mul(sx, e1y), L::mul(sy, e1x));
+    const F bv = L::mul(f, L::add(L::add(L::mul(dx, qx), L::mul(dy, qy)), L::mul(dz, qz)));
+    ok = L::both(ok, L::both(L::ge(bv, L::set1(0.0f)), L::le(L::add(bu, bv), L::set1(1.0f))));
+
+    const F bt = L::mul(f, L::add(L::add(L::mul(e2x, qx), L::mul(e2y, qy)), L::mul(e2z, qz)));
+    ok = L::both(ok, L::both(L::gt(bt, L::set1(1e-6f)), L::lt(bt, L::set1(maxT))));
+
+    return L::mask(ok) & ((1 << n) - 1);
+}
+
+inline bool TriangleBVH::intersectLeaf(uint32_t first, uint32_t count, const ugm::Ray& ray, float& maxT,
+                                       uint32_t& bestPrim, float& bestU, float& bestV) const {
+    bool found = false;
+#ifdef RAYGEN_BVH_SSE
+    for (uint32_t b = first; b < first + count; b += BVH_LEAF_BLOCK) {
+        const int n = (int)std::min<uint32_t>(BVH_LEAF_BLOCK, first + count - b);
+        float t, u, v;
+        const int lane = intersectBlock<BVHLeafLanes>(b, n, ray, maxT, t, u, v);
+        if (lane >= 0) {
+            maxT = t;
+            bestPrim = b + lane;
+            bestU = u;
+            bestV = v;
+            found = true;
+        }
+    }
+#else
+    for (uint32_t i = first; i < first + count; i++) {
+        float t, u, v;
+        if (intersectTriangle(i, ray, maxT, t, u, v)) {
+            maxT = t;
+            bestPrim = i;
+            bestU = u;
+            bestV = v;
+            found = true;
+        }
+    }
+#endif
+    return found;
+}
+
+template<typename Pred>
+inline bool TriangleBVH::occludesLeaf(uint32_t first, uint32_t count, const ugm::Ray& ray, float maxT,
+                                      Pred& pred) const {
+#ifdef RAYGEN_BVH_SSE
+    for (uint32_t b = first; b < first + count; b += BVH_LEAF_BLOCK) {
+        const int n = (int)std::min<uint32_t>(BVH_LEAF_BLOCK, first + count - b);
+        const int mask = occludesBlock<BVHLeafLanes>(b, n, ray, maxT);
+        if (!mask) continue;
+        for (int i = 0; i < n; i++) {
+            if ((mask & (1 << i)) && pred(prims[b + i])) return true;
+        }
+    }
+#else
+    for (uint32_t i = first; i < first + count; i++) {
+        if (occludesTriangle(i, ray, maxT) && pred(prims[i])) return true;
+    }
+#endif
+    return false;
+}
+
 // Implementation of intersectAny kept in the header so the predicate is
 // inlined at each call site — the whole point of templating the callback.
 template<typename Pred>
 bool TriangleBVH::intersectAny(const ugm::Ray& ray, float maxT, Pred&& pred) const {
     if (nodes.empty()) return false;
+    if (!nodes4.empty()) return intersectAnyWide(nodes4, ray, maxT, pred);
+    if (!nodes8.empty()) return intersectAnyWide(nodes8, ray, maxT, pred);
+
+    const float invDx = (fabsf(ray.dir.x) > 1e-20f) ? 1.0f / ray.dir.x : 1e30f;
+    const float invDy = (fabsf(ray.dir.y) > 1e-20f) ? 1.0f / ray.dir.y : 1e30f;
+    const float invDz = (fabsf(ray.dir.z) > 1e-20f) ? 1.0f / ray.dir.z : 1e30f;
+
+    uint32_t stack[64];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+        const BVHNode& n = nodes[stack[--sp]];
+
+        float t1x = (n.bmin.x - ray.origin.x) * invDx;
+        float t2x = (n.bmax.x - ray.origin.x) * invDx;
+        float t1y = (n.bmin.y - ray.origin.y) * invDy;
+        float t2y = (n.bmax.y - ray.origin.y) * invDy;
+        float t1z = (n.bmin.z - ray.origin.z) * invDz;
+        float t2z = (n.bmax.z - ray.origin.z) * invDz;
+        float tmin = fmaxf(fmaxf(fminf(t1x, t2x), fminf(t1y, t2y)), fminf(t1z, t2z));
+        float tmax = fminf(fminf(fmaxf(t1x, t2x), fmaxf(t1y, t2y)), fmaxf(t1z, t2z));
+        if (tmax < 0.0f || tmin > tmax || tmin > maxT) continue;
+
+        if (n.count > 0) {
+            if (occludesLeaf(n.firstOrLeft, n.count, ray, maxT, pred)) return true;
+        } else {
+            stack[sp++] = n.firstOrLeft + 1;
+            stack[sp++] = n.firstOrLeft;
+        }
+    }
+    return false;
+}
+
+// Any occluder ends the walk, so children are pushed unsorted.
+template<int W, typename Pred>
+bool TriangleBVH::intersectAnyWide(const std::vector<WideBVHNode<W>>& wnodes, const ugm::Ray& ray,
+                                   float maxT, Pred&& pred) const {
+    const WideBVHRay wr(ray);
+
+    // Leaf children are pushed too, with their prim count alongside
+    // (count 0 = wide node index).
+    uint32_t stack[64 * W];
+    uint16_t stackCount[64 * W];
+    int sp = 0;
+    stack[sp] = 0;
+    stackCount[sp++] = 0;
+
+    float tnear[W];
+    while (sp > 0) {
+        --sp;
+        const uint32_t idx = stack[sp];
+        const uint16_t count = stackCount[sp];
+
+        if (count > 0) {
+            if (occludesLeaf(idx, count, ray, maxT, pred)) return true;
+            continue;
+        }
+
+        const WideBVHNode<W>& n = wnodes[idx];
+        const int mask = intersectWideChildren(n, wr, maxT, tnear);
+        for (int c = 0; c < W; c++) {
+            if (!(mask & (1 << c))) continue;
+            stack[sp] = n.child[c];
+            stackCount[sp++] = n.count[c];
+        }
+    }
+    return false;
+}
+
+template<typename Pred>
+bool InstanceBVH::intersectAny(const ugm::Ray& ray, float maxT, Pred&& pred) const {
+    if (nodes.empty()) return false;
 
     const float invDx = (fabsf(ray.dir.x) > 1e-20f) ? 1.0f / ray.dir.x : 1e30f;
     const float invDy = (fabsf(ray.dir.y) > 1e-20f) ? 1.0f / ray.dir.y : 1e30f;
@@ -87,10 +725,11 @@ bool TriangleBVH::intersectAny(const ugm::Ray& ray, float maxT, Pred&& pred) con
 
         if (n.count > 0) {
             for (uint16_t i = 0; i < n.count; i++) {
-                const RenderMeshTriangle* rt = prims[n.firstOrLeft + i];
-                float t;
-                ugm::vec3 h;
-                if (rt->intersectsRay(ray, maxT, t, h) && pred(rt)) return true;
+                const BVHInstance& inst = instances[n.firstOrLeft + i];
+                const SceneObject& obj = *inst.object;
+                if (inst.blas->intersectAny(inst.localRay(ray), maxT, [&](const RenderMeshTriangle* rt) {
+                    return pred(rt, obj);
+                })) return true;
             }
         } else {
             stack[sp++] = n.firstOrLeft + 1;
@@ -0,0 +1,201 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "film.h"
+#include <cstring>
+#include <cmath>
+
+namespace raygen {
+
+using namespace ugm;
+
+namespace {
+
+// IEEE 754 binary16, rounding to nearest even; values past the half range
+// become infinity, tiny ones denormals or zero.
+inline uint16_t floatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    const uint16_t sign = (uint16_t)((x >> 16) & 0x8000u);
+    const uint32_t absx = x & 0x7fffffffu;
+
+    if (absx >= 0x7f800000u) {
+        // Inf stays Inf, NaN stays a (quiet) NaN.
+        return sign | (absx > 0x7f800000u ? 0x7e00u : 0x7c00u);
+    }
+    if (absx >= 0x477ff000u) {
+        // Rounds up past 65504.
+        return sign | 0x7c00u;
+    }
+    if (absx < 0x38800000u) {
+        // Below the smallest normal half, 2^-14: denormal or zero.
+        if (absx < 0x33000000u) return sign;
+        const uint32_t mant = (absx & 0x007fffffu) | 0x00800000u;
+        const int shift = 126 - (int)(absx >> 23);
+        uint32_t half = mant >> shift;
+        const uint32_t rest = mant & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1u))) half++;
+        return sign | (uint16_t)half;
+    }
+
+    uint32_t half = ((absx >> 13) - (112u << 10));
+    const uint32_t rest = absx & 0x1fffu;
+    if (rest > 0x1000u || (rest == 0x1000u && (half & 1u))) half++;
+    return sign | (uint16_t)half;
+}
+
+inline float halfToFloat(uint16_t h) {
+    const uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+    const uint32_t exp = (h >> 10) & 0x1fu;
+    uint32_t mant = h & 0x03ffu;
+    uint32_t x;
+
+    if (exp == 0) {
+        if (mant == 0) {
+            x = sign;
+        } else {
+            // Denormal half: normalise into a float exponent.
+            int e = -1;
+            do { mant <<= 1; e++; } while ((mant & 0x0400u) == 0);
+            x = sign | ((uint32_t)(112 - e) << 23) | ((mant & 0x03ffu) << 13);
+        }
+    } else if (exp == 0x1fu) {
+        x = sign | 0x7f800000u | (mant << 13);
+    } else {
+        x = sign | ((exp + 112u) << 23) | (mant << 13);
+    }
+
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+}
+
+void RenderFilm::reset(int width, int height, bool variance, bool aovs, bool halfAOVs) {
+    this->reset(0, 0, width, height, variance, aovs, halfAOVs);
+}
+
+void RenderFilm::reset(int originX, int originY, int width, int height,
+                       bool variance, bool aovs, bool halfAOVs) {
+    this->x0 = originX;
+    this->y0 = originY;
+    this->w = width > 0 ? width : 0;
+    this->h = height > 0 ? height : 0;
+    const size_t n = (size_t)this->w * this->h;
+
+    // assign() over clear()+shrink: a film re-used at the same size keeps
+    // its allocations, one that no longer needs a plane gives it back.
+    this->sum.assign(n, color3f(0.0f, 0.0f, 0.0f));
+    this->count.assign(n, 0);
+    if (variance) {
+        this->sumSq.assign(n, color3f(0.0f, 0.0f, 0.0f));
+    } else {
+        std::vector<color3f>().swap(this->sumSq);
+    }
+
+    if (aovs && halfAOVs) {
+        this->aovHalf.assign(n * AOV_CHANNELS, 0);
+    } else {
+        std::vector<uint16_t>().swap(this->aovHalf);
+    }
+    if (aovs && !halfAOVs) {
+        this->aovFloat.assign(n * AOV_CHANNELS, 0.0f);
+    } else {
+        std::vector<float>().swap(this->aovFloat);
+    }
+    if (aovs) {
+        this->aovMask.assign(n, 0);
+    } else {
+        std::vector<uint8_t>().swap(this->aovMask);
+    }
+}
+
+void RenderFilm::addBlock(int bx0, int by0, int bw, int bh,
+                          const color3f* blockSum, const color3f* blockSumSq, const int samples) {
+    const bool variance = this->hasVariance() && blockSumSq != NULL;
+
+    for (int by = 0; by < bh; by++) {
+        const size_t row = this->index(bx0, by0 + by);
+        color3f* s = &this->sum[row];
+        uint32_t* c = &this->count[row];
+        const color3f* src = blockSum + (size_t)by * bw;
+        for (int bx = 0; bx < bw; bx++) {
+            s[bx].r += src[bx].r;
+            s[bx].g += src[bx].g;
+            s[bx].b += src[bx].b;
+            c[bx] += (uint32_t)samples;
+        }
+        if (variance) {
+            color3f* sq = &this->sumSq[row];
+            const color3f* srcSq = blockSumSq + (size_t)by * bw;
+            for (int bx = 0; bx < bw; bx++) {
+                sq[bx].r += srcSq[bx].r;
+                sq[bx].g += srcSq[bx].g;
+                sq[bx].b += srcSq[bx].b;
+            }
+        }
+    }
+}
+
+void RenderFilm::resolve(Image& hdr, const float scale) const {
+    if ((int)hdr.width() != this->w || (int)hdr.height() != this->h) {
+        hdr.createEmpty(this->w, this->h);
+    }
+
+    for (int y = 0; y < this->h; y++) {
+        const size_t row = (size_t)y * this->w;
+        for (int x = 0; x < this->w; x++) {
+            const uint32_t n = this->count[row + x];
+            const float k = (n > 0) ? scale / (float)n : 0.0f;
+            const color3f& s = this->sum[row + x];
+            hdr.setPixel(x, y, color4f(fmaxf(s.r * k, 0.0f),
+                                       fmaxf(s.g * k, 0.0f),
+                                       fmaxf(s.b * k, 0.0f),
+                                       1.0f));
+        }
+    }
+}
+
+void RenderFilm::setAOV(int x, int y, const vec3& normal, const color3f& albedo,
+                        const float depth, const bool hit) {
+    const size_t p = this->index(x, y);
+    const size_t i = p * AOV_CHANNELS;
+    this->setAOVChannel(i,     normal.x);
+    this->setAOVChannel(i + 1, normal.y);
+    this->setAOVChannel(i + 2, normal.z);
+    this->setAOVChannel(i + 3, albedo.r);
+    this->setAOVChannel(i + 4, albedo.g);
+    this->setAOVChannel(i + 5, albedo.b);
+    this->setAOVChannel(i + 6, depth);
+    this->aovMask[p] = hit ? 1 : 0;
+}
+
+float RenderFilm::aov(const size_t i) const {
+    return this->aovHalf.empty() ? this->aovFloat[i] : halfToFloat(this->aovHalf[i]);
+}
+
+void RenderFilm::setAOVChannel(const size_t i, const float v) {
+    if (this->aovHalf.empty()) {
+        this->aovFloat[i] = v;
+    } else {
+        this->aovHalf[i] = floatToHalf(v);
+    }
+}
+
+size_t RenderFilm::memoryUsage() const {
+    return this->sum.size() * sizeof(color3f)
+        + this->sumSq.size() * sizeof(color3f)
+        + this->count.size() * sizeof(uint32_t)
+        + this->aovFloat.size() * sizeof(float)
+        + this->aovHalf.size() * sizeof(uint16_t)
+        + this->aovMask.size() * sizeof(uint8_t);
+}
+
+}
@@ -0,0 +1,111 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __raygen_film_h__
+#define __raygen_film_h__
+
+#include <vector>
+#include <cstdint>
+#include "ugm/types3d.h"
+#include "ugm/color.h"
+#include "ugm/image.h"
+
+namespace raygen {
+
+// The one full-resolution record of a render: per-pixel sample sums, sums
+// of squares (for the adaptive sampler's noise estimate, only when asked
+// for) and sample counts, plus the primary-hit guides the denoiser reads.
+// Everything else the renderer shows is derived from it: the LDR preview
+// per finished tile, the linear HDR image once tracing is done.
+//
+// Sums are float RGB without the alpha the generic Image formats carry;
+// the guides (normal, albedo, depth) can be kept as half floats, which is
+// plenty for edge-stopping weights and halves their footprint.
+class RenderFilm {
+public:
+    // Sizes the film and zeroes every sum. `variance` keeps sums of squares,
+    // `aovs` the denoise guides, in half precision when `halfAOVs` is set.
+    void reset(int width, int height, bool variance, bool aovs, bool halfAOVs);
+    // Same for a film covering only the window at (originX, originY) of the
+    // frame; pixels are still addressed in frame coordinates.
+    void reset(int originX, int originY, int width, int height,
+               bool variance, bool aovs, bool halfAOVs);
+
+    inline int originX() const { return this->x0; }
+    inline int originY() const { return this->y0; }
+    inline int width() const { return this->w; }
+    inline int height() const { return this->h; }
+    inline bool hasVariance() const { return !this->sumSq.empty(); }
+    inline bool hasAOVs() const { return !this->aovMask.empty(); }
+
+    // Adds `samples` samples' worth of `blockSum` / `blockSumSq` (row-major
+    // over the bw × bh block at bx0, by0) to the film. blockSumSq may be
+    // NULL and is ignored without variance. Threads must add disjoint blocks.
+    void addBlock(int bx0, int by0, int bw, int bh,
+                  const ugm::color3f* blockSum, const ugm::color3f* blockSumSq, int samples);
+
+    inline const ugm::color3f& sumAt(int x, int y) const {
+        return this->sum[this->index(x, y)];
+    }
+    inline const ugm::color3f& sumSqAt(int x, int y) const {
+        return this->sumSq[this->index(x, y)];
+    }
+    inline int samplesAt(int x, int y) const {
+        return (int)this->count[this->index(x, y)];
+    }
+
+    // Mean radiance times `scale` into every pixel of `hdr` (resized to the
+    // film, its pixel 0,0 at the film's origin), clamped at zero with alpha
+    // 1; unsampled pixels are black.
+    void resolve(ugm::Image& hdr, float scale) const;
+
+    // Denoise guides of the primary hit. `hit` is false where the eye ray
+    // left the scene; the other values are then meaningless.
+    void setAOV(int x, int y, const ugm::vec3& normal, const ugm::color3f& albedo,
+                float depth, bool hit);
+    inline bool aovHit(int x, int y) const {
+        return this->aovMask[this->index(x, y)] != 0;
+    }
+    inline ugm::vec3 aovNormal(int x, int y) const {
+        const size_t i = this->index(x, y) * AOV_CHANNELS;
+        return ugm::vec3(this->aov(i), this->aov(i + 1), this->aov(i + 2));
+    }
+    inline ugm::color3f aovAlbedo(int x, int y) const {
+        const size_t i = this->index(x, y) * AOV_CHANNELS;
+        return ugm::color3f(this->aov(i + 3), this->aov(i + 4), this->aov(i + 5));
+    }
+    inline float aovDepth(int x, int y) const {
+        return this->aov(this->index(x, y) * AOV_CHANNELS + 6);
+    }
+
+    // Bytes held by the film's planes.
+    size_t memoryUsage() const;
+
+private:
+    // Normal xyz, albedo rgb, depth.
+    static const int AOV_CHANNELS = 7;
+
+    int x0 = 0, y0 = 0;
+    int w = 0, h = 0;
+    std::vector<ugm::color3f> sum, sumSq;
+    std::vector<uint32_t> count;
+    // Guides in full or half precision; only one of the two is in use.
+    std::vector<float> aovFloat;
+    std::vector<uint16_t> aovHalf;
+    std::vector<uint8_t> aovMask;
+
+    inline size_t index(int x, int y) const {
+        return (size_t)(y - this->y0) * this->w + (x - this->x0);
+    }
+    float aov(size_t i) const;
+    void setAOVChannel(size_t i, float v);
+};
+
+}
+
+#endif /* __raygen_film_h__ */
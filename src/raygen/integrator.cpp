@@ -0,0 +1,244 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "medium.h"
+#include "rayrenderer.h"
+
+namespace raygen {
+
+namespace {
+
+// Everything the recursion used to carry down in BSDFParam and restore on
+// the way back up; one path's worth, updated in place each vertex.
+struct PathState {
+    Ray ray;
+    // Product of every vertex weight so far, the factor the radiance found
+    // at the next vertex is added with. Also what Russian Roulette reads.
+    color3 throughput = color3(1.0f, 1.0f, 1.0f);
+    // Solid-angle pdf the last vertex sampled `ray` with; 0 for the eye ray,
+    // delta lobes and phase samples (see BSDFParam::bsdfSampledPdf).
+    float bsdfPdf = 0.0f;
+    // BSDFParam::passes of the last vertex; meaningless while `eye` is set.
+    int passes = 0;
+    // No vertex yet: shaders see a NULL shaderParam.
+    bool eye = true;
+    int chromaChannel = -1;
+    const HomogeneousMedium* medium = NULL;
+};
+
+inline color3 misWeightedEnvironment(const RayRenderer& renderer, const PathState& st) {
+    color3 env = renderer.sampleEnvironment(st.ray.dir);
+    if (!st.eye && st.bsdfPdf > 0.0f) {
+        const float envPdf = renderer.envmapDirectionPdf(st.ray.dir);
+        const float b2 = st.bsdfPdf * st.bsdfPdf;
+        const float e2 = envPdf * envPdf;
+        env = env * ((b2 + e2 > 0.0f) ? b2 / (b2 + e2) : 1.0f);
+    }
+    return env;
+}
+
+}
+
+bool RayRenderer::useIterativeIntegrator() const {
+    // scatter() only exists on the BSDF provider, and DiffuseShader only
+    // guides its recursive shade(). scatter() always picks one MixShader
+    // lobe, so tracing every lobe stays with the recursion.
+    return this->settings.enableIterativeIntegrator
+        && this->settings.enableLobeSelection
+        && this->settings.shaderProvider == 5
+        && this->getPathGuide() == NULL;
+}
+
+color4 RayRenderer::traceIterative(const Ray& eyeRay, const RayTriangleIntersectionInfo& eyeHit) const {
+    RayBSDFShaderProvider* provider = (RayBSDFShaderProvider*)this->shaderProvider;
+    const HomogeneousMedium* globalMedium = (this->scene != NULL) ? this->scene->globalMedium : NULL;
+
+    PathState st;
+    st.ray = eyeRay;
+    st.medium = globalMedium;
+
+    // shadeEyeRay's eye-ray rules: without fog, an eye ray that misses or
+    // hits an invisible object sees the environment, or the back color
+    // when that is black; with fog the segment is traced like any other.
+    const bool fogged = st.medium != NULL && st.medium->isActive();
+    if (!fogged && (eyeHit.triangle == NULL || !eyeHit.object->visible)) {
+        const color3 env = this->sampleEnvironment(eyeRay.dir);
+        return env != color3::zero ? color4(env, 1.0f) : this->settings.backColor;
+    }
+
+    color3 radiance = color3::zero;
+    RayTriangleIntersectionInfo info = eyeHit;
+    bool haveHit = true;
+
+    while (true) {
+        if (!haveHit) {
+            info = RayTriangleIntersectionInfo();
+            this->findNearestTriangle(st.ray, info);
+        }
+        haveHit = false;
+
+        const HomogeneousMedium* medium = st.medium;
+        const bool inMedium = medium != NULL && medium->isActive();
+
+        if (inMedium && medium->isHeatHaze()) {
+            // March to the next surface bending the ray, then continue in
+            // the outer medium (see tracePath). A heat-haze global medium
+            // bends the segment once and then leaves the path in vacuum.
+            const float maxT = (info.triangle != NULL) ? info.t : RAY_MAX_DISTANCE;
+            st.ray = medium->bendRay(st.ray, fminf(maxT, 1000.0f));
+            st.medium = (globalMedium != medium) ? globalMedium : NULL;
+            continue;
+        }
+
+        if (inMedium) {
+            // Free flight through the segment, as tracePath's volumetric
+            // branch; an in-scattering event becomes a path vertex.
+            const float maxT = (info.triangle != NULL) ? info.t : RAY_MAX_DISTANCE;
+            bool scattered = false;
+            float tFlight = 0.0f;
+            float densityAtScatter = 1.0f;
+            if (medium->isHeterogeneous()) {
+                scattered = medium->sampleDeltaTracking(st.ray, maxT, tFlight, densityAtScatter);
+                if (!scattered) tFlight = maxT;
+            } else {
+                tFlight = medium->sampleFreeFlight(randomValue());
+                scattered = (tFlight < maxT);
+            }
+
+            radiance += st.throughput * medium->emissionIntegralAlongRay(st.ray, scattered ? tFlight : maxT);
+
+            if (scattered) {
+                color3 scatterWeight;
+                if (medium->isHeterogeneous()) {
+                    const float invHero = (medium->sigma_t_max_hero > 0.0f) ? (1.0f / medium->sigma_t_max_hero) : 0.0f;
+                    const color3 sS = medium->sigma_s_eff * densityAtScatter;
+                    scatterWeight = color3(sS.r * invHero, sS.g * invHero, sS.b * invHero);
+                } else {
+                    const float pHero = medium->freeFlightPdf(tFlight);
+                    const color3 Tr = medium->transmittance(tFlight);
+                    if (pHero > 0.0f) {
+                        scatterWeight = color3(medium->sigma_s_eff.r * Tr.r / pHero,
+                                               medium->sigma_s_eff.g * Tr.g / pHero,
+                                               medium->sigma_s_eff.b * Tr.b / pHero);
+                    }
+                }
+                if (scatterWeight == color3::zero) break;
+
+                // As in tracePath, a scatter the eye ray reaches is depth 1,
+                // where a surface hit there is depth 0.
+                const int passes = st.eye ? 1 : st.passes + 1;
+                if (passes > MAX_TRACE_DEPTH) break;
+
+                const vec3 scatterPos = st.ray.origin + st.ray.dir * tFlight;
+                const vec3 normalProxy = -st.ray.dir;
+                color3 direct = color3::zero;
+
+                vec3 lDir; float pdfLight = 0.0f; color3 Le;
+                if (this->sampleAreaLightForNEE(scatterPos, normalProxy, lDir, pdfLight, Le) && pdfLight > 0.0f) {
+                    direct += Le * (medium->phasePdf(-st.ray.dir, lDir) / pdfLight);
+                }
+                vec3 eDir; float pdfEnv = 0.0f; color3 Li;
+                if (this->sampleEnvmapForNEE(scatterPos, normalProxy, eDir, pdfEnv, Li) && pdfEnv > 0.0f) {
+                    direct += Li * (medium->phasePdf(-st.ray.dir, eDir) / pdfEnv);
+                }
+                vec3 vDir; float vDist; float vPdf = 0.0f; color3 vLe;
+                if (this->sampleVolumeLightForNEE(scatterPos, normalProxy, vDir, vDist, vPdf, vLe) && vPdf > 0.0f) {
+                    direct += vLe * (medium->phasePdf(-st.ray.dir, vDir) / vPdf);
+                }
+
+                const vec3 nextDir = medium->samplePhase(st.ray.dir, randomValue(), randomValue());
+
+                radiance += st.throughput * scatterWeight * direct;
+
+                float rrWeight = 1.0f;
+                if (passes >= MIN_RR_DEPTH) {
+                    const color3 t = st.throughput * scatterWeight;
+                    float q = fmaxf(t.r, fmaxf(t.g, t.b));
+                    q = fminf(RR_MAX_PROB, fmaxf(RR_MIN_PROB, q));
+                    if (randomValue() >= q) break;
+                    rrWeight = 1.0f / q;
+                }
+
+                st.throughput *= scatterWeight * rrWeight;
+                st.ray = ThicknessRay(scatterPos, nextDir);
+                st.bsdfPdf = 0.0f;
+                st.passes = passes;
+                st.eye = false;
+                continue;
+            }
+
+            // Reached the surface (or escaped): spectral correction of the
+            // hero-channel survival, 1 under delta tracking.
+            if (!medium->isHeterogeneous()) {
+                const float survival = medium->freeFlightSurvivalProb(maxT);
+                if (survival > 0.0f) {
+                    const color3 Tr = medium->transmittance(maxT);
+                    st.throughput *= color3(Tr.r / survival, Tr.g / survival, Tr.b / survival);
+                }
+            }
+        }
+
+        if (info.triangle == NULL) {
+            radiance += st.throughput * misWeightedEnvironment(*this, st);
+            break;
+        }
+
+        VertexInterpolation vi;
+        this->calcVertexInterpolation(info, &vi);
+        if (inMedium) {
+            // tracePath's smooth-shading silhouette fix, which it applies on
+            // the volumetric branch only.
+            const vec3 gpd = info.geometricNormal();
+            const vec3 geomN = (dot(gpd, st.ray.dir) <= 0.0f) ? gpd : -gpd;
+            if (dot(st.ray.dir, vi.normal) > 0.0f && dot(st.ray.dir, geomN) < 0.0f) {
+                vi.normal = geomN;
+            }
+        }
+
+        BSDFSample s;
+        if (st.eye) {
+            provider->scatter(info, st.ray, vi, NULL, s);
+        } else {
+            BSDFParam incoming(*const_cast<RayRenderer*>(this), info, st.ray, vi, st.passes);
+            incoming.throughput = st.throughput;
+            incoming.bsdfSampledPdf = st.bsdfPdf;
+            incoming.chromaChannel = st.chromaChannel;
+            incoming.currentMedium = st.medium;
+            provider->scatter(info, st.ray, vi, &incoming, s);
+        }
+
+        radiance += st.throughput * s.emitted;
+        for (int i = 0; i < s.shadowCount; i++) {
+            const BSDFShadowRay& sh = s.shadows[i];
+            if (sh.radiance == color3::zero) continue;
+            if (this->isShadowed(sh.ray, sh.maxT, sh.occluders)) continue;
+            radiance += st.throughput * sh.radiance;
+        }
+
+        if (!s.scattered) break;
+        st.throughput *= s.weight;
+        if (st.throughput == color3::zero) break;
+
+        st.ray = s.ray;
+        st.bsdfPdf = s.pdf;
+        st.chromaChannel = s.chromaChannel;
+        st.medium = s.medium;
+        st.passes = st.eye ? 0 : st.passes + 1;
+        st.eye = false;
+    }
+
+    if (eyeHit.triangle == NULL && radiance == color3::zero) {
+        return this->settings.backColor;
+    }
+    return color4(fmaxf(radiance.r, 0.0f),
+                  fmaxf(radiance.g, 0.0f),
+                  fmaxf(radiance.b, 0.0f),
+                  1.0f);
+}
+
+}
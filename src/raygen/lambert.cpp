@@ -12,7 +12,7 @@
 namespace raygen {
 
 color3 LambertShaderProvider::shade(const RayTriangleIntersectionInfo& interInfo, const Ray& inray, const VertexInterpolation& vi, void* shaderParam) {
-    const Material& m = interInfo.triangle->object.material;
+    const Material& m = interInfo.object->material;
     
     if (m.emission > 0) {
         return m.color * m.emission;
@@ -39,7 +39,7 @@ color3 LambertShaderProvider::shade(const RayTriangleIntersectionInfo& interInfo
 }
 
 color3 LambertWithAOShaderProvider::shade(const RayTriangleIntersectionInfo& interInfo, const Ray& inray, const VertexInterpolation& hi, void* shaderParam) {
-    const Material& m = interInfo.triangle->object.material;
+    const Material& m = interInfo.object->material;
     
     if (m.emission > 0) {
         return m.color * m.emission;
@@ -66,7 +66,7 @@ color3 LambertWithAOShaderProvider::shade(const RayTriangleIntersectionInfo& int
 
 color3 LambertWithAOLightShaderProvider::shade(const RayTriangleIntersectionInfo& interInfo,
                                                const Ray& inray, const VertexInterpolation& vi, void* shaderParam) {
-    const Material& m = interInfo.triangle->object.material;
+    const Material& m = interInfo.object->material;
     
     if (m.emission > 0.0f) {
         return m.color * m.emission;
@@ -0,0 +1,399 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "lightbvh.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+namespace raygen {
+
+using ugm::vec3;
+
+namespace {
+
+constexpr int LIGHT_BVH_BINS = 12;
+// Below this depth splits are chosen by cost; deeper ranges are halved by
+// index, which keeps every root-to-leaf trail within its 64 bits.
+constexpr int LIGHT_BVH_SAH_DEPTH = 32;
+constexpr float LIGHT_BVH_PI = 3.14159265358979f;
+// Largest float below one; the reused sample is clamped to it per level.
+constexpr float LIGHT_BVH_ONE_MINUS_EPSILON = 0.99999994f;
+
+inline float clampCos(float c) {
+    return std::max(-1.0f, std::min(1.0f, c));
+}
+
+// Bounds, power and normal cone of a set of emitters, accumulated one
+// emitter or bin at a time. A cone with cosTheta == -1 is the whole sphere.
+struct LightBounds {
+    vec3 bmin, bmax;
+    vec3 axis;
+    float cosTheta = 1.0f;
+    float power = 0.0f;
+    bool empty = true;
+
+    void add(const vec3& omin, const vec3& omax, const vec3& oaxis, float ocos, float opower) {
+        if (this->empty) {
+            this->bmin = omin;
+            this->bmax = omax;
+            this->axis = oaxis;
+            this->cosTheta = ocos;
+            this->power = opower;
+            this->empty = false;
+            return;
+        }
+        for (int k = 0; k < 3; k++) {
+            this->bmin[k] = std::min(this->bmin[k], omin[k]);
+            this->bmax[k] = std::max(this->bmax[k], omax[k]);
+        }
+        this->power += opower;
+        this->addCone(oaxis, ocos);
+    }
+
+    inline void add(const LightEmitter& e) {
+        this->add(e.bmin, e.bmax, e.axis, e.cosTheta, e.power);
+    }
+
+    inline void add(const LightBounds& b) {
+        if (!b.empty) this->add(b.bmin, b.bmax, b.axis, b.cosTheta, b.power);
+    }
+
+    // Smallest cone around both cones (pbrt-v4's DirectionCone Union).
+    void addCone(const vec3& oaxis, float ocos) {
+        if (this->cosTheta <= -1.0f) return;
+        if (ocos <= -1.0f) {
+            this->cosTheta = -1.0f;
+            return;
+        }
+        const float thetaA = acosf(clampCos(this->cosTheta));
+        const float thetaB = acosf(clampCos(ocos));
+        const float thetaD = acosf(clampCos(dot(this->axis, oaxis)));
+        if (std::min(thetaD + thetaB, LIGHT_BVH_PI) <= thetaA) return;
+        if (std::min(thetaD + thetaA, LIGHT_BVH_PI) <= thetaB) {
+            this->axis = oaxis;
+            this->cosTheta = ocos;
+            return;
+        }
+
+        const float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+        if (thetaO >= LIGHT_BVH_PI) {
+            this->cosTheta = -1.0f;
+            return;
+        }
+        const vec3 wr = cross(this->axis, oaxis);
+        const float wrLen2 = dot(wr, wr);
+        if (wrLen2 < 1e-12f) {
+            this->cosTheta = -1.0f;
+            return;
+        }
+        // Rotate the axis toward `oaxis` by thetaO - thetaA about wr; wr is
+        // perpendicular to the axis, so Rodrigues loses its last term.
+        const vec3 k = wr / sqrtf(wrLen2);
+        const float thetaR = thetaO - thetaA;
+        this->axis = normalize(this->axis * cosf(thetaR) + cross(k, this->axis) * sinf(thetaR));
+        this->cosTheta = cosf(thetaO);
+    }
+
+    inline float surfaceArea() const {
+        const vec3 d = this->bmax - this->bmin;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+};
+
+// Solid-angle measure of a normal cone widened by the π/2 a one-sided
+// emitter spreads around each normal (Conty & Kulla's M_Ω).
+float coneMeasure(float cosTheta) {
+    const float thetaO = acosf(clampCos(cosTheta));
+    const float thetaW = std::min(thetaO + LIGHT_BVH_PI * 0.5f, LIGHT_BVH_PI);
+    const float sinO = sinf(thetaO);
+    return 2.0f * LIGHT_BVH_PI * (1.0f - cosTheta)
+        + LIGHT_BVH_PI * 0.5f * (2.0f * thetaW * sinO - cosf(thetaO - 2.0f * thetaW)
+                                 - 2.0f * thetaO * sinO + cosTheta);
+}
+
+// Conservative estimate of how much a node can light a point at `p`:
+// power over squared distance, times the cosine of the smallest angle
+// between the cone and the direction to `p` once the cone's spread and the
+// angle the bounds subtend are taken off. Zero only when nothing below the
+// node can face `p`.
+float importance(const LightBVHNode& node, const vec3& p) {
+    if (node.power <= 0.0f) return 0.0f;
+
+    const vec3 pc = (node.bmin + node.bmax) * 0.5f;
+    const vec3 diag = node.bmax - node.bmin;
+    const float r2 = std::max(dot(diag, diag) * 0.25f, 1e-12f);
+    const vec3 toP = p - pc;
+    const float d2 = dot(toP, toP);
+    // Inside the bounding sphere every direction is possible.
+    if (d2 <= r2) return node.power / r2;
+
+    const vec3 wi = toP / sqrtf(d2);
+    const float cosW = dot(node.axis, wi);
+    const float sinW = sqrtf(std::max(0.0f, 1.0f - cosW * cosW));
+    const float cosO = node.cosTheta;
+    const float sinO = sqrtf(std::max(0.0f, 1.0f - cosO * cosO));
+
+    // θx = max(0, θw − θo)
+    float cosX = 1.0f, sinX = 0.0f;
+    if (cosW < cosO) {
+        cosX = cosW * cosO + sinW * sinO;
+        sinX = sinW * cosO - cosW * sinO;
+    }
+
+    // θ' = max(0, θx − θb)
+    const float sin2B = r2 / d2;
+    const float cosB = sqrtf(std::max(0.0f, 1.0f - sin2B));
+    const float sinB = sqrtf(sin2B);
+    const float cosP = (cosX > cosB) ? 1.0f : cosX * cosB + sinX * sinB;
+    if (cosP <= 0.0f) return 0.0f;
+
+    return node.power * cosP / d2;
+}
+
+inline float centroid(const LightEmitter& e, int axis) {
+    return (e.bmin[axis] + e.bmax[axis]) * 0.5f;
+}
+
+}
+
+void LightBVH::reset() {
+    this->emitters.clear();
+    this->powerCdf.clear();
+    this->totalPower = 0.0f;
+    this->nodes.clear();
+    this->trails.clear();
+}
+
+void LightBVH::build(const std::vector<const RenderMeshTriangle*>& triangles) {
+    this->reset();
+
+    for (const RenderMeshTriangle* rt : triangles) {
+        const Material& m = rt->object.material;
+        if (m.emission <= 0.0f) continue;
+
+        const color3 Le = m.color * m.emission;
+        const float power = (0.2126f * Le.r + 0.7152f * Le.g + 0.0722f * Le.b) * rt->area;
+        if (!(power > 0.0f)) continue;
+
+        LightEmitter e;
+        e.triangle = rt;
+        e.power = power;
+        e.bmin = rt->bbox.min;
+        e.bmax = rt->bbox.max;
+
+        // Shading normals interpolate the vertex normals, so a cone around
+        // their average that reaches every vertex normal holds them all.
+        const float len = rt->faceNormal.length();
+        if (len > 1e-6f) {
+            e.axis = rt->faceNormal / len;
+            e.cosTheta = 1.0f;
+            for (int k = 0; k < 3; k++) {
+                e.cosTheta = std::min(e.cosTheta, dot(e.axis, normalize(rt->ns[k])));
+            }
+        } else {
+            e.axis = normalize(cross(rt->v2 - rt->v1, rt->v3 - rt->v1));
+            e.cosTheta = -1.0f;
+        }
+
+        this->emitters.push_back(e);
+        this->totalPower += power;
+    }
+
+    const size_t count = this->emitters.size();
+    if (count == 0) return;
+
+    this->powerCdf.resize(count);
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        sum += this->emitters[i].power;
+        this->powerCdf[i] = sum / this->totalPower;
+    }
+    this->powerCdf[count - 1] = 1.0f;
+
+    std::vector<uint32_t> order(count);
+    for (size_t i = 0; i < count; i++) order[i] = (uint32_t)i;
+    this->trails.resize(count);
+    this->nodes.reserve(count * 2 - 1);
+    this->buildRecursive(order, 0, count, 0, 0);
+}
+
+uint32_t LightBVH::buildRecursive(std::vector<uint32_t>& order, size_t begin, size_t end,
+                                  uint64_t trail, int depth) {
+    const uint32_t index = (uint32_t)this->nodes.size();
+    this->nodes.push_back(LightBVHNode());
+
+    LightBounds bounds;
+    for (size_t i = begin; i < end; i++) {
+        bounds.add(this->emitters[order[i]]);
+    }
+    {
+        LightBVHNode& node = this->nodes[index];
+        node.bmin = bounds.bmin;
+        node.bmax = bounds.bmax;
+        node.power = bounds.power;
+        node.axis = bounds.axis;
+        node.cosTheta = bounds.cosTheta;
+    }
+
+    if (end - begin == 1) {
+        LightBVHNode& node = this->nodes[index];
+        node.leaf = 1;
+        node.secondOrEmitter = order[begin];
+        this->trails[order[begin]] = trail;
+        return index;
+    }
+
+    // Binned split on the surface area orientation heuristic: each side
+    // costs power × cone measure × surface area, and thin axes are
+    // penalised by the bounds' aspect so flat light panels aren't sliced
+    // across their normal.
+    size_t mid = begin + (end - begin) / 2;
+    if (depth < LIGHT_BVH_SAH_DEPTH) {
+        vec3 cmin, cmax;
+        for (int k = 0; k < 3; k++) {
+            cmin[k] = FLT_MAX;
+            cmax[k] = -FLT_MAX;
+        }
+        for (size_t i = begin; i < end; i++) {
+            for (int k = 0; k < 3; k++) {
+                const float c = centroid(this->emitters[order[i]], k);
+                cmin[k] = std::min(cmin[k], c);
+                cmax[k] = std::max(cmax[k], c);
+            }
+        }
+
+        const vec3 extent = bounds.bmax - bounds.bmin;
+        const float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+
+        float bestCost = FLT_MAX;
+        int bestAxis = -1, bestSplit = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            const float range = cmax[axis] - cmin[axis];
+            if (!(range > 0.0f)) continue;
+
+            LightBounds bins[LIGHT_BVH_BINS];
+            const float scale = LIGHT_BVH_BINS / range;
+            for (size_t i = begin; i < end; i++) {
+                const LightEmitter& e = this->emitters[order[i]];
+                const int b = std::min(LIGHT_BVH_BINS - 1, (int)((centroid(e, axis) - cmin[axis]) * scale));
+                bins[b].add(e);
+            }
+
+            LightBounds below[LIGHT_BVH_BINS];
+            LightBounds acc;
+            for (int b = 0; b < LIGHT_BVH_BINS - 1; b++) {
+                acc.add(bins[b]);
+                below[b] = acc;
+            }
+            const float kr = (extent[axis] > 0.0f) ? maxExtent / extent[axis] : 1.0f;
+            acc = LightBounds();
+            for (int b = LIGHT_BVH_BINS - 1; b > 0; b--) {
+                acc.add(bins[b]);
+                const LightBounds& left = below[b - 1];
+                if (left.empty || acc.empty) continue;
+                const float cost = kr * (left.power * coneMeasure(left.cosTheta) * left.surfaceArea()
+                                         + acc.power * coneMeasure(acc.cosTheta) * acc.surfaceArea());
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        if (bestAxis >= 0) {
+            const float scale = LIGHT_BVH_BINS / (cmax[bestAxis] - cmin[bestAxis]);
+            const float lo = cmin[bestAxis];
+            const auto split = std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t e) {
+                const int b = std::min(LIGHT_BVH_BINS - 1, (int)((centroid(this->emitters[e], bestAxis) - lo) * scale));
+                return b < bestSplit;
+            });
+            const size_t m = (size_t)(split - order.begin());
+            if (m > begin && m < end) mid = m;
+        }
+    }
+
+    this->buildRecursive(order, begin, mid, trail, depth + 1);
+    const uint32_t second = this->buildRecursive(order, mid, end, trail | (1ull << depth), depth + 1);
+
+    LightBVHNode& node = this->nodes[index];
+    node.leaf = 0;
+    node.secondOrEmitter = second;
+    return index;
+}
+
+int LightBVH::sample(const vec3& p, float u, float& pmf) const {
+    pmf = 0.0f;
+    if (this->nodes.empty()) return -1;
+
+    uint32_t index = 0;
+    float prob = 1.0f;
+    if (this->nodes[0].leaf && importance(this->nodes[0], p) <= 0.0f) return -1;
+
+    while (!this->nodes[index].leaf) {
+        const LightBVHNode& node = this->nodes[index];
+        const float c0 = importance(this->nodes[index + 1], p);
+        const float c1 = importance(this->nodes[node.secondOrEmitter], p);
+        if (c0 <= 0.0f && c1 <= 0.0f) return -1;
+
+        // One uniform drives the whole descent: the part of it left after
+        // each choice is rescaled to [0,1) for the next level.
+        const float p0 = c0 / (c0 + c1);
+        if (u < p0) {
+            index = index + 1;
+            u = std::min(u / p0, LIGHT_BVH_ONE_MINUS_EPSILON);
+            prob *= p0;
+        } else {
+            index = node.secondOrEmitter;
+            u = std::min((u - p0) / (1.0f - p0), LIGHT_BVH_ONE_MINUS_EPSILON);
+            prob *= 1.0f - p0;
+        }
+    }
+
+    pmf = prob;
+    return (int)this->nodes[index].secondOrEmitter;
+}
+
+float LightBVH::pmf(const vec3& p, int emitter) const {
+    if (emitter < 0 || this->nodes.empty()) return 0.0f;
+    if (this->nodes[0].leaf) return importance(this->nodes[0], p) > 0.0f ? 1.0f : 0.0f;
+
+    uint32_t index = 0;
+    uint64_t trail = this->trails[emitter];
+    float prob = 1.0f;
+    while (!this->nodes[index].leaf) {
+        const LightBVHNode& node = this->nodes[index];
+        const float c0 = importance(this->nodes[index + 1], p);
+        const float c1 = importance(this->nodes[node.secondOrEmitter], p);
+        const float sum = c0 + c1;
+        if (sum <= 0.0f) return 0.0f;
+
+        if (trail & 1) {
+            prob *= c1 / sum;
+            index = node.secondOrEmitter;
+        } else {
+            prob *= c0 / sum;
+            index = index + 1;
+        }
+        trail >>= 1;
+    }
+    return prob;
+}
+
+int LightBVH::samplePower(float u, float& pmf) const {
+    pmf = 0.0f;
+    if (this->emitters.empty()) return -1;
+
+    const auto it = std::upper_bound(this->powerCdf.begin(), this->powerCdf.end(), u);
+    const int index = std::min((int)(it - this->powerCdf.begin()), (int)this->emitters.size() - 1);
+    pmf = this->powerPmf(index);
+    return index;
+}
+
+}
@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __raygen_lightbvh_h__
+#define __raygen_lightbvh_h__
+
+#include <vector>
+#include <cstdint>
+#include "ugm/types3d.h"
+#include "raycommon.h"
+
+namespace raygen {
+
+// One emissive triangle. `power` is luminance(color × emission) × area, the
+// flux it sends out up to a constant; the normal cone (`axis`, `cosTheta`)
+// bounds every shading normal on the triangle. Emission is one-sided.
+struct LightEmitter {
+    const RenderMeshTriangle* triangle;
+    float power;
+    ugm::vec3 bmin, bmax;
+    ugm::vec3 axis;
+    float cosTheta;
+};
+
+// Light BVH node: bounds, total power and the union normal cone of the
+// emitters below. Nodes are stored depth-first, so an inner node's left
+// child follows it and `secondOrEmitter` is the right child; a leaf holds
+// exactly one emitter and `secondOrEmitter` is its index.
+struct LightBVHNode {
+    ugm::vec3 bmin;
+    float power;
+    ugm::vec3 bmax;
+    float cosTheta;
+    ugm::vec3 axis;
+    uint32_t secondOrEmitter : 31;
+    uint32_t leaf : 1;
+};
+
+// Picks the emissive triangle a shading point sends its shadow ray to.
+//
+// Every emissive triangle goes into one flat emitter array. Without a
+// receiver position the pick is proportional to power (`samplePower`), so a
+// small dim panel no longer gets the same share of shadow rays as a large
+// bright one. With a position the pick descends a BVH over the emitters,
+// choosing each child by an importance estimate — power, distance to the
+// node and how far its normal cone faces away from the receiver (Conty &
+// Kulla 2018, in the form pbrt-v4 uses) — so nearby lights facing the point
+// get the rays and the ones behind it get none.
+//
+// `pmf` gives back the probability of having picked a given emitter, which
+// is what the emission-hit side of MIS needs. It retraces the emitter's
+// root-to-leaf path recorded at build time, so it costs one importance pair
+// per level and no search; the power-only pmf is a single division.
+class LightBVH {
+public:
+    // Collects the emissive triangles of `triangles` (material emission > 0
+    // with a non-black color) and builds the tree over them.
+    void build(const std::vector<const RenderMeshTriangle*>& triangles);
+    void reset();
+
+    inline bool empty() const { return this->emitters.empty(); }
+    inline size_t size() const { return this->emitters.size(); }
+    inline const LightEmitter& emitter(int index) const { return this->emitters[index]; }
+    inline const std::vector<LightEmitter>& getEmitters() const { return this->emitters; }
+
+    // Spatial pick for a receiver at `p`. Returns the emitter index, or -1
+    // when no emitter can light `p` (everything faces away).
+    int sample(const ugm::vec3& p, float u, float& pmf) const;
+    float pmf(const ugm::vec3& p, int emitter) const;
+
+    // Power-proportional pick, independent of the receiver.
+    int samplePower(float u, float& pmf) const;
+    inline float powerPmf(int emitter) const {
+        return this->totalPower > 0.0f ? this->emitters[emitter].power / this->totalPower : 0.0f;
+    }
+
+private:
+    std::vector<LightEmitter> emitters;
+    std::vector<float> powerCdf;
+    float totalPower = 0.0f;
+
+    std::vector<LightBVHNode> nodes;
+    // Child choices from the root to each emitter's leaf, one bit per level
+    // (1 = right), lowest bit first.
+    std::vector<uint64_t> trails;
+
+    uint32_t buildRecursive(std::vector<uint32_t>& order, size_t begin, size_t end,
+                            uint64_t trail, int depth);
+};
+
+}
+
+#endif /* __raygen_lightbvh_h__ */
@@ -177,11 +177,11 @@ public:
     float  sigma_t_hero = 0.0f;      // average channel for free-flight pdf
     vec3   coneAxisN = vec3(0.0f, 0.0f, -1.0f);  // normalised coneAxis (world)
 
-    // Render-space cache. The renderer transforms scene geometry into the
-    // BVH's "view space" (viewMatrix · modelMatrix) once per render(); cone
-    // params authored in world space need the same transform applied so the
-    // ray-marched evaluation hits the right region. bake() refreshes these
-    // before tracePath sees the medium for the first time on a frame.
+    // Render-space cache. The renderer builds the BVH in world space
+    // (modelMatrix only; eye rays are moved out of camera space), and cone
+    // params need the same transform as the geometry so the ray-marched
+    // evaluation hits the right region. bake() refreshes these before
+    // tracePath sees the medium for the first time on a frame.
     vec3   coneOriginR = vec3::zero;
     vec3   coneAxisR   = vec3(0.0f, 0.0f, -1.0f);
 
@@ -0,0 +1,366 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "pathguide.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+namespace raygen {
+
+using ugm::vec3;
+
+namespace {
+
+constexpr float PATH_GUIDE_PI = 3.14159265358979f;
+constexpr float PATH_GUIDE_ONE_MINUS_EPSILON = 0.99999994f;
+// A directional quadrant holding more than this share of its tree's energy
+// is subdivided for the next iteration (Müller et al. use the same 1%).
+constexpr float PATH_GUIDE_SUBDIVIDE_SHARE = 0.01f;
+constexpr int PATH_GUIDE_MAX_DIRECTION_DEPTH = 20;
+// Spatial leaves split once an iteration leaves more than this many records
+// times sqrt(iteration) in them. The paper scales by the square root of the
+// iteration's sample count; every adaptive pass here takes the same number
+// of samples, so the iteration count stands in for it.
+constexpr double PATH_GUIDE_SPATIAL_RECORDS = 4000.0;
+constexpr int PATH_GUIDE_MAX_SPATIAL_DEPTH = 48;
+// Records a thread queues before taking the lock.
+constexpr size_t PATH_GUIDE_RECORD_BATCH = 4096;
+
+inline float clampUnit(float v) {
+    return std::max(0.0f, std::min(PATH_GUIDE_ONE_MINUS_EPSILON, v));
+}
+
+inline void directionToSquare(const vec3& d, float& x, float& y) {
+    float phi = atan2f(d.y, d.x);
+    if (phi < 0.0f) phi += 2.0f * PATH_GUIDE_PI;
+    x = clampUnit((d.z + 1.0f) * 0.5f);
+    y = clampUnit(phi * (0.5f / PATH_GUIDE_PI));
+}
+
+inline vec3 squareToDirection(float x, float y) {
+    const float cosTheta = 2.0f * x - 1.0f;
+    const float sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    const float phi = 2.0f * PATH_GUIDE_PI * y;
+    return vec3(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+}
+
+struct GuideRecord {
+    uint32_t leaf;
+    vec3 dir;
+    float value;
+};
+
+// Records of the current thread, queued for `owner`. Render threads flush
+// before they exit, so a buffer left pointing at another guide is empty.
+struct GuideRecordBuffer {
+    const PathGuide* owner = NULL;
+    std::vector<GuideRecord> records;
+};
+
+thread_local GuideRecordBuffer g_guideRecords;
+
+}
+
+///////////////////////// GuideDirectionTree /////////////////////////
+
+GuideDirectionTree::GuideDirectionTree() {
+    this->nodes.assign(1, Node());
+    Node& root = this->nodes[0];
+    for (int q = 0; q < 4; q++) {
+        root.sum[q] = 0.0f;
+        root.child[q] = 0;
+    }
+}
+
+void GuideDirectionTree::record(const vec3& dir, float value) {
+    float x, y;
+    directionToSquare(dir, x, y);
+
+    uint32_t n = 0;
+    while (true) {
+        const int ix = x >= 0.5f ? 1 : 0;
+        const int iy = y >= 0.5f ? 1 : 0;
+        const int q = ix + 2 * iy;
+        Node& node = this->nodes[n];
+        if (node.child[q] == 0) {
+            node.sum[q] += value;
+            return;
+        }
+        x = 2.0f * x - (float)ix;
+        y = 2.0f * y - (float)iy;
+        n = node.child[q];
+    }
+}
+
+void GuideDirectionTree::build() {
+    this->buildRecursive(0);
+}
+
+float GuideDirectionTree::buildRecursive(uint32_t node) {
+    float total = 0.0f;
+    for (int q = 0; q < 4; q++) {
+        const uint32_t c = this->nodes[node].child[q];
+        if (c != 0) {
+            const float s = this->buildRecursive(c);
+            this->nodes[node].sum[q] = s;
+        }
+        total += this->nodes[node].sum[q];
+    }
+    return total;
+}
+
+bool GuideDirectionTree::sample(float u0, float u1, vec3& outDir, float& outPdf) const {
+    // Each level picks a column with u0 and a row within it with u1, then
+    // rescales both, so a level costs one bit of each and 20 levels stay
+    // within float precision.
+    u0 = clampUnit(u0);
+    u1 = clampUnit(u1);
+
+    float ox = 0.0f, oy = 0.0f, size = 1.0f;
+    float pdf = 1.0f;
+    uint32_t n = 0;
+
+    while (true) {
+        const Node& node = this->nodes[n];
+        const float total = node.sum[0] + node.sum[1] + node.sum[2] + node.sum[3];
+        if (total <= 0.0f) return false;
+
+        int ix;
+        const float pLeft = (node.sum[0] + node.sum[2]) / total;
+        if (u0 < pLeft) {
+            ix = 0;
+            u0 = u0 / pLeft;
+        } else {
+            ix = 1;
+            u0 = (u0 - pLeft) / (1.0f - pLeft);
+        }
+        u0 = clampUnit(u0);
+
+        int iy;
+        const float column = node.sum[ix] + node.sum[ix + 2];
+        const float pBottom = node.sum[ix] / column;
+        if (u1 < pBottom) {
+            iy = 0;
+            u1 = u1 / pBottom;
+        } else {
+            iy = 1;
+            u1 = (u1 - pBottom) / (1.0f - pBottom);
+        }
+        u1 = clampUnit(u1);
+
+        const int q = ix + 2 * iy;
+        pdf *= 4.0f * node.sum[q] / total;
+        size *= 0.5f;
+        ox += (float)ix * size;
+        oy += (float)iy * size;
+
+        if (node.child[q] == 0) break;
+        n = node.child[q];
+    }
+
+    outDir = squareToDirection(ox + u0 * size, oy + u1 * size);
+    outPdf = pdf * (0.25f / PATH_GUIDE_PI);
+    return true;
+}
+
+float GuideDirectionTree::pdf(const vec3& dir) const {
+    float x, y;
+    directionToSquare(dir, x, y);
+
+    float pdf = 1.0f;
+    uint32_t n = 0;
+    while (true) {
+        const Node& node = this->nodes[n];
+        const float total = node.sum[0] + node.sum[1] + node.sum[2] + node.sum[3];
+        if (total <= 0.0f) return 0.0f;
+
+        const int ix = x >= 0.5f ? 1 : 0;
+        const int iy = y >= 0.5f ? 1 : 0;
+        const int q = ix + 2 * iy;
+        pdf *= 4.0f * node.sum[q] / total;
+        if (node.child[q] == 0) break;
+        x = 2.0f * x - (float)ix;
+        y = 2.0f * y - (float)iy;
+        n = node.child[q];
+    }
+    return pdf * (0.25f / PATH_GUIDE_PI);
+}
+
+void GuideDirectionTree::refineFrom(const GuideDirectionTree& source, float threshold, int maxDepth) {
+    *this = GuideDirectionTree();
+    const float total = source.total();
+    if (total <= 0.0f) return;
+    this->refineRecursive(source, 0, 0, source.nodes[0].sum, total, threshold, 1, maxDepth);
+}
+
+void GuideDirectionTree::refineRecursive(const GuideDirectionTree& source, uint32_t node, int sourceNode,
+                                         const float energy[4], float total, float threshold,
+                                         int depth, int maxDepth) {
+    if (depth >= maxDepth) return;
+
+    for (int q = 0; q < 4; q++) {
+        if (energy[q] <= total * threshold) continue;
+
+        // Below a source leaf the energy is taken as uniform over the
+        // quadrant, so a bright leaf keeps splitting until its quarters
+        // drop under the threshold.
+        float childEnergy[4];
+        int childSource = -1;
+        if (sourceNode >= 0 && source.nodes[sourceNode].child[q] != 0) {
+            childSource = (int)source.nodes[sourceNode].child[q];
+            for (int k = 0; k < 4; k++) childEnergy[k] = source.nodes[childSource].sum[k];
+        } else {
+            for (int k = 0; k < 4; k++) childEnergy[k] = energy[q] * 0.25f;
+        }
+
+        const uint32_t c = (uint32_t)this->nodes.size();
+        this->nodes.push_back(GuideDirectionTree().nodes[0]);
+        this->nodes[node].child[q] = c;
+        this->refineRecursive(source, c, childSource, childEnergy, total, threshold, depth + 1, maxDepth);
+    }
+}
+
+///////////////////////// PathGuide /////////////////////////
+
+void PathGuide::reset(const vec3& bmin, const vec3& bmax) {
+    const vec3 size = bmax - bmin;
+    this->extent = std::max(std::max(size.x, size.y), std::max(size.z, 1e-4f));
+    // A little margin so hits on the bounds don't all clamp into the
+    // outermost leaves.
+    this->extent *= 1.01f;
+    this->origin = (bmin + bmax) * 0.5f - vec3(this->extent, this->extent, this->extent) * 0.5f;
+
+    SpatialNode root;
+    root.child[0] = root.child[1] = 0;
+    root.leaf = 0;
+    root.axis = 0;
+    this->nodes.assign(1, root);
+    this->leaves.assign(1, SpatialLeaf());
+    this->iteration = 0;
+    this->training = true;
+}
+
+uint32_t PathGuide::findLeaf(const vec3& p) const {
+    const float inv = 1.0f / this->extent;
+    float q[3] = {
+        clampUnit((p.x - this->origin.x) * inv),
+        clampUnit((p.y - this->origin.y) * inv),
+        clampUnit((p.z - this->origin.z) * inv),
+    };
+
+    uint32_t n = 0;
+    while (this->nodes[n].child[0] != 0) {
+        const SpatialNode& node = this->nodes[n];
+        float& c = q[node.axis];
+        if (c < 0.5f) {
+            c = 2.0f * c;
+            n = node.child[0];
+        } else {
+            c = clampUnit(2.0f * c - 1.0f);
+            n = node.child[1];
+        }
+    }
+    return this->nodes[n].leaf;
+}
+
+const GuideDirectionTree* PathGuide::lookup(const vec3& p) const {
+    if (this->iteration == 0 || this->nodes.empty()) return NULL;
+    const GuideDirectionTree& tree = this->leaves[this->findLeaf(p)].sampling;
+    return tree.total() > 0.0f ? &tree : NULL;
+}
+
+void PathGuide::record(const vec3& p, const vec3& dir, float value) {
+    // NaN, infinities and negative estimates would poison the sums.
+    if (!(value >= 0.0f) || value > FLT_MAX) return;
+
+    GuideRecordBuffer& buffer = g_guideRecords;
+    if (buffer.owner != this) {
+        buffer.records.clear();
+        buffer.owner = this;
+    }
+
+    GuideRecord r;
+    r.leaf = this->findLeaf(p);
+    r.dir = dir;
+    r.value = value;
+    buffer.records.push_back(r);
+
+    if (buffer.records.size() >= PATH_GUIDE_RECORD_BATCH) {
+        this->flushThreadRecords();
+    }
+}
+
+void PathGuide::flushThreadRecords() {
+    GuideRecordBuffer& buffer = g_guideRecords;
+    if (buffer.owner != this || buffer.records.empty()) return;
+
+    std::lock_guard<std::mutex> lock(this->recordLock);
+    for (const GuideRecord& r : buffer.records) {
+        SpatialLeaf& leaf = this->leaves[r.leaf];
+        leaf.records += 1.0;
+        if (r.value > 0.0f) leaf.recording.record(r.dir, r.value);
+    }
+    buffer.records.clear();
+}
+
+void PathGuide::splitRecursive(uint32_t node, int depth, double threshold) {
+    if (this->nodes[node].child[0] != 0) {
+        const uint32_t left = this->nodes[node].child[0];
+        const uint32_t right = this->nodes[node].child[1];
+        this->splitRecursive(left, depth + 1, threshold);
+        this->splitRecursive(right, depth + 1, threshold);
+        return;
+    }
+
+    const uint32_t leaf = this->nodes[node].leaf;
+    if (this->leaves[leaf].records <= threshold || depth >= PATH_GUIDE_MAX_SPATIAL_DEPTH) return;
+
+    // Both halves start from the parent's trees and half its records;
+    // they diverge from the next iteration on.
+    this->leaves[leaf].records *= 0.5;
+    const uint32_t copy = (uint32_t)this->leaves.size();
+    this->leaves.push_back(this->leaves[leaf]);
+
+    const int childAxis = (this->nodes[node].axis + 1) % 3;
+    SpatialNode child;
+    child.child[0] = child.child[1] = 0;
+    child.axis = childAxis;
+
+    const uint32_t left = (uint32_t)this->nodes.size();
+    child.leaf = leaf;
+    this->nodes.push_back(child);
+    child.leaf = copy;
+    this->nodes.push_back(child);
+
+    this->nodes[node].child[0] = left;
+    this->nodes[node].child[1] = left + 1;
+
+    this->splitRecursive(left, depth + 1, threshold);
+    this->splitRecursive(left + 1, depth + 1, threshold);
+}
+
+void PathGuide::refine() {
+    if (this->nodes.empty()) return;
+
+    this->splitRecursive(0, 0, PATH_GUIDE_SPATIAL_RECORDS * sqrt((double)(this->iteration + 1)));
+
+    for (SpatialLeaf& leaf : this->leaves) {
+        leaf.recording.build();
+        // A region nobody recorded into this time keeps what it had.
+        if (leaf.recording.total() > 0.0f) {
+            leaf.sampling = leaf.recording;
+        }
+        leaf.recording.refineFrom(leaf.sampling, PATH_GUIDE_SUBDIVIDE_SHARE, PATH_GUIDE_MAX_DIRECTION_DEPTH);
+        leaf.records = 0.0;
+    }
+
+    this->iteration++;
+}
+
+}
@@ -0,0 +1,133 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __raygen_pathguide_h__
+#define __raygen_pathguide_h__
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include "ugm/types3d.h"
+
+namespace raygen {
+
+// Directional distribution of incident radiance at one region of space, as
+// a quadtree over the equal-area square of directions: x = (cosθ + 1) / 2,
+// y = φ / 2π. Equal areas on the square are equal solid angles, so a
+// density on the square is 4π times the density on the sphere. Each node
+// keeps the energy of its four quadrants (index = ix + 2·iy); a quadrant
+// with a child node is subdivided further.
+class GuideDirectionTree {
+public:
+    GuideDirectionTree();
+
+    // Adds `value` to the leaf quadrant containing `dir`.
+    void record(const ugm::vec3& dir, float value);
+    // Sums the recorded leaf energy up into the inner quadrants. Recording
+    // only touches leaves; run this once before sampling from the tree.
+    void build();
+
+    inline float total() const {
+        const Node& root = this->nodes[0];
+        return root.sum[0] + root.sum[1] + root.sum[2] + root.sum[3];
+    }
+
+    // Draws a direction proportional to the recorded energy and returns
+    // its solid-angle pdf; false when the tree holds no energy.
+    bool sample(float u0, float u1, ugm::vec3& outDir, float& outPdf) const;
+    // Solid-angle pdf `sample` would have drawn `dir` with.
+    float pdf(const ugm::vec3& dir) const;
+
+    // Replaces this tree with an empty one shaped after `source`'s energy:
+    // quadrants holding more than `threshold` of the total are subdivided
+    // (down to `maxDepth` levels), the rest stay or become leaves.
+    void refineFrom(const GuideDirectionTree& source, float threshold, int maxDepth);
+
+private:
+    struct Node {
+        float sum[4];
+        // 0 = leaf quadrant; the root is never anyone's child.
+        uint32_t child[4];
+    };
+    std::vector<Node> nodes;
+
+    float buildRecursive(uint32_t node);
+    void refineRecursive(const GuideDirectionTree& source, uint32_t node, int sourceNode,
+                         const float energy[4], float total, float threshold,
+                         int depth, int maxDepth);
+};
+
+// Online-learned guiding distribution for the diffuse bounce ("Practical
+// Path Guiding for Efficient Light-Transport Simulation", Müller et al.
+// 2017): a binary kd-tree over the scene bounds, each leaf holding one
+// directional quadtree to sample from and one being recorded into.
+//
+// Training runs in iterations. During an iteration shaders record the
+// radiance their bounce and light samples brought back; `refine` then
+// splits spatial leaves that collected many records, promotes every
+// recorded tree to the sampling tree, and restarts recording on a tree
+// subdivided where the new distribution puts its energy. Sampling trees
+// are read-only while the render threads run; records go to a per-thread
+// buffer and reach the shared trees in batches under a lock.
+class PathGuide {
+public:
+    // Drops everything learned and starts over with one spatial leaf
+    // covering [bmin, bmax], grown into a cube.
+    void reset(const ugm::vec3& bmin, const ugm::vec3& bmax);
+
+    // True once an iteration has been refined, so `lookup` can return trees.
+    inline bool trained() const { return this->iteration > 0; }
+    // Whether shaders should call `record` at all; off after training.
+    inline bool recording() const { return this->training; }
+    inline void setRecording(bool on) { this->training = on; }
+
+    // Sampling tree of the region containing `p`, or NULL when guiding is
+    // not trained there yet (nothing recorded, or before the first refine).
+    const GuideDirectionTree* lookup(const ugm::vec3& p) const;
+
+    // Queues `value` (an incident radiance estimate, already divided by the
+    // pdf its direction was drawn with) for `dir` at `p`.
+    void record(const ugm::vec3& p, const ugm::vec3& dir, float value);
+    // Hands this thread's queued records to the recording trees. Every
+    // render thread calls it before it exits.
+    void flushThreadRecords();
+
+    // Ends an iteration; see the class comment. Not thread-safe, run it
+    // between passes.
+    void refine();
+
+private:
+    struct SpatialNode {
+        // Children are both valid or both 0; a leaf indexes `leaves`.
+        uint32_t child[2];
+        uint32_t leaf;
+        int axis;
+    };
+    struct SpatialLeaf {
+        GuideDirectionTree sampling;
+        GuideDirectionTree recording;
+        double records = 0.0;
+    };
+
+    ugm::vec3 origin;
+    float extent = 1.0f;
+    std::vector<SpatialNode> nodes;
+    std::vector<SpatialLeaf> leaves;
+    int iteration = 0;
+    bool training = false;
+    std::mutex recordLock;
+
+    uint32_t findLeaf(const ugm::vec3& p) const;
+    // Splits every leaf below `node` holding more than `threshold` records,
+    // alternating the axis per level.
+    void splitRecursive(uint32_t node, int depth, double threshold);
+};
+
+}
+
+#endif /* __raygen_pathguide_h__ */
@@ -9,6 +9,7 @@
 #include "raycommon.h"
 #include <cmath>
 #include <cstdint>
+#include <algorithm>
 
 namespace raygen {
 
@@ -25,9 +26,38 @@ constexpr int LDS_PRIMES[LDS_MAX_DIM] = {
     2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53
 };
 
+LowDiscrepancySequence g_ldsSequence = LowDiscrepancySequence::Halton;
+// ZSobol: index bits given to the samples of one pixel, and the Morton
+// tiles the image is cut into so pixel and sample bits fit 32 bits.
+int g_ldsSampleBits = 0;
+int g_ldsTileBits = 0;
+
 thread_local int g_ldsSampleIdx = 0;
 thread_local uint32_t g_ldsPixelScramble = 0;
 thread_local int g_ldsDim = 0;
+// ZSobol: Morton index of the pixel within its tile, and the tile's seed.
+thread_local uint32_t g_ldsMorton = 0;
+thread_local uint32_t g_ldsTileSeed = 0;
+
+// Counter-based PRNG: draw n of a stream is a pure function of (key, n),
+// so no state is shared between threads and a pixel-sample sees the same
+// numbers whichever thread renders it and whatever that thread rendered
+// before. The key is set per pixel-sample by ldsBeginPixelSample.
+thread_local uint64_t g_rngKey = 0;
+thread_local uint32_t g_rngDraws = 0;
+
+// SplitMix64 finaliser. Fed key + n * golden ratio it is the SplitMix
+// generator itself, evaluated at an arbitrary position instead of stepped.
+inline uint64_t splitMix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t rngStreamKey(int x, int y, int sampleIdx) {
+    const uint64_t id = ((uint64_t)(uint32_t)x << 40) ^ ((uint64_t)(uint32_t)y << 20) ^ (uint32_t)sampleIdx;
+    return splitMix64(id + 0x9e3779b97f4a7c15ull);
+}
 
 // PCG-style integer hash for the per-pixel scramble seed. Cheap, decent
 // mixing; good enough to decorrelate neighbouring pixels without producing
@@ -60,15 +90,142 @@ inline float radicalInverse(uint32_t i, int base) {
     return v < 1.0f ? v : 0.9999999f;
 }
 
+// Generator matrices of Sobol dims 0 and 1, one column per index bit.
+// Together they form a (0,2)-sequence: every power-of-two prefix
+// stratifies the unit square in all elementary intervals.
+constexpr uint32_t SOBOL_DIRECTIONS[2][32] = {
+    {
+        0x80000000u, 0x40000000u, 0x20000000u, 0x10000000u, 0x08000000u, 0x04000000u, 0x02000000u, 0x01000000u,
+        0x00800000u, 0x00400000u, 0x00200000u, 0x00100000u, 0x00080000u, 0x00040000u, 0x00020000u, 0x00010000u,
+        0x00008000u, 0x00004000u, 0x00002000u, 0x00001000u, 0x00000800u, 0x00000400u, 0x00000200u, 0x00000100u,
+        0x00000080u, 0x00000040u, 0x00000020u, 0x00000010u, 0x00000008u, 0x00000004u, 0x00000002u, 0x00000001u,
+    },
+    {
+        0x80000000u, 0xc0000000u, 0xa0000000u, 0xf0000000u, 0x88000000u, 0xcc000000u, 0xaa000000u, 0xff000000u,
+        0x80800000u, 0xc0c00000u, 0xa0a00000u, 0xf0f00000u, 0x88880000u, 0xcccc0000u, 0xaaaa0000u, 0xffff0000u,
+        0x80008000u, 0xc000c000u, 0xa000a000u, 0xf000f000u, 0x88008800u, 0xcc00cc00u, 0xaa00aa00u, 0xff00ff00u,
+        0x80808080u, 0xc0c0c0c0u, 0xa0a0a0a0u, 0xf0f0f0f0u, 0x88888888u, 0xccccccccu, 0xaaaaaaaau, 0xffffffffu,
+    },
+};
+
+inline uint32_t sobolSample(uint32_t index, int dim) {
+    uint32_t x = 0;
+    for (int bit = 0; index != 0; bit++, index >>= 1) {
+        if (index & 1) x ^= SOBOL_DIRECTIONS[dim][bit];
+    }
+    return x;
+}
+
+inline uint32_t reverseBits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Owen scrambling by hashing (Burley 2020, "Practical Hash-based Owen
+// Scrambling"): a Laine-Karras style hash only lets lower bits affect
+// higher ones, so run on the reversed value it flips each bit depending
+// on the bits above it, which is what a nested uniform scramble does.
+inline uint32_t owenScramble(uint32_t x, uint32_t seed) {
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits(x);
+}
+
+// Dim `dim` of point `sampleIdx` of a sequence scrambled by `seed`. Dims
+// are paired; each pair owns an index shuffle (itself an Owen scramble of
+// the index) and each dim its own value scramble.
+inline float sobolNext(uint32_t sampleIdx, int dim, uint32_t seed) {
+    const uint32_t pairSeed = hashPixel(dim >> 1, 1, seed);
+    const uint32_t index = owenScramble(sampleIdx, pairSeed);
+    const uint32_t x = owenScramble(sobolSample(index, dim & 1), hashPixel(dim, 2, seed));
+    return (x >> 8) * (1.0f / (float)(1u << 24));
+}
+
+// Interleaves the low `bits` bits of x and y, x in the even positions.
+inline uint32_t mortonCode(uint32_t x, uint32_t y, int bits) {
+    uint32_t m = 0;
+    for (int i = 0; i < bits; i++) {
+        m |= ((x >> i) & 1u) << (2 * i);
+        m |= ((y >> i) & 1u) << (2 * i + 1);
+    }
+    return m;
+}
+
 } // namespace
 
-void ldsBeginPixelSample(int x, int y, int sampleIdx) {
+void ldsSetSequence(LowDiscrepancySequence sequence, int samplesPerPixel) {
+    g_ldsSequence = sequence;
+
+    g_ldsSampleBits = 0;
+    while ((1 << g_ldsSampleBits) < samplesPerPixel && g_ldsSampleBits < 16) g_ldsSampleBits++;
+    g_ldsTileBits = std::min(8, (32 - g_ldsSampleBits) / 2);
+}
+
+void ldsBeginPixelSample(int x, int y, int sampleIdx, int dim, int draws) {
     g_ldsSampleIdx = sampleIdx;
     g_ldsPixelScramble = hashPixel(x, y, 0);
-    g_ldsDim = 0;
+    g_ldsDim = dim;
+    if (g_ldsSequence == LowDiscrepancySequence::ZSobol) {
+        const uint32_t mask = (1u << g_ldsTileBits) - 1;
+        g_ldsMorton = mortonCode((uint32_t)x & mask, (uint32_t)y & mask, g_ldsTileBits);
+        g_ldsTileSeed = hashPixel(x >> g_ldsTileBits, y >> g_ldsTileBits, 0x9e3779b9u);
+    }
+    g_rngKey = rngStreamKey(x, y, sampleIdx);
+    g_rngDraws = (uint32_t)draws;
+}
+
+int ldsDimension() {
+    return g_ldsDim;
+}
+
+int randomDraws() {
+    return (int)g_rngDraws;
+}
+
+float randomValue() {
+    const uint64_t v = splitMix64(g_rngKey + (uint64_t)g_rngDraws++ * 0x9e3779b97f4a7c15ull);
+    // Top 24 bits: every value is exact in a float and strictly below 1.
+    return (float)(v >> 40) * (1.0f / (float)(1u << 24));
+}
+
+vec3 randomDirectionInHemisphere(const vec3& normal) {
+    // Uniform over the hemisphere: cos(theta) is uniform in [0, 1).
+    const float z = randomValue();
+    const float phi = 2.0f * M_PI * randomValue();
+    const float r = sqrtf(fmaxf(0.0f, 1.0f - z * z));
+
+    vec3 tangent;
+    if (fabs(normal.x) > fabs(normal.y)) {
+        tangent = normalize(cross(vec3(0.0f, 1.0f, 0.0f), normal));
+    } else {
+        tangent = normalize(cross(vec3(1.0f, 0.0f, 0.0f), normal));
+    }
+    const vec3 bitangent = cross(normal, tangent);
+
+    return normalize(tangent * (r * cosf(phi)) + bitangent * (r * sinf(phi)) + normal * z);
 }
 
 float ldsNext1D() {
+    if (g_ldsSequence == LowDiscrepancySequence::ZSobol
+        && (uint32_t)g_ldsSampleIdx < (1u << g_ldsSampleBits)) {
+        // One sequence per tile, pixel after pixel in Morton order. The
+        // index shuffle maps aligned power-of-two blocks onto aligned
+        // blocks, so any Morton quad of pixels holds a stratified chunk
+        // of the sequence and its error comes out as blue noise.
+        const uint32_t index = (g_ldsMorton << g_ldsSampleBits) | (uint32_t)g_ldsSampleIdx;
+        return sobolNext(index, g_ldsDim++, g_ldsTileSeed);
+    }
+    if (g_ldsSequence != LowDiscrepancySequence::Halton) {
+        return sobolNext((uint32_t)g_ldsSampleIdx, g_ldsDim++, g_ldsPixelScramble);
+    }
+
     if (g_ldsDim >= LDS_MAX_DIM) return randomValue();
     const int base = LDS_PRIMES[g_ldsDim];
     const float v = radicalInverse((uint32_t)g_ldsSampleIdx + 1, base);
@@ -87,6 +244,9 @@ float ldsNext1D() {
 }
 
 void ldsNext2D(float& u, float& v) {
+    // Start on a Sobol pair so (u, v) gets the 2D stratification, not two
+    // halves of neighbouring pairs.
+    if (g_ldsSequence != LowDiscrepancySequence::Halton && (g_ldsDim & 1)) g_ldsDim++;
     u = ldsNext1D();
     v = ldsNext1D();
 }
@@ -148,6 +308,16 @@ void RenderMeshTriangle::precalc() {
     this->pdf = 1.0f / this->area;
 }
 
+void RenderMeshTriangle::setGeometry(const vec3& v1, const vec3& v2, const vec3& v3,
+	const vec3& n1, const vec3& n2, const vec3& n3) {
+	this->v1 = v1; this->v2 = v2; this->v3 = v3;
+	this->n1 = n1; this->n2 = n2; this->n3 = n3;
+
+	this->precalc();
+	this->faceNormal = (n1 + n2 + n3) / 3.0f;
+	this->bbox = BoundingBox::fromTriangle(v1, v2, v3);
+}
+
 bool RenderMeshTriangle::intersectsRay(const Ray& ray, float maxt, float& t, vec3& hit) const {
 //	const float dist = -dot(this->ti.l, vec4(ray.origin, 1.0f)) / dot(this->ti.l, vec4(ray.dir, 0.0f));
 //
@@ -230,6 +400,8 @@ bool RenderMeshTriangle::intersectsRay(const Ray& ray, RayTriangleIntersectionIn
     info.v = v;
     info.w = 1.0f - u - v;
     info.triangle = this;
+    info.object = &this->object;
+    info.normalMatrix = NULL;
     
     return true;
 }
@@ -62,10 +62,42 @@ vec3 ldsPointInTriangle(const Triangle& tri);
 // Halton dimension and advances. Call ldsBeginPixelSample at the top of each
 // pixel-sample loop so the first few dims get stratified across samples; at
 // high dims we fall back to the PRNG, which is fine for tail bounces.
-void ldsBeginPixelSample(int x, int y, int sampleIdx);
+// `dim` and `draws` resume a pixel-sample part way through, e.g. when the
+// eye ray was generated earlier with ldsDimension() dims and randomDraws()
+// PRNG values already drawn.
+void ldsBeginPixelSample(int x, int y, int sampleIdx, int dim = 0, int draws = 0);
+
+// Sequence behind ldsNext1D, shared by every thread; set it before the
+// render threads start. Halton takes one prime base per dim and hands dims
+// past its table to the PRNG. Sobol draws dims in 2D pairs from an
+// Owen-scrambled (0,2)-sequence with the sample index shuffled per pair,
+// so every dim of a deep path stays stratified. ZSobol (Ahmed & Wonka,
+// "Screen-Space Blue-Noise Diffusion of Monte Carlo Sampling Error via
+// Hierarchical Ordering of Pixels") runs one such sequence across
+// Morton-ordered pixels, `samplesPerPixel` points each, so neighbouring
+// pixels share stratification and the error is blue noise; samples past
+// that count fall back to per-pixel Sobol.
+enum class LowDiscrepancySequence { Halton, Sobol, ZSobol };
+void ldsSetSequence(LowDiscrepancySequence sequence, int samplesPerPixel = 1);
+int ldsDimension();
+int randomDraws();
 float ldsNext1D();
 void ldsNext2D(float& u, float& v);
 
+// Renderer PRNG, in place of ugm's randomValue() and rand(): uniform
+// [0, 1) from a counter-based stream keyed by the current pixel-sample.
+// Lock-free, and a render comes out the same for any thread count or tile
+// order. Code that runs outside a pixel-sample should start its own with
+// ldsBeginPixelSample first.
+float randomValue();
+vec3 randomDirectionInHemisphere(const vec3& normal);
+
+// Uniform index in [0, count), count > 0.
+inline int randomIndex(int count) {
+	const int i = (int)(randomValue() * (float)count);
+	return i < count ? i : count - 1;
+}
+
 inline Ray ThicknessRay(const vec3& origin, const vec3& dir) {
 	return Ray(origin + dir.normalize() * SURFACE_THICKNESS, dir);
 }
@@ -141,6 +173,10 @@ public:
 
 	BoundingBox bbox;
 
+	// Slot in the renderer's light sampler when the triangle is emissive,
+	// -1 otherwise; lets an emission hit look up its selection pmf directly.
+	int emitterIndex = -1;
+
 	const SceneObject& object;
 	const Mesh& mesh;
 
@@ -158,6 +194,12 @@ public:
 		this->bbox = BoundingBox::fromTriangle(v1, v2, v3);
 	}
 
+	// Moves the triangle in place (vertex animation, a new transform) and
+	// redoes what the constructor derives from positions and normals. UVs,
+	// object and mesh are kept.
+	void setGeometry(const vec3& v1, const vec3& v2, const vec3& v3,
+		const vec3& n1, const vec3& n2, const vec3& n3);
+
 	void precalc();
 	bool intersectsRay(const Ray& ray, float maxt, float& t, vec3& hit) const;
     bool intersectsRay(const Ray& ray, RayTriangleIntersectionInfo& interInfo) const;
@@ -170,13 +212,32 @@ struct RayTriangleIntersectionInfo {
     float t;        // disance
     vec3 hit;       // hit point
     float u, v, w;  // hit interpolation middle info
+
+    // Placement that was hit. Instanced meshes share one set of mesh-local
+    // triangles between every SceneObject that references them, so
+    // `triangle->object` only names the first placement — always read the
+    // material / visibility through this pointer instead.
+    const SceneObject* object;
+    // Mesh-local → view normal transform for instanced hits; NULL when the
+    // triangle was already baked into view space. `hit` is always view space.
+    const Matrix4* normalMatrix;
     
     RayTriangleIntersectionInfo(const RenderMeshTriangle* triangle = NULL, float t = MAX_RAY_DISTANCE,
                                 vec3 hit = vec3::zero, float u = 0, float v = 0, float w = 0)
-        : triangle(triangle), t(t), hit(hit), u(u), v(v), w(w)
+        : triangle(triangle), t(t), hit(hit), u(u), v(v), w(w),
+          object(triangle != NULL ? &triangle->object : NULL), normalMatrix(NULL)
     {
         
     }
+
+    inline vec3 toViewNormal(const vec3& n) const {
+        return this->normalMatrix == NULL ? n : (vec4(n, 0.0f) * *this->normalMatrix).xyz.normalize();
+    }
+
+    // View-space unit geometric normal of the hit triangle.
+    inline vec3 geometricNormal() const {
+        return this->toViewNormal(this->triangle->ti.normalizedpd);
+    }
 };
 
 struct RayMeshIntersection {
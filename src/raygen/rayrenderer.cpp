@@ -31,18 +31,10 @@
 
 #define TRACE_LIGHT_TRIES 1
 #define TRACE_PATH_TRIES 1
-// Safety cap on recursion. Russian Roulette handles typical path termination
-// (see RayBSDFShaderProvider::shade), so this only bounds worst-case depth.
-// Glass / refractive meshes can chain 10+ internal Fresnel bounces on
-// concave geometry, so the cap needs headroom above the diffuse norm.
-#define MAX_TRACE_DEPTH 32
-// Start Russian Roulette after this many bounces so early, high-throughput
-// bounces are always traced — only the tail of the path is stochastic.
-#define MIN_RR_DEPTH 3
-// Continuation probability is clamped to this range: low enough that dim
-// paths can die quickly, high enough that variance from 1/q stays bounded.
-#define RR_MIN_PROB 0.05f
-#define RR_MAX_PROB 0.95f
+
+// Triangles per work item when transformScene() builds the triangles in
+// parallel; small enough to spread one large mesh over every thread.
+#define TRANSFORM_CHUNK_TRIANGLES 4096
 
 #define PP_GLOW_SIZE_ASPECT 0.15
 #define PP_GLOW_GAMMA 1.4
@@ -80,9 +72,6 @@ RayRenderer::RayRenderer(const RendererSettings* settings) {
     this->setRenderSize(this->settings.resolutionWidth, this->settings.resolutionHeight);
 
     this->cullBackFace = settings->cullBackFace;
-    
-    /* initialize random seed */
-    srand((unsigned int)time(NULL));
 }
 
 RayRenderer::~RayRenderer() {
@@ -98,8 +87,8 @@ void RayRenderer::initRenderThreadContext(RenderThreadContext* ctx) {
     const Camera* camera = this->scene->mainCamera;
     if (camera == NULL) camera = &this->defaultCamera;
     
-    const sizei& renderingImageSize = this->renderingImage.getSize();
-    ctx->renderSize = sizef((float)renderingImageSize.width, (float)renderingImageSize.height);
+    // Not renderingImage's size: a streaming render never allocates it.
+    ctx->renderSize = sizef((float)this->renderWidth, (float)this->renderHeight);
     ctx->halfRenderSize = sizef(ctx->renderSize.width * 0.5f, ctx->renderSize.height * 0.5f);
     
     ctx->aspectRate = ctx->renderSize.width / ctx->renderSize.height;
@@ -118,7 +107,7 @@ void RayRenderer::initRenderThreadContext(RenderThreadContext* ctx) {
     ctx->viewScaleY = (2.0f * tanHalfFov) / ctx->renderSize.height;
     ctx->viewScaleX = ctx->viewScaleY;
 
-    // Legacy fields kept for any consumer that still reads them; not used by renderPixel.
+    // Legacy fields kept for any consumer that still reads them; not used by the tracer.
     ctx->viewportSize = sizef(ctx->viewScaleX * ctx->renderSize.width,
                               ctx->viewScaleY * ctx->renderSize.height);
 
@@ -136,12 +125,6 @@ void RayRenderer::clearRenderResult() {
 }
 
 void RayRenderer::clearTransformedScene() {
-    for (const auto& p : this->meshTriangles) {
-        for (const auto* rt : p.second) {
-            delete rt;
-        }
-    }
-    
     this->meshTriangles.clear();
     
     for (auto tmesh : this->transformedMeshes) {
@@ -149,15 +132,170 @@ void RayRenderer::clearTransformedScene() {
     }
     
     this->transformedMeshes.clear();
-    this->areaLightSources.clear();
+
+    for (const auto& p : this->instancedMeshes) {
+        delete p.second;
+    }
+
+    this->instancedMeshes.clear();
+    this->instances.clear();
+    this->instanceBvh.reset();
+    this->meshPlacements.clear();
+
+    this->lightBvh.reset();
     this->pointLightSources.clear();
-    this->emissiveVolumeSources.clear();
+    this->transformedScene = NULL;
+
+    // Last: the lists and BVHs above only pointed into it.
+    this->triangleArena.clear();
+}
+
+RenderMeshTriangle* RenderTriangleArena::allocate(size_t count) {
+    if (count == 0) return NULL;
+
+    Block block;
+    block.data = static_cast<RenderMeshTriangle*>(::operator new(count * sizeof(RenderMeshTriangle)));
+    block.count = count;
+    this->blocks.push_back(block);
+    this->count += count;
+    return block.data;
+}
+
+void RenderTriangleArena::clear() {
+    for (const Block& block : this->blocks) {
+        for (size_t i = 0; i < block.count; i++) {
+            block.data[i].~RenderMeshTriangle();
+        }
+        ::operator delete(block.data);
+    }
+    this->blocks.clear();
+    this->count = 0;
+}
+
+// A run of one mesh's triangles for the parallel triangle build. `out` and
+// `list` are the whole mesh's; a chunk fills indices [begin, end) of both.
+struct TriangleBuildChunk {
+    RenderMeshTriangle* out;
+    RayRenderTriangleList* list;
+    BoundingBox* meshBbox;
+    const Mesh* mesh;
+    const SceneObject* object;
+    // NULL keeps the triangles mesh-local (instanced meshes).
+    const Matrix4* modelMatrix;
+    const Matrix4* normalMatrix;
+    uint begin, end;
+    BoundingBox bbox;
+};
+
+static void addTriangleChunks(std::vector<TriangleBuildChunk>& chunks, const TriangleBuildChunk& mesh) {
+    const uint count = (uint)mesh.list->size();
+    for (uint begin = 0; begin < count; begin += TRANSFORM_CHUNK_TRIANGLES) {
+        TriangleBuildChunk c = mesh;
+        c.begin = begin;
+        c.end = std::min(count, begin + TRANSFORM_CHUNK_TRIANGLES);
+        chunks.push_back(c);
+    }
+}
+
+static void buildTriangleChunk(TriangleBuildChunk& c) {
+    const Mesh& mesh = *c.mesh;
+
+    for (uint k = c.begin; k < c.end; k++) {
+        vec3 v1, v2, v3, n1, n2, n3;
+        vec2 uv1, uv2, uv3, uv4, uv5, uv6;
+
+        mesh.getVertex(k, &v1, &v2, &v3);
+        mesh.getNormal(k, &n1, &n2, &n3);
+
+        if (mesh.uvCount > 0) {
+            mesh.getUV(0, k, &uv1, &uv2, &uv3);
+        }
+        if (mesh.uvCount > 1) {
+            mesh.getUV(1, k, &uv4, &uv5, &uv6);
+        }
+
+        if (c.modelMatrix != NULL) {
+            v1 = (vec4(v1, 1.0f) * *c.modelMatrix).xyz;
+            v2 = (vec4(v2, 1.0f) * *c.modelMatrix).xyz;
+            v3 = (vec4(v3, 1.0f) * *c.modelMatrix).xyz;
+
+            n1 = (vec4(n1, 0.0f) * *c.normalMatrix).xyz;
+            n2 = (vec4(n2, 0.0f) * *c.normalMatrix).xyz;
+            n3 = (vec4(n3, 0.0f) * *c.normalMatrix).xyz;
+        }
+
+        RenderMeshTriangle* rt = new (&c.out[k]) RenderMeshTriangle(v1, v2, v3,
+                                                                    n1.normalize(), n2.normalize(), n3.normalize(),
+                                                                    uv1, uv2, uv3,
+                                                                    uv4, uv5, uv6,
+                                                                    *c.object, mesh);
+        (*c.list)[k] = rt;
+
+        if (k == c.begin) {
+            c.bbox.initTo(v1);
+        } else {
+            c.bbox.expandTo(v1);
+        }
+        c.bbox.expandTo(v2);
+        c.bbox.expandTo(v3);
+    }
+}
+
+// Builds every chunk on up to `threads` threads, then gathers the chunk
+// bounds into each mesh's box.
+static void buildTriangleChunks(std::vector<TriangleBuildChunk>& chunks, int threads) {
+    std::atomic<size_t> nextChunk{0};
+    auto worker = [&chunks, &nextChunk] {
+        for (size_t i = nextChunk++; i < chunks.size(); i = nextChunk++) {
+            buildTriangleChunk(chunks[i]);
+        }
+    };
+
+    threads = std::max(1, std::min(threads, (int)chunks.size()));
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++) pool.push_back(std::thread(worker));
+    worker();
+    for (std::thread& th : pool) th.join();
+
+    for (const TriangleBuildChunk& c : chunks) {
+        if (c.begin == 0) {
+            c.meshBbox->initTo(c.bbox.min);
+        } else {
+            c.meshBbox->expandTo(c.bbox.min);
+        }
+        c.meshBbox->expandTo(c.bbox.max);
+    }
+    for (const TriangleBuildChunk& c : chunks) {
+        if (c.begin == 0) c.meshBbox->finalize();
+    }
 }
 
 void RayRenderer::transformScene() {
     if (this->scene == NULL) return;
 
     this->triangleList.clear();
+    this->instances.clear();
+    this->meshTransformJobs.clear();
+    this->sceneObjectBounds.clear();
+
+    // Count placements per mesh up front so transformObject knows which
+    // meshes to share. Mirrors transformObject's own visibility walk.
+    this->meshPlacements.clear();
+    if (this->settings.enableInstancing) {
+        std::function<void(const SceneObject*)> countObj = [&](const SceneObject* obj) {
+            if (obj->renderable && obj->material.emission <= 0) {
+                for (const Mesh* mesh : obj->getMeshes()) {
+                    this->meshPlacements[mesh]++;
+                }
+            }
+            for (const SceneObject* child : obj->getObjects()) {
+                if (child->visible) countObj(child);
+            }
+        };
+        for (const SceneObject* obj : this->scene->getObjects()) {
+            if (obj->visible) countObj(obj);
+        }
+    }
 
     for (SceneObject* obj : this->scene->getObjects()) {
         if (obj->visible) {
@@ -165,17 +303,91 @@ void RayRenderer::transformScene() {
         }
     }
 
-    this->bvh.build(this->triangleList);
+    // The walk sized every mesh; build all their triangles into one block.
+    size_t triangleCount = 0;
+    for (const MeshTransformJob& job : this->meshTransformJobs) {
+        triangleCount += job.tmesh->triangleList.size();
+    }
+    RenderMeshTriangle* triangles = this->triangleArena.allocate(triangleCount);
+
+    std::vector<TriangleBuildChunk> chunks;
+    for (MeshTransformJob& job : this->meshTransformJobs) {
+        TriangleBuildChunk c;
+        c.out = triangles + job.first;
+        c.list = &job.tmesh->triangleList;
+        c.meshBbox = &job.tmesh->bbox;
+        c.mesh = job.tmesh->mesh;
+        c.object = job.object;
+        c.modelMatrix = &job.modelMatrix;
+        c.normalMatrix = &job.normalMatrix;
+        addTriangleChunks(chunks, c);
+    }
+    buildTriangleChunks(chunks, this->settings.threads);
+
+    this->triangleList.reserve(triangleCount);
+    for (const MeshTransformJob& job : this->meshTransformJobs) {
+        const RayRenderTriangleList& list = job.tmesh->triangleList;
+        if (list.empty()) continue;
+
+        this->triangleList.insert(this->triangleList.end(), list.begin(), list.end());
+        auto& meshList = this->meshTriangles[job.tmesh->mesh];
+        meshList.insert(meshList.end(), list.begin(), list.end());
+
+        SceneObjectBounds& ob = this->sceneObjectBounds[job.bounds];
+        if (ob.empty) {
+            ob.bbox.initTo(job.tmesh->bbox.min);
+            ob.empty = false;
+        } else {
+            ob.bbox.expandTo(job.tmesh->bbox.min);
+        }
+        ob.bbox.expandTo(job.tmesh->bbox.max);
+    }
+    for (SceneObjectBounds& ob : this->sceneObjectBounds) {
+        ob.bbox.finalize();
+        ob.object->worldBbox = ob.bbox;
+    }
+
+    this->bvh.build(this->triangleList, this->settings.threads, this->settings.bvhWidth,
+                    this->settings.bvhQuality);
+    this->instanceBvh.build(this->instances);
+    this->buildLightSampler();
+
+    this->transformedScene = this->scene;
+
+    //    int count = 0;
+    //    for (const auto& m : this->meshTriangles) {
+    //        count += m.second.size();
+    //    }
+    //    printf("polygons: %d\n", count);
+}
+
+void RayRenderer::buildLightSampler() {
+    // The renderer allocated these; the lists only hand out const.
+    for (const LightEmitter& e : this->lightBvh.getEmitters()) {
+        const_cast<RenderMeshTriangle*>(e.triangle)->emitterIndex = -1;
+    }
+
+    this->lightBvh.build(this->triangleList);
 
-    // Bake any participating-medium cone params into render space (the BVH
-    // and all rays operate in viewMatrix-transformed coordinates). Authored
-    // values are world-space; a single matrix mult per medium per frame is
-    // negligible vs. the per-sample emissionAt evaluation that would
-    // otherwise need to undo the transform on every step.
+    const auto& emitters = this->lightBvh.getEmitters();
+    for (size_t i = 0; i < emitters.size(); i++) {
+        const_cast<RenderMeshTriangle*>(emitters[i].triangle)->emitterIndex = (int)i;
+    }
+}
+
+void RayRenderer::prepareMedia() {
+    this->emissiveVolumeSources.clear();
+    this->hasInteriorMedia = false;
+    if (this->scene == NULL) return;
+
+    // Bake any participating-medium cone params into render space. The
+    // transformed scene and all rays are world space, so only the model
+    // transform applies. Re-run every render() rather than with the cached
+    // geometry, since medium sliders don't invalidate the scene.
+    Matrix4 ident; ident.loadIdentity();
     if (this->scene->globalMedium != NULL) {
         // No owning object — globalMedium can't follow anything; pass identity.
-        Matrix4 ident; ident.loadIdentity();
-        this->scene->globalMedium->bake(this->viewMatrix, ident);
+        this->scene->globalMedium->bake(ident, ident);
     }
     // Emissive-volume registration (Phase 4 NEE light list). Anything with
     // interiorMedium that has cone intensity > 0 (procedural) or non-zero
@@ -189,8 +401,9 @@ void RayRenderer::transformScene() {
             // the SceneObject's location/angle/scale chain.
             Matrix4 modelMatrix; modelMatrix.loadIdentity();
             obj->getWorldTransform(&modelMatrix);
-            obj->interiorMedium->bake(this->viewMatrix, modelMatrix);
+            obj->interiorMedium->bake(ident, modelMatrix);
             const HomogeneousMedium* m = obj->interiorMedium;
+            if (m->isActive()) this->hasInteriorMedia = true;
             const bool emissiveCone = (m->emissionMode == HomogeneousMedium::EmissionMode_Cone)
                                       && (m->coneIntensity > 0.0f);
             const bool emissiveConst = (m->emissionMode == HomogeneousMedium::EmissionMode_Constant)
@@ -205,12 +418,6 @@ void RayRenderer::transformScene() {
         for (SceneObject* child : obj->getObjects()) bakeObj(child);
     };
     for (SceneObject* obj : this->scene->getObjects()) bakeObj(obj);
-
-    //    int count = 0;
-    //    for (const auto& m : this->meshTriangles) {
-    //        count += m.second.size();
-    //    }
-    //    printf("polygons: %d\n", count);
 }
 
 bool isSharedEdgeUV2(const Mesh& mesh, uint currentTid, const vec2& refv1, const vec2& refv2) {
@@ -234,6 +441,50 @@ bool isSharedEdgeUV2(const Mesh& mesh, uint currentTid, const vec2& refv1, const
     return false;
 }
 
+const RayInstancedMesh* RayRenderer::getInstancedMesh(const Mesh& mesh, const SceneObject& obj) {
+    auto it = this->instancedMeshes.find(&mesh);
+    if (it != this->instancedMeshes.end()) return it->second;
+
+    RayInstancedMesh* imesh = new RayInstancedMesh();
+    imesh->mesh = &mesh;
+    this->instancedMeshes[&mesh] = imesh;
+
+    imesh->triangleList.resize(mesh.getTriangleCount());
+
+    TriangleBuildChunk c;
+    c.out = this->triangleArena.allocate(mesh.getTriangleCount());
+    c.list = &imesh->triangleList;
+    c.meshBbox = &imesh->bbox;
+    c.mesh = &mesh;
+    c.object = &obj;
+    c.modelMatrix = NULL;
+    c.normalMatrix = NULL;
+
+    std::vector<TriangleBuildChunk> chunks;
+    addTriangleChunks(chunks, c);
+    buildTriangleChunks(chunks, this->settings.threads);
+
+    imesh->bvh.build(imesh->triangleList, this->settings.threads, this->settings.bvhWidth,
+                     this->settings.bvhQuality);
+
+    return imesh;
+}
+
+// Conservative view-space bounds of a mesh-local box: the box of its eight
+// transformed corners.
+static BoundingBox transformBoundingBox(const BoundingBox& b, const Matrix4& m) {
+    BoundingBox out;
+    for (int i = 0; i < 8; i++) {
+        const vec3 c((i & 1) ? b.max.x : b.min.x,
+                     (i & 2) ? b.max.y : b.min.y,
+                     (i & 4) ? b.max.z : b.min.z);
+        const vec3 p = (vec4(c, 1.0f) * m).xyz;
+        if (i == 0) out.initTo(p); else out.expandTo(p);
+    }
+    out.finalize();
+    return out;
+}
+
 void RayRenderer::transformObject(SceneTransformStack& transformStack, SceneObject& obj) {
     transformStack.pushObject(obj);
     
@@ -243,114 +494,94 @@ void RayRenderer::transformObject(SceneTransformStack& transformStack, SceneObje
     
     BoundingBox bbox;
     bool first = true;
+    bool hasJobs = false;
     
-    const Matrix4& viewModelMatrix = this->viewMatrix * this->transformStack->modelMatrix;
-
-    Matrix4 normalMatrix = viewModelMatrix;
-    normalMatrix.inverse();
-    normalMatrix.transpose();
+    // Triangles are kept in world space so the transformed scene survives
+    // camera moves; eye rays are carried into world space instead.
+    const Matrix4& modelMatrix = this->transformStack->modelMatrix;
+    const Matrix4 normalMatrix = this->transformStack->normalMatrix;
     
     if (obj.renderable && meshes.size() > 0) {
 //        int count = 0;
         
         for (const Mesh* mesh : obj.getMeshes()) {
-            auto& triangleList = this->meshTriangles[mesh];
-            
-            RayTransformedMesh* tmesh = new RayTransformedMesh();
-            tmesh->mesh = mesh;
-            this->transformedMeshes.push_back(tmesh);
-            
-            for (uint k = 0; k < mesh->getTriangleCount(); k++) {
-                vec3 v1, v2, v3, n1, n2, n3;
-                vec2 uv1, uv2, uv3, uv4, uv5, uv6;
-                
-                mesh->getVertex(k, &v1, &v2, &v3);
-                mesh->getNormal(k, &n1, &n2, &n3);
-                
-                if (mesh->uvCount > 0) {
-                    mesh->getUV(0, k, &uv1, &uv2, &uv3);
-                }
-                if (mesh->uvCount > 1) {
-                    mesh->getUV(1, k, &uv4, &uv5, &uv6);
-                }
-                
-                v1 = (vec4(v1, 1.0f) * viewModelMatrix).xyz;
-                v2 = (vec4(v2, 1.0f) * viewModelMatrix).xyz;
-                v3 = (vec4(v3, 1.0f) * viewModelMatrix).xyz;
-                
-                n1 = (vec4(n1, 0.0f) * normalMatrix).xyz.normalize();
-                n2 = (vec4(n2, 0.0f) * normalMatrix).xyz.normalize();
-                n3 = (vec4(n3, 0.0f) * normalMatrix).xyz.normalize();
-                
-                RenderMeshTriangle* rt = new RenderMeshTriangle(v1, v2, v3,
-                                                              n1, n2, n3,
-                                                              uv1, uv2, uv3,
-                                                              uv4, uv5, uv6,
-                                                              obj, *mesh);
-                
-//                rt->uvt2Info.shared.e1 = isSharedEdgeUV2(*mesh, k, uv5, uv4);
-//                rt->uvt2Info.shared.e2 = isSharedEdgeUV2(*mesh, k, uv6, uv4);
-//                rt->uvt2Info.shared.e3 = isSharedEdgeUV2(*mesh, k, uv6, uv5);
-                
+            const auto placement = this->meshPlacements.find(mesh);
+            if (m.emission <= 0 && placement != this->meshPlacements.end() && placement->second > 1) {
+                const RayInstancedMesh* imesh = this->getInstancedMesh(*mesh, obj);
+                if (imesh->triangleList.empty()) continue;
+
+                BVHInstance inst;
+                inst.blas = &imesh->bvh;
+                inst.object = &obj;
+                inst.toLocal = modelMatrix;
+                inst.toLocal.inverse();
+                inst.normalMatrix = normalMatrix;
+                inst.bbox = transformBoundingBox(imesh->bbox, modelMatrix);
+                this->instances.push_back(inst);
+
                 if (first) {
-                    bbox.initTo(v1);
-                    bbox.expandTo(v2);
-                    bbox.expandTo(v3);
-                    
+                    bbox.initTo(inst.bbox.min);
                     first = false;
+                } else {
+                    bbox.expandTo(inst.bbox.min);
                 }
-                else {
-                    bbox.expandTo(v1);
-                    bbox.expandTo(v2);
-                    bbox.expandTo(v3);
-                }
-                
-                triangleList.push_back(rt);
-
-                this->triangleList.push_back(rt);
-                
-                tmesh->triangleList.push_back(rt);
-            }
-            
-            bbox.finalize();
-            tmesh->bbox = bbox;
-            
-            const int level = (int)log10(tmesh->triangleList.size() - 1);
-            
-            if (level > 0) {
-                tmesh->triangleTree.initSpace(tmesh->bbox, level);
+                bbox.expandTo(inst.bbox.max);
+                continue;
             }
-            
-            for (const auto rt : triangleList) {
-                this->putTriangleIntoTree(&tmesh->triangleTree.root, rt);
+
+            RayTransformedMesh* tmesh = new RayTransformedMesh();
+            tmesh->mesh = mesh;
+            tmesh->triangleList.resize(mesh->getTriangleCount());
+            this->transformedMeshes.push_back(tmesh);
+
+            // Built by transformScene() once the walk has sized the arena.
+            MeshTransformJob job;
+            job.tmesh = tmesh;
+            job.object = &obj;
+            job.modelMatrix = modelMatrix;
+            job.normalMatrix = normalMatrix;
+            job.first = 0;
+            if (!this->meshTransformJobs.empty()) {
+                const MeshTransformJob& last = this->meshTransformJobs.back();
+                job.first = last.first + last.tmesh->triangleList.size();
             }
+            job.bounds = this->sceneObjectBounds.size();
+            this->meshTransformJobs.push_back(job);
+            hasJobs = true;
         }
     }
     
-    bbox.finalize();
-    obj.worldBbox = bbox;
+    if (hasJobs) {
+        // worldBbox is completed once the triangles exist.
+        SceneObjectBounds ob;
+        ob.object = &obj;
+        ob.bbox = bbox;
+        ob.empty = first;
+        this->sceneObjectBounds.push_back(ob);
+    } else {
+        bbox.finalize();
+        obj.worldBbox = bbox;
+    }
     
-    if (m.emission > 0) {
+    // Emissive meshes are sampled per triangle through lightBvh, built once
+    // the triangles exist; an emitter without meshes is a point light.
+    if (m.emission > 0 && obj.getMeshes().size() <= 0) {
         
         LightSource ls;
         ls.object = &obj;
         
-        if (obj.getMeshes().size() > 0) {
-            this->areaLightSources.push_back(ls);
-        } else {
-            const float s1 = sinf(RADIAN_TO_DEGREE(obj.angle.x));
-            const float c1 = cosf(RADIAN_TO_DEGREE(obj.angle.x));
-            const float s2 = sinf(RADIAN_TO_DEGREE(obj.angle.y));
-            const float c2 = cosf(RADIAN_TO_DEGREE(obj.angle.y));
-            
-            vec3 v = (vec4(0.0f, 0.0f, 0.0f, 1.0f) * viewModelMatrix).xyz;
-            vec3 n = (vec4(normalize(vec3(c2 * s1, c2 * c1, s2)), 0.0f) * normalMatrix).xyz;
-            
-            ls.transformedLocation = v;
-            ls.transformedNormal = n;
-            
-            this->pointLightSources.push_back(ls);
-        }
+        const float s1 = sinf(RADIAN_TO_DEGREE(obj.angle.x));
+        const float c1 = cosf(RADIAN_TO_DEGREE(obj.angle.x));
+        const float s2 = sinf(RADIAN_TO_DEGREE(obj.angle.y));
+        const float c2 = cosf(RADIAN_TO_DEGREE(obj.angle.y));
+        
+        vec3 v = (vec4(0.0f, 0.0f, 0.0f, 1.0f) * modelMatrix).xyz;
+        vec3 n = (vec4(normalize(vec3(c2 * s1, c2 * c1, s2)), 0.0f) * normalMatrix).xyz;
+        
+        ls.transformedLocation = v;
+        ls.transformedNormal = n;
+        
+        this->pointLightSources.push_back(ls);
     }
     
     for (SceneObject* child : obj.getObjects()) {
@@ -362,6 +593,174 @@ void RayRenderer::transformObject(SceneTransformStack& transformStack, SceneObje
     transformStack.popObject();
 }
 
+bool RayRenderer::refitScene() {
+    if (this->scene == NULL) return false;
+
+    // Shared meshes first: placements below take their bounds from these.
+    // The triangles are mesh-local, so only vertex edits move them.
+    for (auto& p : this->instancedMeshes) {
+        const Mesh& mesh = *p.first;
+        RayInstancedMesh* imesh = p.second;
+        if (imesh->triangleList.size() != mesh.getTriangleCount()) return false;
+        if (imesh->triangleList.empty()) continue;
+
+        for (uint k = 0; k < mesh.getTriangleCount(); k++) {
+            vec3 v1, v2, v3, n1, n2, n3;
+            mesh.getVertex(k, &v1, &v2, &v3);
+            mesh.getNormal(k, &n1, &n2, &n3);
+
+            // The renderer allocated these; the lists only hand out const.
+            RenderMeshTriangle* rt = const_cast<RenderMeshTriangle*>(imesh->triangleList[k]);
+            rt->setGeometry(v1, v2, v3, n1.normalize(), n2.normalize(), n3.normalize());
+
+            if (k == 0) {
+                imesh->bbox.initTo(v1);
+            } else {
+                imesh->bbox.expandTo(v1);
+            }
+            imesh->bbox.expandTo(v2);
+            imesh->bbox.expandTo(v3);
+        }
+        imesh->bbox.finalize();
+        imesh->bvh.refit(this->settings.threads);
+    }
+
+    // refitObject bails out without popping what it pushed; the reset puts
+    // the stack back the way transformScene expects it.
+    SceneRefitCursor cursor;
+    for (SceneObject* obj : this->scene->getObjects()) {
+        if (obj->visible && !this->refitObject(*this->transformStack, *obj, cursor)) {
+            this->transformStack->reset();
+            return false;
+        }
+    }
+    if (cursor.mesh != this->transformedMeshes.size()
+        || cursor.instance != this->instances.size()
+        || cursor.pointLight != this->pointLightSources.size()) {
+        return false;
+    }
+
+    this->bvh.refit(this->settings.threads);
+    // Placements are few; a fresh top-level build is as cheap as a refit.
+    this->instanceBvh.build(this->instances);
+    // Likewise the light tree, which also picks up emitter colour edits.
+    this->buildLightSampler();
+    return true;
+}
+
+bool RayRenderer::refitObject(SceneTransformStack& transformStack, SceneObject& obj, SceneRefitCursor& cursor) {
+    transformStack.pushObject(obj);
+
+    const Material& m = obj.material;
+
+    BoundingBox bbox;
+    bool first = true;
+
+    const Matrix4& modelMatrix = this->transformStack->modelMatrix;
+    const Matrix4 normalMatrix = this->transformStack->normalMatrix;
+
+    // Same walk as transformObject, so every cached piece is met in the
+    // order it was created; anything out of step means the structure
+    // changed under an invalidateGeometry() and the caller rebuilds.
+    if (obj.renderable && obj.getMeshes().size() > 0) {
+        for (const Mesh* mesh : obj.getMeshes()) {
+            const auto placement = this->meshPlacements.find(mesh);
+            if (m.emission <= 0 && placement != this->meshPlacements.end() && placement->second > 1) {
+                const auto it = this->instancedMeshes.find(mesh);
+                if (it == this->instancedMeshes.end()) return false;
+                if (it->second->triangleList.empty()) continue;
+                if (cursor.instance >= this->instances.size()) return false;
+
+                BVHInstance& inst = this->instances[cursor.instance++];
+                if (inst.object != &obj || inst.blas != &it->second->bvh) return false;
+                inst.toLocal = modelMatrix;
+                inst.toLocal.inverse();
+                inst.normalMatrix = normalMatrix;
+                inst.bbox = transformBoundingBox(it->second->bbox, modelMatrix);
+
+                if (first) {
+                    bbox.initTo(inst.bbox.min);
+                    first = false;
+                } else {
+                    bbox.expandTo(inst.bbox.min);
+                }
+                bbox.expandTo(inst.bbox.max);
+                continue;
+            }
+
+            if (cursor.mesh >= this->transformedMeshes.size()) return false;
+            RayTransformedMesh* tmesh = const_cast<RayTransformedMesh*>(this->transformedMeshes[cursor.mesh++]);
+            if (tmesh->mesh != mesh || tmesh->triangleList.size() != mesh->getTriangleCount()) return false;
+            if (tmesh->triangleList.empty()) continue;
+
+            // The mesh's own box; merged into the object's below.
+            BoundingBox meshBbox;
+
+            for (uint k = 0; k < mesh->getTriangleCount(); k++) {
+                vec3 v1, v2, v3, n1, n2, n3;
+                mesh->getVertex(k, &v1, &v2, &v3);
+                mesh->getNormal(k, &n1, &n2, &n3);
+
+                v1 = (vec4(v1, 1.0f) * modelMatrix).xyz;
+                v2 = (vec4(v2, 1.0f) * modelMatrix).xyz;
+                v3 = (vec4(v3, 1.0f) * modelMatrix).xyz;
+
+                n1 = (vec4(n1, 0.0f) * normalMatrix).xyz.normalize();
+                n2 = (vec4(n2, 0.0f) * normalMatrix).xyz.normalize();
+                n3 = (vec4(n3, 0.0f) * normalMatrix).xyz.normalize();
+
+                RenderMeshTriangle* rt = const_cast<RenderMeshTriangle*>(tmesh->triangleList[k]);
+                rt->setGeometry(v1, v2, v3, n1, n2, n3);
+
+                if (k == 0) {
+                    meshBbox.initTo(v1);
+                } else {
+                    meshBbox.expandTo(v1);
+                }
+                meshBbox.expandTo(v2);
+                meshBbox.expandTo(v3);
+            }
+
+            meshBbox.finalize();
+            tmesh->bbox = meshBbox;
+
+            if (first) {
+                bbox.initTo(meshBbox.min);
+                first = false;
+            } else {
+                bbox.expandTo(meshBbox.min);
+            }
+            bbox.expandTo(meshBbox.max);
+        }
+    }
+
+    bbox.finalize();
+    obj.worldBbox = bbox;
+
+    if (m.emission > 0 && obj.getMeshes().size() == 0) {
+        if (cursor.pointLight >= this->pointLightSources.size()) return false;
+        LightSource& ls = this->pointLightSources[cursor.pointLight++];
+        if (ls.object != &obj) return false;
+
+        const float s1 = sinf(RADIAN_TO_DEGREE(obj.angle.x));
+        const float c1 = cosf(RADIAN_TO_DEGREE(obj.angle.x));
+        const float s2 = sinf(RADIAN_TO_DEGREE(obj.angle.y));
+        const float c2 = cosf(RADIAN_TO_DEGREE(obj.angle.y));
+
+        ls.transformedLocation = (vec4(0.0f, 0.0f, 0.0f, 1.0f) * modelMatrix).xyz;
+        ls.transformedNormal = (vec4(normalize(vec3(c2 * s1, c2 * c1, s2)), 0.0f) * normalMatrix).xyz;
+    }
+
+    for (SceneObject* child : obj.getObjects()) {
+        if (child->visible && !this->refitObject(transformStack, *child, cursor)) {
+            return false;
+        }
+    }
+
+    transformStack.popObject();
+    return true;
+}
+
 int calculateGaussianKernelSize(int width, int height) {
     int maxDim = std::max(width, height);
 
@@ -482,6 +881,8 @@ void RayRenderer::render() {
     
     if (this->scene == NULL || this->scene->mainCamera == NULL) return;
 
+    ldsSetSequence(this->settings.sampleSequence, this->settings.samples);
+
     RenderThreadContext ctx;
     this->initRenderThreadContext(&ctx);
     
@@ -519,18 +920,46 @@ void RayRenderer::render() {
     
     this->cameraWorldPos = camera.getWorldLocation();
 
-    this->clearTransformedScene();
-    this->transformScene();
-
-    // hdrImage is the linear-radiance shadow of renderingImage. It's what bloom
-    // and the final tonemap read from. Sized here so it tracks any external
-    // setRenderSize that happened before render().
-    this->hdrImage.createEmpty(ctx.renderSize.width, ctx.renderSize.height);
-
-    if (this->settings.enableDenoise) {
-        this->normalBuffer.createEmpty(ctx.renderSize.width, ctx.renderSize.height);
-        this->depthBuffer.createEmpty(ctx.renderSize.width, ctx.renderSize.height);
-        this->albedoBuffer.createEmpty(ctx.renderSize.width, ctx.renderSize.height);
+    ctx.cameraToWorld = this->viewMatrix;
+    ctx.cameraToWorld.inverse();
+
+    // The transformed scene is world space, so a camera move (or a settings
+    // tweak) reuses the triangles and BVHs from the previous render. Only
+    // scene edits flagged via invalidateScene(), or a different Scene, pay
+    // for the rebuild; invalidateGeometry() edits are refitted in place.
+    // exchange() before building so an edit that lands mid-build re-flags
+    // the next render.
+    const bool rebuild = this->sceneDirty.exchange(false) || this->transformedScene != this->scene;
+    const bool moved = this->geometryDirty.exchange(false);
+    if (rebuild || (moved && !this->refitScene())) {
+        this->clearTransformedScene();
+        this->transformScene();
+    }
+    this->prepareMedia();
+
+    // The film is the only full-resolution buffer the render threads touch
+    // besides the LDR preview; hdrImage is resolved from it afterwards.
+    // Sized here so it tracks any external setRenderSize that happened
+    // before render().
+    if (this->isStreaming()) {
+        // Finished tiles go to disk instead; give back a film left over
+        // from an earlier in-memory render.
+        this->film.reset(0, 0, false, false, false);
+        this->hasPreBloomImage = false;
+    } else {
+        // A pre-bloom image kept as the film's mean would go with the old
+        // film. Resolve it out first, so a cancelled render leaves the
+        // previous one for reapplyPostProcess as it would with denoise.
+        if (this->hasPreBloomImage && this->preBloomInFilm) {
+            this->preBloomHdrImage.setPixelDataFormat(this->hdrImage.getPixelDataFormat(),
+                                                      this->hdrImage.getBitDepth());
+            this->film.resolve(this->preBloomHdrImage, this->filmExposure);
+            this->preBloomInFilm = false;
+        }
+        this->film.reset((int)ctx.renderSize.width, (int)ctx.renderSize.height,
+                         this->settings.enableAdaptiveSampling,
+                         this->settings.enableDenoise,
+                         this->settings.enableHalfFloatAOVs);
     }
 
     this->progressRate = 0;
@@ -543,24 +972,27 @@ void RayRenderer::render() {
     this->nextTileIndex.store(0, std::memory_order_relaxed);
     this->completedTiles.store(0, std::memory_order_relaxed);
 
+    this->guidingActive = false;
+
+    if (this->isStreaming()) {
+        this->renderStreaming(ctx);
+        return;
+    }
+
     if (this->settings.enableAdaptiveSampling) {
-        // Adaptive driver runs multiple passes internally, spawning + joining
-        // its own worker pool per pass. Tiles converged below the noise
+        // Adaptive driver runs multiple passes internally, each one a task
+        // batch on the worker pool. Tiles converged below the noise
         // threshold drop out early, so the total trace work is typically
         // well below settings.samples × pixelCount on mixed-difficulty scenes.
         this->renderAdaptive(ctx);
     } else {
-        std::vector<std::thread> threads;
-
-        for (int i = 0; i < this->settings.threads; i++) {
-            threads.push_back(std::thread([this, ctx, i] { this->renderThread(ctx, i); }));
-        }
-
-        for (std::thread &th : threads) {
-            th.join();
-        }
+        ThreadPool& pool = this->workerPool();
+        pool.parallelFor(pool.size(), [this, &ctx](int i) { this->renderThread(ctx, i); },
+                         &this->cancelRequested);
     }
 
+    this->film.resolve(this->hdrImage, ctx.exposure);
+
     // If the user cancelled, leave the partial image alone and skip the
     // expensive post passes. Don't refresh the pre-bloom cache either, so
     // subsequent post-only tweaks reuse whatever prior full render produced.
@@ -568,23 +1000,26 @@ void RayRenderer::render() {
         return;
     }
 
+    // Cache the pre-bloom HDR so reapplyPostProcess() can re-run bloom
+    // against it without a full re-trace. Captured whether or not bloom is
+    // currently enabled so the user can toggle it on later and re-run from
+    // this baseline.
     if (this->settings.enableDenoise) {
         // Denoise runs on linear HDR (filtering in radiance avoids the banding
         // non-linear compression induces around edges and gradients).
         Image3f denoised;
         denoised.createEmpty(ctx.renderSize.width, ctx.renderSize.height);
-        this->denoiseImage(this->hdrImage, this->normalBuffer,
-                           this->depthBuffer, this->albedoBuffer, denoised);
+        this->denoiseImage(this->hdrImage, this->film, denoised);
         Image::copy(denoised, this->hdrImage);
-    }
 
-    // Cache the pre-bloom HDR so reapplyPostProcess() can re-run bloom
-    // against it without a full re-trace. Captured whether or not bloom is
-    // currently enabled so the user can toggle it on later and re-run from
-    // this baseline.
-    this->preBloomHdrImage.setPixelDataFormat(this->hdrImage.getPixelDataFormat(),
-                                              this->hdrImage.getBitDepth());
-    Image::copy(this->hdrImage, this->preBloomHdrImage);
+        this->preBloomHdrImage.setPixelDataFormat(this->hdrImage.getPixelDataFormat(),
+                                                  this->hdrImage.getBitDepth());
+        Image::copy(this->hdrImage, this->preBloomHdrImage);
+        this->preBloomInFilm = false;
+    } else {
+        this->preBloomInFilm = true;
+        this->filmExposure = ctx.exposure;
+    }
     this->hasPreBloomImage = true;
 
     if (this->settings.enableRenderingPostProcess) {
@@ -609,26 +1044,9 @@ void RayRenderer::applyPostProcess(Image& hdr) {
     Image glow(hdr.getPixelDataFormat(), hdr.getBitDepth());
     glow.createEmpty(W, H);
 
-    const float threshold = fmaxf(this->settings.bloomThreshold, 0.0f);
-    const float curve = fmaxf(this->settings.bloomCurve, 1e-3f);
-
     for (int y = 0; y < H; ++y) {
         for (int x = 0; x < W; ++x) {
-            const color4f c = hdr.getPixel(x, y);
-            const float L = 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
-            color4f g(0.0f, 0.0f, 0.0f, c.a);
-            if (L > threshold && L > 1e-6f) {
-                // scale is the fraction of luma that exceeds threshold. At
-                // curve=1 this gives strict energy-above-threshold (physically
-                // what "the halo carries the over-white light" means).
-                // curve>1 sharpens the knee so near-threshold pixels fade out.
-                float scale = (L - threshold) / L;
-                if (curve != 1.0f) scale = powf(scale, curve);
-                g.r = c.r * scale;
-                g.g = c.g * scale;
-                g.b = c.b * scale;
-            }
-            glow.setPixel(x, y, g);
+            glow.setPixel(x, y, this->bloomExtract(hdr.getPixel(x, y)));
         }
     }
 
@@ -656,21 +1074,7 @@ void RayRenderer::applyPostProcess(Image& hdr) {
     downsampleArea(glow, glowSmall);
     dumpStage("02-downsample", glowSmall);
 
-    // Halo sigma in full-resolution pixels is bloomRadius × W. The blur runs
-    // in downsampled space, so scale the sigma by the downsample ratio; after
-    // the bilinear upsample the effective sigma in full-res pixels comes back
-    // out to roughly `bloomRadius × W`. This decouples halo width from
-    // bloomSizeAspect (which is now purely a perf/quality knob), so sliding
-    // bloomRadius scales the halo linearly instead of fading it as wider
-    // glow buffers spread the same energy over more pixels.
-    const float sigmaFull = fmaxf(0.0f, this->settings.bloomRadius) * (float)W;
-    const float sigmaDown = sigmaFull * aspect;
-    if (sigmaDown >= 0.5f) {
-        // Two passes compound to an effective sigma of sigma·√2 and give a
-        // visibly smoother falloff than one pass at the equivalent total.
-        separableGaussianBlur(glowSmall, sigmaDown * 0.70710678f);  // /√2
-        separableGaussianBlur(glowSmall, sigmaDown * 0.70710678f);
-    }
+    this->bloomBlur(glowSmall, W);
     dumpStage("03-blur", glowSmall);
 
     // Bilinear upsample back to full resolution. Upsampling a smoothly-blurred
@@ -696,13 +1100,56 @@ void RayRenderer::applyPostProcess(Image& hdr) {
     dumpStage("05-composite", hdr);
 }
 
+color4f RayRenderer::bloomExtract(const color4f& c) const {
+    const float threshold = fmaxf(this->settings.bloomThreshold, 0.0f);
+    const float curve = fmaxf(this->settings.bloomCurve, 1e-3f);
+
+    const float L = 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+    color4f g(0.0f, 0.0f, 0.0f, c.a);
+    if (L > threshold && L > 1e-6f) {
+        // scale is the fraction of luma that exceeds threshold. At
+        // curve=1 this gives strict energy-above-threshold (physically
+        // what "the halo carries the over-white light" means).
+        // curve>1 sharpens the knee so near-threshold pixels fade out.
+        float scale = (L - threshold) / L;
+        if (curve != 1.0f) scale = powf(scale, curve);
+        g.r = c.r * scale;
+        g.g = c.g * scale;
+        g.b = c.b * scale;
+    }
+    return g;
+}
+
+void RayRenderer::bloomBlur(Image& glowSmall, const int fullWidth) const {
+    // Halo sigma in full-resolution pixels is bloomRadius × W. The blur runs
+    // in downsampled space, so scale the sigma by the downsample ratio; after
+    // the bilinear upsample the effective sigma in full-res pixels comes back
+    // out to roughly `bloomRadius × W`. This decouples halo width from
+    // bloomSizeAspect (which is now purely a perf/quality knob), so sliding
+    // bloomRadius scales the halo linearly instead of fading it as wider
+    // glow buffers spread the same energy over more pixels.
+    const float aspect = fmaxf(0.02f, this->settings.bloomSizeAspect);
+    const float sigmaFull = fmaxf(0.0f, this->settings.bloomRadius) * (float)fullWidth;
+    const float sigmaDown = sigmaFull * aspect;
+    if (sigmaDown >= 0.5f) {
+        // Two passes compound to an effective sigma of sigma·√2 and give a
+        // visibly smoother falloff than one pass at the equivalent total.
+        separableGaussianBlur(glowSmall, sigmaDown * 0.70710678f);  // /√2
+        separableGaussianBlur(glowSmall, sigmaDown * 0.70710678f);
+    }
+}
+
 bool RayRenderer::reapplyPostProcess() {
     if (!this->hasPreBloomImage) return false;
 
     // Restore the denoised-but-not-bloomed HDR and re-run the bloom pass
     // with whatever parameters are currently in settings, then tonemap to
     // renderingImage for display.
-    Image::copy(this->preBloomHdrImage, this->hdrImage);
+    if (this->preBloomInFilm) {
+        this->film.resolve(this->hdrImage, this->filmExposure);
+    } else {
+        Image::copy(this->preBloomHdrImage, this->hdrImage);
+    }
     if (this->settings.enableRenderingPostProcess) {
         this->applyPostProcess(this->hdrImage);
     }
@@ -715,11 +1162,7 @@ void RayRenderer::renderAsyncThread(RenderThreadCallback* callback) {
 }
 
 void RayRenderer::buildTileList(int imgWidth, int imgHeight) {
-    // 32 px is a long-standing sweet spot for path tracers: small enough
-    // that load imbalance between tiles is bounded (one heavy tile is
-    // ~1024 rays out of 1M+ total), large enough that the per-tile
-    // atomic fetch_add is amortised over thousands of ray-traces.
-    constexpr int tileSize = 32;
+    const int tileSize = RENDER_TILE_SIZE;
 
     this->renderTiles.clear();
     if (imgWidth <= 0 || imgHeight <= 0) return;
@@ -758,6 +1201,17 @@ void RayRenderer::renderThread(const RenderThreadContext& ctx, const int threadI
     const size_t totalTiles = this->renderTiles.size();
     if (totalTiles == 0) return;
     const float invTotalTiles = 1.0f / (float)totalTiles;
+    const bool packets = this->usePacketTracing(ctx);
+    const bool wavefront = this->useWavefront();
+    WavefrontPaths paths;
+    RenderTileBuffer buf;
+    const int samples = this->settings.samples;
+
+    // Streaming: writeDenoiseGuides fills this thread's tile, not the film.
+    struct StreamBufferScope {
+        explicit StreamBufferScope(RenderTileBuffer* b) { RayRenderer::streamTileBuffer = b; }
+        ~StreamBufferScope() { RayRenderer::streamTileBuffer = NULL; }
+    } streamScope(this->isStreaming() ? &buf : NULL);
 
     while (true) {
         // Tile-granular cancellation. ~1024 ray-traces per tile, so the
@@ -771,22 +1225,51 @@ void RayRenderer::renderThread(const RenderThreadContext& ctx, const int threadI
         const RenderTile& tile = this->renderTiles[idx];
         const int xEnd = tile.x + tile.width;
         const int yEnd = tile.y + tile.height;
-
-        for (int y = tile.y; y < yEnd; y += pixelBlock) {
-            for (int x = tile.x; x < xEnd; x += pixelBlock) {
-                color4f hdrPix;
-                const color4f c = this->renderPixel(ctx, ray, x, y, &hdrPix);
-
-#if PIXEL_BLOCK == 1
-                this->renderingImage.setPixel(x, y, c);
-                this->hdrImage.setPixel(x, y, hdrPix);
-#else
-                this->renderingImage.fillRect(recti(x, y, pixelBlock, pixelBlock), c);
-                this->hdrImage.fillRect(recti(x, y, pixelBlock, pixelBlock), hdrPix);
+        this->beginTileBuffer(buf, tile);
+
+        if (wavefront) {
+            this->accumulateWavefrontSamples(ctx, paths, tile, 0, samples,
+                                             buf.sum.data(), buf.sumSq.data());
+        } else if (packets) {
+            for (int y = tile.y; y < yEnd; y += PACKET_BLOCK_SIZE) {
+                for (int x = tile.x; x < xEnd; x += PACKET_BLOCK_SIZE) {
+                    const int w = std::min(PACKET_BLOCK_SIZE, xEnd - x);
+                    const int h = std::min(PACKET_BLOCK_SIZE, yEnd - y);
+                    color3f sum[BVH_PACKET_SIZE], sumSq[BVH_PACKET_SIZE];
+                    for (int k = 0; k < w * h; k++) {
+                        sum[k] = sumSq[k] = color3f(0.0f, 0.0f, 0.0f);
+                    }
+                    this->accumulatePacketSamples(ctx, ray, x, y, w, h,
+                                                  0, samples, sum, sumSq);
+                    for (int k = 0; k < w * h; k++) {
+                        const int t = (y - tile.y + k / w) * tile.width + (x - tile.x + k % w);
+                        buf.sum[t] = sum[k];
+                        buf.sumSq[t] = sumSq[k];
+                    }
+                }
+            }
+        } else {
+            for (int y = tile.y; y < yEnd; y += pixelBlock) {
+                for (int x = tile.x; x < xEnd; x += pixelBlock) {
+                    const int t = (y - tile.y) * tile.width + (x - tile.x);
+                    this->accumulatePixelSamples(ctx, ray, x, y, 0, samples,
+                                                 buf.sum[t], buf.sumSq[t]);
+#if PIXEL_BLOCK != 1
+                    // One traced pixel stands for its whole block.
+                    for (int by = y; by < std::min(y + pixelBlock, yEnd); by++) {
+                        for (int bx = x; bx < std::min(x + pixelBlock, xEnd); bx++) {
+                            const int b = (by - tile.y) * tile.width + (bx - tile.x);
+                            buf.sum[b] = buf.sum[t];
+                            buf.sumSq[b] = buf.sumSq[t];
+                        }
+                    }
 #endif /* PIXEL_BLOCK */
+                }
             }
         }
 
+        this->commitTileBuffer(ctx, tile, buf, samples);
+
         const size_t done = this->completedTiles.fetch_add(1, std::memory_order_relaxed) + 1;
         const float pr = (float)done * invTotalTiles;
 
@@ -808,6 +1291,143 @@ void RayRenderer::renderThread(const RenderThreadContext& ctx, const int threadI
     }
 }
 
+void RayRenderer::writeDenoiseGuides(const Ray& ray, const int x, const int y) {
+    RenderFilm& guides = streamTileBuffer != NULL ? streamTileBuffer->guides : this->film;
+
+    ViewRaySurfaceInfo traceRayInfo;
+    this->traceEyeRaySurfaceInfo(ray, &traceRayInfo);
+
+    if (traceRayInfo.hitted) {
+        // Albedo from material base color (texture sample not folded in here;
+        // demodulation is a future improvement and would need linear HDR).
+        const color3 albedo = traceRayInfo.mat->color;
+
+        // Depth: near = 1, far = 0 (sqrt-compressed for perceptual spacing)
+        const float distance = (traceRayInfo.interInfo.hit - cameraWorldPos).length();
+        float depth = distance / scene->mainCamera->viewFar;
+        depth = sqrtf(depth);
+        depth = 1.0f - clamp(depth, 0.0f, 1.0f);
+        guides.setAOV(x, y, traceRayInfo.hi.normal,
+                      color3f(albedo.r, albedo.g, albedo.b), depth, true);
+    } else {
+        // Background sentinel: zero normal, zero depth (= far).
+        const color4& back = this->settings.backColor;
+        guides.setAOV(x, y, vec3::zero, color3f(back.r, back.g, back.b), 0.0f, false);
+    }
+}
+
+void RayRenderer::generateEyeRay(const RenderThreadContext& ctx, const int x, const int y,
+                                 const int sampleIdx, Ray& ray) const {
+    // Angular offsets (tangent-space). Ray through pixel is normalize(vec3(dx, dy, -1)).
+    const float dx = ((float)x + 0.5f - ctx.halfRenderSize.width) * ctx.viewScaleX;
+    const float dy = -((float)y + 0.5f - ctx.halfRenderSize.height) * ctx.viewScaleY;
+
+    const bool aaEnabled = this->settings.enableAntialias;
+
+    // Reset the Halton walk for this (pixel, sample). The early dims (0,1
+    // for sub-pixel jitter, 2,3 for DOF) are the best-stratified slots, and
+    // the remaining dims propagate down into the path trace for BSDF /
+    // light sampling.
+    ldsBeginPixelSample(x, y, sampleIdx);
+
+    if (ctx.depthOfField >= 0.001f && ctx.aperture > 0.0f) {
+        // Sub-pixel jitter on dims 0,1 when AA is on; pin to pixel centre
+        // otherwise. When AA is off we still consume the 2D sample so the
+        // Halton dims line up with the AA-on case and DOF/path sampling
+        // sees the same downstream stratification.
+        float jx, jy;
+        ldsNext2D(jx, jy);
+        const float jxOffset = aaEnabled ? (jx - 0.5f) : 0.0f;
+        const float jyOffset = aaEnabled ? (jy - 0.5f) : 0.0f;
+        const float pxDx = dx + jxOffset * ctx.viewScaleX;
+        const float pxDy = dy - jyOffset * ctx.viewScaleY;
+        const vec3 focalPointJ(pxDx * ctx.depthOfField, pxDy * ctx.depthOfField, -ctx.depthOfField);
+
+        // Aperture sample on dims 2,3. Blades=0 → full disk (circular
+        // bokeh). Blades ≥ 3 → uniformly sample a regular n-gon inscribed
+        // in the aperture radius so out-of-focus highlights take the
+        // familiar hex/octagon iris shape of real lenses. Sampling is
+        // done wedge-by-wedge: pick a triangle from the centre, then a
+        // uniform point inside it (square → triangle fold).
+        float du, dv;
+        ldsNext2D(du, dv);
+        float offsetX, offsetY;
+        if (ctx.apertureBlades >= 3) {
+            const int N = ctx.apertureBlades;
+            const float u0 = du * (float)N;
+            const int wedge = fminf((float)(N - 1), floorf(u0));
+            float s = u0 - (float)wedge;
+            float t = dv;
+            if (s + t > 1.0f) { s = 1.0f - s; t = 1.0f - t; }
+            const float step = 2.0f * (float)M_PI / (float)N;
+            const float a0 = ctx.apertureRotation + step * (float)wedge;
+            const float a1 = a0 + step;
+            const float px = cosf(a0) * s + cosf(a1) * t;
+            const float py = sinf(a0) * s + sinf(a1) * t;
+            offsetX = px * ctx.aperture;
+            offsetY = py * ctx.aperture;
+        } else {
+            // Shirley's concentric square-to-disk mapping — keeps
+            // stratified (u,v) grid cells compact when mapped to the
+            // disk. The older r = √u, θ = 2πv path produced radial
+            // spokes because it stretched each cell along the radius.
+            const float a = 2.0f * du - 1.0f;
+            const float b = 2.0f * dv - 1.0f;
+            float r, phi;
+            if (a == 0.0f && b == 0.0f) {
+                r = 0.0f; phi = 0.0f;
+            } else if (a * a > b * b) {
+                r = a;
+                phi = (float)(M_PI / 4.0) * (b / a);
+            } else {
+                r = b;
+                phi = (float)(M_PI / 2.0) - (float)(M_PI / 4.0) * (a / b);
+            }
+            offsetX = r * cosf(phi) * ctx.aperture;
+            offsetY = r * sinf(phi) * ctx.aperture;
+        }
+
+        ray.origin = vec3(offsetX, offsetY, 0.0f);
+        ray.dir = (focalPointJ - ray.origin).normalize();
+    } else {
+        // Sub-pixel jitter for stochastic anti-aliasing; ray direction
+        // pivots at origin. When AA is off we still consume the 2D LDS
+        // sample (see note above) but ignore it, so the ray goes through
+        // the deterministic pixel centre and edges will alias.
+        float jx, jy;
+        ldsNext2D(jx, jy);
+        const float jxOffset = aaEnabled ? (jx - 0.5f) : 0.0f;
+        const float jyOffset = aaEnabled ? (jy - 0.5f) : 0.0f;
+        ray.origin = vec3::zero;
+        ray.dir = vec3(dx + jxOffset * ctx.viewScaleX,
+                       dy - jyOffset * ctx.viewScaleY,
+                       -1.0f).normalize();
+    }
+
+    // Camera space → world space, where the scene is built.
+    ray.origin = (vec4(ray.origin, 1.0f) * ctx.cameraToWorld).xyz;
+    ray.dir = (vec4(ray.dir, 0.0f) * ctx.cameraToWorld).xyz.normalize();
+}
+
+// Firefly clamp: bound per-sample radiance before accumulation so a single
+// near-infinite-variance path (tight NEE r², low-roughness glossy
+// caustics…) cannot anchor the Monte-Carlo average. Biased but the bias
+// shrinks as samples grow and speckles vanish.
+void RayRenderer::accumulateSample(color4f oneSample, const float clampMax,
+                                   color3f& sum, color3f& sumSq) {
+    if (clampMax > 0.0f) {
+        oneSample.r = fminf(oneSample.r, clampMax);
+        oneSample.g = fminf(oneSample.g, clampMax);
+        oneSample.b = fminf(oneSample.b, clampMax);
+    }
+    sum.r   += oneSample.r;
+    sum.g   += oneSample.g;
+    sum.b   += oneSample.b;
+    sumSq.r += oneSample.r * oneSample.r;
+    sumSq.g += oneSample.g * oneSample.g;
+    sumSq.b += oneSample.b * oneSample.b;
+}
+
 void RayRenderer::accumulatePixelSamples(const RenderThreadContext& ctx, Ray& ray,
                                           const int x, const int y,
                                           const int sampleStart, const int sampleCount,
@@ -817,142 +1437,89 @@ void RayRenderer::accumulatePixelSamples(const RenderThreadContext& ctx, Ray& ra
     // first sample — they're a primary-ray-only snapshot, so adaptive passes
     // beyond the first reuse what pass 0 already wrote.
     if (sampleStart == 0 && this->settings.enableDenoise) {
-        ViewRaySurfaceInfo traceRayInfo;
-        this->traceEyeRaySurfaceInfo(ray, &traceRayInfo);
-
-        if (traceRayInfo.hitted) {
-            // Normal encoded [-1..1] → [0..1]
-            const vec3 normalColor = traceRayInfo.hi.normal * 0.5f + 0.5f;
-            this->normalBuffer.setPixel(x, y, color4(normalColor, 1.0f));
-
-            // Albedo from material base color (texture sample not folded in here;
-            // demodulation is a future improvement and would need linear HDR).
-            this->albedoBuffer.setPixel(x, y, color4(traceRayInfo.mat->color, 1.0f));
-
-            // Depth: near = 1, far = 0 (sqrt-compressed for perceptual spacing)
-            const float distance = (traceRayInfo.interInfo.hit - cameraWorldPos).length();
-            float depth = distance / scene->mainCamera->viewFar;
-            depth = sqrtf(depth);
-            depth = 1.0f - clamp(depth, 0.0f, 1.0f);
-            this->depthBuffer.setPixel(x, y, color4(depth, depth, depth, 1.0f));
-        } else {
-            // Background sentinel: encoded-zero normal, zero depth (= far).
-            this->normalBuffer.setPixel(x, y, color4(0.5f, 0.5f, 0.5f, 0.0f));
-            this->albedoBuffer.setPixel(x, y, this->settings.backColor);
-            this->depthBuffer.setPixel(x, y, color4(0.0f, 0.0f, 0.0f, 0.0f));
-        }
+        this->generateEyeRay(ctx, x, y, 0, ray);
+        this->writeDenoiseGuides(ray, x, y);
     }
 
+    const float clampMax = this->settings.fireflyClamp;
 
-    // Angular offsets (tangent-space). Ray through pixel is normalize(vec3(dx, dy, -1)).
-    const float dx = ((float)x + 0.5f - ctx.halfRenderSize.width) * ctx.viewScaleX;
-    const float dy = -((float)y + 0.5f - ctx.halfRenderSize.height) * ctx.viewScaleY;
+    const int sampleEnd = sampleStart + sampleCount;
+    for (int i = sampleStart; i < sampleEnd; i++) {
+        this->generateEyeRay(ctx, x, y, i, ray);
+        accumulateSample(this->traceEyeRay(ray), clampMax, sum, sumSq);
+    }
+}
+
+bool RayRenderer::usePacketTracing(const RenderThreadContext& ctx) const {
+    if (!this->settings.enablePacketTracing || PIXEL_BLOCK != 1) return false;
+
+    // Packets only walk the binary nodes. With a wide BVH, per-pixel rays
+    // keep the SIMD child tests it was collapsed for.
+    if (this->bvh.width() > 2) return false;
+
+    // A global medium sends eye rays through tracePath, which finds its own
+    // hits; nothing to share.
+    const HomogeneousMedium* gm = (this->scene != NULL) ? this->scene->globalMedium : NULL;
+    if (gm != NULL && gm->isActive()) return false;
+
+    // With depth of field, origins spread over the lens and directions over
+    // the lens-to-focus cone. Up to a small spread angle the packet still
+    // culls well; beyond that rays in a block diverge and it's a loss.
+    if (ctx.depthOfField >= 0.001f && ctx.aperture > 0.0f) {
+        return ctx.aperture <= ctx.depthOfField * PACKET_MAX_DOF_SPREAD;
+    }
+    return true;
+}
+
+void RayRenderer::accumulatePacketSamples(const RenderThreadContext& ctx, Ray& ray,
+                                           const int x0, const int y0, const int w, const int h,
+                                           const int sampleStart, const int sampleCount,
+                                           color3f* sum, color3f* sumSq) {
+    const int count = w * h;
+
+    // Each pixel's guides come from its own sample-0 eye ray, as on the
+    // per-pixel path; one shared ray would stamp them in 4×4 blocks.
+    if (sampleStart == 0 && this->settings.enableDenoise) {
+        Ray guideRay;
+        for (int k = 0; k < count; k++) {
+            const int px = x0 + k % w, py = y0 + k / w;
+            this->generateEyeRay(ctx, px, py, 0, guideRay);
+            this->writeDenoiseGuides(guideRay, px, py);
+        }
+    }
 
-    const bool aaEnabled = this->settings.enableAntialias;
     const float clampMax = this->settings.fireflyClamp;
 
+    Ray rays[BVH_PACKET_SIZE];
+    int shadeDim[BVH_PACKET_SIZE];
+    int shadeDraws[BVH_PACKET_SIZE];
+    RayTriangleIntersectionInfo infos[BVH_PACKET_SIZE];
+
     const int sampleEnd = sampleStart + sampleCount;
     for (int i = sampleStart; i < sampleEnd; i++) {
-        // Reset the Halton walk for this (pixel, sample). The early dims (0,1
-        // for sub-pixel jitter, 2,3 for DOF) are the best-stratified slots, and
-        // the remaining dims propagate down into the path trace for BSDF /
-        // light sampling.
-        ldsBeginPixelSample(x, y, i);
-
-        if (ctx.depthOfField >= 0.001f && ctx.aperture > 0.0f) {
-            // Sub-pixel jitter on dims 0,1 when AA is on; pin to pixel centre
-            // otherwise. When AA is off we still consume the 2D sample so the
-            // Halton dims line up with the AA-on case and DOF/path sampling
-            // sees the same downstream stratification.
-            float jx, jy;
-            ldsNext2D(jx, jy);
-            const float jxOffset = aaEnabled ? (jx - 0.5f) : 0.0f;
-            const float jyOffset = aaEnabled ? (jy - 0.5f) : 0.0f;
-            const float pxDx = dx + jxOffset * ctx.viewScaleX;
-            const float pxDy = dy - jyOffset * ctx.viewScaleY;
-            const vec3 focalPointJ(pxDx * ctx.depthOfField, pxDy * ctx.depthOfField, -ctx.depthOfField);
-
-            // Aperture sample on dims 2,3. Blades=0 → full disk (circular
-            // bokeh). Blades ≥ 3 → uniformly sample a regular n-gon inscribed
-            // in the aperture radius so out-of-focus highlights take the
-            // familiar hex/octagon iris shape of real lenses. Sampling is
-            // done wedge-by-wedge: pick a triangle from the centre, then a
-            // uniform point inside it (square → triangle fold).
-            float du, dv;
-            ldsNext2D(du, dv);
-            float offsetX, offsetY;
-            if (ctx.apertureBlades >= 3) {
-                const int N = ctx.apertureBlades;
-                const float u0 = du * (float)N;
-                const int wedge = fminf((float)(N - 1), floorf(u0));
-                float s = u0 - (float)wedge;
-                float t = dv;
-                if (s + t > 1.0f) { s = 1.0f - s; t = 1.0f - t; }
-                const float step = 2.0f * (float)M_PI / (float)N;
-                const float a0 = ctx.apertureRotation + step * (float)wedge;
-                const float a1 = a0 + step;
-                const float px = cosf(a0) * s + cosf(a1) * t;
-                const float py = sinf(a0) * s + sinf(a1) * t;
-                offsetX = px * ctx.aperture;
-                offsetY = py * ctx.aperture;
-            } else {
-                // Shirley's concentric square-to-disk mapping — keeps
-                // stratified (u,v) grid cells compact when mapped to the
-                // disk. The older r = √u, θ = 2πv path produced radial
-                // spokes because it stretched each cell along the radius.
-                const float a = 2.0f * du - 1.0f;
-                const float b = 2.0f * dv - 1.0f;
-                float r, phi;
-                if (a == 0.0f && b == 0.0f) {
-                    r = 0.0f; phi = 0.0f;
-                } else if (a * a > b * b) {
-                    r = a;
-                    phi = (float)(M_PI / 4.0) * (b / a);
-                } else {
-                    r = b;
-                    phi = (float)(M_PI / 2.0) - (float)(M_PI / 4.0) * (a / b);
-                }
-                offsetX = r * cosf(phi) * ctx.aperture;
-                offsetY = r * sinf(phi) * ctx.aperture;
-            }
+        // Same sample `i` for every pixel of the block: the jitter is
+        // sub-pixel, so the rays stay as coherent as the pixel grid.
+        for (int k = 0; k < count; k++) {
+            this->generateEyeRay(ctx, x0 + k % w, y0 + k / w, i, rays[k]);
+            shadeDim[k] = ldsDimension();
+            shadeDraws[k] = randomDraws();
+            infos[k] = RayTriangleIntersectionInfo();
+        }
 
-            ray.origin = vec3(offsetX, offsetY, 0.0f);
-            ray.dir = (focalPointJ - ray.origin).normalize();
-        } else {
-            // Sub-pixel jitter for stochastic anti-aliasing; ray direction
-            // pivots at origin. When AA is off we still consume the 2D LDS
-            // sample (see note above) but ignore it, so the ray goes through
-            // the deterministic pixel centre and edges will alias.
-            float jx, jy;
-            ldsNext2D(jx, jy);
-            const float jxOffset = aaEnabled ? (jx - 0.5f) : 0.0f;
-            const float jyOffset = aaEnabled ? (jy - 0.5f) : 0.0f;
-            ray.origin = vec3::zero;
-            ray.dir = vec3(dx + jxOffset * ctx.viewScaleX,
-                           dy - jyOffset * ctx.viewScaleY,
-                           -1.0f).normalize();
-        }
-
-        color4f oneSample = this->traceEyeRay(ray);
-        // Firefly clamp: bound per-sample radiance before accumulation so a
-        // single near-infinite-variance path (tight NEE r², low-roughness
-        // glossy caustics…) cannot anchor the Monte-Carlo average. Biased but
-        // the bias shrinks as samples grow and speckles vanish.
-        if (clampMax > 0.0f) {
-            oneSample.r = fminf(oneSample.r, clampMax);
-            oneSample.g = fminf(oneSample.g, clampMax);
-            oneSample.b = fminf(oneSample.b, clampMax);
-        }
-        sum.r   += oneSample.r;
-        sum.g   += oneSample.g;
-        sum.b   += oneSample.b;
-        sumSq.r += oneSample.r * oneSample.r;
-        sumSq.g += oneSample.g * oneSample.g;
-        sumSq.b += oneSample.b * oneSample.b;
-    }
-}
-
-// Tonemap + gamma path shared by renderPixel and the adaptive commit. Takes a
+        this->findNearestTrianglePacket(rays, count, infos);
+
+        // Shading picks the Halton walk and the PRNG stream up where the
+        // eye ray left them, so each pixel sees exactly the values it would
+        // on the per-pixel path.
+        for (int k = 0; k < count; k++) {
+            ldsBeginPixelSample(x0 + k % w, y0 + k / w, i, shadeDim[k], shadeDraws[k]);
+            accumulateSample(this->shadeEyeRay(rays[k], infos[k]), clampMax, sum[k], sumSq[k]);
+        }
+        ray = rays[count - 1];
+    }
+}
+
+// Tonemap + gamma path of resolvePixel, which every tile commit goes through. Takes a
 // linear-HDR radiance (already exposure-multiplied) and returns the LDR
 // preview color, or the unchanged HDR (with alpha=1) when the denoiser is
 // going to handle compression itself.
@@ -987,12 +1554,8 @@ static inline color4f hdrToPreview(const color3f& radiance, bool denoising) {
     return color4f(clamp(encoded, 0.0f, 1.0f), 1.0f);
 }
 
-color4f RayRenderer::renderPixel(const RenderThreadContext& ctx, Ray& ray, const int x, const int y, color4f* outHdr) {
-    color3f sum(0.0f, 0.0f, 0.0f);
-    color3f sumSq(0.0f, 0.0f, 0.0f);
-    const int totalSamples = this->settings.samples;
-    this->accumulatePixelSamples(ctx, ray, x, y, 0, totalSamples, sum, sumSq);
-
+color4f RayRenderer::resolvePixel(const RenderThreadContext& ctx, const color3f& sum,
+                                  const int totalSamples, color4f* outHdr) const {
     const float invN = (totalSamples > 0) ? (1.0f / (float)totalSamples) : 0.0f;
     const color3f radiance(sum.r * invN * ctx.exposure,
                            sum.g * invN * ctx.exposure,
@@ -1008,31 +1571,43 @@ color4f RayRenderer::renderPixel(const RenderThreadContext& ctx, Ray& ray, const
     return preview;
 }
 
-void RayRenderer::commitTilePreview(const RenderThreadContext& ctx, size_t tileIdx) {
-    const RenderTile& tile = this->renderTiles[tileIdx];
-    const int n = this->tileSampleCounts[tileIdx];
-    if (n <= 0) return;
+void RayRenderer::beginTileBuffer(RenderTileBuffer& buf, const RenderTile& tile) const {
+    const int n = tile.width * tile.height;
+    buf.sum.assign(n, color3f(0.0f, 0.0f, 0.0f));
+    buf.sumSq.assign(n, color3f(0.0f, 0.0f, 0.0f));
 
-    const float invN = 1.0f / (float)n;
-    const float exposure = ctx.exposure;
-    const bool denoising = this->settings.enableDenoise;
+    // Edge tiles are smaller, so the preview is resized now and then; the
+    // common 32×32 case keeps its allocation from tile to tile.
+    if ((int)buf.preview.width() != tile.width || (int)buf.preview.height() != tile.height) {
+        buf.preview.createEmpty(tile.width, tile.height);
+    }
 
-    const int xEnd = tile.x + tile.width;
-    const int yEnd = tile.y + tile.height;
-    for (int y = tile.y; y < yEnd; y++) {
-        for (int x = tile.x; x < xEnd; x++) {
-            const color4f sum = this->adaptiveSumImage.getPixel(x, y);
-            const color3f radiance(sum.r * invN * exposure,
-                                   sum.g * invN * exposure,
-                                   sum.b * invN * exposure);
-            const color4f hdrPix(fmaxf(radiance.r, 0.0f),
-                                 fmaxf(radiance.g, 0.0f),
-                                 fmaxf(radiance.b, 0.0f),
-                                 1.0f);
-            this->hdrImage.setPixel(x, y, hdrPix);
-            this->renderingImage.setPixel(x, y, hdrToPreview(radiance, denoising));
+    if (this->isStreaming() && this->settings.enableDenoise) {
+        // Written once per pixel, read once at commit: no point in halves.
+        buf.guides.reset(tile.x, tile.y, tile.width, tile.height, false, true, false);
+    }
+}
+
+void RayRenderer::commitTileBuffer(const RenderThreadContext& ctx, const RenderTile& tile,
+                                   RenderTileBuffer& buf, const int samples) {
+    if (samples <= 0) return;
+
+    if (this->isStreaming()) {
+        this->commitStreamTile(ctx, tile, buf, samples);
+        return;
+    }
+
+    this->film.addBlock(tile.x, tile.y, tile.width, tile.height,
+                        buf.sum.data(), buf.sumSq.data(), samples);
+
+    for (int ty = 0; ty < tile.height; ty++) {
+        for (int tx = 0; tx < tile.width; tx++) {
+            const int x = tile.x + tx, y = tile.y + ty;
+            buf.preview.setPixel(tx, ty, this->resolvePixel(ctx, this->film.sumAt(x, y),
+                                                            this->film.samplesAt(x, y), NULL));
         }
     }
+    Image::copyRect(buf.preview, 0, 0, this->renderingImage, tile.x, tile.y);
 }
 
 float RayRenderer::computeTileNoise(size_t tileIdx) const {
@@ -1051,8 +1626,8 @@ float RayRenderer::computeTileNoise(size_t tileIdx) const {
 
     for (int y = tile.y; y < yEnd; y++) {
         for (int x = tile.x; x < xEnd; x++) {
-            const color4f sum   = this->adaptiveSumImage.getPixel(x, y);
-            const color4f sumSq = this->adaptiveSumSqImage.getPixel(x, y);
+            const color3f& sum   = this->film.sumAt(x, y);
+            const color3f& sumSq = this->film.sumSqAt(x, y);
 
             const float mr = sum.r * invN;
             const float mg = sum.g * invN;
@@ -1099,6 +1674,19 @@ void RayRenderer::renderThreadAdaptive(const RenderThreadContext& ctx,
     const size_t activeCount = activeTiles->size();
     if (activeCount == 0) return;
     const float invActive = 1.0f / (float)activeCount;
+    const bool packets = this->usePacketTracing(ctx);
+    const bool wavefront = this->useWavefront();
+    WavefrontPaths paths;
+    RenderTileBuffer buf;
+
+    // Guiding records this thread still holds go to the shared trees before
+    // the pass joins and refines them, whichever way the loop exits.
+    struct GuideRecordFlush {
+        PathGuide* guide;
+        ~GuideRecordFlush() {
+            if (this->guide != NULL && this->guide->recording()) this->guide->flushThreadRecords();
+        }
+    } guideRecordFlush = { this->getPathGuide() };
 
     while (true) {
         if (this->cancelRequested.load(std::memory_order_relaxed)) return;
@@ -1111,29 +1699,37 @@ void RayRenderer::renderThreadAdaptive(const RenderThreadContext& ctx,
 
         const int xEnd = tile.x + tile.width;
         const int yEnd = tile.y + tile.height;
-        for (int y = tile.y; y < yEnd; y++) {
-            for (int x = tile.x; x < xEnd; x++) {
-                color3f localSum(0.0f, 0.0f, 0.0f);
-                color3f localSumSq(0.0f, 0.0f, 0.0f);
-                this->accumulatePixelSamples(ctx, ray, x, y,
-                                             sampleStart, sampleCount,
-                                             localSum, localSumSq);
-
-                // Merge per-pixel running totals. No race: this tile's
-                // pixels are exclusively owned by this thread until the
-                // commit below.
-                const color4f prevSum   = this->adaptiveSumImage.getPixel(x, y);
-                const color4f prevSumSq = this->adaptiveSumSqImage.getPixel(x, y);
-                this->adaptiveSumImage.setPixel(x, y,
-                    color4f(prevSum.r + localSum.r,
-                            prevSum.g + localSum.g,
-                            prevSum.b + localSum.b,
-                            0.0f));
-                this->adaptiveSumSqImage.setPixel(x, y,
-                    color4f(prevSumSq.r + localSumSq.r,
-                            prevSumSq.g + localSumSq.g,
-                            prevSumSq.b + localSumSq.b,
-                            0.0f));
+        this->beginTileBuffer(buf, tile);
+
+        if (wavefront) {
+            this->accumulateWavefrontSamples(ctx, paths, tile, sampleStart, sampleCount,
+                                             buf.sum.data(), buf.sumSq.data());
+        } else if (packets) {
+            for (int y = tile.y; y < yEnd; y += PACKET_BLOCK_SIZE) {
+                for (int x = tile.x; x < xEnd; x += PACKET_BLOCK_SIZE) {
+                    const int w = std::min(PACKET_BLOCK_SIZE, xEnd - x);
+                    const int h = std::min(PACKET_BLOCK_SIZE, yEnd - y);
+                    color3f localSum[BVH_PACKET_SIZE], localSumSq[BVH_PACKET_SIZE];
+                    for (int k = 0; k < w * h; k++) {
+                        localSum[k] = localSumSq[k] = color3f(0.0f, 0.0f, 0.0f);
+                    }
+                    this->accumulatePacketSamples(ctx, ray, x, y, w, h,
+                                                  sampleStart, sampleCount,
+                                                  localSum, localSumSq);
+                    for (int k = 0; k < w * h; k++) {
+                        const int t = (y - tile.y + k / w) * tile.width + (x - tile.x + k % w);
+                        buf.sum[t] = localSum[k];
+                        buf.sumSq[t] = localSumSq[k];
+                    }
+                }
+            }
+        } else {
+            for (int y = tile.y, t = 0; y < yEnd; y++) {
+                for (int x = tile.x; x < xEnd; x++, t++) {
+                    this->accumulatePixelSamples(ctx, ray, x, y,
+                                                 sampleStart, sampleCount,
+                                                 buf.sum[t], buf.sumSq[t]);
+                }
             }
         }
 
@@ -1142,7 +1738,7 @@ void RayRenderer::renderThreadAdaptive(const RenderThreadContext& ctx,
         // so we can write the new total directly without read-modify-write
         // races.
         this->tileSampleCounts[tileIdx] = sampleStart + sampleCount;
-        this->commitTilePreview(ctx, tileIdx);
+        this->commitTileBuffer(ctx, tile, buf, sampleCount);
 
         const size_t done = this->completedTiles.fetch_add(1, std::memory_order_relaxed) + 1;
         // Map this pass's per-tile fraction onto the global 0..1 progress
@@ -1159,14 +1755,38 @@ void RayRenderer::renderThreadAdaptive(const RenderThreadContext& ctx,
     }
 }
 
+ThreadPool& RayRenderer::workerPool() {
+    this->threadPool.resize(this->settings.threads);
+    return this->threadPool;
+}
+
+bool RayRenderer::beginPathGuiding() {
+    BoundingBox bounds;
+    bool empty = true;
+    auto expand = [&](const BoundingBox& b) {
+        if (empty) {
+            bounds.initTo(b.min);
+            empty = false;
+        } else {
+            bounds.expandTo(b.min);
+        }
+        bounds.expandTo(b.max);
+    };
+    for (const RenderMeshTriangle* rt : this->triangleList) expand(rt->bbox);
+    for (const BVHInstance& inst : this->instances) expand(inst.bbox);
+    if (empty) return false;
+
+    if (this->pathGuide == NULL) this->pathGuide.reset(new PathGuide());
+    this->pathGuide->reset(bounds.min, bounds.max);
+    return true;
+}
+
 void RayRenderer::renderAdaptive(const RenderThreadContext& ctx) {
     const int W = (int)ctx.renderSize.width;
     const int H = (int)ctx.renderSize.height;
 
-    // Per-pixel accumulators. createEmpty zeroes the buffer so first-pass
-    // accumulation starts from 0.
-    this->adaptiveSumImage.createEmpty(W, H);
-    this->adaptiveSumSqImage.createEmpty(W, H);
+    // Per-pixel accumulators live in the film, which render() has zeroed
+    // with sums of squares for this mode.
     this->tileSampleCounts.assign(this->renderTiles.size(), 0);
 
     const int targetSamples = std::max(1, this->settings.samples);
@@ -1180,6 +1800,15 @@ void RayRenderer::renderAdaptive(const RenderThreadContext& ctx) {
     const double totalWorkInv =
         1.0 / ((double)targetSamples * (double)W * (double)H);
 
+    // Path guiding learns over the first passes: each one records into the
+    // guide and is refined into the sampling distribution of the next.
+    // Learning starts over every render, as the scene or camera may have
+    // moved since the last one.
+    const int trainingPasses = std::max(0, this->settings.guidingTrainingPasses);
+    this->guidingActive = this->settings.enablePathGuiding && trainingPasses > 0
+        && this->beginPathGuiding();
+    int trainedPasses = 0;
+
     auto runPass = [&](const std::vector<size_t>& active, int sampleStart, int sampleCount) {
         if (active.empty()) return;
 
@@ -1197,15 +1826,17 @@ void RayRenderer::renderAdaptive(const RenderThreadContext& ctx) {
         this->nextTileIndex.store(0, std::memory_order_relaxed);
         this->completedTiles.store(0, std::memory_order_relaxed);
 
-        std::vector<std::thread> workers;
-        for (int i = 0; i < this->settings.threads; i++) {
-            workers.push_back(std::thread(
-                [this, &ctx, &active, sampleStart, sampleCount, baseProgress, passShare] {
-                    this->renderThreadAdaptive(ctx, &active, sampleStart, sampleCount,
-                                               baseProgress, passShare);
-                }));
+        ThreadPool& pool = this->workerPool();
+        pool.parallelFor(pool.size(),
+            [this, &ctx, &active, sampleStart, sampleCount, baseProgress, passShare](int) {
+                this->renderThreadAdaptive(ctx, &active, sampleStart, sampleCount,
+                                           baseProgress, passShare);
+            }, &this->cancelRequested);
+
+        if (this->guidingActive && this->pathGuide->recording()) {
+            this->pathGuide->refine();
+            if (++trainedPasses >= trainingPasses) this->pathGuide->setRecording(false);
         }
-        for (std::thread& w : workers) w.join();
 
         // Force-fire the end-of-pass progress: the worker uses pr > rate so
         // the very last tick can race-skip, leaving the bar a hair below the
@@ -1256,6 +1887,13 @@ color4 RayRenderer::traceEyeRay(const Ray& ray) const {
 //    RayMeshIntersection rmi(NULL, 9999999.0f);
     RayTriangleIntersectionInfo interInfo;
     this->findNearestTriangle(ray, interInfo);
+    return this->shadeEyeRay(ray, interInfo);
+}
+
+color4 RayRenderer::shadeEyeRay(const Ray& ray, const RayTriangleIntersectionInfo& interInfo) const {
+    if (this->useIterativeIntegrator()) {
+        return this->traceIterative(ray, interInfo);
+    }
 
     // Volumetric eye ray: route through tracePath so the global medium's
     // free-flight sampling, in-scattering NEE, and emission integral run on
@@ -1277,10 +1915,10 @@ color4 RayRenderer::traceEyeRay(const Ray& ray) const {
         VertexInterpolation vi;
         this->calcVertexInterpolation(interInfo, &vi);
 
-        if (interInfo.triangle->object.visible) {
+        if (interInfo.object->visible) {
             // Return HDR radiance unclamped so high-intensity emitters (e.g.
             // a red light with emission=10) carry through to the tonemap.
-            // Reinhard at renderPixel's output handles the compression.
+            // Reinhard at resolvePixel's output handles the compression.
             const color3 shaded = this->shaderProvider->shade(interInfo, ray, vi);
             return color4(fmaxf(shaded.r, 0.0f),
                           fmaxf(shaded.g, 0.0f),
@@ -1348,16 +1986,29 @@ color3 RayRenderer::sampleEnvironment(const vec3& dir) const {
 }
 
 namespace {
-// Binary search in an ascending CDF whose last element is 1.0. Returns the
-// largest index i with cdf[i] <= u, clamped to [0, n-1]. `n` is the number
-// of intervals (cdf has n+1 entries).
-inline int searchCDF(const float* cdf, int n, float u) {
-    int lo = 0, hi = n;
-    while (lo < hi) {
-        const int mid = (lo + hi) >> 1;
-        if (cdf[mid + 1] <= u) lo = mid + 1; else hi = mid;
-    }
-    return lo < n ? lo : n - 1;
+// Draws a slot from a Walker alias table of `n` entries with one uniform:
+// its integer part picks the slot, the fraction decides slot or alias and
+// is then rescaled into `frac`, uniform within whichever was drawn.
+inline int sampleAlias(const EnvmapAliasEntry* table, int n, float u, float& frac) {
+    const float scaled = u * (float)n;
+    int i = (int)scaled;
+    if (i >= n) i = n - 1;
+    const float r = fminf(scaled - (float)i, 0.99999994f);
+
+    const EnvmapAliasEntry& e = table[i];
+    if (r < e.threshold) {
+        frac = r / e.threshold;
+        return i;
+    }
+    frac = (r - e.threshold) / (1.0f - e.threshold);
+    return (int)e.alias;
+}
+
+// Solid angle of a point on a cube face relative to its (s, t) area; the
+// cubemap tables weight cells by it at their centres.
+inline float cubeFaceJacobian(float s, float t) {
+    const float denom = s * s + t * t + 1.0f;
+    return 1.0f / (denom * sqrtf(denom));
 }
 }
 
@@ -1381,27 +2032,16 @@ void RayRenderer::sampleEnvmapDirection(float u0, float u1, vec3& outDir, float&
     outPdf = 0.0f;
     if (this->scene == NULL) return;
 
-    // Cubemap path: sample (face, y, x) from the three-level CDF.
+    // Cubemap path: one draw picks the face and row, one the cell.
     if (this->scene->envCubeFaceSize > 0 && this->scene->envCubeTotalWeight > 0.0f) {
         const int W = this->scene->envCubeFaceSize;
         const int H = W;
 
-        const int face = searchCDF(this->scene->envCubeMarginalFace.data(), 6, u0);
-        const float faceLo = this->scene->envCubeMarginalFace[face];
-        const float faceSpan = this->scene->envCubeMarginalFace[face + 1] - faceLo;
-        const float u0r = (faceSpan > 0.0f) ? (u0 - faceLo) / faceSpan : 0.5f;
-
-        const float* marY = &this->scene->envCubeMarginalY[(size_t)face * (H + 1)];
-        const int y = searchCDF(marY, H, u0r);
-        const float yLo = marY[y];
-        const float ySpan = marY[y + 1] - yLo;
-        const float yFrac = (ySpan > 0.0f) ? (u0r - yLo) / ySpan : 0.5f;
-
-        const float* condX = &this->scene->envCubeConditionalX[((size_t)face * H + y) * (W + 1)];
-        const int x = searchCDF(condX, W, u1);
-        const float xLo = condX[x];
-        const float xSpan = condX[x + 1] - xLo;
-        const float xFrac = (xSpan > 0.0f) ? (u1 - xLo) / xSpan : 0.5f;
+        float yFrac, xFrac;
+        const int row = sampleAlias(this->scene->envCubeRowAlias.data(), 6 * H, u0, yFrac);
+        const int x = sampleAlias(&this->scene->envCubeCellAlias[(size_t)row * W], W, u1, xFrac);
+        const int face = row / H;
+        const int y = row - face * H;
 
         const float u = (x + xFrac) / (float)W;
         const float v = (y + yFrac) / (float)H;
@@ -1417,18 +2057,7 @@ void RayRenderer::sampleEnvmapDirection(float u0, float u1, vec3& outDir, float&
         const float wz = -dirLocal.x * sinY + dirLocal.z * cosY;
         outDir = vec3(wx, dirLocal.y, wz).normalize();
 
-        // PDF in solid-angle: p(ω) = lum(texel)·jac / totalWeight, where jac
-        // = 1/(s² + t² + 1)^(3/2) is the per-texel solid-angle Jacobian and
-        // the CDF was built on (lum × jac) weights.
-        const color4f texel = this->scene->envCubemapFaces[face]->getImage().getPixel(x, y);
-        const float lum = fmaxf(0.0f, 0.2126f * texel.r + 0.7152f * texel.g + 0.0722f * texel.b);
-        const float denom = s * s + t * t + 1.0f;
-        const float jac = 1.0f / (denom * sqrtf(denom));
-        // Convert from "pdf per (u,v) face area" to solid-angle pdf: multiply
-        // by Jacobian of (u,v → ω). Area of one texel in (s,t) space = 4/(W·H),
-        // so pdf_uv_area = lum·jac / totalWeight, and pdf_ω = pdf_uv_area /
-        // (jac · 4/(W·H)) = lum · W·H / (4 · totalWeight).
-        outPdf = lum * (float)(W * H) / (4.0f * this->scene->envCubeTotalWeight);
+        outPdf = this->envCubeCellPdf(face, x, y, s, t);
         return;
     }
 
@@ -1436,20 +2065,13 @@ void RayRenderer::sampleEnvmapDirection(float u0, float u1, vec3& outDir, float&
     const int H = this->scene->envmapH;
     if (W <= 0 || H <= 0 || this->scene->envmapTotalWeight <= 0.0f) return;
 
-    // 2D inversion: first the row from the marginal, then a pixel within
-    // that row from its conditional CDF.
-    const int y = searchCDF(this->scene->envmapMarginalY.data(), H, u0);
-    const float* row = &this->scene->envmapConditionalX[(size_t)y * (W + 1)];
-    const int x = searchCDF(row, W, u1);
-
-    // Jitter inside the chosen pixel so samples aren't all on pixel centres.
-    const float yPrev = this->scene->envmapMarginalY[y];
-    const float ySpan = this->scene->envmapMarginalY[y + 1] - yPrev;
-    const float xPrev = row[x];
-    const float xSpan = row[x + 1] - xPrev;
-    const float yFrac = (ySpan > 0.0f) ? (u0 - yPrev) / ySpan : 0.5f;
-    const float xFrac = (xSpan > 0.0f) ? (u1 - xPrev) / xSpan : 0.5f;
+    // Row from the row table, then a cell from that row's table.
+    float yFrac, xFrac;
+    const int y = sampleAlias(this->scene->envmapRowAlias.data(), H, u0, yFrac);
+    const int x = sampleAlias(&this->scene->envmapCellAlias[(size_t)y * W], W, u1, xFrac);
 
+    // Spread the sample over the chosen cell, which can cover many pixels
+    // of the image when the importance map is downsampled.
     const float u = (x + xFrac) / (float)W;
     const float v = (y + yFrac) / (float)H;
 
@@ -1470,38 +2092,41 @@ void RayRenderer::sampleEnvmapDirection(float u0, float u1, vec3& outDir, float&
     const float wz = -dx * sinY + dz * cosY;
     outDir = vec3(wx, dy, wz).normalize();
 
-    // PDF conversion: from (u,v) uniform space to solid angle on the sphere.
-    // p_img(u,v) = pixel_weight / total_weight.
-    // p_dir(ω) = p_img * (W*H) / (2π² sin(θ))  [standard eqrect jacobian]
-    const color4f texel = this->scene->envmap->getImage().getPixel(x, y);
-    const float lum = fmaxf(0.0f, 0.2126f * texel.r + 0.7152f * texel.g + 0.0722f * texel.b);
+    outPdf = this->envmapCellPdf(x, y, v);
+}
+
+float RayRenderer::envmapCellPdf(int x, int y, float v) const {
+    // The tables pick cell (x, y) with probability pmf and spread the
+    // sample uniformly over it. Over (u,v) that is a density of pmf·W·H;
+    // dω = 2π² sin(θ) du dv turns it into solid angle. sin(θ) is taken at
+    // `v` itself, the row's centre only enters through the weight.
+    const int W = this->scene->envmapW;
+    const int H = this->scene->envmapH;
     const float sinTheta = sinf((float)M_PI * v);
-    if (sinTheta <= 0.0f) { outPdf = 0.0f; return; }
-    const float pdfUV = (lum * sinTheta) / this->scene->envmapTotalWeight;
-    outPdf = pdfUV * (float)(W * H) / (2.0f * (float)(M_PI * M_PI) * sinTheta);
+    if (sinTheta <= 0.0f) return 0.0f;
+
+    const float pmf = this->scene->envmapCellPmf[(size_t)y * W + x];
+    return pmf * (float)(W * H) / (2.0f * (float)(M_PI * M_PI) * sinTheta);
 }
 
-color3 RayRenderer::traceEnvmapLight(const vec3& hit, const vec3& normal, float bsdfPdf) const {
-    if (this->scene == NULL) return color3::zero;
-    const bool hasEquirect = this->scene->envmap != NULL && this->scene->envmapTotalWeight > 0.0f;
-    const bool hasCube = this->scene->envCubeFaceSize > 0 && this->scene->envCubeTotalWeight > 0.0f;
-    if (!hasEquirect && !hasCube) return color3::zero;
+float RayRenderer::envCubeCellPdf(int face, int x, int y, float s, float t) const {
+    // A cell covers 4/(N·N) of the face's (s,t) square and dω = jac(s,t)
+    // ds dt at the sampled point.
+    const int N = this->scene->envCubeFaceSize;
+    const float pmf = this->scene->envCubeCellPmf[((size_t)face * N + y) * N + x];
+    return pmf * (float)(N * N) / (4.0f * cubeFaceJacobian(s, t));
+}
 
+color3 RayRenderer::traceEnvmapLight(const vec3& hit, const vec3& normal, float bsdfPdf) const {
     vec3 envDir;
     float envPdf = 0.0f;
-    this->sampleEnvmapDirection(randomValue(), randomValue(), envDir, envPdf);
-    if (envPdf <= 0.0f) return color3::zero;
+    color3 Li;
+    Ray shadowRay;
+    float maxT;
+    if (!this->sampleEnvmapLight(hit, normal, envDir, envPdf, Li, shadowRay, maxT)) return color3::zero;
+    if (this->isShadowed(shadowRay, maxT, ShadowOccluders::OpaqueOrRefractive)) return color3::zero;
 
     const float cosObj = dot(envDir, normal);
-    if (cosObj <= 0.0f) return color3::zero;
-
-    const Ray shadowRay = SurfaceRay(hit, envDir, normal);
-    const bool blocked = this->bvh.intersectAny(shadowRay, 1e30f, [](const RenderMeshTriangle* rt) {
-        const auto& mat = rt->object.material;
-        if (mat.emission > 0.0f) return false;
-        return mat.transparency < 0.01f || mat.refraction > 0.1f;
-    });
-    if (blocked) return color3::zero;
 
     // Power heuristic MIS weight. bsdfPdf is the cosine-weighted strategy's
     // pdf for this direction = cos/π. When the caller didn't advertise MIS
@@ -1513,7 +2138,6 @@ color3 RayRenderer::traceEnvmapLight(const vec3& hit, const vec3& normal, float
         w = e2 / (e2 + b2);
     }
 
-    const color3 Li = this->sampleEnvironment(envDir);
     // Lambertian BRDF = 1/π; cosθ from shading; divide by pdf_env; apply MIS.
     return Li * (cosObj * w / ((float)M_PI * envPdf));
 }
@@ -1550,9 +2174,7 @@ float RayRenderer::envmapDirectionPdf(const vec3& dir) const {
         const int W = this->scene->envCubeFaceSize;
         int x = (int)(u * W); if (x < 0) x = 0; if (x >= W) x = W - 1;
         int y = (int)(v * W); if (y < 0) y = 0; if (y >= W) y = W - 1;
-        const color4f texel = this->scene->envCubemapFaces[face]->getImage().getPixel(x, y);
-        const float lum = fmaxf(0.0f, 0.2126f * texel.r + 0.7152f * texel.g + 0.0722f * texel.b);
-        return lum * (float)(W * W) / (4.0f * this->scene->envCubeTotalWeight);
+        return this->envCubeCellPdf(face, x, y, s / ma, t / ma);
     }
 
     const int W = this->scene->envmapW;
@@ -1564,12 +2186,7 @@ float RayRenderer::envmapDirectionPdf(const vec3& dir) const {
     int x = (int)(u * W); if (x < 0) x = 0; if (x >= W) x = W - 1;
     int y = (int)(v * H); if (y < 0) y = 0; if (y >= H) y = H - 1;
 
-    const color4f texel = this->scene->envmap->getImage().getPixel(x, y);
-    const float lum = fmaxf(0.0f, 0.2126f * texel.r + 0.7152f * texel.g + 0.0722f * texel.b);
-    const float sinTheta = sinf((float)M_PI * v);
-    if (sinTheta <= 0.0f) return 0.0f;
-    const float pdfUV = (lum * sinTheta) / this->scene->envmapTotalWeight;
-    return pdfUV * (float)(W * H) / (2.0f * (float)(M_PI * M_PI) * sinTheta);
+    return this->envmapCellPdf(x, y, v);
 }
 
 void RayRenderer::traceEyeRaySurfaceInfo(const Ray& ray, ViewRaySurfaceInfo* surfaceInfo) const {
@@ -1581,11 +2198,11 @@ void RayRenderer::traceEyeRaySurfaceInfo(const Ray& ray, ViewRaySurfaceInfo* sur
         VertexInterpolation hi;
         this->calcVertexInterpolation(interInfo, &hi);
 
-        if (interInfo.triangle->object.visible) {
+        if (interInfo.object->visible) {
             surfaceInfo->hitted = true;
             surfaceInfo->interInfo = interInfo;
             surfaceInfo->hi = hi;
-            surfaceInfo->mat = &interInfo.triangle->object.material;
+            surfaceInfo->mat = &interInfo.object->material;
             return;
         }
     }
@@ -1839,7 +2456,7 @@ color3 RayRenderer::tracePath(const Ray& ray, void* shaderParam) const {
         // to the geometric face normal when we detect this anomaly;
         // smooth shading is locally lost on those slivers but the
         // black artefact goes away.
-        const vec3& gpd = info.triangle->ti.normalizedpd;
+        const vec3 gpd = info.geometricNormal();
         const vec3 geomN = (dot(gpd, ray.dir) <= 0.0f) ? gpd : -gpd;
         if (dot(ray.dir, vi.normal) > 0.0f && dot(ray.dir, geomN) < 0.0f) {
             vi.normal = geomN;
@@ -1865,6 +2482,16 @@ color3 RayRenderer::tracePath(const Ray& ray, void* shaderParam) const {
 
 void RayRenderer::findNearestTriangle(const Ray& ray, RayTriangleIntersectionInfo& info) const {
     this->bvh.intersectClosest(ray, info);
+    // Instanced geometry only has to beat the baked hit already in info.t.
+    this->instanceBvh.intersectClosest(ray, info);
+}
+
+void RayRenderer::findNearestTrianglePacket(const Ray* rays, int count, RayTriangleIntersectionInfo* infos) const {
+    this->bvh.intersectClosestPacket(rays, count, infos);
+    if (this->instanceBvh.empty()) return;
+    for (int i = 0; i < count; i++) {
+        this->instanceBvh.intersectClosest(rays[i], infos[i]);
+    }
 }
 
 vec3 cosineWeightedPointInTriangle(const Triangle& tri, const vec3& normal) {
@@ -1907,31 +2534,37 @@ float lightPDF(const vec3& hitPoint, const vec3& lightPoint, const vec3& lightNo
     return distanceSquared / (cosThetaLight * lightArea);
 }
 
-float RayRenderer::areaLightSampledArea(const RenderMeshTriangle& tri) const {
-    auto it = this->meshTriangles.find(&tri.mesh);
-    if (it == this->meshTriangles.end()) return tri.area;
-    return (float)it->second.size() * tri.area;
+float RayRenderer::areaLightPmf(const RenderMeshTriangle& tri, const vec3& from) const {
+    // Emission hits pass the continuation ray's origin, which sits one
+    // SURFACE_THICKNESS off the hit the NEE pick was made from; the light
+    // tree's importance doesn't change measurably over that distance.
+    if (tri.emitterIndex < 0) return 0.0f;
+    return this->settings.enableLightBVH ? this->lightBvh.pmf(from, tri.emitterIndex)
+                                         : this->lightBvh.powerPmf(tri.emitterIndex);
 }
 
-color3 RayRenderer::traceAreaLight(const LightSource& lightSource, const vec3& hit, const vec3& objectNormal) const {
-    const SceneObject* obj = lightSource.object;
-    if (obj == NULL) return color3::zero;
-
-    const auto& meshes = obj->getMeshes();
-    if (meshes.size() <= 0) return color3::zero;
+bool RayRenderer::pickAreaLight(const vec3& hit, const RenderMeshTriangle*& outTriangle, float& outPmf) const {
+    if (this->lightBvh.empty()) return false;
 
-    const Mesh* mesh = meshes[rand() % meshes.size()];
+    const float u = randomValue();
+    const int index = this->settings.enableLightBVH ? this->lightBvh.sample(hit, u, outPmf)
+                                                    : this->lightBvh.samplePower(u, outPmf);
+    if (index < 0 || outPmf <= 0.0f) return false;
 
-    const auto& triangleList = this->meshTriangles.at(mesh);
-    if (triangleList.size() <= 0) return colors::transparent;
+    outTriangle = this->lightBvh.emitter(index).triangle;
+    return true;
+}
 
-    const size_t triCount = triangleList.size();
-    const auto& triangle = *triangleList[rand() % triCount];
+color3 RayRenderer::traceAreaLight(const vec3& hit, const vec3& objectNormal) const {
+    const RenderMeshTriangle* picked = NULL;
+    float pmf = 0.0f;
+    if (!this->pickAreaLight(hit, picked, pmf)) return color3::zero;
+    const RenderMeshTriangle& triangle = *picked;
 
-    // Uniform area sampling: picking a triangle with probability 1/N and then
-    // a point uniformly within it gives point-pdf 1/(N * triArea). Converted to
-    // solid angle (multiplied by r²/cos_light), the estimator carries a factor
-    // of (N * triArea * cos_light / r²).
+    // Picking the triangle with probability pmf and then a point uniformly
+    // within it gives point-pdf pmf / triArea. Converted to solid angle
+    // (multiplied by r²/cos_light), the estimator carries a factor of
+    // (triArea / pmf * cos_light / r²).
     const vec3 p = ldsPointInTriangle(triangle.tri);
     const vec3 lightRay = p - hit;
     const vec3 lightDir = normalize(lightRay);
@@ -1953,15 +2586,15 @@ color3 RayRenderer::traceAreaLight(const LightSource& lightSource, const vec3& h
     // exact sampled point, but area lights are typically multi-triangle, so
     // other triangles of the same light can still sit at t<1 — skip anything
     // emissive so a light never self-shadows.
-    const bool blocked = this->bvh.intersectAny(ray, maxt, [](const RenderMeshTriangle* rt) {
-        const auto& mat = rt->object.material;
+    const bool blocked = this->isOccluded(ray, maxt, [](const RenderMeshTriangle*, const SceneObject& obj) {
+        const auto& mat = obj.material;
         return mat.transparency < 0.01f && mat.emission <= 0.0f;
     });
 
     if (blocked) return color3::zero;
 
-    const Material& lightMat = lightSource.object->material;
-    const float sampledArea = (float)triCount * triangle.area;
+    const Material& lightMat = triangle.object.material;
+    const float sampledArea = triangle.area / pmf;
     const float r2 = lightRay.length2();
 
     // MIS power heuristic (β=2) between this shadow-ray (light) strategy and
@@ -1983,29 +2616,16 @@ color3 RayRenderer::traceAreaLight(const LightSource& lightSource, const vec3& h
         * wLight;
 }
 
-bool RayRenderer::sampleAreaLightForNEE(const vec3& hit, const vec3& surfaceNormal,
-                                        vec3& outDir, float& outPdfLight, color3& outLe) const {
-    const int N = (int)this->areaLightSources.size();
-    if (N <= 0) return false;
-
-    const LightSource& ls = this->areaLightSources[rand() % N];
-    const SceneObject* obj = ls.object;
-    if (obj == NULL) return false;
-
-    const auto& meshes = obj->getMeshes();
-    if (meshes.size() <= 0) return false;
-    const Mesh* mesh = meshes[rand() % meshes.size()];
+bool RayRenderer::sampleAreaLight(const vec3& hit, const vec3& surfaceNormal,
+                                  vec3& outDir, float& outPdfLight, color3& outLe,
+                                  Ray& outShadowRay, float& outMaxT) const {
+    const RenderMeshTriangle* picked = NULL;
+    float pmf = 0.0f;
+    if (!this->pickAreaLight(hit, picked, pmf)) return false;
+    const RenderMeshTriangle& triangle = *picked;
 
-    const auto it = this->meshTriangles.find(mesh);
-    if (it == this->meshTriangles.end()) return false;
-    const auto& triangleList = it->second;
-    const size_t triCount = triangleList.size();
-    if (triCount <= 0) return false;
-
-    const auto& triangle = *triangleList[rand() % triCount];
-
-    // Same uniform-area sampling scheme traceAreaLight uses — the MIS pairing
-    // in the caller assumes this exact pdf.
+    // Same pick and point sampling traceAreaLight uses — the MIS pairing in
+    // the caller, and areaLightPmf at emission hits, assume this exact pdf.
     const vec3 p = ldsPointInTriangle(triangle.tri);
     const vec3 lightRay = p - hit;
     const vec3 dir = normalize(lightRay);
@@ -2018,25 +2638,28 @@ bool RayRenderer::sampleAreaLightForNEE(const vec3& hit, const vec3& surfaceNorm
     const float cosLight = dot(-dir, lightHit.normal);
     if (cosLight <= 0.0f) return false;
 
-    Ray shadowRay = SurfaceRay(hit, lightRay, surfaceNormal);
-    constexpr float maxt = 0.99999f;
-    const bool blocked = this->bvh.intersectAny(shadowRay, maxt, [](const RenderMeshTriangle* rt) {
-        const auto& mat = rt->object.material;
-        return mat.transparency < 0.01f && mat.emission <= 0.0f;
-    });
-    if (blocked) return false;
-
-    const Material& lightMat = obj->material;
-    const float sampledArea = (float)triCount * triangle.area;
+    const Material& lightMat = triangle.object.material;
+    const float sampledArea = triangle.area / pmf;
     const float r2 = lightRay.length2();
     outDir = dir;
     outPdfLight = r2 / (cosLight * sampledArea);
     outLe = lightMat.color * lightMat.emission;
+    outShadowRay = SurfaceRay(hit, lightRay, surfaceNormal);
+    outMaxT = 0.99999f;
     return true;
 }
 
-bool RayRenderer::sampleEnvmapForNEE(const vec3& hit, const vec3& surfaceNormal,
-                                     vec3& outDir, float& outPdfEnv, color3& outLi) const {
+bool RayRenderer::sampleAreaLightForNEE(const vec3& hit, const vec3& surfaceNormal,
+                                        vec3& outDir, float& outPdfLight, color3& outLe) const {
+    Ray shadowRay;
+    float maxT;
+    if (!this->sampleAreaLight(hit, surfaceNormal, outDir, outPdfLight, outLe, shadowRay, maxT)) return false;
+    return !this->isShadowed(shadowRay, maxT, ShadowOccluders::Opaque);
+}
+
+bool RayRenderer::sampleEnvmapLight(const vec3& hit, const vec3& surfaceNormal,
+                                    vec3& outDir, float& outPdfEnv, color3& outLi,
+                                    Ray& outShadowRay, float& outMaxT) const {
     if (this->scene == NULL) return false;
     const bool hasEquirect = this->scene->envmap != NULL && this->scene->envmapTotalWeight > 0.0f;
     const bool hasCube = this->scene->envCubeFaceSize > 0 && this->scene->envCubeTotalWeight > 0.0f;
@@ -2050,20 +2673,36 @@ bool RayRenderer::sampleEnvmapForNEE(const vec3& hit, const vec3& surfaceNormal,
     const float cosObj = dot(envDir, surfaceNormal);
     if (cosObj <= 0.0f) return false;
 
-    const Ray shadowRay = SurfaceRay(hit, envDir, surfaceNormal);
-    const bool blocked = this->bvh.intersectAny(shadowRay, 1e30f, [](const RenderMeshTriangle* rt) {
-        const auto& mat = rt->object.material;
-        if (mat.emission > 0.0f) return false;
-        return mat.transparency < 0.01f || mat.refraction > 0.1f;
-    });
-    if (blocked) return false;
-
     outDir = envDir;
     outPdfEnv = envPdf;
     outLi = this->sampleEnvironment(envDir);
+    outShadowRay = SurfaceRay(hit, envDir, surfaceNormal);
+    outMaxT = 1e30f;
     return true;
 }
 
+bool RayRenderer::sampleEnvmapForNEE(const vec3& hit, const vec3& surfaceNormal,
+                                     vec3& outDir, float& outPdfEnv, color3& outLi) const {
+    Ray shadowRay;
+    float maxT;
+    if (!this->sampleEnvmapLight(hit, surfaceNormal, outDir, outPdfEnv, outLi, shadowRay, maxT)) return false;
+    return !this->isShadowed(shadowRay, maxT, ShadowOccluders::OpaqueOrRefractive);
+}
+
+bool RayRenderer::isShadowed(const Ray& ray, const float maxT, const ShadowOccluders occluders) const {
+    if (occluders == ShadowOccluders::Opaque) {
+        return this->isOccluded(ray, maxT, [](const RenderMeshTriangle*, const SceneObject& obj) {
+            const auto& mat = obj.material;
+            return mat.transparency < 0.01f && mat.emission <= 0.0f;
+        });
+    }
+    return this->isOccluded(ray, maxT, [](const RenderMeshTriangle*, const SceneObject& obj) {
+        const auto& mat = obj.material;
+        if (mat.emission > 0.0f) return false;
+        return mat.transparency < 0.01f || mat.refraction > 0.1f;
+    });
+}
+
 bool RayRenderer::sampleVolumeLightForNEE(const vec3& hit, const vec3& surfaceNormal,
                                           vec3& outDir, float& outDist,
                                           float& outPdf, color3& outLe) const {
@@ -2073,7 +2712,7 @@ bool RayRenderer::sampleVolumeLightForNEE(const vec3& hit, const vec3& surfaceNo
     // Uniform-pick a registered emissive volume. With N > 1 the per-volume
     // pdf factor 1/N is folded into outPdf below so the caller doesn't have
     // to know the scene's volume count.
-    const int idx = rand() % N;
+    const int idx = randomIndex(N);
     const EmissiveVolumeSource& ev = this->emissiveVolumeSources[idx];
     const HomogeneousMedium* m = ev.medium;
     if (m == NULL) return false;
@@ -2089,13 +2728,10 @@ bool RayRenderer::sampleVolumeLightForNEE(const vec3& hit, const vec3& surfaceNo
         segA = m->coneOriginR;
         segB = m->coneOriginR + m->coneAxisR * m->coneLength;
     } else {
-        // Fall back: take object location through the view matrix as a
-        // single point. With a zero-length segment, equiangular collapses
-        // to a single direction sample — acts like a point light.
-        const vec3 loc = ev.object->location;
-        const vec4 lw(loc.x, loc.y, loc.z, 1.0f);
-        const vec4 lv = lw * this->viewMatrix;
-        segA = vec3(lv.x, lv.y, lv.z);
+        // Fall back: take the object location as a single point. With a
+        // zero-length segment, equiangular collapses to a single direction
+        // sample — acts like a point light.
+        segA = ev.object->location;
         segB = segA;
     }
 
@@ -2166,8 +2802,8 @@ bool RayRenderer::sampleVolumeLightForNEE(const vec3& hit, const vec3& surfaceNo
     // before the sampled point.
     const Ray shadowRay = SurfaceRay(hit, toSamp, surfaceNormal);
     const float maxt = 0.99999f;
-    const bool blocked = this->bvh.intersectAny(shadowRay, maxt, [](const RenderMeshTriangle* rt) {
-        const auto& mat = rt->object.material;
+    const bool blocked = this->isOccluded(shadowRay, maxt, [](const RenderMeshTriangle*, const SceneObject& obj) {
+        const auto& mat = obj.material;
         if (mat.emission > 0.0f) return false;
         return mat.transparency < 0.01f && mat.refraction <= 0.1f;
     });
@@ -2202,89 +2838,95 @@ bool RayRenderer::sampleVolumeLightForNEE(const vec3& hit, const vec3& surfaceNo
     return true;
 }
 
-color3 RayRenderer::tracePointLight(const LightSource& lightSource, const vec3& hit, const vec3& objectNormal) const {
+bool RayRenderer::samplePointLight(const LightSource& lightSource, const vec3& hit, const vec3& objectNormal,
+                                   color3& outL, Ray& outShadowRay, float& outMaxT) const {
     const vec3 lightray = lightSource.transformedLocation - hit;
+    const SceneObject* light = lightSource.object;
 
-    Ray ray = SurfaceRay(hit, lightray, objectNormal);
-    constexpr float maxt = 0.99999f;
+    const vec3 lightrayNormal = lightray.normalize();
 
-    const bool blocked = this->bvh.intersectAny(ray, maxt, [](const RenderMeshTriangle* rt) {
-        const auto& mat = rt->object.material;
-        if (mat.emission > 0.0f) return false;
-        return mat.transparency < 0.01f || mat.refraction > 0.1f;
-    });
+    float dotToObject = dot(lightrayNormal, objectNormal);
+    float dotToLight = dot(lightrayNormal, lightSource.transformedNormal);
 
-    const SceneObject* light = lightSource.object;
+    if (dotToObject <= 0) return false;
 
-    if (!blocked) {
-        const vec3 lightrayNormal = lightray.normalize();
+    const Material& lightMat = light->material;
 
-        float dotToObject = dot(lightrayNormal, objectNormal);
-        float dotToLight = dot(lightrayNormal, lightSource.transformedNormal);
+    if (lightMat.spotRange > 0) {
+        // spot light
+        const float spotRangeDot = cosf(RADIAN_TO_DEGREE(lightMat.spotRange * 0.5f));
+        dotToLight = dotToLight * smoothstep(fmaxf(spotRangeDot - 0.1f, 0.0f), fminf(spotRangeDot + 0.1f, 1.0f), dotToLight);
+    }
+    else {
+        dotToLight = fabsf(dotToObject);
+    }
 
-        if (dotToObject > 0) {
-            const Material& lightMat = light->material;
+    if (dotToLight <= 0) return false;
 
-            if (lightMat.spotRange > 0) {
-                // spot light
-                const float spotRangeDot = cosf(RADIAN_TO_DEGREE(lightMat.spotRange * 0.5f));
-                dotToLight = dotToLight * smoothstep(fmaxf(spotRangeDot - 0.1f, 0.0f), fminf(spotRangeDot + 0.1f, 1.0f), dotToLight);
-            }
-            else {
-                dotToLight = fabsf(dotToObject);
-            }
+    // distance attenuation
+    const float da = powf(lightray.length(), -2.0f);
 
-            if (dotToLight > 0) {
-                // distance attenuation
-                const float da = powf(lightray.length(), -2.0f);
+    // calc the lum from this light
+    const float lum = lightMat.emission * dotToLight * da;
 
-                // calc the lum from this light
-                const float lum = lightMat.emission * dotToLight * da;
+    // calc the phong specluar
+    float specluar = 0;
 
-                // calc the phong specluar
-                float specluar = 0;
-                
-                // todo
-//                const float glossy = interInfo.triangle->object.material.glossy;
-//                
-//                if (glossy > 0) {
-//                    if (this->settings.shaderProvider < 5) {
-//                        const vec3 r = reflect(-lightray, objectNormal).normalize();
-//                        const float d = dot(r, (cameraWorldPos - hit).normalize());
-//                        if (d > 0) {
-//                            specluar = powf(d, 10000 * glossy);
-//                        }
-//                    } else {
-//                        specluar = 0;
-//                    }
-//                }
-                
-                // final light color
-                return clamp(lightMat.color * ((lum + specluar)));
-            }
-        }
-    }
+    // todo
+//    const float glossy = interInfo.object->material.glossy;
+//
+//    if (glossy > 0) {
+//        if (this->settings.shaderProvider < 5) {
+//            const vec3 r = reflect(-lightray, objectNormal).normalize();
+//            const float d = dot(r, (cameraWorldPos - hit).normalize());
+//            if (d > 0) {
+//                specluar = powf(d, 10000 * glossy);
+//            }
+//        } else {
+//            specluar = 0;
+//        }
+//    }
+
+    // final light color
+    outL = clamp(lightMat.color * ((lum + specluar)));
+    outShadowRay = SurfaceRay(hit, lightray, objectNormal);
+    outMaxT = 0.99999f;
+    return true;
+}
+
+color3 RayRenderer::tracePointLight(const LightSource& lightSource, const vec3& hit, const vec3& objectNormal) const {
+    color3 light;
+    Ray ray;
+    float maxt;
+    if (!this->samplePointLight(lightSource, hit, objectNormal, light, ray, maxt)) return color3::zero;
+    if (this->isShadowed(ray, maxt, ShadowOccluders::OpaqueOrRefractive)) return color3::zero;
+    return light;
+}
 
-    return color3::zero;
+bool RayRenderer::samplePointLights(const vec3& hit, const vec3& objectNormal,
+                                    color3& outL, Ray& outShadowRay, float& outMaxT) const {
+    const int count = (int)this->pointLightSources.size();
+    if (count <= 0) return false;
+
+    // Same pick as traceLight: one light per call, uniformly.
+    const LightSource& ls = (count == 1) ? this->pointLightSources[0]
+                                         : this->pointLightSources[randomIndex(count)];
+    return this->samplePointLight(ls, hit, objectNormal, outL, outShadowRay, outMaxT);
 }
 
 color3 RayRenderer::traceLight(const vec3& hit, const vec3& normal) const {
     color3 areaLightColor, pointLightColor;
 
-    const int areaLightSourceCount = (int)this->areaLightSources.size();
     const int pointLightSourceCount = (int)this->pointLightSources.size();
 
-    if (areaLightSourceCount > 0) {
-        const LightSource& ls = this->areaLightSources[rand() % areaLightSourceCount];
-        areaLightColor = this->traceAreaLight(ls, hit, normal);
-    }
+    areaLightColor = this->traceAreaLight(hit, normal);
 
     if (pointLightSourceCount > 0) {
         if (pointLightSourceCount == 1) {
             pointLightColor = this->tracePointLight(this->pointLightSources[0], hit, normal);
         }
         else {
-            const LightSource& ls = this->pointLightSources[rand() % pointLightSourceCount];
+            const LightSource& ls = this->pointLightSources[randomIndex(pointLightSourceCount)];
             pointLightColor = this->tracePointLight(ls, hit, normal);
         }
     }
@@ -2320,12 +2962,7 @@ color3 RayRenderer::lambertTraceLights(const vec3& hit, const vec3& objectNormal
     
     color3 areaLightColor, pointLightColor;
 
-    const int areaLightSourceCount = (int)this->areaLightSources.size();
-
-    if (areaLightSourceCount > 0) {
-            const LightSource& ls = this->areaLightSources[rand() % areaLightSourceCount];
-            areaLightColor += this->traceAreaLight(ls, hit, objectNormal);
-    }
+    areaLightColor += this->traceAreaLight(hit, objectNormal);
 
     for (const LightSource& ls : this->pointLightSources) {
         pointLightColor += this->tracePointLight(ls, hit, objectNormal);
@@ -2358,7 +2995,7 @@ void RayRenderer::calcVertexInterpolation(const RayTriangleIntersectionInfo& inf
     vi->uv = rt->uv1 * info.w + rt->uv2 * info.u + rt->uv3 * info.v;
 
     // 法線のバリセンター補間（正規化）
-    vi->normal = (rt->n1 * info.w + rt->n2 * info.u + rt->n3 * info.v).normalize();
+    vi->normal = info.toViewNormal((rt->n1 * info.w + rt->n2 * info.u + rt->n3 * info.v).normalize());
 }
 
 #if !defined(AO_RANDOM_HEMISPHERE_RAY)
@@ -2388,8 +3025,8 @@ float RayRenderer::calcAO(const vec3& vertex, const vec3& normal, const float tr
         Ray ray = ThicknessRay(vertex, dir);
 
         
-        const bool occluded = this->bvh.intersectAny(ray, traceDistance, [](const RenderMeshTriangle* rt) {
-            return rt->object.material.transparency < 0.01f;
+        const bool occluded = this->isOccluded(ray, traceDistance, [](const RenderMeshTriangle*, const SceneObject& obj) {
+            return obj.material.transparency < 0.01f;
         });
 
         if (!occluded) {
@@ -2417,11 +3054,11 @@ float RayRenderer::calcVertexAO(const Mesh& mesh, const int triangleIndex, const
     int s = 0;
     
     for (int i = 0; i < this->settings.samples; i++) {
-        const vec3& dir = randomRayInHemisphere(n);
+        const vec3& dir = randomDirectionInHemisphere(n);
         
         Ray ray(v, dir);
 
-        const bool blocked = this->bvh.intersectAny(ray, traceDistance, [](const RenderMeshTriangle*) {
+        const bool blocked = this->isOccluded(ray, traceDistance, [](const RenderMeshTriangle*, const SceneObject&) {
             return true;
         });
 
@@ -2456,7 +3093,7 @@ void RayRenderer::calcVertexColors(Mesh &mesh) {
     }
 }
 
-inline bool RayRenderer::putTriangleIntoChildrenNode(RaySpaceTreeNode* node, const RenderMeshTriangle* rt) {
+inline bool RayRenderer::putTriangleIntoChildrenNode(RaySpaceTreeNode* node, const RenderMeshTriangle* rt) const {
   bool inLeft = node->left->intersectTriangle(rt->tri);
   bool inRight = node->right->intersectTriangle(rt->tri);
   
@@ -2470,7 +3107,7 @@ inline bool RayRenderer::putTriangleIntoChildrenNode(RaySpaceTreeNode* node, con
     return false;
 }
 
-bool RayRenderer::putTriangleIntoTree(RaySpaceTreeNode* node, const RenderMeshTriangle* rt) {
+bool RayRenderer::putTriangleIntoTree(RaySpaceTreeNode* node, const RenderMeshTriangle* rt) const {
     if (!node->splitted
         || !putTriangleIntoChildrenNode(node, rt))
     {
@@ -2530,83 +3167,6 @@ void RayRenderer::scanBoundingBoxNearestTriangle(const Ray& ray, const RenderMes
 #endif /* USE_SPACE_TREE_IN_BOUNDING_BOX */
 
 
-// Edge-avoiding À-Trous wavelet pass over rows [yStart, yEnd). The step size
-// expands the 5×5 stencil each level (1, 2, 4, ...). Edge-stopping functions
-// use luminance, encoded-normal cosine, and depth to gate the Gaussian kernel.
-void RayRenderer::atrousPass(const Image3f& srcColor, Image3f& dstColor,
-                             const Image3f& normal, const Image3f& depth,
-                             int stepSize, int yStart, int yEnd) const {
-    // B3 spline 5-tap: 1/16, 1/4, 3/8, 1/4, 1/16
-    static const float kernel[5] = { 1.0f/16.0f, 1.0f/4.0f, 3.0f/8.0f, 1.0f/4.0f, 1.0f/16.0f };
-
-    const int w = (int)srcColor.width();
-    const int h = (int)srcColor.height();
-
-    const float sigmaC = this->settings.denoiseSigmaColor;
-    const float sigmaN = this->settings.denoiseSigmaNormal;
-    const float sigmaD = this->settings.denoiseSigmaDepth;
-    const float invSigmaC2 = 1.0f / (2.0f * sigmaC * sigmaC + 1e-8f);
-    // Depth tolerance grows with step size so far-apart taps at high levels
-    // don't erroneously reject over micro depth gradients.
-    const float depthScale = 1.0f / (sigmaD * (float)stepSize + 1e-8f);
-
-    for (int y = yStart; y < yEnd; ++y) {
-        for (int x = 0; x < w; ++x) {
-            const color4f cc = srcColor.getPixel(x, y);
-            const color4f nc = normal.getPixel(x, y);
-            const color4f dc = depth.getPixel(x, y);
-            const vec3 centerColor(cc.r, cc.g, cc.b);
-            const vec3 centerNormal(nc.r * 2.0f - 1.0f, nc.g * 2.0f - 1.0f, nc.b * 2.0f - 1.0f);
-            const float centerDepth = dc.r;
-            const float centerLum = 0.2126f * centerColor.x + 0.7152f * centerColor.y + 0.0722f * centerColor.z;
-
-            vec3 sum(0.0f, 0.0f, 0.0f);
-            float wsum = 0.0f;
-
-            for (int ky = 0; ky < 5; ++ky) {
-                const int ny = y + (ky - 2) * stepSize;
-                if (ny < 0 || ny >= h) continue;
-                for (int kx = 0; kx < 5; ++kx) {
-                    const int nx = x + (kx - 2) * stepSize;
-                    if (nx < 0 || nx >= w) continue;
-
-                    const color4f cs = srcColor.getPixel(nx, ny);
-                    const color4f ns = normal.getPixel(nx, ny);
-                    const color4f ds = depth.getPixel(nx, ny);
-                    const vec3 sampleColor(cs.r, cs.g, cs.b);
-                    const vec3 sampleNormal(ns.r * 2.0f - 1.0f, ns.g * 2.0f - 1.0f, ns.b * 2.0f - 1.0f);
-                    const float sampleDepth = ds.r;
-
-                    const float sampleLum = 0.2126f * sampleColor.x + 0.7152f * sampleColor.y + 0.0722f * sampleColor.z;
-                    const float lumDiff = sampleLum - centerLum;
-                    const float wColor = expf(-(lumDiff * lumDiff) * invSigmaC2);
-
-                    // Normal weight: cosine raised to σ_n; clamp dot to [0,1].
-                    float ndot = sampleNormal.x * centerNormal.x
-                               + sampleNormal.y * centerNormal.y
-                               + sampleNormal.z * centerNormal.z;
-                    if (ndot < 0.0f) ndot = 0.0f;
-                    const float wNormal = powf(ndot, sigmaN);
-
-                    const float depthDiff = fabsf(sampleDepth - centerDepth);
-                    const float wDepth = expf(-depthDiff * depthScale);
-
-                    const float wKernel = kernel[kx] * kernel[ky];
-                    const float weight = wKernel * wColor * wNormal * wDepth;
-
-                    sum.x += sampleColor.x * weight;
-                    sum.y += sampleColor.y * weight;
-                    sum.z += sampleColor.z * weight;
-                    wsum += weight;
-                }
-            }
-
-            const vec3 finalColor = (wsum > 1e-8f) ? (sum / wsum) : centerColor;
-            dstColor.setPixel(x, y, color4(finalColor, cc.a));
-        }
-    }
-}
-
 void RayRenderer::applyTonemapGamma(const Image& src, Image& dst) const {
     const int w = (int)src.width();
     const int h = (int)src.height();
@@ -2646,136 +3206,61 @@ void RayRenderer::applyTonemapGamma(const Image& src, Image& dst) const {
     }
 }
 
-void RayRenderer::denoiseImage(const Image3f& noisy, const Image3f& normal,
-                               const Image3f& depth, const Image3f& albedo,
-                               Image3f& output) {
+void RayRenderer::denoiseImage(const Image3f& noisy, const RenderFilm& guides, Image3f& output) {
     const int w = (int)noisy.width();
     const int h = (int)noisy.height();
-    const int levels = std::max(1, this->settings.denoiseLevels);
-    const int numThreads = std::max(1, this->settings.threads);
-
-    Image3f bufA, bufB;
-    bufA.createEmpty(w, h);
-    bufB.createEmpty(w, h);
-
-    // Pre-pass: firefly suppression + albedo demodulation.
-    //
-    // Fireflies — isolated bright pixels from rare high-contribution paths
-    // (e.g. a lucky NEE hit on a dark material) — are preserved by the
-    // edge-stopping kernel because their color differs so much from
-    // neighbors that the weight collapses to zero. At samples=1 this shows
-    // up as persistent bright dots. A soft clamp against the 3×3 local max
-    // luminance pulls them into a reasonable range before filtering without
-    // touching legitimate bright regions (where the max is already close).
-    //
-    // Demodulation then divides the suppressed noisy signal by albedo so
-    // the filter operates on "incoming lighting" — smooth across material
-    // boundaries — and we re-multiply by albedo after the final pass to
-    // restore color detail. The albedo floor prevents division-blowup on
-    // dark channels; the demod cap bounds any residual amplification.
-    // AOV alpha channel flags geometry hits (1) vs sky/miss (0); sky
-    // pixels pass through unchanged.
-    const float albedoFloor = 0.3f;
-    const float demodCap = 3.0f;
-    const float fireflyRatio = 1.5f;
-    const float fireflyEps = 0.01f;
-    auto luminance = [](float r, float g, float b) {
-        return 0.2126f * r + 0.7152f * g + 0.0722f * b;
-    };
-    for (int y = 0; y < h; ++y) {
-        for (int x = 0; x < w; ++x) {
-            color4f c = noisy.getPixel(x, y);
-
-            float maxNeighLum = 0.0f;
-            for (int dy = -1; dy <= 1; ++dy) {
-                const int ny = y + dy;
-                if (ny < 0 || ny >= h) continue;
-                for (int dx = -1; dx <= 1; ++dx) {
-                    if (dx == 0 && dy == 0) continue;
-                    const int nx = x + dx;
-                    if (nx < 0 || nx >= w) continue;
-                    const color4f n = noisy.getPixel(nx, ny);
-                    const float nlum = luminance(n.r, n.g, n.b);
-                    if (nlum > maxNeighLum) maxNeighLum = nlum;
-                }
-            }
-            const float centerLum = luminance(c.r, c.g, c.b);
-            const float cap = fireflyRatio * maxNeighLum + fireflyEps;
-            if (centerLum > cap) {
-                const float scale = cap / centerLum;
-                c.r *= scale; c.g *= scale; c.b *= scale;
-            }
-
-            const color4f a = albedo.getPixel(x, y);
-            if (a.a > 0.5f) {
-                const float ar = fmaxf(a.r, albedoFloor);
-                const float ag = fmaxf(a.g, albedoFloor);
-                const float ab = fmaxf(a.b, albedoFloor);
-                bufA.setPixel(x, y, color4f(fminf(c.r / ar, demodCap),
-                                            fminf(c.g / ag, demodCap),
-                                            fminf(c.b / ab, demodCap),
-                                            1.0f));
-            } else {
-                bufA.setPixel(x, y, c);
+    ThreadPool& pool = this->workerPool();
+    AtrousDenoiser& d = this->denoiser;
+    d.resize(w, h);
+
+    // Row bands a few per worker, as in the denoiser's own stages.
+    const int bands = std::max(1, std::min(h, pool.size() * 4));
+    const int rowsPerBand = (h + bands - 1) / bands;
+
+    // Unpack the image and the film's guides (possibly half floats) into
+    // the denoiser's planes once, rather than per tap and level.
+    pool.parallelFor(bands, [&](int band) {
+        const int yEnd = std::min(h, (band + 1) * rowsPerBand);
+        for (int y = band * rowsPerBand; y < yEnd; ++y) {
+            for (int x = 0; x < w; ++x) {
+                const size_t i = (size_t)y * w + x;
+                const color4f c = noisy.getPixel(x, y);
+                d.r[i] = c.r; d.g[i] = c.g; d.b[i] = c.b;
+                const vec3 n = guides.aovNormal(x, y);
+                d.normalX[i] = n.x; d.normalY[i] = n.y; d.normalZ[i] = n.z;
+                d.depth[i] = guides.aovDepth(x, y);
+                const color3f a = guides.aovAlbedo(x, y);
+                d.albedoR[i] = a.r; d.albedoG[i] = a.g; d.albedoB[i] = a.b;
+                d.hit[i] = guides.aovHit(x, y) ? 1 : 0;
             }
         }
-    }
-
-    Image3f* src = &bufA;
-    Image3f* dst = &bufB;
-
-    for (int level = 0; level < levels; ++level) {
-        const int stepSize = 1 << level;
-
-        std::vector<std::thread> workers;
-        workers.reserve(numThreads);
-        const int rowsPerThread = (h + numThreads - 1) / numThreads;
-        for (int t = 0; t < numThreads; ++t) {
-            const int yStart = t * rowsPerThread;
-            const int yEnd = std::min(h, yStart + rowsPerThread);
-            if (yStart >= yEnd) break;
-            const Image3f* srcConst = src;
-            Image3f* dstPtr = dst;
-            workers.emplace_back([this, srcConst, dstPtr, &normal, &depth, stepSize, yStart, yEnd] {
-                this->atrousPass(*srcConst, *dstPtr, normal, depth, stepSize, yStart, yEnd);
-            });
-        }
-        for (std::thread& th : workers) th.join();
-
-        Image3f* tmp = src; src = dst; dst = tmp;
-    }
+    });
 
-    // Remodulate and blend with the original noisy input by `denoiseIntensity`.
-    // intensity = 1 → pure filtered output (full denoise)
-    // intensity = 0 → original noisy (pass-through, effectively disabled)
-    // Blending happens in linear-HDR space, before the post-denoise tonemap.
-    const Image3f& filtered = *src;
-    const float t = clamp(this->settings.denoiseIntensity, 0.0f, 1.0f);
-    const float s = 1.0f - t;
-    for (int y = 0; y < h; ++y) {
-        for (int x = 0; x < w; ++x) {
-            const color4f f = filtered.getPixel(x, y);
-            const color4f n = noisy.getPixel(x, y);
-            const color4f a = albedo.getPixel(x, y);
-            color4f remod;
-            if (a.a > 0.5f) {
-                remod = color4f(f.r * a.r, f.g * a.g, f.b * a.b, 1.0f);
-            } else {
-                remod = f;
+    AtrousParams params;
+    params.levels = this->settings.denoiseLevels;
+    params.sigmaColor = this->settings.denoiseSigmaColor;
+    params.sigmaNormal = this->settings.denoiseSigmaNormal;
+    params.sigmaDepth = this->settings.denoiseSigmaDepth;
+    params.intensity = this->settings.denoiseIntensity;
+    params.fusedLevels = this->settings.denoiseFusedLevels;
+    d.denoise(pool, params);
+
+    pool.parallelFor(bands, [&](int band) {
+        const int yEnd = std::min(h, (band + 1) * rowsPerBand);
+        for (int y = band * rowsPerBand; y < yEnd; ++y) {
+            for (int x = 0; x < w; ++x) {
+                const size_t i = (size_t)y * w + x;
+                output.setPixel(x, y, color4f(d.r[i], d.g[i], d.b[i], 1.0f));
             }
-            output.setPixel(x, y, color4f(n.r * s + remod.r * t,
-                                          n.g * s + remod.g * t,
-                                          n.b * s + remod.b * t,
-                                          1.0f));
         }
-    }
+    });
 }
 
 //--------------------------------------
 
 color3 RayBSDFShaderProvider::shade(const RayTriangleIntersectionInfo& interInfo, const Ray& inray,
                                     const VertexInterpolation& vi, void* shaderParam) {
-    const Material& m = interInfo.triangle->object.material;
+    const Material& m = interInfo.object->material;
     BSDFParam param(*this->renderer, interInfo, inray, vi);
 
     // Seed the path's current medium so child shaders can read it (e.g.
@@ -2805,8 +3290,8 @@ color3 RayBSDFShaderProvider::shade(const RayTriangleIntersectionInfo& interInfo
                 if (cosLight <= 0.0f) return color3::zero;
 
                 const float r2 = (interInfo.hit - inray.origin).length2();
-                const float sampledArea = this->renderer->areaLightSampledArea(*interInfo.triangle);
-                const float pdfLight = r2 / (cosLight * sampledArea);
+                const float pmf = this->renderer->areaLightPmf(*interInfo.triangle, inray.origin);
+                const float pdfLight = r2 * pmf / (cosLight * interInfo.triangle->area);
                 const float pdfBsdf = sp->bsdfSampledPdf;
                 const float pdfLight2 = pdfLight * pdfLight;
                 const float pdfBsdf2 = pdfBsdf * pdfBsdf;
@@ -2895,9 +3380,112 @@ color3 RayBSDFShaderProvider::shade(const RayTriangleIntersectionInfo& interInfo
     }
 }
 
+void RayBSDFShaderProvider::scatter(const RayTriangleIntersectionInfo& interInfo, const Ray& inray,
+                                    const VertexInterpolation& vi, const BSDFParam* incoming,
+                                    BSDFSample& s) {
+    // Non-recursive twin of shade(): the same decisions in the same order,
+    // but the continuation and the NEE shadow rays are handed back in `s`.
+    const Material& m = interInfo.object->material;
+    BSDFParam param(*this->renderer, interInfo, inray, vi);
+
+    // Same medium seed as shade(); lobes that cross the surface replace it.
+    if (incoming != NULL) {
+        param.currentMedium = incoming->currentMedium;
+    } else {
+        const Scene* sc = this->renderer->getScene();
+        if (sc != NULL) param.currentMedium = sc->globalMedium;
+    }
+    s.medium = param.currentMedium;
+
+    if (m.emission > 0.0f) {
+        const color3 emission = m.color * m.emission;
+        s.emitted = emission;
+        if (incoming != NULL && incoming->bsdfSampledPdf > 0.0f) {
+            const float cosLight = -dot(inray.dir, vi.normal);
+            if (cosLight <= 0.0f) {
+                s.emitted = color3::zero;
+                return;
+            }
+            const float r2 = (interInfo.hit - inray.origin).length2();
+            const float pmf = this->renderer->areaLightPmf(*interInfo.triangle, inray.origin);
+            const float pdfLight = r2 * pmf / (cosLight * interInfo.triangle->area);
+            const float pdfBsdf2 = incoming->bsdfSampledPdf * incoming->bsdfSampledPdf;
+            s.emitted = emission * (pdfBsdf2 / (pdfBsdf2 + pdfLight * pdfLight));
+        }
+        return;
+    }
+
+    if (dot(inray.dir, vi.normal) > 0.0f) {
+        if (m.transparency > 0.001f) {
+            if (incoming != NULL && incoming->passes + 1 <= MAX_TRACE_DEPTH) {
+                param.passes = incoming->passes + 1;
+                param.throughput = incoming->throughput;
+                transparencyShader.sample(param, s);
+                s.chromaChannel = param.chromaChannel;
+            }
+            return;
+        }
+        else if (m.refraction < 0.001f && m.glossy > 0.001f) {
+            return;
+        }
+    }
+
+    if (incoming != NULL) {
+        if (incoming->passes + 1 >= MAX_TRACE_DEPTH) {
+            // Rare enough that the direct term is traced in place rather
+            // than queued.
+            if (1.0f - m.glossy - m.refraction > 0.00001f && this->renderer->settings.enableColorSampling) {
+                color3 color = m.color;
+                if (m.texture != NULL) {
+                    color *= m.texture->sample(vi.uv * m.texTiling).rgb;
+                }
+                s.emitted = this->renderer->traceLight(interInfo.hit, vi.normal) * color;
+            }
+            return;
+        }
+
+        param.passes = incoming->passes + 1;
+        param.throughput = incoming->throughput;
+        param.chromaChannel = incoming->chromaChannel;
+        param.bsdfSampledPdf = incoming->bsdfSampledPdf;
+
+        float rrWeight = 1.0f;
+        if (param.passes >= MIN_RR_DEPTH) {
+            const color3& t = param.throughput;
+            float q = fmaxf(t.r, fmaxf(t.g, t.b));
+            q = fminf(RR_MAX_PROB, fmaxf(RR_MIN_PROB, q));
+            if (randomValue() >= q) return;
+            rrWeight = 1.0f / q;
+        }
+
+        if (m.transparency > 0.001f) {
+            transparencyShader.sample(param, s);
+        } else {
+            mixShader.sample(param, s);
+        }
+        s.scale(rrWeight);
+    } else {
+        if (m.transparency > 0.01f) {
+            // shade() sums mix * (1 - transparency) + transparency; pick one
+            // of the two with probability proportional to its weight.
+            const float wMix = 1.0f - m.transparency;
+            const float total = wMix + 1.0f;
+            if (randomValue() * total < wMix) {
+                mixShader.sample(param, s);
+            } else {
+                transparencyShader.sample(param, s);
+            }
+            s.scale(total);
+        } else {
+            mixShader.sample(param, s);
+        }
+    }
+    s.chromaChannel = param.chromaChannel;
+}
+
 color3 RayBSDFBakeShaderProvider::shade(const RayTriangleIntersectionInfo& interInfo, const Ray& inray,
                                         const VertexInterpolation& vi, void* shaderParam) {
-    const Material& m = interInfo.triangle->object.material;
+    const Material& m = interInfo.object->material;
     
     if (m.emission > 0.0f) {
         return (m.color * m.emission);
@@ -12,10 +12,18 @@
 #include <stdio.h>
 #include <atomic>
 #include <map>
+#include <memory>
 
 #include "raycommon.h"
 #include "bsdf.h"
+#include "atrous.h"
 #include "bvh.h"
+#include "film.h"
+#include "lightbvh.h"
+#include "pathguide.h"
+#include "threadpool.h"
+#include "tilefile.h"
+#include "wavefront.h"
 #include "renderer.h"
 #include "cubetex.h"
 #include "ucm/stopwatch.h"
@@ -31,22 +39,45 @@
 #if defined(DEBUG) || defined(_DEBUG) /* DEBUG */
 #define PIXEL_BLOCK 1
 #define TRACE_PATH_SAMPLES 2
-#define RENDER_THREADS 7
 #else /* RELEASE */
 #define PIXEL_BLOCK 1
 #define TRACE_PATH_SAMPLES 20
-#define RENDER_THREADS 7
 #endif /* END OF DEBUG */
 
 #else /* DEBUG */
 #define PIXEL_BLOCK 1
 #define TRACE_PATH_SAMPLES 100
-#define RENDER_THREADS 1
 
 #endif /* DEBUG */
 
 #define RAY_MAX_DISTANCE 100.0f
 
+// Safety cap on path depth. Russian Roulette handles typical path termination
+// (see RayBSDFShaderProvider::shade), so this only bounds worst-case depth.
+// Glass / refractive meshes can chain 10+ internal Fresnel bounces on
+// concave geometry, so the cap needs headroom above the diffuse norm.
+#define MAX_TRACE_DEPTH 32
+// Start Russian Roulette after this many bounces so early, high-throughput
+// bounces are always traced — only the tail of the path is stochastic.
+#define MIN_RR_DEPTH 3
+// Continuation probability is clamped to this range: low enough that dim
+// paths can die quickly, high enough that variance from 1/q stays bounded.
+#define RR_MIN_PROB 0.05f
+#define RR_MAX_PROB 0.95f
+
+// Eye rays are traced as 4x4 pixel packets (BVH_PACKET_SIZE) unless depth
+// of field spreads them wider than this lens radius / focus distance ratio.
+#define PACKET_BLOCK_SIZE 4
+#define PACKET_MAX_DOF_SPREAD 0.02f
+
+// Side of the square tiles render threads pull from the work queue. 32 px
+// is a long-standing sweet spot for path tracers: small enough that load
+// imbalance between tiles is bounded (one heavy tile is ~1024 rays out of
+// 1M+ total), large enough that the per-tile atomic fetch_add is amortised
+// over thousands of ray-traces. Streaming renders use it as the tile size
+// of their scratch files.
+#define RENDER_TILE_SIZE 32
+
 namespace raygen {
 
 class RayShaderProvider;
@@ -85,19 +116,73 @@ struct RenderTile {
 	int width, height;
 };
 
+// A render worker's private pixels for the tile it is working on. Samples
+// accumulate into `sum` / `sumSq` (row-major over the tile); once the tile
+// is done they are added to the film and the tile's preview is resolved
+// into `preview` and copied into the frame as one block, so workers never
+// write the shared frame pixel by pixel and neighbouring tiles don't
+// bounce cache lines between cores.
+struct RenderTileBuffer {
+	std::vector<color3f> sum, sumSq;
+	Image4f preview;
+	// The tile's denoise guides while streaming, when there's no full-frame
+	// film to hold them.
+	RenderFilm guides;
+};
+
 class RayTransformedMesh {
 public:
 	const Mesh* mesh = NULL;
 	BoundingBox bbox;
 	RayRenderTriangleList triangleList;
-	RaySpaceTree triangleTree;
+};
+
+// Storage for the transformed triangles of one transformScene(). Each mesh
+// takes one contiguous block, sized up front, in place of a heap
+// allocation per triangle; clear() destroys them all at once.
+class RenderTriangleArena {
+public:
+	RenderTriangleArena() { }
+	~RenderTriangleArena() { this->clear(); }
+
+	RenderTriangleArena(const RenderTriangleArena&) = delete;
+	RenderTriangleArena& operator=(const RenderTriangleArena&) = delete;
+
+	// Uninitialised room for `count` triangles. The caller constructs every
+	// one of them (placement new) before the next clear().
+	RenderMeshTriangle* allocate(size_t count);
+	void clear();
+
+	inline size_t size() const {
+		return this->count;
+	}
+
+private:
+	struct Block {
+		RenderMeshTriangle* data;
+		size_t count;
+	};
+	std::vector<Block> blocks;
+	size_t count = 0;
+};
+
+// Mesh-local geometry shared by every placement of an instanced mesh. Built
+// once per transformScene() no matter how many SceneObjects reference it;
+// each placement only adds a BVHInstance to the top-level tree.
+class RayInstancedMesh {
+public:
+	const Mesh* mesh = NULL;
+	BoundingBox bbox;  // mesh-local
+	RayRenderTriangleList triangleList;
+	TriangleBVH bvh;
 };
 
 typedef void RenderThreadCallback(float progressRate);
 
 struct RendererSettings {
 	int resolutionWidth = DEFAULT_RENDER_WIDTH, resolutionHeight = DEFAULT_RENDER_HEIGHT;
-	int threads = RENDER_THREADS;
+	// One worker per hardware thread unless the caller says otherwise.
+	int threads = ThreadPool::hardwareThreads();
 	int samples = TRACE_PATH_SAMPLES;
 	byte shaderProvider = 5;
 
@@ -107,13 +192,85 @@ struct RendererSettings {
 	bool enableRenderingPostProcess = false;
 	bool enableBakingPostProcess = true;
 	bool enableDenoise = false;
+	// Keep the denoiser's normal / albedo / depth guides as half floats.
+	bool enableHalfFloatAOVs = true;
 	bool cullBackFace = false;
+	// Meshes placed by more than one SceneObject are kept once in mesh-local
+	// space under a shared bottom-level BVH and referenced from a top-level
+	// instance BVH, instead of being baked into view space per placement.
+	// Emissive objects are always baked so light sampling sees view-space
+	// triangles. Bake rendering turns this off (lightmaps are per placement).
+	bool enableInstancing = true;
+	// Node width of the triangle BVHs: 2 traverses the binary tree, 4 or 8
+	// collapse it into wide nodes whose children are slab-tested in one
+	// SSE/AVX pass. Kept selectable to compare the two on the same scene.
+	int bvhWidth = 2;
+	// Build preset of the triangle BVHs. Fast bins fewer candidates for
+	// interactive previews; High adds spatial splits, which pay off on
+	// long thin triangles at several times the Balanced build time.
+	BVHBuildQuality bvhQuality = BVHBuildQuality::Balanced;
+	// Trace primary rays as coherent 4x4-pixel packets through the BVH.
+	// Skipped automatically with a global medium, a wide DOF aperture or
+	// bvhWidth above 2, where the per-pixel path is used as before. Shading stays per ray and
+	// draws the same Halton dims per pixel-sample as the per-pixel path.
+	bool enablePacketTracing = true;
+	// Wavefront integrator: trace a tile's paths breadth-first in stages
+	// (generate, intersect, sort by shader, shade, shadow-ray batch) out of
+	// SoA queues instead of recursing per sample. Unbiased against the
+	// recursive integrator but not sample-identical: MixShader always picks
+	// one lobe per vertex (see enableLobeSelection). Falls back to the
+	// recursive path for non-BSDF shaders and scenes with active media.
+	bool enableWavefront = false;
+	// MixShader picks one of a mixed material's diffuse, glossy and
+	// refraction lobes per hit, with probability proportional to its
+	// weight, instead of tracing every lobe. A sample costs linear rather
+	// than exponential time in path depth; off traces all lobes, which is
+	// less noisy per sample on shallow scenes. Off by default, so mixed
+	// materials render as they always have.
+	bool enableLobeSelection = false;
+	// Trace each sample in a loop over an explicit path state (throughput,
+	// medium, MIS pdf, dispersion channel) instead of recursing through
+	// tracePath and the shaders: no stack growth with depth, and the same
+	// estimator through the shaders' sample() twins. Like the wavefront
+	// integrator, mixed materials always trace one lobe per hit, so it
+	// only runs with enableLobeSelection on. The recursive integrator
+	// still runs for non-BSDF shader providers and while path guiding is
+	// on. Off by default: it is unbiased against the recursive integrator
+	// but not sample-identical, and tracks a single current medium rather
+	// than a stack of nested ones.
+	bool enableIterativeIntegrator = false;
+	// Low-discrepancy sequence of the pixel-sample dims. Halton stratifies
+	// the first 16 dims (two or three bounces) and leaves the rest to the
+	// PRNG; Sobol stays stratified at any depth, which converges deep
+	// glass and volume paths faster at the same sample count. ZSobol also
+	// spreads the error as blue noise across pixels, which reads cleaner
+	// and denoises better at the 1-8 spp of interactive previews.
+	LowDiscrepancySequence sampleSequence = LowDiscrepancySequence::Halton;
+	// Area-light NEE picks the emissive triangle through a light BVH that
+	// weighs power by distance and orientation to the shading point. Off,
+	// triangles are picked by power alone, which is cheaper per shadow ray
+	// but wastes samples on lights far away or facing elsewhere.
+	bool enableLightBVH = true;
+	// Path guiding: the first `guidingTrainingPasses` adaptive passes learn
+	// where light reaches each region of the scene from, and later diffuse
+	// bounces draw half their directions from that, so interiors lit mostly
+	// by bounced light find the bright openings sooner. Needs adaptive
+	// sampling and is ignored without it; the wavefront integrator keeps
+	// cosine sampling. The one exception to renders coming out the same
+	// for any thread count: the guide sums records in whatever order the
+	// threads hand them in, so its learned distribution, and the image,
+	// can differ in the last bits between runs.
+	bool enablePathGuiding = false;
+	int guidingTrainingPasses = 4;
 
 	int denoiseLevels = 5;
 	float denoiseSigmaColor = 0.4f;
 	float denoiseSigmaNormal = 128.0f;
 	float denoiseSigmaDepth = 0.1f;
 	float denoiseIntensity = 1.0f;  // 0 = pass-through, 1 = full À-Trous
+	// Leading denoise levels run back to back per cache tile instead of
+	// one full-frame pass each (see AtrousDenoiser); 0 = off.
+	int denoiseFusedLevels = 0;
 
 	// Per-sample radiance clamp (“firefly clamp”). Bounds the HDR return of
 	// each primary sample before accumulation so a single path with
@@ -148,6 +305,14 @@ struct RendererSettings {
 	// here when --dump-bloom is passed.
 	ucm::string postprocessDumpPath;
 
+	// Non-empty path (.ppm, or .pfm for linear HDR) switches render() to
+	// out-of-core mode for renders too large for memory: finished tiles go
+	// to scratch tile files next to it instead of the in-memory images, and
+	// denoise, bloom and tonemap run over them block by block, writing the
+	// result straight to this path. Uniform sampling only; getRenderResult()
+	// and getHdrResult() stay empty.
+	ucm::string streamOutputPath;
+
 	color3 worldColor = color3(1.0f, 0.95f, 0.9f) * 0.1f;
 	color4 backColor = color4(1.0f, 0.95f, 0.9f, 0.0f) * 0.2f;
 };
@@ -165,6 +330,9 @@ struct RenderThreadContext {
 	int apertureBlades = 0;
 	float apertureRotation = 0.0f;  // radians
     float exposure = 1.0;
+	// Inverse of viewMatrix. Eye rays are generated in camera space and
+	// moved into world space, where the cached scene lives.
+	Matrix4 cameraToWorld;
 };
 
 struct ViewRaySurfaceInfo {
@@ -181,9 +349,10 @@ private:
 	vec3 cameraWorldPos;
 
 	std::vector<const RayTransformedMesh*> transformedMeshes;
-	std::vector<LightSource> areaLightSources;
 	std::vector<LightSource> pointLightSources;
 	std::vector<EmissiveVolumeSource> emissiveVolumeSources;
+	// Any object carries an active interior medium (set by prepareMedia).
+	bool hasInteriorMedia = false;
 	
 	void initRenderThreadContext(RenderThreadContext* ctx);
     void renderThread(const RenderThreadContext& ctx, const int threadId);
@@ -194,8 +363,8 @@ private:
 	void buildTileList(int imgWidth, int imgHeight);
 
 	// Adaptive driver: runs base + per-tile refinement passes, accumulating
-	// into adaptiveSumImage / adaptiveSumSqImage and committing the running
-	// mean to renderingImage / hdrImage so the preview refines progressively.
+	// into the film and committing the running mean to renderingImage so
+	// the preview refines progressively.
 	void renderAdaptive(const RenderThreadContext& ctx);
 	// Adaptive worker: pulls tile indices out of `activeTiles` via fetch_add,
 	// runs samples [sampleStart, sampleStart + sampleCount) for each pixel.
@@ -215,20 +384,68 @@ private:
 	                            int x, int y,
 	                            int sampleStart, int sampleCount,
 	                            color3f& sum, color3f& sumSq);
-	// Commit the running mean for one tile to hdrImage + renderingImage so
-	// the in-flight preview shows refinement after each adaptive pass.
-	void commitTilePreview(const RenderThreadContext& ctx, size_t tileIdx);
+	// Packet flavour of accumulatePixelSamples for a block of up to
+	// PACKET_BLOCK_SIZE² pixels at (x0, y0); sum / sumSq are per pixel in
+	// row-major block order. Used when usePacketTracing() says so.
+	void accumulatePacketSamples(const RenderThreadContext& ctx, Ray& ray,
+	                             int x0, int y0, int w, int h,
+	                             int sampleStart, int sampleCount,
+	                             color3f* sum, color3f* sumSq);
+	bool usePacketTracing(const RenderThreadContext& ctx) const;
+	// Wavefront flavour for a whole tile, used when useWavefront() says so:
+	// runs samples [sampleStart, sampleStart + sampleCount) for every pixel
+	// breadth-first until all paths have terminated. sum / sumSq are per
+	// pixel in row-major tile order. `paths` is the thread's reusable state.
+	void accumulateWavefrontSamples(const RenderThreadContext& ctx, WavefrontPaths& paths,
+	                                const RenderTile& tile, int sampleStart, int sampleCount,
+	                                color3f* sum, color3f* sumSq);
+	bool useWavefront() const;
+	void wavefrontGenerate(const RenderThreadContext& ctx, WavefrontPaths& paths,
+	                       const RenderTile& tile, int sampleStart, int sampleCount) const;
+	void wavefrontIntersect(WavefrontPaths& paths, bool packets) const;
+	void wavefrontSort(WavefrontPaths& paths) const;
+	void wavefrontShade(WavefrontPaths& paths, const RenderTile& tile);
+	void wavefrontTraceShadows(WavefrontPaths& paths) const;
+	// Loop-based integrator for one eye sample whose closest hit is already
+	// in `eyeHit`; returns what shadeEyeRay would.
+	bool useIterativeIntegrator() const;
+	color4 traceIterative(const Ray& eyeRay, const RayTriangleIntersectionInfo& eyeHit) const;
+	// Firefly-clamp one sample and add it to a pixel's running sums.
+	static void accumulateSample(color4f oneSample, float clampMax, color3f& sum, color3f& sumSq);
+	// Eye ray for (x, y, sampleIdx) in world space. Starts the pixel-sample's
+	// Halton walk and draws the jitter / lens dims from it.
+	void generateEyeRay(const RenderThreadContext& ctx, int x, int y, int sampleIdx, Ray& ray) const;
+	void writeDenoiseGuides(const Ray& ray, int x, int y);
+	// Average `sum` over `samples` and tonemap; HDR radiance to `outHdr`.
+	color4f resolvePixel(const RenderThreadContext& ctx, const color3f& sum, int samples, color4f* outHdr) const;
+	// Zeroes `buf`'s sums for `tile` and sizes its preview to match.
+	void beginTileBuffer(RenderTileBuffer& buf, const RenderTile& tile) const;
+	// Adds `buf`'s `samples` samples to the film and refreshes the tile's
+	// part of renderingImage from the film's totals. The adaptive passes
+	// commit after each pass, so the in-flight preview shows the refinement.
+	void commitTileBuffer(const RenderThreadContext& ctx, const RenderTile& tile,
+	                      RenderTileBuffer& buf, int samples);
 	// Mean per-pixel relative standard-error-of-the-mean across the tile.
 	// Returns 0 if the tile has no samples yet.
 	float computeTileNoise(size_t tileIdx) const;
 	
 	void findNearestTriangle(const Ray& ray, RayTriangleIntersectionInfo& info) const;
+	void findNearestTrianglePacket(const Ray* rays, int count, RayTriangleIntersectionInfo* infos) const;
+	// Shadow / occlusion query over both the baked BVH and the instance BVH.
+	// `pred(triangle, placement)` returns true when the hit occludes.
+	template<typename Pred>
+	bool isOccluded(const Ray& ray, float maxT, Pred&& pred) const {
+		if (this->bvh.intersectAny(ray, maxT, [&](const RenderMeshTriangle* rt) {
+			return pred(rt, rt->object);
+		})) return true;
+		return this->instanceBvh.intersectAny(ray, maxT, pred);
+	}
 	void scanBoundingBoxNearestTriangle(const Ray& ray, const RenderMeshTriangle* hitrt, RayMeshIntersection& rmi) const;
 	void scanBoundingBoxSpaceTreeNearestTriangle(const Ray& ray, RayMeshIntersection& rmi) const;
 	float scanBoundingBoxRayBlocked(const Ray& ray, const float maxt, const RenderMeshTriangle* hitrt) const;
 
-    bool putTriangleIntoChildrenNode(RaySpaceTreeNode* node, const RenderMeshTriangle* rt);
-    bool putTriangleIntoTree(RaySpaceTreeNode* node, const RenderMeshTriangle* rt);
+    bool putTriangleIntoChildrenNode(RaySpaceTreeNode* node, const RenderMeshTriangle* rt) const;
+    bool putTriangleIntoTree(RaySpaceTreeNode* node, const RenderMeshTriangle* rt) const;
 	void scanSpaceTreeNearestTriangle(const RaySpaceTreeNode* node, const Ray& ray, RayMeshIntersection& rmi) const;
     float scanSpaceTreeRayBlocked(const RaySpaceTreeNode* node, const Ray& ray, const float maxt, float* t_out = NULL) const;
 	float scanBoundingBoxSpaceTreeRayBlocked(const Ray& ray, const float maxt, float* t_out = NULL) const;
@@ -237,16 +454,25 @@ private:
 	void calcVertexInterpolation(const RenderMeshTriangle& rt, const vec3& hit, VertexInterpolation* hi) const;
     void calcVertexInterpolation(const RayTriangleIntersectionInfo& info, VertexInterpolation* vi) const;
     
-	color3 traceAreaLight(const LightSource& lightSource, const vec3& hit, const vec3& normal) const;
+	color3 traceAreaLight(const vec3& hit, const vec3& normal) const;
+	// Picks an emissive triangle for NEE from `hit` and returns its
+	// selection probability; false when no emitter can light `hit`.
+	bool pickAreaLight(const vec3& hit, const RenderMeshTriangle*& outTriangle, float& outPmf) const;
 	color3 tracePointLight(const LightSource& lightSource, const vec3& hit, const vec3& objectNormal) const;
+	bool samplePointLight(const LightSource& lightSource, const vec3& hit, const vec3& objectNormal,
+	                      color3& outL, Ray& outShadowRay, float& outMaxT) const;
 
-	color4 renderPixel(const RenderThreadContext& ctx, Ray& ray, const int x, const int y, color4f* outHdr = NULL);
 	color4 traceEyeRay(const Ray& ray) const;
+	// Shade an eye ray whose closest hit is already in `interInfo`.
+	color4 shadeEyeRay(const Ray& ray, const RayTriangleIntersectionInfo& interInfo) const;
     void traceEyeRaySurfaceInfo(const Ray& ray, ViewRaySurfaceInfo* info) const;
 
 protected:
 	RaySpaceTree tree;
 	TriangleBVH bvh;
+	InstanceBVH instanceBvh;
+	// Emissive triangles of triangleList, for area-light NEE.
+	LightBVH lightBvh;
 	
 	std::vector<const RenderMeshTriangle*> triangleList;
 	Image4f renderingImage;
@@ -262,35 +488,99 @@ protected:
 	std::atomic<size_t> nextTileIndex{0};
 	std::atomic<size_t> completedTiles{0};
 
-	// Adaptive sampling state. Allocated and populated only when
-	// settings.enableAdaptiveSampling is on; otherwise these stay empty
-	// and zero overhead. adaptiveSumImage/SumSqImage are per-pixel
-	// running totals (alpha unused). tileSampleCounts records the number
-	// of samples that have been accumulated for each tile so far —
-	// uniform across the tile, since every pass spans the whole tile.
-	Image adaptiveSumImage;
-	Image adaptiveSumSqImage;
+	// Adaptive sampling state. tileSampleCounts records the number of
+	// samples that have been accumulated for each tile so far — uniform
+	// across the tile, since every pass spans the whole tile. The per-pixel
+	// running totals live in the film, which keeps sums of squares for the
+	// noise estimate only when adaptive sampling is on.
 	std::vector<int> tileSampleCounts;
 
+	// Path guiding state of the current adaptive render; guidingActive is
+	// set by renderAdaptive() when settings.enablePathGuiding is on and the
+	// scene has geometry to bound the guide.
+	std::unique_ptr<PathGuide> pathGuide;
+	bool guidingActive = false;
+	bool beginPathGuiding();
+
+	// Long-lived workers shared by render(), the adaptive passes, the
+	// denoiser and the baker. Started on first use; workerPool() restarts
+	// it when settings.threads has changed since.
+	ThreadPool threadPool;
+	ThreadPool& workerPool();
+
 	void transformScene();
 	void transformObject(SceneTransformStack& transformStack, SceneObject& obj);
 	void clearTransformedScene();
+	// (Re)builds lightBvh over triangleList and stamps each triangle's
+	// emitterIndex. Run after the triangles are built or refitted.
+	void buildLightSampler();
+
+	// transformObject() only records what each non-instanced mesh needs;
+	// transformScene() then sizes the arena once and builds every triangle
+	// in parallel. `bounds` indexes sceneObjectBounds, the object whose
+	// worldBbox the mesh contributes to.
+	struct MeshTransformJob {
+		RayTransformedMesh* tmesh;
+		const SceneObject* object;
+		Matrix4 modelMatrix;
+		Matrix4 normalMatrix;
+		size_t first;  // into triangleList and the arena block
+		size_t bounds;
+	};
+	struct SceneObjectBounds {
+		SceneObject* object;
+		BoundingBox bbox;
+		bool empty;
+	};
+	std::vector<MeshTransformJob> meshTransformJobs;
+	std::vector<SceneObjectBounds> sceneObjectBounds;
+	RenderTriangleArena triangleArena;
+
+	// Positions in the transformed scene that refitObject() has walked so
+	// far; the walk visits objects in transformObject's order.
+	struct SceneRefitCursor {
+		size_t mesh = 0;        // into transformedMeshes
+		size_t instance = 0;    // into instances
+		size_t pointLight = 0;  // into pointLightSources
+	};
+	// Re-reads vertex positions and transforms into the cached triangles,
+	// instances and point lights, then refits the BVHs instead of building
+	// them. Returns false without finishing when the scene no longer has
+	// the structure it was built with; the caller rebuilds then.
+	bool refitScene();
+	bool refitObject(SceneTransformStack& transformStack, SceneObject& obj, SceneRefitCursor& cursor);
+	// Bakes participating media and rebuilds the emissive-volume light list.
+	// Cheap, so it runs every render() even when the geometry is reused.
+	void prepareMedia();
+
+	// Set by invalidateScene(); render() rebuilds the world-space scene when
+	// this is set or when `transformedScene` no longer matches `scene`.
+	std::atomic<bool> sceneDirty{true};
+	// Set by invalidateGeometry(); render() refits the cached scene.
+	std::atomic<bool> geometryDirty{false};
+	const Scene* transformedScene = NULL;
+	// Returns the shared mesh-local BVH for `mesh`, building it on first use.
+	// `obj` only seeds RenderMeshTriangle::object; instanced hits report the
+	// actual placement through RayTriangleIntersectionInfo::object.
+	const RayInstancedMesh* getInstancedMesh(const Mesh& mesh, const SceneObject& obj);
 	
 	std::map<const Mesh*, RayRenderTriangleList> meshTriangles;
-    
-    // ガイド付きデノイズ用バッファ（一次ヒット AOV）
-    Image3f normalBuffer;
-    Image3f albedoBuffer;
-    Image3f depthBuffer;
 
+	// Instancing state, rebuilt by transformScene(). meshPlacements counts
+	// how many non-emissive renderable objects reference each mesh; meshes
+	// with more than one go through instancedMeshes / instances.
+	std::map<const Mesh*, int> meshPlacements;
+	std::map<const Mesh*, RayInstancedMesh*> instancedMeshes;
+	std::vector<BVHInstance> instances;
+    
     // Edge-avoiding À-Trous wavelet denoiser. Multi-pass with step sizes
-    // 1, 2, 4, ... per level; guided by normal/depth AOVs.
-    void denoiseImage(const Image3f& noisy, const Image3f& normal,
-                      const Image3f& depth, const Image3f& albedo,
-                      Image3f& output);
-    void atrousPass(const Image3f& srcColor, Image3f& dstColor,
-                    const Image3f& normal, const Image3f& depth,
-                    int stepSize, int yStart, int yEnd) const;
+    // 1, 2, 4, ... per level; guided by the film's normal/depth AOVs and
+    // demodulated by its albedo AOV.
+    void denoiseImage(const Image3f& noisy, const RenderFilm& guides, Image3f& output);
+    // Planes of the last denoise, kept for the next one at the same render
+    // size so every preview denoise doesn't reallocate them. Released by
+    // setRenderSize and after a streamed post-process.
+    AtrousDenoiser denoiser;
     // Reinhard + ≈1/2.2 gamma. Reads linear HDR `src`, writes LDR `dst`.
     // Used as the final pass after HDR bloom (or as-is when bloom is off).
     void applyTonemapGamma(const Image& src, Image& dst) const;
@@ -301,15 +591,44 @@ protected:
     // reapplyPostProcess() can re-run it against the cached HDR image.
     void applyPostProcess(Image& hdr);
 
-    // Linear HDR radiance buffer populated by each render thread alongside
-    // the LDR `renderingImage` preview. Bloom + tonemap operate from here.
+    // Sample totals and denoise guides of the current render; see
+    // RenderFilm. Render threads write here and to the LDR preview only.
+    RenderFilm film;
+    int renderWidth = 0, renderHeight = 0;
+
+    // Linear HDR radiance, resolved from the film once tracing finishes.
+    // Denoise, bloom + tonemap operate from here.
     Image hdrImage;
 
     // Snapshot of the (optionally denoised) linear HDR image taken right
     // before bloom. reapplyPostProcess restores from this so tweaking bloom
-    // params is near-free compared to a full re-render.
+    // params is near-free compared to a full re-render. Without denoise the
+    // snapshot would equal the film's mean, so it is resolved again from
+    // the film (at `filmExposure`) instead, and only copied out when the
+    // next render is about to reset the film.
     Image preBloomHdrImage;
     bool hasPreBloomImage = false;
+    bool preBloomInFilm = false;
+    float filmExposure = 1.0f;
+
+    // Bloom stages shared by applyPostProcess and the streaming post pass:
+    // the part of `c` above the threshold, and the halo blur of the glow
+    // downsampled by bloomSizeAspect from a `fullWidth`-wide image.
+    color4f bloomExtract(const color4f& c) const;
+    void bloomBlur(Image& glowSmall, int fullWidth) const;
+
+    // Out-of-core rendering (settings.streamOutputPath). The worker of each
+    // thread points streamTileBuffer at its buffer, so writeDenoiseGuides
+    // fills the tile's guides instead of the film.
+    inline bool isStreaming() const { return !this->settings.streamOutputPath.isEmpty(); }
+    std::unique_ptr<TiledImageFile> streamRadiance;
+    std::unique_ptr<TiledImageFile> streamGuides;
+    static thread_local RenderTileBuffer* streamTileBuffer;
+    void renderStreaming(const RenderThreadContext& ctx);
+    void commitStreamTile(const RenderThreadContext& ctx, const RenderTile& tile,
+                          RenderTileBuffer& buf, int samples);
+    // Denoise, bloom and tonemap over the tile files into the output file.
+    bool finishStreaming();
 
 public:
 	RendererSettings settings;
@@ -335,11 +654,17 @@ public:
 	// Importance-sample the envmap by luminance. u0/u1 are uniform in [0,1);
 	// returns the sampled world-space direction in outDir and the solid-angle
 	// PDF in outPdf. PDF is 0 when the envmap has no weight (no light to
-	// sample) — callers must skip the NEE path then.
+	// sample) — callers must skip the NEE path then. Constant time: u0 draws
+	// the row from the scene's alias tables, u1 the cell within it.
 	void sampleEnvmapDirection(float u0, float u1, vec3& outDir, float& outPdf) const;
 	// Solid-angle PDF that the envmap importance sampler would have assigned
 	// to this world-space direction. Used on the BSDF side of the MIS pair.
 	float envmapDirectionPdf(const vec3& dir) const;
+	// Shared by the two above: solid-angle pdf of a direction inside
+	// importance-map cell (x, y), at image v / face coordinates (s, t) in
+	// [-1, 1]. Reads the stored cell pmf, not the image.
+	float envmapCellPdf(int x, int y, float v) const;
+	float envCubeCellPdf(int face, int x, int y, float s, float t) const;
 	// Direct envmap contribution at a diffuse hit via luminance IS + shadow
 	// ray + MIS against a cos-weighted BSDF strategy of pdf `bsdfPdf`.
 	// Returns L(ω) · cos(θ) / π / pdf_env · w_env, excluding surface albedo
@@ -359,6 +684,20 @@ public:
 	                           vec3& outDir, float& outPdfLight, color3& outLe) const;
 	bool sampleEnvmapForNEE(const vec3& hit, const vec3& surfaceNormal,
 	                        vec3& outDir, float& outPdfEnv, color3& outLi) const;
+	// The same samplers with the shadow test left to the caller, which gets
+	// the shadow ray and its maxT instead. The wavefront integrator queues
+	// these and tests them in one batch through isShadowed().
+	bool sampleAreaLight(const vec3& hit, const vec3& surfaceNormal,
+	                     vec3& outDir, float& outPdfLight, color3& outLe,
+	                     Ray& outShadowRay, float& outMaxT) const;
+	bool sampleEnvmapLight(const vec3& hit, const vec3& surfaceNormal,
+	                       vec3& outDir, float& outPdfEnv, color3& outLi,
+	                       Ray& outShadowRay, float& outMaxT) const;
+	// Point-light half of traceLight: picks one point light and returns its
+	// unshadowed contribution (Lambert-weighted, as tracePointLight).
+	bool samplePointLights(const vec3& hit, const vec3& objectNormal,
+	                       color3& outL, Ray& outShadowRay, float& outMaxT) const;
+	bool isShadowed(const Ray& ray, float maxT, ShadowOccluders occluders) const;
 	// Phase 4: NEE for emissive participating media. Picks one of the
 	// registered emissive volumes and equiangular-samples a point along its
 	// cone axis (or bbox centre for Constant-mode media). On success returns
@@ -378,11 +717,16 @@ public:
 	                             float& outPdf, color3& outLe) const;
 	color3 lambertTraceLights(const vec3& hit, const vec3& objectNormal) const;
 
-	// Effective area of the light strategy's pdf at a given emitter triangle:
-	// returns triCount * tri.area, matching the "pick triangle uniformly,
-	// then pick a uniform point" sampling used by traceAreaLight. Used by
-	// the BSDF-sampled emission hit to reconstruct pdf_light for MIS.
-	float areaLightSampledArea(const RenderMeshTriangle& tri) const;
+	// Probability that the light strategy, shading at `from`, picks emitter
+	// triangle `tri` — the same pick traceAreaLight / sampleAreaLight make.
+	// A point on it then has area pdf pmf / tri.area. Used by the BSDF-
+	// sampled emission hit to reconstruct pdf_light for MIS.
+	float areaLightPmf(const RenderMeshTriangle& tri, const vec3& from) const;
+	// Guide the diffuse shader samples and records against, NULL when path
+	// guiding is off for the current render.
+	inline PathGuide* getPathGuide() const {
+		return this->guidingActive ? this->pathGuide.get() : NULL;
+	}
     std::vector<LightSource> getAllLights() { return this->pointLightSources; }
     
     float calcAO(const vec3& vertex, const vec3& normal, const float traceDistance = RAY_MAX_DISTANCE) const;
@@ -394,11 +738,17 @@ public:
     }
 	
 	inline void setRenderSize(const int width, const int height) {
-		this->renderingImage.createEmpty(width, height);
-		this->hdrImage.createEmpty(width, height);
+		this->renderWidth = width;
+		this->renderHeight = height;
+		// Streaming renders never hold the whole frame.
+		if (!this->isStreaming()) {
+			this->renderingImage.createEmpty(width, height);
+			this->hdrImage.createEmpty(width, height);
+		}
 		// Pre-bloom cache was sized to the old buffer; drop it so the next
 		// reapplyPostProcess call correctly falls back to a full render.
 		this->hasPreBloomImage = false;
+		this->denoiser.release();
 	}
   
     inline const Image& getRenderResult() const {
@@ -412,8 +762,38 @@ public:
         return this->hdrImage;
     }
 
+    // Per-pixel sample sums and denoise guides of the last render.
+    inline const RenderFilm& getFilm() const {
+        return this->film;
+    }
+
 	void clearRenderResult();
 
+	// Build report for the baked-triangle BVH of the last scene rebuild.
+	inline const BVHBuildStats& getBVHBuildStats() const {
+		return this->bvh.buildStats();
+	}
+
+	// Marks the cached world-space scene (triangles, BVHs, light lists) stale
+	// so the next render() rebuilds it. Call after editing objects, meshes,
+	// materials or transforms; camera moves and settings changes don't need
+	// it. Safe to call from another thread while a render is running.
+	inline void invalidateScene() {
+		this->sceneDirty = true;
+	}
+
+	// Cheaper form of invalidateScene() for frames where geometry only
+	// moved: object location / angle / scale edits, or mesh vertices
+	// rewritten in place (an animated surface). The next render() updates
+	// the cached triangles and refits the BVHs in one linear pass. Anything
+	// else — visibility, emission, triangle counts, added or removed objects
+	// — still needs invalidateScene(); a refit that finds the scene's
+	// structure changed, or the BVH quality degraded too far, falls back to
+	// the full rebuild on its own.
+	inline void invalidateGeometry() {
+		this->geometryDirty = true;
+	}
+
 	// Re-runs post-process (bloom) on the cached pre-bloom image, skipping
 	// the ray-tracing + denoise passes entirely. Returns false and leaves
 	// renderingImage untouched if no prior render is cached yet.
@@ -491,6 +871,10 @@ public:
 	}
 	
 	color3 shade(const RayTriangleIntersectionInfo& interInfo, const Ray& inray, const VertexInterpolation& vi, void* shaderParam = NULL);
+	// One path vertex for the wavefront integrator. `incoming` carries the
+	// path state shade() reads from its shaderParam (NULL for the eye ray).
+	void scatter(const RayTriangleIntersectionInfo& interInfo, const Ray& inray, const VertexInterpolation& vi,
+	             const BSDFParam* incoming, BSDFSample& s);
 };
 
 class RayBSDFBakeShaderProvider : public RayShaderProvider
@@ -327,138 +327,189 @@ Scene::~Scene() {
     }
 }
 
-void Scene::buildEnvmapCDF() {
-    this->envmapMarginalY.clear();
-    this->envmapConditionalX.clear();
+namespace {
+// Vose's alias method over `n` weights. `scaled`, `under` and `over` are
+// scratch the caller reuses across the many per-row tables. A table whose
+// weights are all zero comes out uniform; its row is never drawn anyway.
+void buildAliasTable(const float* weights, int n, EnvmapAliasEntry* out,
+                     std::vector<double>& scaled, std::vector<int>& under, std::vector<int>& over) {
+    double total = 0.0;
+    for (int i = 0; i < n; i++) total += weights[i];
+    if (total <= 0.0) {
+        for (int i = 0; i < n; i++) {
+            out[i].threshold = 1.0f;
+            out[i].alias = (uint32_t)i;
+        }
+        return;
+    }
+
+    scaled.resize(n);
+    under.clear();
+    over.clear();
+    for (int i = 0; i < n; i++) {
+        scaled[i] = weights[i] * (double)n / total;
+        if (scaled[i] < 1.0) under.push_back(i); else over.push_back(i);
+    }
+
+    // Each under-full slot is topped up by one over-full slot, which may
+    // then drop below full itself.
+    while (!under.empty() && !over.empty()) {
+        const int lo = under.back();
+        under.pop_back();
+        const int hi = over.back();
+        out[lo].threshold = (float)scaled[lo];
+        out[lo].alias = (uint32_t)hi;
+        scaled[hi] -= 1.0 - scaled[lo];
+        if (scaled[hi] < 1.0) {
+            over.pop_back();
+            under.push_back(hi);
+        }
+    }
+    // Whatever is left is full up to round-off.
+    for (int i : over) {
+        out[i].threshold = 1.0f;
+        out[i].alias = (uint32_t)i;
+    }
+    for (int i : under) {
+        out[i].threshold = 1.0f;
+        out[i].alias = (uint32_t)i;
+    }
+}
+
+// Mean luminance of the source pixels under each cell of a gw × gh grid
+// laid over `img`. Cells cover whole pixels, at least one each, so a cell
+// has weight wherever the image has any light.
+void boxFilterLuminance(const Image& img, int gw, int gh, std::vector<float>& out) {
+    const int W = (int)img.width();
+    const int H = (int)img.height();
+    out.assign((size_t)gw * gh, 0.0f);
+
+    for (int gy = 0; gy < gh; gy++) {
+        const int y0 = (int)((long long)gy * H / gh);
+        const int y1 = std::max(y0 + 1, (int)((long long)(gy + 1) * H / gh));
+        for (int gx = 0; gx < gw; gx++) {
+            const int x0 = (int)((long long)gx * W / gw);
+            const int x1 = std::max(x0 + 1, (int)((long long)(gx + 1) * W / gw));
+            float sum = 0.0f;
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    const color4f c = img.getPixel(x, y);
+                    sum += fmaxf(0.0f, 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b);
+                }
+            }
+            out[(size_t)gy * gw + gx] = sum / (float)((y1 - y0) * (x1 - x0));
+        }
+    }
+}
+}
+
+void Scene::buildEnvmapAliasTables() {
+    this->envmapRowAlias.clear();
+    this->envmapCellAlias.clear();
+    this->envmapCellPmf.clear();
     this->envmapTotalWeight = 0.0f;
     this->envmapW = 0;
     this->envmapH = 0;
 
-    this->envCubeMarginalFace.clear();
-    this->envCubeMarginalY.clear();
-    this->envCubeConditionalX.clear();
+    this->envCubeRowAlias.clear();
+    this->envCubeCellAlias.clear();
+    this->envCubeCellPmf.clear();
     this->envCubeTotalWeight = 0.0f;
     this->envCubeFaceSize = 0;
 
-    // Cubemap path: when all six faces are attached, build a luminance CDF
-    // per face weighted by each texel's solid angle on the unit sphere. This
-    // matches the equirect CDF's convention (pdf in solid-angle units) so the
-    // MIS weights interoperate.
+    std::vector<float> cellLum;
+    std::vector<double> scaled;
+    std::vector<int> under, over;
+
+    // Cubemap path: when all six faces are attached, weight each cell by
+    // its luminance and its solid angle on the unit sphere. This matches
+    // the equirect tables' convention (pdf in solid-angle units) so the MIS
+    // weights interoperate.
     bool hasCube = true;
     for (int i = 0; i < 6; i++) if (this->envCubemapFaces[i] == NULL) { hasCube = false; break; }
     if (hasCube) {
-        const int W = (int)this->envCubemapFaces[0]->getImage().width();
-        const int H = (int)this->envCubemapFaces[0]->getImage().height();
-        if (W > 0 && H > 0) {
-            this->envCubeFaceSize = W;  // assumes square faces, consistent across all 6
-            this->envCubeMarginalFace.assign(7, 0.0f);
-            this->envCubeMarginalY.assign((size_t)6 * (H + 1), 0.0f);
-            this->envCubeConditionalX.assign((size_t)6 * H * (W + 1), 0.0f);
-
-            float faceWeights[6] = { 0, 0, 0, 0, 0, 0 };
+        int N = (int)this->envCubemapFaces[0]->getImage().width();  // assumes square faces, consistent across all 6
+        if (this->envmapImportanceWidth > 0) N = std::min(N, std::max(1, this->envmapImportanceWidth / 4));
+        if (N > 0) {
+            this->envCubeFaceSize = N;
+            this->envCubeCellAlias.resize((size_t)6 * N * N);
+            this->envCubeCellPmf.resize((size_t)6 * N * N);
+            std::vector<float> rowWeight((size_t)6 * N, 0.0f);
 
             for (int f = 0; f < 6; f++) {
-                const auto& img = this->envCubemapFaces[f]->getImage();
-                std::vector<float> rowWeight(H, 0.0f);
-                for (int y = 0; y < H; y++) {
-                    this->envCubeConditionalX[((size_t)f * H + y) * (W + 1)] = 0.0f;
+                boxFilterLuminance(this->envCubemapFaces[f]->getImage(), N, N, cellLum);
+                for (int y = 0; y < N; y++) {
+                    const size_t row = (size_t)f * N + y;
+                    float* weight = &this->envCubeCellPmf[row * N];
                     float rowSum = 0.0f;
-                    const float t = 1.0f - (y + 0.5f) * (2.0f / (float)H);  // face-local, [-1, 1]
-                    for (int x = 0; x < W; x++) {
-                        const float s = (x + 0.5f) * (2.0f / (float)W) - 1.0f;
-                        // Per-texel solid angle on the unit sphere ∝ 1/(s² + t² + 1)^(3/2).
+                    const float t = 1.0f - (y + 0.5f) * (2.0f / (float)N);  // face-local, [-1, 1]
+                    for (int x = 0; x < N; x++) {
+                        const float s = (x + 0.5f) * (2.0f / (float)N) - 1.0f;
+                        // Per-cell solid angle on the unit sphere ∝ 1/(s² + t² + 1)^(3/2).
                         const float denom = s * s + t * t + 1.0f;
                         const float jac = 1.0f / (denom * sqrtf(denom));
-                        const color4f c = img.getPixel(x, y);
-                        const float lum = fmaxf(0.0f, 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b);
-                        const float w = lum * jac;
-                        rowSum += w;
-                        this->envCubeConditionalX[((size_t)f * H + y) * (W + 1) + (x + 1)] = rowSum;
-                    }
-                    if (rowSum > 0.0f) {
-                        const float inv = 1.0f / rowSum;
-                        for (int x = 1; x <= W; x++) {
-                            this->envCubeConditionalX[((size_t)f * H + y) * (W + 1) + x] *= inv;
-                        }
+                        weight[x] = cellLum[(size_t)y * N + x] * jac;
+                        rowSum += weight[x];
                     }
-                    rowWeight[y] = rowSum;
-                }
-                this->envCubeMarginalY[(size_t)f * (H + 1)] = 0.0f;
-                for (int y = 0; y < H; y++) {
-                    this->envCubeMarginalY[(size_t)f * (H + 1) + y + 1] =
-                        this->envCubeMarginalY[(size_t)f * (H + 1) + y] + rowWeight[y];
-                }
-                const float faceTotal = this->envCubeMarginalY[(size_t)f * (H + 1) + H];
-                faceWeights[f] = faceTotal;
-                if (faceTotal > 0.0f) {
-                    const float inv = 1.0f / faceTotal;
-                    for (int y = 0; y <= H; y++) this->envCubeMarginalY[(size_t)f * (H + 1) + y] *= inv;
+                    buildAliasTable(weight, N, &this->envCubeCellAlias[row * N], scaled, under, over);
+                    rowWeight[row] = rowSum;
                 }
             }
 
             float total = 0.0f;
-            for (int f = 0; f < 6; f++) total += faceWeights[f];
+            for (float w : rowWeight) total += w;
             this->envCubeTotalWeight = total;
+            this->envCubeRowAlias.resize(rowWeight.size());
+            buildAliasTable(rowWeight.data(), (int)rowWeight.size(), this->envCubeRowAlias.data(), scaled, under, over);
             if (total > 0.0f) {
-                const float inv = 1.0f / total;
-                float acc = 0.0f;
-                this->envCubeMarginalFace[0] = 0.0f;
-                for (int f = 0; f < 6; f++) {
-                    acc += faceWeights[f];
-                    this->envCubeMarginalFace[f + 1] = acc * inv;
-                }
+                for (float& w : this->envCubeCellPmf) w /= total;
             }
         }
     }
 
     if (this->envmap == NULL) return;
     const auto& img = this->envmap->getImage();
-    const int W = (int)img.width();
-    const int H = (int)img.height();
+    int W = (int)img.width();
+    int H = (int)img.height();
     if (W <= 0 || H <= 0) return;
+    if (this->envmapImportanceWidth > 0 && W > this->envmapImportanceWidth) {
+        H = std::max(1, (int)((long long)H * this->envmapImportanceWidth / W));
+        W = this->envmapImportanceWidth;
+    }
 
     this->envmapW = W;
     this->envmapH = H;
+    boxFilterLuminance(img, W, H, cellLum);
 
-    // Row-major per-pixel weights, each weighted by sin(theta) so equal-area
-    // samples come from a sphere, not from the image (pixels near the poles
-    // of an equirectangular map are highly foreshortened).
+    // Cell weights are luminance, rows are additionally weighted by
+    // sin(theta) so equal-area samples come from a sphere, not from the
+    // image (cells near the poles of an equirectangular map are highly
+    // foreshortened). sin(theta) is constant along a row, so the per-row
+    // tables don't need it.
     std::vector<float> rowWeight(H, 0.0f);
-    this->envmapConditionalX.resize((size_t)H * (W + 1));
+    this->envmapCellAlias.resize((size_t)H * W);
+    this->envmapCellPmf.resize((size_t)H * W);
 
     for (int y = 0; y < H; y++) {
         const float v = (y + 0.5f) / (float)H;
         const float sinTheta = sinf((float)M_PI * v);
+        const float* lum = &cellLum[(size_t)y * W];
         float rowSum = 0.0f;
-        this->envmapConditionalX[(size_t)y * (W + 1)] = 0.0f;
         for (int x = 0; x < W; x++) {
-            const color4f c = img.getPixel(x, y);
-            const float lum = fmaxf(0.0f, 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b);
-            rowSum += lum * sinTheta;
-            this->envmapConditionalX[(size_t)y * (W + 1) + (x + 1)] = rowSum;
+            rowSum += lum[x];
+            this->envmapCellPmf[(size_t)y * W + x] = lum[x] * sinTheta;
         }
-        rowWeight[y] = rowSum;
+        buildAliasTable(lum, W, &this->envmapCellAlias[(size_t)y * W], scaled, under, over);
+        rowWeight[y] = rowSum * sinTheta;
     }
 
-    // Normalize conditional CDFs per row. Rows with zero total pick x=0 by
-    // fallthrough; their pdf is zero and NEE just skips them.
-    for (int y = 0; y < H; y++) {
-        const float total = rowWeight[y];
-        if (total > 0.0f) {
-            const float inv = 1.0f / total;
-            for (int x = 1; x <= W; x++) this->envmapConditionalX[(size_t)y * (W + 1) + x] *= inv;
-        }
-    }
-
-    // Marginal CDF over rows.
-    this->envmapMarginalY.resize(H + 1);
-    this->envmapMarginalY[0] = 0.0f;
-    for (int y = 0; y < H; y++) this->envmapMarginalY[y + 1] = this->envmapMarginalY[y] + rowWeight[y];
-
-    this->envmapTotalWeight = this->envmapMarginalY[H];
-    if (this->envmapTotalWeight > 0.0f) {
-        const float inv = 1.0f / this->envmapTotalWeight;
-        for (int y = 0; y <= H; y++) this->envmapMarginalY[y] *= inv;
+    float total = 0.0f;
+    for (float w : rowWeight) total += w;
+    this->envmapTotalWeight = total;
+    this->envmapRowAlias.resize(H);
+    buildAliasTable(rowWeight.data(), H, this->envmapRowAlias.data(), scaled, under, over);
+    if (total > 0.0f) {
+        for (float& w : this->envmapCellPmf) w /= total;
     }
 }
 
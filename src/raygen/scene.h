@@ -10,6 +10,7 @@
 #define Scene_h
 
 #include <stdio.h>
+#include <stdint.h>
 #include <vector>
 #include <map>
 
@@ -24,6 +25,13 @@ namespace raygen {
 class HomogeneousMedium;
 class SceneObject;
 
+// One slot of a Walker alias table: a slot drawn uniformly keeps its own
+// index with probability `threshold` and stands for `alias` otherwise.
+struct EnvmapAliasEntry {
+	float threshold;
+	uint32_t alias;
+};
+
 class SceneObject
 {
 protected:
@@ -200,28 +208,40 @@ public:
 	// ordering). Pool owns each Texture; Scene just borrows the pointers.
 	Texture* envCubemapFaces[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
 
-	// Luminance CDF for importance sampling the envmap. Built once when the
-	// envmap is attached to the scene; consumed by DiffuseShader's NEE.
-	// `envmapMarginalY[v]` is the CDF over rows by row luminance×sin(theta);
-	// `envmapConditionalX[v*W + u]` is the per-row CDF over pixels.
+	// Width of the luminance map the envmap sampling tables are built on.
+	// The image is box-filtered down to it (never up), so an 8K HDRI costs
+	// a few MB of tables instead of several hundred; radiance is still
+	// looked up at full resolution. Cubemap faces get a quarter of it
+	// each. 0 builds the tables on the full-resolution image.
+	int envmapImportanceWidth = 1024;
+
+	// Alias tables for importance sampling the envmap. Built once when the
+	// envmap is attached to the scene; consumed by the envmap NEE. They
+	// index the envmapW × envmapH importance map: a cell is drawn in two
+	// constant-time steps, a row from `envmapRowAlias` weighted by row
+	// luminance×sin(theta), then a cell from that row's own table at
+	// `envmapCellAlias[v*W]`, and the sample is spread uniformly over the
+	// cell. `envmapCellPmf` is each cell's probability, for the pdf.
 	int envmapW = 0, envmapH = 0;
-	std::vector<float> envmapMarginalY;      // length H+1
-	std::vector<float> envmapConditionalX;   // length H*(W+1)
+	std::vector<EnvmapAliasEntry> envmapRowAlias;     // length H
+	std::vector<EnvmapAliasEntry> envmapCellAlias;    // length H*W
+	std::vector<float> envmapCellPmf;                 // length H*W
 	float envmapTotalWeight = 0.0f;
 
-	// Cubemap CDF for importance sampling when envCubemapFaces are set.
-	// envCubeMarginalFace: 7 entries — CDF over faces by total face weight.
-	// envCubeMarginalY: 6 × (H+1) — per-face CDF over rows.
-	// envCubeConditionalX: 6 × H × (W+1) — per-face per-row CDF over pixels.
-	// Weights are pixel_luminance × solid-angle Jacobian so the resulting
-	// pdf is in solid-angle units and matches envmap sampling's convention.
+	// Alias tables for importance sampling when envCubemapFaces are set,
+	// over envCubeFaceSize² cells per face. The rows of all six faces are
+	// stacked into one row table (row face*H + y), so the face and the row
+	// come out of a single draw; envCubeCellAlias holds a table per
+	// stacked row as above. Weights are cell luminance × solid-angle
+	// Jacobian so the resulting pdf is in solid-angle units and matches
+	// envmap sampling's convention.
 	int envCubeFaceSize = 0;
-	std::vector<float> envCubeMarginalFace;
-	std::vector<float> envCubeMarginalY;
-	std::vector<float> envCubeConditionalX;
+	std::vector<EnvmapAliasEntry> envCubeRowAlias;    // length 6*H
+	std::vector<EnvmapAliasEntry> envCubeCellAlias;   // length 6*H*W
+	std::vector<float> envCubeCellPmf;                // length 6*H*W
 	float envCubeTotalWeight = 0.0f;
 
-	void buildEnvmapCDF();
+	void buildEnvmapAliasTables();
 
 	// Scene-wide ambient medium (e.g. fog). Applied to any path segment that
 	// is not currently inside a SceneObject's interiorMedium. Owned by Scene.
@@ -827,12 +827,13 @@ static void finalizeSceneFromRoot(SceneJsonLoader& self,
 
     if (pendingEnvmap != NULL) {
         scene.envmap = pendingEnvmap;
-        scene.buildEnvmapCDF();
     }
     scene.envmapIntensity = pendingEnvmapIntensity;
     scene.envmapRotation  = pendingEnvmapRotation;
     scene.envmapPath      = pendingEnvmapPath;
     for (int i = 0; i < 6; i++) scene.envCubemapFaces[i] = pendingEnvCubemap[i];
+    // After the faces: a cubemap gets its own tables.
+    scene.buildEnvmapAliasTables();
 
     if (pendingGlobalMedium != NULL) {
         if (scene.globalMedium != NULL) delete scene.globalMedium;
@@ -0,0 +1,366 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "rayrenderer.h"
+
+namespace raygen {
+
+thread_local RenderTileBuffer* RayRenderer::streamTileBuffer = NULL;
+
+namespace {
+
+// Post-processing works on blocks this size plus a halo; large enough that
+// the halo (63 px at 5 denoise levels) costs well under 2× in reads.
+const int STREAM_POST_BLOCK = 256;
+
+// Normal xyz, albedo rgb, depth, hit.
+const int STREAM_GUIDE_CHANNELS = 8;
+
+// Bilinear sample of the blurred glow at full-resolution pixel (x, y), the
+// same upsample applyPostProcess gets from Image::resize.
+color4f sampleGlow(const Image& glowSmall, const int x, const int y, const int W, const int H) {
+    const int gw = (int)glowSmall.width();
+    const int gh = (int)glowSmall.height();
+
+    const float fx = fminf(fmaxf(((float)x + 0.5f) * (float)gw / (float)W - 0.5f, 0.0f), (float)(gw - 1));
+    const float fy = fminf(fmaxf(((float)y + 0.5f) * (float)gh / (float)H - 0.5f, 0.0f), (float)(gh - 1));
+    const int x0 = (int)fx, y0 = (int)fy;
+    const int x1 = std::min(x0 + 1, gw - 1), y1 = std::min(y0 + 1, gh - 1);
+    const float tx = fx - (float)x0, ty = fy - (float)y0;
+
+    const color4f c00 = glowSmall.getPixel(x0, y0), c10 = glowSmall.getPixel(x1, y0);
+    const color4f c01 = glowSmall.getPixel(x0, y1), c11 = glowSmall.getPixel(x1, y1);
+    const float w00 = (1.0f - tx) * (1.0f - ty), w10 = tx * (1.0f - ty);
+    const float w01 = (1.0f - tx) * ty, w11 = tx * ty;
+    return color4f(c00.r * w00 + c10.r * w10 + c01.r * w01 + c11.r * w11,
+                   c00.g * w00 + c10.g * w10 + c01.g * w01 + c11.g * w11,
+                   c00.b * w00 + c10.b * w10 + c01.b * w01 + c11.b * w11,
+                   1.0f);
+}
+
+// Destination cell of every source column (or row) for an area-averaging
+// downsample from `src` to `dst` pixels, split the way downsampleArea
+// splits them, plus the number of source pixels in each cell.
+void buildDownsampleCells(const int src, const int dst, std::vector<int>& cell, std::vector<int>& count) {
+    cell.assign(src, 0);
+    count.assign(dst, 0);
+    for (int d = 0; d < dst; ++d) {
+        const int s0 = (int)((int64_t)d * src / dst);
+        const int s1 = std::max(s0 + 1, (int)((int64_t)(d + 1) * src / dst));
+        for (int s = s0; s < s1 && s < src; ++s) {
+            cell[s] = d;
+            count[d]++;
+        }
+    }
+}
+
+}
+
+void RayRenderer::renderStreaming(const RenderThreadContext& ctx) {
+    const ucm::string& outPath = this->settings.streamOutputPath;
+    if (!outPath.endsWith(".ppm", StringComparingFlags::SCF_CASE_INSENSITIVE)
+        && !outPath.endsWith(".pfm", StringComparingFlags::SCF_CASE_INSENSITIVE)) {
+        printf("streaming output must be .ppm or .pfm: %s\n", outPath.getBuffer());
+        return;
+    }
+
+    const int W = this->renderWidth;
+    const int H = this->renderHeight;
+
+    ucm::string radiancePath = outPath;
+    radiancePath.appendFormat(".radiance.tiles");
+    ucm::string guidesPath = outPath;
+    guidesPath.appendFormat(".guides.tiles");
+
+    this->streamRadiance.reset(new TiledImageFile());
+    if (!this->streamRadiance->create(radiancePath.getBuffer(), W, H, RENDER_TILE_SIZE, 3)) {
+        printf("can't create %s\n", radiancePath.getBuffer());
+        this->streamRadiance.reset();
+        return;
+    }
+    if (this->settings.enableDenoise) {
+        this->streamGuides.reset(new TiledImageFile());
+        if (!this->streamGuides->create(guidesPath.getBuffer(), W, H,
+                                        RENDER_TILE_SIZE, STREAM_GUIDE_CHANNELS)) {
+            printf("can't create %s\n", guidesPath.getBuffer());
+            this->streamGuides.reset();
+        }
+    }
+
+    // Uniform sampling only: the adaptive driver revisits tiles, and the
+    // sums it reads back would have to come off the disk as well.
+    if (!this->settings.enableDenoise || this->streamGuides) {
+        ThreadPool& pool = this->workerPool();
+        pool.parallelFor(pool.size(), [this, &ctx](int i) { this->renderThread(ctx, i); },
+                         &this->cancelRequested);
+
+        if (!this->cancelRequested.load(std::memory_order_relaxed)) {
+            this->finishStreaming();
+        }
+    }
+
+    this->streamRadiance->close(true);
+    this->streamRadiance.reset();
+    if (this->streamGuides) {
+        this->streamGuides->close(true);
+        this->streamGuides.reset();
+    }
+}
+
+void RayRenderer::commitStreamTile(const RenderThreadContext& ctx, const RenderTile& tile,
+                                   RenderTileBuffer& buf, const int samples) {
+    const int n = tile.width * tile.height;
+    // Scratch tiles are the render tiles, so a finished tile is one slot.
+    const int tx = tile.x / RENDER_TILE_SIZE;
+    const int ty = tile.y / RENDER_TILE_SIZE;
+
+    // Mean radiance, the same values film.resolve would give hdrImage.
+    const float k = ctx.exposure / (float)samples;
+    std::vector<float> pixels((size_t)n * 3);
+    for (int i = 0; i < n; i++) {
+        pixels[i * 3]     = fmaxf(buf.sum[i].r * k, 0.0f);
+        pixels[i * 3 + 1] = fmaxf(buf.sum[i].g * k, 0.0f);
+        pixels[i * 3 + 2] = fmaxf(buf.sum[i].b * k, 0.0f);
+    }
+    bool written = this->streamRadiance->writeTile(tx, ty, pixels.data());
+
+    if (written && this->streamGuides) {
+        pixels.resize((size_t)n * STREAM_GUIDE_CHANNELS);
+        for (int y = 0; y < tile.height; y++) {
+            for (int x = 0; x < tile.width; x++) {
+                const int fx = tile.x + x, fy = tile.y + y;
+                const vec3 normal = buf.guides.aovNormal(fx, fy);
+                const color3f albedo = buf.guides.aovAlbedo(fx, fy);
+                float* p = &pixels[(size_t)(y * tile.width + x) * STREAM_GUIDE_CHANNELS];
+                p[0] = normal.x; p[1] = normal.y; p[2] = normal.z;
+                p[3] = albedo.r; p[4] = albedo.g; p[5] = albedo.b;
+                p[6] = buf.guides.aovDepth(fx, fy);
+                p[7] = buf.guides.aovHit(fx, fy) ? 1.0f : 0.0f;
+            }
+        }
+        written = this->streamGuides->writeTile(tx, ty, pixels.data());
+    }
+
+    // A full disk ends the render rather than leaving holes in the output.
+    if (!written && !this->cancelRequested.exchange(true)) {
+        printf("can't write tile %d,%d to %s\n", tile.x, tile.y,
+               this->settings.streamOutputPath.getBuffer());
+    }
+}
+
+bool RayRenderer::finishStreaming() {
+    const ucm::string& outPath = this->settings.streamOutputPath;
+    const int W = this->renderWidth;
+    const int H = this->renderHeight;
+    const bool denoise = this->streamGuides != nullptr;
+    const bool bloom = this->settings.enableRenderingPostProcess;
+
+    const int blocksX = (W + STREAM_POST_BLOCK - 1) / STREAM_POST_BLOCK;
+    const int blocksY = (H + STREAM_POST_BLOCK - 1) / STREAM_POST_BLOCK;
+
+    // Denoised radiance gets its own tile file, one slot per block.
+    TiledImageFile denoised;
+    ucm::string denoisedPath = outPath;
+    denoisedPath.appendFormat(".denoised.tiles");
+    if (denoise && !denoised.create(denoisedPath.getBuffer(), W, H, STREAM_POST_BLOCK, 3)) {
+        printf("can't create %s\n", denoisedPath.getBuffer());
+        return false;
+    }
+    const TiledImageFile& radiance = denoise ? denoised : *this->streamRadiance;
+
+    // Bloom's downsampled glow is small enough (bloomSizeAspect² of the
+    // frame) to stay in memory; its cells are filled as blocks go by.
+    // Aspects above 1 would upsample, which area averaging doesn't do.
+    const float aspect = fminf(fmaxf(0.02f, this->settings.bloomSizeAspect), 1.0f);
+    const int gw = std::max(1, (int)((float)W * aspect));
+    const int gh = std::max(1, (int)((float)H * aspect));
+    std::vector<int> cellX, cellY, countX, countY;
+    std::vector<color3f> glowSum;
+    if (bloom) {
+        buildDownsampleCells(W, gw, cellX, countX);
+        buildDownsampleCells(H, gh, cellY, countY);
+        glowSum.assign((size_t)gw * gh, color3f(0.0f, 0.0f, 0.0f));
+    }
+
+    // Pass 1, block by block: denoise (each block in parallel over the
+    // pool) and gather the bloom glow. The halo covers the À-Trous reach,
+    // 2·(2^levels − 1), plus the firefly pre-pass's one pixel, so the
+    // block's core comes out as it would from a full-frame denoise.
+    const int levels = std::max(1, this->settings.denoiseLevels);
+    const int halo = denoise ? 2 * ((1 << levels) - 1) + 1 : 0;
+    std::vector<float> color, guides;
+
+    for (int by = 0; by < blocksY && (denoise || bloom); by++) {
+        for (int bx = 0; bx < blocksX; bx++) {
+            if (this->cancelRequested.load(std::memory_order_relaxed)) {
+                denoised.close(true);
+                return false;
+            }
+
+            const int cx0 = bx * STREAM_POST_BLOCK, cy0 = by * STREAM_POST_BLOCK;
+            const int cw = std::min(STREAM_POST_BLOCK, W - cx0);
+            const int ch = std::min(STREAM_POST_BLOCK, H - cy0);
+            const int rx0 = std::max(0, cx0 - halo), ry0 = std::max(0, cy0 - halo);
+            const int rw = std::min(W, cx0 + cw + halo) - rx0;
+            const int rh = std::min(H, cy0 + ch + halo) - ry0;
+
+            color.resize((size_t)rw * rh * 3);
+            if (!this->streamRadiance->readRect(rx0, ry0, rw, rh, color.data())) {
+                printf("can't read %s\n", this->settings.streamOutputPath.getBuffer());
+                denoised.close(true);
+                return false;
+            }
+
+            if (denoise) {
+                guides.resize((size_t)rw * rh * STREAM_GUIDE_CHANNELS);
+                if (!this->streamGuides->readRect(rx0, ry0, rw, rh, guides.data())) {
+                    printf("can't read %s\n", this->settings.streamOutputPath.getBuffer());
+                    denoised.close(true);
+                    return false;
+                }
+
+                Image3f noisy, filtered;
+                noisy.createEmpty(rw, rh);
+                filtered.createEmpty(rw, rh);
+                RenderFilm regionGuides;
+                regionGuides.reset(rw, rh, false, true, false);
+                for (int y = 0; y < rh; y++) {
+                    for (int x = 0; x < rw; x++) {
+                        const size_t i = (size_t)y * rw + x;
+                        const float* c = &color[i * 3];
+                        const float* g = &guides[i * STREAM_GUIDE_CHANNELS];
+                        noisy.setPixel(x, y, color4f(c[0], c[1], c[2], 1.0f));
+                        regionGuides.setAOV(x, y, vec3(g[0], g[1], g[2]),
+                                            color3f(g[3], g[4], g[5]), g[6], g[7] != 0.0f);
+                    }
+                }
+                this->denoiseImage(noisy, regionGuides, filtered);
+
+                // Keep the core only, in place of the noisy radiance.
+                color.resize((size_t)cw * ch * 3);
+                for (int y = 0; y < ch; y++) {
+                    for (int x = 0; x < cw; x++) {
+                        const color4f c = filtered.getPixel(cx0 - rx0 + x, cy0 - ry0 + y);
+                        float* p = &color[((size_t)y * cw + x) * 3];
+                        p[0] = c.r; p[1] = c.g; p[2] = c.b;
+                    }
+                }
+                if (!denoised.writeTile(bx, by, color.data())) {
+                    printf("can't write %s\n", denoisedPath.getBuffer());
+                    denoised.close(true);
+                    return false;
+                }
+            }
+
+            if (bloom) {
+                // Without the halo, color is already the core.
+                for (int y = 0; y < ch; y++) {
+                    for (int x = 0; x < cw; x++) {
+                        const float* c = &color[((size_t)y * cw + x) * 3];
+                        const color4f g = this->bloomExtract(color4f(c[0], c[1], c[2], 1.0f));
+                        color3f& s = glowSum[(size_t)cellY[cy0 + y] * gw + cellX[cx0 + x]];
+                        s.r += g.r; s.g += g.g; s.b += g.b;
+                    }
+                }
+            }
+        }
+    }
+
+    // The last block is denoised; its planes aren't needed for pass 2.
+    this->denoiser.release();
+
+    Image3f glowSmall;
+    if (bloom) {
+        glowSmall.createEmpty(gw, gh);
+        for (int y = 0; y < gh; y++) {
+            for (int x = 0; x < gw; x++) {
+                const color3f& s = glowSum[(size_t)y * gw + x];
+                const float inv = 1.0f / (float)(countX[x] * countY[y]);
+                glowSmall.setPixel(x, y, color4f(s.r * inv, s.g * inv, s.b * inv, 1.0f));
+            }
+        }
+        std::vector<color3f>().swap(glowSum);
+        this->bloomBlur(glowSmall, W);
+    }
+
+    // Pass 2, blocks in parallel: composite the glow, tonemap, write.
+    RasterImageFile output;
+    const bool hdr = outPath.endsWith(".pfm", StringComparingFlags::SCF_CASE_INSENSITIVE);
+    if (!output.create(outPath.getBuffer(), W, H, hdr)) {
+        printf("can't create %s\n", outPath.getBuffer());
+        denoised.close(true);
+        return false;
+    }
+
+    const float strength = this->settings.bloomStrength;
+    std::atomic<bool> failed(false);
+    ThreadPool& pool = this->workerPool();
+    pool.parallelFor(blocksX * blocksY, [&](int b) {
+        const int cx0 = (b % blocksX) * STREAM_POST_BLOCK;
+        const int cy0 = (b / blocksX) * STREAM_POST_BLOCK;
+        const int cw = std::min(STREAM_POST_BLOCK, W - cx0);
+        const int ch = std::min(STREAM_POST_BLOCK, H - cy0);
+
+        std::vector<float> block((size_t)cw * ch * 3);
+        if (!radiance.readRect(cx0, cy0, cw, ch, block.data())) {
+            failed = true;
+            return;
+        }
+
+        Image3f hdrBlock;
+        hdrBlock.createEmpty(cw, ch);
+        for (int y = 0; y < ch; y++) {
+            for (int x = 0; x < cw; x++) {
+                float* p = &block[((size_t)y * cw + x) * 3];
+                if (bloom) {
+                    // Unclamped HDR add, as in applyPostProcess.
+                    const color4f g = sampleGlow(glowSmall, cx0 + x, cy0 + y, W, H);
+                    p[0] += g.r * strength;
+                    p[1] += g.g * strength;
+                    p[2] += g.b * strength;
+                }
+                hdrBlock.setPixel(x, y, color4f(p[0], p[1], p[2], 1.0f));
+            }
+        }
+
+        if (hdr) {
+            if (!output.writeBlock(cx0, cy0, cw, ch, block.data())) failed = true;
+            return;
+        }
+
+        Image4f ldrBlock;
+        this->applyTonemapGamma(hdrBlock, ldrBlock);
+        std::vector<unsigned char> bytes((size_t)cw * ch * 3);
+        for (int y = 0; y < ch; y++) {
+            for (int x = 0; x < cw; x++) {
+                const color4f c = ldrBlock.getPixel(x, y);
+                unsigned char* p = &bytes[((size_t)y * cw + x) * 3];
+                p[0] = (unsigned char)(clamp(c.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+                p[1] = (unsigned char)(clamp(c.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+                p[2] = (unsigned char)(clamp(c.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+            }
+        }
+        if (!output.writeBlock(cx0, cy0, cw, ch, bytes.data())) failed = true;
+    }, &this->cancelRequested);
+
+    output.close();
+    denoised.close(true);
+
+    if (failed) {
+        printf("can't write %s\n", outPath.getBuffer());
+        return false;
+    }
+    return !this->cancelRequested.load(std::memory_order_relaxed);
+}
+
+}
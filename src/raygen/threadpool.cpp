@@ -0,0 +1,175 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "threadpool.h"
+#include <algorithm>
+
+namespace raygen {
+
+namespace {
+
+// Pool and deque index of the current thread when it is a pool worker, so
+// tasks queued from inside a task go to the worker's own deque.
+thread_local const ThreadPool* t_pool = NULL;
+thread_local int t_workerIndex = -1;
+
+}
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads > 0) this->start(threads);
+}
+
+ThreadPool::~ThreadPool() {
+    this->stop();
+}
+
+int ThreadPool::hardwareThreads() {
+    const unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? (int)n : 1;
+}
+
+void ThreadPool::resize(int threads) {
+    threads = std::max(1, threads);
+    if (threads == this->size()) return;
+    this->stop();
+    this->start(threads);
+}
+
+void ThreadPool::start(int threads) {
+    this->stopping = false;
+    this->queues.clear();
+    for (int i = 0; i < threads; i++) {
+        this->queues.push_back(std::unique_ptr<TaskQueue>(new TaskQueue()));
+    }
+    for (int i = 0; i < threads; i++) {
+        this->workers.push_back(std::thread([this, i] { this->workerLoop(i); }));
+    }
+}
+
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(this->sleepLock);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    for (std::thread& th : this->workers) th.join();
+    this->workers.clear();
+}
+
+void ThreadPool::notify() {
+    // Taking the lock orders this against a sleeper's predicate check, so
+    // a task queued between the check and the wait isn't missed.
+    { std::lock_guard<std::mutex> lock(this->sleepLock); }
+    this->wake.notify_all();
+}
+
+void ThreadPool::run(TaskGroup& group, std::function<void()> task) {
+    group.pending.fetch_add(1);
+
+    Task t;
+    t.fn = std::move(task);
+    t.group = &group;
+
+    if (this->queues.empty()) {
+        // No workers: run in place.
+        this->execute(t);
+        return;
+    }
+
+    const int self = (t_pool == this) ? t_workerIndex : -1;
+    const size_t q = (self >= 0) ? (size_t)self
+        : (size_t)(this->nextQueue.fetch_add(1) % (unsigned)this->queues.size());
+    {
+        std::lock_guard<std::mutex> lock(this->queues[q]->lock);
+        this->queues[q]->tasks.push_back(std::move(t));
+    }
+    this->queued.fetch_add(1);
+    this->notify();
+}
+
+bool ThreadPool::popTask(int self, Task& out) {
+    if (this->queued.load() <= 0) return false;
+
+    const int n = (int)this->queues.size();
+    if (self >= 0) {
+        TaskQueue& own = *this->queues[self];
+        std::lock_guard<std::mutex> lock(own.lock);
+        if (!own.tasks.empty()) {
+            out = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            this->queued.fetch_sub(1);
+            return true;
+        }
+    }
+    for (int k = 1; k <= n; k++) {
+        const int victim = ((self >= 0 ? self : 0) + k) % n;
+        TaskQueue& q = *this->queues[victim];
+        std::lock_guard<std::mutex> lock(q.lock);
+        if (!q.tasks.empty()) {
+            out = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            this->queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::execute(Task& task) {
+    TaskGroup* group = task.group;
+    if (group->cancel == NULL || !group->cancel->load(std::memory_order_relaxed)) {
+        task.fn();
+    }
+    task.fn = nullptr;
+    if (group->pending.fetch_sub(1) == 1) {
+        this->notify();
+    }
+}
+
+void ThreadPool::workerLoop(int index) {
+    t_pool = this;
+    t_workerIndex = index;
+
+    Task task;
+    while (true) {
+        if (this->popTask(index, task)) {
+            this->execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(this->sleepLock);
+        this->wake.wait(lock, [this] { return this->stopping || this->queued.load() > 0; });
+        if (this->stopping && this->queued.load() <= 0) return;
+    }
+}
+
+void ThreadPool::wait(TaskGroup& group) {
+    const int self = (t_pool == this) ? t_workerIndex : -1;
+
+    Task task;
+    while (group.pending.load() > 0) {
+        if (this->popTask(self, task)) {
+            this->execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(this->sleepLock);
+        this->wake.wait(lock, [this, &group] {
+            return group.pending.load() <= 0 || this->queued.load() > 0;
+        });
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& fn,
+                             const std::atomic<bool>* cancel) {
+    TaskGroup group(cancel);
+    for (int i = 0; i < count; i++) {
+        this->run(group, [&fn, i] { fn(i); });
+    }
+    this->wait(group);
+}
+
+}
@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __raygen_threadpool_h__
+#define __raygen_threadpool_h__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace raygen {
+
+// Long-lived worker threads with one task deque each. A worker pops its own
+// deque from the back and, when that runs dry, steals from the front of the
+// others; tasks queued from outside the pool are dealt round-robin. Callers
+// batch tasks in a TaskGroup and wait() on it, running queued tasks
+// themselves meanwhile, so waiting from inside a task doesn't deadlock.
+//
+// Starting and joining threads per frame, pass or denoise level costs a
+// measurable share of short viewer renders; the pool pays it once.
+class ThreadPool {
+public:
+    // Tasks of one batch. A group with a cancel flag drops its queued tasks
+    // once the flag is set; tasks already running finish on their own.
+    class TaskGroup {
+    public:
+        explicit TaskGroup(const std::atomic<bool>* cancel = NULL) : cancel(cancel) { }
+
+    private:
+        friend class ThreadPool;
+        std::atomic<int> pending{0};
+        const std::atomic<bool>* cancel;
+    };
+
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Restarts the pool with `threads` workers (at least one); a no-op when
+    // the count is unchanged. Only call it while no tasks are queued.
+    void resize(int threads);
+    inline int size() const { return (int)this->workers.size(); }
+
+    void run(TaskGroup& group, std::function<void()> task);
+    // Returns once every task of `group` has run or been dropped.
+    void wait(TaskGroup& group);
+
+    // Runs fn(0) .. fn(count - 1) as one group and waits for it.
+    void parallelFor(int count, const std::function<void(int)>& fn,
+                     const std::atomic<bool>* cancel = NULL);
+
+    // std::thread::hardware_concurrency(), or 1 when it is unknown.
+    static int hardwareThreads();
+
+private:
+    struct Task {
+        std::function<void()> fn;
+        TaskGroup* group;
+    };
+    struct TaskQueue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<int> queued{0};
+    std::atomic<unsigned> nextQueue{0};
+    // Guards sleeping: workers wait here for tasks, wait() for tasks or
+    // its group to finish.
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void start(int threads);
+    void stop();
+    void workerLoop(int index);
+    // Own deque's back first (`self` < 0 has none), then the others' fronts.
+    bool popTask(int self, Task& out);
+    void execute(Task& task);
+    void notify();
+};
+
+}
+
+#endif /* __raygen_threadpool_h__ */
@@ -0,0 +1,191 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "tilefile.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace raygen {
+
+namespace {
+
+const char TILE_FILE_MAGIC[8] = { 'R', 'G', 'T', 'I', 'L', 'E', '0', '1' };
+const uint64_t TILE_FILE_HEADER_SIZE = 32;
+
+// Gigapixel files run past 2 GB, beyond what fseek's long reaches on
+// Windows and 32-bit platforms.
+bool seekFile(FILE* f, uint64_t offset) {
+#if defined(_WIN32)
+    return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+void putInt32(unsigned char* p, int32_t v) {
+    const uint32_t u = (uint32_t)v;
+    p[0] = (unsigned char)(u & 0xff);
+    p[1] = (unsigned char)((u >> 8) & 0xff);
+    p[2] = (unsigned char)((u >> 16) & 0xff);
+    p[3] = (unsigned char)((u >> 24) & 0xff);
+}
+
+}
+
+///////////////// TiledImageFile /////////////////
+
+TiledImageFile::~TiledImageFile() {
+    this->close();
+}
+
+bool TiledImageFile::create(const char* path, int width, int height, int tileSize, int channels) {
+    this->close();
+    if (width <= 0 || height <= 0 || tileSize <= 0 || channels <= 0) return false;
+
+    // w+ so the same handle reads tiles back for post-processing.
+    this->file = fopen(path, "w+b");
+    if (this->file == NULL) return false;
+
+    this->path = path;
+    this->w = width;
+    this->h = height;
+    this->tile = tileSize;
+    this->ch = channels;
+
+    unsigned char header[TILE_FILE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, TILE_FILE_MAGIC, sizeof(TILE_FILE_MAGIC));
+    putInt32(header + 8, width);
+    putInt32(header + 12, height);
+    putInt32(header + 16, tileSize);
+    putInt32(header + 20, channels);
+    if (fwrite(header, 1, sizeof(header), this->file) != sizeof(header)) {
+        this->close(true);
+        return false;
+    }
+    return true;
+}
+
+void TiledImageFile::close(bool remove) {
+    if (this->file != NULL) {
+        fclose(this->file);
+        this->file = NULL;
+        if (remove) ::remove(this->path.c_str());
+    }
+}
+
+uint64_t TiledImageFile::slotOffset(int tx, int ty) const {
+    const uint64_t tilesX = (uint64_t)((this->w + this->tile - 1) / this->tile);
+    const uint64_t slotBytes = (uint64_t)this->tile * this->tile * this->ch * sizeof(float);
+    return TILE_FILE_HEADER_SIZE + ((uint64_t)ty * tilesX + (uint64_t)tx) * slotBytes;
+}
+
+bool TiledImageFile::writeTile(int tx, int ty, const float* pixels) {
+    const int tw = std::min(this->tile, this->w - tx * this->tile);
+    const int th = std::min(this->tile, this->h - ty * this->tile);
+    if (this->file == NULL || tw <= 0 || th <= 0) return false;
+
+    const size_t count = (size_t)tw * th * this->ch;
+    std::lock_guard<std::mutex> guard(this->lock);
+    return seekFile(this->file, this->slotOffset(tx, ty))
+        && fwrite(pixels, sizeof(float), count, this->file) == count;
+}
+
+bool TiledImageFile::readTile(int tx, int ty, float* pixels) const {
+    const int tw = std::min(this->tile, this->w - tx * this->tile);
+    const int th = std::min(this->tile, this->h - ty * this->tile);
+    if (this->file == NULL || tw <= 0 || th <= 0) return false;
+
+    const size_t count = (size_t)tw * th * this->ch;
+    std::lock_guard<std::mutex> guard(this->lock);
+    return seekFile(this->file, this->slotOffset(tx, ty))
+        && fread(pixels, sizeof(float), count, this->file) == count;
+}
+
+bool TiledImageFile::readRect(int x, int y, int rw, int rh, float* pixels) const {
+    if (x < 0 || y < 0 || rw <= 0 || rh <= 0 || x + rw > this->w || y + rh > this->h) return false;
+
+    std::vector<float> tileData((size_t)this->tile * this->tile * this->ch);
+    const size_t pixelFloats = (size_t)this->ch;
+
+    for (int ty = y / this->tile; ty * this->tile < y + rh; ty++) {
+        for (int tx = x / this->tile; tx * this->tile < x + rw; tx++) {
+            if (!this->readTile(tx, ty, tileData.data())) return false;
+
+            const int tileX = tx * this->tile, tileY = ty * this->tile;
+            const int tw = std::min(this->tile, this->w - tileX);
+            const int x0 = std::max(x, tileX), x1 = std::min(x + rw, tileX + tw);
+            const int y0 = std::max(y, tileY), y1 = std::min(y + rh, tileY + this->tile);
+            for (int py = y0; py < y1; py++) {
+                memcpy(pixels + ((size_t)(py - y) * rw + (x0 - x)) * pixelFloats,
+                       tileData.data() + ((size_t)(py - tileY) * tw + (x0 - tileX)) * pixelFloats,
+                       (size_t)(x1 - x0) * pixelFloats * sizeof(float));
+            }
+        }
+    }
+    return true;
+}
+
+///////////////// RasterImageFile /////////////////
+
+RasterImageFile::~RasterImageFile() {
+    this->close();
+}
+
+bool RasterImageFile::create(const char* path, int width, int height, bool hdr) {
+    this->close();
+    if (width <= 0 || height <= 0) return false;
+
+    this->file = fopen(path, "wb");
+    if (this->file == NULL) return false;
+
+    this->w = width;
+    this->h = height;
+    this->hdr = hdr;
+
+    // Negative PFM scale = little-endian floats.
+    char header[64];
+    const int len = hdr ? snprintf(header, sizeof(header), "PF\n%d %d\n-1.0\n", width, height)
+                        : snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    this->headerSize = (uint64_t)len;
+    if (fwrite(header, 1, (size_t)len, this->file) != (size_t)len) {
+        this->close();
+        return false;
+    }
+    return true;
+}
+
+void RasterImageFile::close() {
+    if (this->file != NULL) {
+        fclose(this->file);
+        this->file = NULL;
+    }
+}
+
+bool RasterImageFile::writeBlock(int x, int y, int bw, int bh, const void* pixels) {
+    if (this->file == NULL || x < 0 || y < 0 || x + bw > this->w || y + bh > this->h) return false;
+
+    const size_t pixelBytes = this->hdr ? 3 * sizeof(float) : 3;
+    const size_t rowBytes = (size_t)bw * pixelBytes;
+    const unsigned char* src = (const unsigned char*)pixels;
+
+    std::lock_guard<std::mutex> guard(this->lock);
+    for (int by = 0; by < bh; by++) {
+        const int row = this->hdr ? (this->h - 1 - (y + by)) : (y + by);
+        const uint64_t offset = this->headerSize
+            + ((uint64_t)row * this->w + (uint64_t)x) * pixelBytes;
+        if (!seekFile(this->file, offset)
+            || fwrite(src + (size_t)by * rowBytes, 1, rowBytes, this->file) != rowBytes) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
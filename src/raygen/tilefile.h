@@ -0,0 +1,92 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __raygen_tilefile_h__
+#define __raygen_tilefile_h__
+
+#include <stdio.h>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace raygen {
+
+// Float image kept on disk in square tiles, for renders too large to hold
+// in memory. Every tile owns a fixed-size slot (edge tiles are stored
+// clipped at the start of theirs), so tiles can be written in whatever
+// order the render finishes them and read back at random. Reads and
+// writes are thread-safe.
+//
+// Layout: a 32-byte header ("RGTILE01", then width, height, tile size and
+// channel count as little-endian int32), then the slots in row-major tile
+// order, each tileSize² × channels floats.
+class TiledImageFile {
+public:
+    TiledImageFile() { }
+    ~TiledImageFile();
+
+    TiledImageFile(const TiledImageFile&) = delete;
+    TiledImageFile& operator=(const TiledImageFile&) = delete;
+
+    // Creates (or truncates) `path`. False when it can't be opened.
+    bool create(const char* path, int width, int height, int tileSize, int channels);
+    // Closes the file, deleting it when `remove` is set.
+    void close(bool remove = false);
+    inline bool isOpen() const { return this->file != NULL; }
+
+    inline int width() const { return this->w; }
+    inline int height() const { return this->h; }
+    inline int tileSize() const { return this->tile; }
+    inline int channels() const { return this->ch; }
+
+    // Pixels of tile (tx, ty), row-major over its clipped width and height
+    // with the channels interleaved.
+    bool writeTile(int tx, int ty, const float* pixels);
+    bool readTile(int tx, int ty, float* pixels) const;
+    // Any rectangle inside the image, gathered from the tiles it overlaps;
+    // same layout as a tile.
+    bool readRect(int x, int y, int rw, int rh, float* pixels) const;
+
+private:
+    FILE* file = NULL;
+    std::string path;
+    int w = 0, h = 0, tile = 0, ch = 0;
+    mutable std::mutex lock;
+
+    uint64_t slotOffset(int tx, int ty) const;
+};
+
+// Uncompressed raster output that can be filled block by block in any
+// order: binary PPM (8-bit RGB, rows top-down) or PFM (float RGB, rows
+// bottom-up). Both have a fixed row size, so every pixel has a known
+// offset. Thread-safe.
+class RasterImageFile {
+public:
+    ~RasterImageFile();
+
+    // PFM when `hdr` is set, PPM otherwise.
+    bool create(const char* path, int width, int height, bool hdr);
+    void close();
+    inline bool isOpen() const { return this->file != NULL; }
+    inline bool isHdr() const { return this->hdr; }
+
+    // Writes a block of RGB pixels at (x, y), row-major over bw × bh:
+    // bytes for PPM, floats for PFM.
+    bool writeBlock(int x, int y, int bw, int bh, const void* pixels);
+
+private:
+    FILE* file = NULL;
+    int w = 0, h = 0;
+    bool hdr = false;
+    uint64_t headerSize = 0;
+    std::mutex lock;
+};
+
+}
+
+#endif /* __raygen_tilefile_h__ */
@@ -0,0 +1,282 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <functional>
+
+#include "wavefront.h"
+#include "medium.h"
+#include "rayrenderer.h"
+
+namespace raygen {
+
+void WavefrontPaths::resize(int n) {
+    this->count = n;
+    if ((int)this->ox.size() >= n) return;
+
+    for (auto* v : { &ox, &oy, &oz, &dx, &dy, &dz, &tr, &tg, &tb, &lr, &lg, &lb, &pdf }) {
+        v->resize(n);
+    }
+    for (auto* v : { &depth, &chroma, &pixel, &sample, &ldsDim, &rngDraws, &kind }) {
+        v->resize(n);
+    }
+    this->hits.resize(n);
+    this->material.resize(n);
+    this->queue.reserve(n);
+    this->next.reserve(n);
+
+    // At most BSDF_MAX_SHADOW_RAYS per path and bounce.
+    const int shadowCap = n * BSDF_MAX_SHADOW_RAYS;
+    ShadowQueue& sq = this->shadows;
+    for (auto* v : { &sq.ox, &sq.oy, &sq.oz, &sq.dx, &sq.dy, &sq.dz, &sq.maxT, &sq.r, &sq.g, &sq.b }) {
+        v->resize(shadowCap);
+    }
+    sq.path.resize(shadowCap);
+    sq.occluders.resize(shadowCap);
+}
+
+static inline int wavefrontShaderKind(const RayTriangleIntersectionInfo& info) {
+    if (info.triangle == NULL) return WSK_Miss;
+    const Material& m = info.object->material;
+    if (m.emission > 0.0f) return WSK_Emission;
+    if (m.transparency > 0.001f) return WSK_Transparency;
+    if (m.refraction > 0.00001f) return WSK_Refraction;
+    if (m.glossy > 0.00001f) return WSK_Glossy;
+    return WSK_Diffuse;
+}
+
+bool RayRenderer::useWavefront() const {
+    if (!this->settings.enableWavefront || PIXEL_BLOCK != 1) return false;
+
+    // scatter() only exists on the BSDF provider, and it has no volumetric
+    // branch: any active medium goes through tracePath as before.
+    if (this->settings.shaderProvider != 5) return false;
+    const HomogeneousMedium* gm = (this->scene != NULL) ? this->scene->globalMedium : NULL;
+    if (gm != NULL && gm->isActive()) return false;
+    return !this->hasInteriorMedia;
+}
+
+void RayRenderer::accumulateWavefrontSamples(const RenderThreadContext& ctx, WavefrontPaths& paths,
+                                             const RenderTile& tile, const int sampleStart, const int sampleCount,
+                                             color3f* sum, color3f* sumSq) {
+    const int pixelCount = tile.width * tile.height;
+    if (pixelCount <= 0) return;
+
+    if (sampleStart == 0 && this->settings.enableDenoise) {
+        Ray ray;
+        for (int k = 0; k < pixelCount; k++) {
+            const int x = tile.x + k % tile.width, y = tile.y + k / tile.width;
+            this->generateEyeRay(ctx, x, y, 0, ray);
+            this->writeDenoiseGuides(ray, x, y);
+        }
+    }
+
+    const float clampMax = this->settings.fireflyClamp;
+    const bool packets = this->usePacketTracing(ctx);
+    const int samplesPerWave = std::max(1, std::min(sampleCount, WAVEFRONT_MAX_PATHS / pixelCount));
+
+    const int sampleEnd = sampleStart + sampleCount;
+    for (int waveStart = sampleStart; waveStart < sampleEnd; waveStart += samplesPerWave) {
+        const int waveSamples = std::min(samplesPerWave, sampleEnd - waveStart);
+
+        this->wavefrontGenerate(ctx, paths, tile, waveStart, waveSamples);
+
+        for (int bounce = 0; !paths.queue.empty(); bounce++) {
+            this->wavefrontIntersect(paths, packets && bounce == 0);
+            this->wavefrontSort(paths);
+            this->wavefrontShade(paths, tile);
+            this->wavefrontTraceShadows(paths);
+            paths.queue.swap(paths.next);
+        }
+
+        // Every path is done; each slot holds one sample of one pixel.
+        for (int i = 0; i < paths.count; i++) {
+            const color4f radiance(fmaxf(paths.lr[i], 0.0f),
+                                   fmaxf(paths.lg[i], 0.0f),
+                                   fmaxf(paths.lb[i], 0.0f),
+                                   1.0f);
+            accumulateSample(radiance, clampMax, sum[paths.pixel[i]], sumSq[paths.pixel[i]]);
+        }
+    }
+}
+
+void RayRenderer::wavefrontGenerate(const RenderThreadContext& ctx, WavefrontPaths& paths,
+                                    const RenderTile& tile, const int sampleStart, const int sampleCount) const {
+    paths.resize(tile.width * tile.height * sampleCount);
+    paths.queue.clear();
+
+    // Pixels go in PACKET_BLOCK_SIZE² blocks so that the first intersect
+    // stage can hand consecutive slots to the packet traversal.
+    int slot = 0;
+    Ray ray;
+    for (int i = sampleStart; i < sampleStart + sampleCount; i++) {
+        for (int by = 0; by < tile.height; by += PACKET_BLOCK_SIZE) {
+            for (int bx = 0; bx < tile.width; bx += PACKET_BLOCK_SIZE) {
+                const int bw = std::min(PACKET_BLOCK_SIZE, tile.width - bx);
+                const int bh = std::min(PACKET_BLOCK_SIZE, tile.height - by);
+                for (int k = 0; k < bw * bh; k++) {
+                    const int px = bx + k % bw, py = by + k / bw;
+                    this->generateEyeRay(ctx, tile.x + px, tile.y + py, i, ray);
+
+                    paths.setRay(slot, ray);
+                    paths.tr[slot] = paths.tg[slot] = paths.tb[slot] = 1.0f;
+                    paths.lr[slot] = paths.lg[slot] = paths.lb[slot] = 0.0f;
+                    paths.pdf[slot] = 0.0f;
+                    paths.depth[slot] = 0;
+                    paths.chroma[slot] = -1;
+                    paths.pixel[slot] = py * tile.width + px;
+                    paths.sample[slot] = i;
+                    paths.ldsDim[slot] = ldsDimension();
+                    paths.rngDraws[slot] = randomDraws();
+                    paths.queue.push_back(slot);
+                    slot++;
+                }
+            }
+        }
+    }
+}
+
+void RayRenderer::wavefrontIntersect(WavefrontPaths& paths, const bool packets) const {
+    const int n = (int)paths.queue.size();
+
+    if (packets) {
+        Ray rays[BVH_PACKET_SIZE];
+        RayTriangleIntersectionInfo infos[BVH_PACKET_SIZE];
+        for (int first = 0; first < n; first += BVH_PACKET_SIZE) {
+            const int count = std::min(BVH_PACKET_SIZE, n - first);
+            for (int k = 0; k < count; k++) {
+                rays[k] = paths.ray(paths.queue[first + k]);
+                infos[k] = RayTriangleIntersectionInfo();
+            }
+            this->findNearestTrianglePacket(rays, count, infos);
+            for (int k = 0; k < count; k++) {
+                paths.hits[paths.queue[first + k]] = infos[k];
+            }
+        }
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        const int slot = paths.queue[i];
+        paths.hits[slot] = RayTriangleIntersectionInfo();
+        this->findNearestTriangle(paths.ray(slot), paths.hits[slot]);
+    }
+}
+
+void RayRenderer::wavefrontSort(WavefrontPaths& paths) const {
+    for (const int slot : paths.queue) {
+        const RayTriangleIntersectionInfo& info = paths.hits[slot];
+        paths.kind[slot] = wavefrontShaderKind(info);
+        paths.material[slot] = (info.triangle != NULL) ? &info.object->material : NULL;
+    }
+
+    // Group by shader, then by material, so that a shading run executes one
+    // branch of scatter() and reads one material / texture at a time.
+    const std::less<const Material*> materialLess;
+    std::sort(paths.queue.begin(), paths.queue.end(), [&](int a, int b) {
+        if (paths.kind[a] != paths.kind[b]) return paths.kind[a] < paths.kind[b];
+        return materialLess(paths.material[a], paths.material[b]);
+    });
+}
+
+void RayRenderer::wavefrontShade(WavefrontPaths& paths, const RenderTile& tile) {
+    RayBSDFShaderProvider* provider = (RayBSDFShaderProvider*)this->shaderProvider;
+    WavefrontPaths::ShadowQueue& sq = paths.shadows;
+    sq.count = 0;
+    paths.next.clear();
+
+    for (const int slot : paths.queue) {
+        const Ray ray = paths.ray(slot);
+        const RayTriangleIntersectionInfo& info = paths.hits[slot];
+        const int depth = paths.depth[slot];
+        const color3 throughput(paths.tr[slot], paths.tg[slot], paths.tb[slot]);
+
+        // Misses: the eye ray sees the environment or the back color (as
+        // shadeEyeRay, which also lets invisible objects through); deeper
+        // bounces pick up MIS-weighted environment light (as tracePath).
+        if (info.triangle == NULL || (depth == 0 && !info.object->visible)) {
+            color3 env = this->sampleEnvironment(ray.dir);
+            if (depth == 0) {
+                if (env == color3::zero) {
+                    const color4& back = this->settings.backColor;
+                    env = color3(back.r, back.g, back.b);
+                }
+            } else if (paths.pdf[slot] > 0.0f) {
+                const float envPdf = this->envmapDirectionPdf(ray.dir);
+                const float b2 = paths.pdf[slot] * paths.pdf[slot];
+                const float e2 = envPdf * envPdf;
+                env = env * ((b2 + e2 > 0.0f) ? b2 / (b2 + e2) : 1.0f);
+            }
+            paths.addRadiance(slot, throughput * env);
+            continue;
+        }
+
+        VertexInterpolation vi;
+        this->calcVertexInterpolation(info, &vi);
+
+        // Resume the pixel-sample's Halton walk and PRNG stream where this
+        // path left them.
+        const int pixel = paths.pixel[slot];
+        ldsBeginPixelSample(tile.x + pixel % tile.width, tile.y + pixel / tile.width,
+                            paths.sample[slot], paths.ldsDim[slot], paths.rngDraws[slot]);
+
+        BSDFSample s;
+        if (depth == 0) {
+            provider->scatter(info, ray, vi, NULL, s);
+        } else {
+            BSDFParam incoming(*this, info, ray, vi, depth - 1);
+            incoming.throughput = throughput;
+            incoming.bsdfSampledPdf = paths.pdf[slot];
+            incoming.chromaChannel = paths.chroma[slot];
+            provider->scatter(info, ray, vi, &incoming, s);
+        }
+        paths.ldsDim[slot] = ldsDimension();
+        paths.rngDraws[slot] = randomDraws();
+
+        paths.addRadiance(slot, throughput * s.emitted);
+
+        for (int i = 0; i < s.shadowCount; i++) {
+            const BSDFShadowRay& sh = s.shadows[i];
+            const color3 radiance = throughput * sh.radiance;
+            if (radiance == color3::zero) continue;
+
+            const int j = sq.count++;
+            sq.ox[j] = sh.ray.origin.x; sq.oy[j] = sh.ray.origin.y; sq.oz[j] = sh.ray.origin.z;
+            sq.dx[j] = sh.ray.dir.x; sq.dy[j] = sh.ray.dir.y; sq.dz[j] = sh.ray.dir.z;
+            sq.maxT[j] = sh.maxT;
+            sq.r[j] = radiance.r; sq.g[j] = radiance.g; sq.b[j] = radiance.b;
+            sq.path[j] = slot;
+            sq.occluders[j] = (int)sh.occluders;
+        }
+
+        // Continue stage: survivors are compacted into `next` for the
+        // following bounce.
+        if (!s.scattered) continue;
+        const color3 t = throughput * s.weight;
+        if (t == color3::zero) continue;
+
+        paths.setRay(slot, s.ray);
+        paths.tr[slot] = t.r; paths.tg[slot] = t.g; paths.tb[slot] = t.b;
+        paths.pdf[slot] = s.pdf;
+        paths.chroma[slot] = s.chromaChannel;
+        paths.depth[slot] = depth + 1;
+        paths.next.push_back(slot);
+    }
+}
+
+void RayRenderer::wavefrontTraceShadows(WavefrontPaths& paths) const {
+    const WavefrontPaths::ShadowQueue& sq = paths.shadows;
+
+    for (int j = 0; j < sq.count; j++) {
+        const Ray ray(vec3(sq.ox[j], sq.oy[j], sq.oz[j]), vec3(sq.dx[j], sq.dy[j], sq.dz[j]));
+        if (this->isShadowed(ray, sq.maxT[j], (ShadowOccluders)sq.occluders[j])) continue;
+        paths.addRadiance(sq.path[j], color3(sq.r[j], sq.g[j], sq.b[j]));
+    }
+}
+
+}
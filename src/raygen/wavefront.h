@@ -0,0 +1,93 @@
+///////////////////////////////////////////////////////////////////////////////
+//  Raygen Renderer
+//  A simple cross-platform ray tracing engine for 3D graphics rendering.
+//
+//  MIT License
+//  (c) 2016-2020 Jingwood, unvell.com, all rights reserved.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __RAY_WAVEFRONT_H__
+#define __RAY_WAVEFRONT_H__
+
+#include <vector>
+#include "raycommon.h"
+
+// Upper bound on the paths in flight per wave. A 32x32 tile runs four
+// samples per pixel per wave; smaller tiles run proportionally more.
+#define WAVEFRONT_MAX_PATHS 4096
+
+namespace raygen {
+
+// Shader class of a path's current hit; the queue is sorted on it (then on
+// the material) between intersect and shade so each shading run stays on
+// one code path and one material.
+enum WavefrontShaderKind {
+	WSK_Miss,
+	WSK_Emission,
+	WSK_Transparency,
+	WSK_Diffuse,
+	WSK_Glossy,
+	WSK_Refraction,
+};
+
+// Path state of the wavefront integrator, structure-of-arrays and indexed
+// by path slot. Slots are fixed for a wave; the stages pass slot indices
+// around in `queue`, so sorting and compaction move ints, not path records.
+struct WavefrontPaths {
+	int count = 0;
+
+	// Current ray.
+	std::vector<float> ox, oy, oz;
+	std::vector<float> dx, dy, dz;
+	// Path throughput and the radiance gathered so far.
+	std::vector<float> tr, tg, tb;
+	std::vector<float> lr, lg, lb;
+	// Solid-angle pdf the last bounce sampled the ray with; 0 = delta / eye.
+	std::vector<float> pdf;
+	std::vector<int> depth;
+	std::vector<int> chroma;
+	// Row-major pixel index within the tile, sample index, and how many
+	// Halton dims and PRNG values this pixel-sample has drawn so far.
+	std::vector<int> pixel;
+	std::vector<int> sample;
+	std::vector<int> ldsDim;
+	std::vector<int> rngDraws;
+
+	std::vector<RayTriangleIntersectionInfo> hits;
+	std::vector<int> kind;
+	std::vector<const Material*> material;
+
+	// Slots still alive, and the survivors of the current shading pass.
+	std::vector<int> queue;
+	std::vector<int> next;
+
+	// Shadow rays queued by the shade stage, tested in one batch.
+	struct ShadowQueue {
+		int count = 0;
+		std::vector<float> ox, oy, oz;
+		std::vector<float> dx, dy, dz;
+		std::vector<float> maxT;
+		std::vector<float> r, g, b;
+		std::vector<int> path;
+		std::vector<int> occluders;
+	} shadows;
+
+	void resize(int n);
+
+	inline Ray ray(int i) const {
+		return Ray(vec3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i]));
+	}
+
+	inline void setRay(int i, const Ray& r) {
+		ox[i] = r.origin.x; oy[i] = r.origin.y; oz[i] = r.origin.z;
+		dx[i] = r.dir.x; dy[i] = r.dir.y; dz[i] = r.dir.z;
+	}
+
+	inline void addRadiance(int i, const color3& c) {
+		lr[i] += c.r; lg[i] += c.g; lb[i] += c.b;
+	}
+};
+
+}
+
+#endif /* __RAY_WAVEFRONT_H__ */
@@ -23,10 +23,11 @@ namespace viewer {
 
 namespace {
 
-// Transform — edits apply instantly to the SceneObject. The renderer
-// re-flattens + rebuilds the BVH on every Full render, so a dirty kick is
-// enough to see the change.
-bool drawTransform(SceneObject& so) {
+// Transform — edits apply instantly to the SceneObject. Location / angle /
+// scale only move geometry, so they're reported through `moved` and the
+// renderer refits its BVH; the visibility toggles change what gets
+// flattened at all and return dirty for a full rebuild.
+bool drawTransform(SceneObject& so, bool& moved) {
     if (!ImGui::CollapsingHeader("Transform", ImGuiTreeNodeFlags_DefaultOpen)) return false;
 
     bool dirty = false;
@@ -35,15 +36,15 @@ bool drawTransform(SceneObject& so) {
     float scl[3] = { so.scale.x,    so.scale.y,    so.scale.z };
     if (ImGui::DragFloat3("location", loc, 0.05f, -1000.0f, 1000.0f, "%.3f")) {
         so.location = ugm::vec3(loc[0], loc[1], loc[2]);
-        dirty = true;
+        moved = true;
     }
     if (ImGui::DragFloat3("angle",    ang, 0.5f,  -360.0f, 360.0f, "%.2f")) {
         so.angle = ugm::vec3(ang[0], ang[1], ang[2]);
-        dirty = true;
+        moved = true;
     }
     if (ImGui::DragFloat3("scale",    scl, 0.01f, 0.0001f, 1000.0f, "%.3f")) {
         so.scale = ugm::vec3(scl[0], scl[1], scl[2]);
-        dirty = true;
+        moved = true;
     }
 
     bool v = so.visible;
@@ -185,11 +186,18 @@ bool drawPropertyPanel(const PropertyPanelCtx& ctx) {
         ImGui::TextDisabled("Select an object in the Outline window to inspect.");
     } else {
         drawHeader(*selected);
-        dirty |= drawTransform(*selected);
+        bool moved = false;
+        dirty |= drawTransform(*selected, moved);
         dirty |= drawMaterial(selected->material, ctx.isRendering, ctx.scenePath);
         // Interior medium UI lives in MediumEditor.cpp — see header for why
         // it's its own file (keeps Phase-by-Phase volume work scoped).
         dirty |= drawInteriorMedium(*selected);
+        if (moved && !dirty) {
+            if (ctx.transformOnly != nullptr) *ctx.transformOnly = true;
+            dirty = true;
+        } else {
+            dirty |= moved;
+        }
     }
     ImGui::End();
     return dirty;
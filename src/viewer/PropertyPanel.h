@@ -27,6 +27,11 @@ struct PropertyPanelCtx {
     // Used to seed the texture-file dialog at the scene folder when the
     // material has no current texture. May be null.
     const char* scenePath;
+
+    // Set to true when the panel's only edit this frame was the selected
+    // object's location / angle / scale — geometry the renderer can refit
+    // instead of rebuilding. May be null.
+    bool* transformOnly;
 };
 
 // Renders the "Property" window. Returns true when any field changed so the
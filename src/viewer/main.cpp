@@ -666,6 +666,12 @@ int main(int argc, char** argv) {
     RendererSettings rsInit;
     rsInit.resolutionWidth  = 600;
     rsInit.resolutionHeight = 375;
+    // Previews rebuild the BVH on every scene edit; the cheaper build
+    // outweighs the slightly slower traversal at preview sample counts.
+    rsInit.bvhQuality = BVHBuildQuality::Fast;
+    // Previews run at a few spp; blue-noise error looks cleaner there and
+    // gives the denoiser less low-frequency blotching to smooth over.
+    rsInit.sampleSequence = LowDiscrepancySequence::ZSobol;
     RayRenderer renderer(&rsInit);
 
     // unique_ptr lets us swap the Scene object on reload without disturbing
@@ -967,7 +973,7 @@ int main(int argc, char** argv) {
             scene->envmap     = tex;
             scene->envmapPath = p;
             for (int i = 0; i < 6; i++) scene->envCubemapFaces[i] = NULL;
-            scene->buildEnvmapCDF();
+            scene->buildEnvmapAliasTables();
             lastKickedParams = uiParams;
             kickFinal(JobKind::Full);
         };
@@ -1074,6 +1080,9 @@ int main(int argc, char** argv) {
             RendererSceneLoader loader2;
             loader2.load(renderer, fresh.get(), scenePath);
             renderer.setScene(fresh.get());
+            // The fresh Scene may land at the old one's address, so don't
+            // rely on the pointer check to drop the cached transformed scene.
+            renderer.invalidateScene();
             scene = std::move(fresh);
 
             // Re-seed from scene then overlay the sidecar, so reload behaves
@@ -1310,8 +1319,9 @@ int main(int argc, char** argv) {
 
         // --- Outline window (scene tree) ---
         // Edits are live even during rendering — same model as the main
-        // control panel. `transformScene()` snapshots triangles + BVH at the
-        // start of each render(), so mid-render visibility/transform changes
+        // control panel. The renderer keeps its world-space triangles + BVH
+        // between renders and only rebuilds them at the start of a render()
+        // after invalidateScene(), so mid-render visibility/transform changes
         // don't affect the current frame; they're picked up by the next Full
         // kick fired when the worker goes idle. Per-hit material reads can
         // briefly mix old/new channels on a dragging slider, but aligned 32-
@@ -1322,17 +1332,26 @@ int main(int argc, char** argv) {
         // reads it.
         bool sceneDirty = false;
         sceneDirty |= viewer::drawOutlinePanel(*scene, selectedObj);
+        bool transformOnly = false;
         viewer::PropertyPanelCtx ppCtx;
-        ppCtx.selected    = selectedObj;
-        ppCtx.isRendering = isRendering;
-        ppCtx.scenePath   = scenePath;
-        sceneDirty |= viewer::drawPropertyPanel(ppCtx);
+        ppCtx.selected      = selectedObj;
+        ppCtx.isRendering   = isRendering;
+        ppCtx.scenePath     = scenePath;
+        ppCtx.transformOnly = &transformOnly;
+        const bool propertyDirty = viewer::drawPropertyPanel(ppCtx);
 
         // Scene edits always need a full re-trace (BVH bounds, transforms,
         // materials all feed the primary ray). Route through the shared
         // pendingDirty machinery; uiParams is unchanged, so
         // onlyPostProcessChanged() returns false and the kick runs as Full.
-        if (sceneDirty) {
+        // A drag that only moved the selected object gets away with a BVH
+        // refit rather than re-flattening the scene.
+        if (sceneDirty || propertyDirty) {
+            if (!sceneDirty && transformOnly) {
+                renderer.invalidateGeometry();
+            } else {
+                renderer.invalidateScene();
+            }
             pendingDirty = true;
         }
 